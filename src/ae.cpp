@@ -43,12 +43,16 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <sched.h>
+#include <algorithm>
 
 #include "ae.h"
 #include "fastlock.h"
 #include "zmalloc.h"
 #include "config.h"
 
+#define AE_ASSERT(x) if (!(x)) do { fprintf(stderr, "AE_ASSER FAILURE\n"); *((volatile int*)0) = 1; } while(0)
+
 #ifdef USE_MUTEX
 thread_local int cOwnLock = 0;
 class mutex_wrapper
@@ -80,18 +84,229 @@ public:
 mutex_wrapper g_lock;
 
 #else
-fastlock g_lock;
+/* Threads running lockless read commands (see aeTryEnterReadSection) never
+ * take g_lock, instead each one advertises itself in a reader slot.  Taking
+ * g_lock does not stop them: most of what is done under it (client I/O,
+ * timers, replies) never touches the keyspace.  A holder about to modify or
+ * free keyspace memory calls aeExcludeReaders(), which raises g_cWriters so no
+ * new readers can enter and waits for the readers already inside to leave.
+ * Readers stay out until the outermost unlock(), so anything the holder
+ * unlinked can be freed right away: no reader still references it.
+ *
+ * Threads running a command under the lock of its database only (see
+ * aeTryEnterStripedSection) advertise themselves in the same slots.  Unlike
+ * readers they are kept out by every outermost acquisition of g_lock, since
+ * the holder may touch any database and the server wide state they share.
+ * A striped command about to modify the keyspace keeps readers out just like
+ * a holder does, until it leaves its section. */
+#define MAX_READER_SLOTS 64
+struct alignas(64) readerslot
+{
+    std::atomic<int> fActive;
+    std::atomic<int> fStriped;
+};
+static readerslot g_rgreaderslots[MAX_READER_SLOTS];
+static std::atomic<int> g_creaderslots {0};
+static std::atomic<int> g_cWriters {0};             // threads keeping readers out
+static std::atomic<int> g_cStripesExcluded {0};     // g_lock holders keeping striped sections out
+static thread_local int t_ireaderslot = -1;
+static thread_local int t_cReadSection = 0;
+static thread_local int t_cStripedSection = 0;
+
+static readerslot *readerSlotThisThread()
+{
+    if (t_ireaderslot < 0)
+    {
+        int islot = g_creaderslots.fetch_add(1);
+        if (islot >= MAX_READER_SLOTS)
+        {
+            g_creaderslots.fetch_sub(1);
+            return nullptr;
+        }
+        t_ireaderslot = islot;
+    }
+    return &g_rgreaderslots[t_ireaderslot];
+}
+
+class readgatedlock
+{
+    fastlock m_lock;
+    cohortlock m_lockCohort;    // used instead of m_lock when NUMA aware locking is enabled
+    bool m_fCohort = false;
+    static thread_local int s_cdepth;
+    static thread_local bool s_fReadersExcluded;
+
+    void lockInner()
+    {
+        if (m_fCohort)
+            m_lockCohort.lock();
+        else
+            m_lock.lock();
+    }
+
+    bool tryLockInner(bool fWeak)
+    {
+        return m_fCohort ? m_lockCohort.try_lock(fWeak) : m_lock.try_lock(fWeak);
+    }
+
+    void unlockInner()
+    {
+        if (m_fCohort)
+            m_lockCohort.unlock();
+        else
+            m_lock.unlock();
+    }
+
+    void drainReaders()
+    {
+        AE_ASSERT(t_cReadSection == 0);  // a reader taking g_lock could deadlock with another
+        g_cWriters.fetch_add(1);
+        int cslots = std::min(g_creaderslots.load(), MAX_READER_SLOTS);
+        for (int islot = 0; islot < cslots; ++islot)
+        {
+            if (islot == t_ireaderslot)
+                continue;
+            unsigned cloops = 0;
+            while (g_rgreaderslots[islot].fActive.load())
+            {
+#if defined(__i386__) || defined(__amd64__)
+                __asm__ ("pause");
 #endif
-thread_local aeEventLoop *g_eventLoopThisThread = NULL;
+                if ((++cloops % 1024) == 0)
+                    sched_yield();
+            }
+        }
+    }
 
-#define AE_ASSERT(x) if (!(x)) do { fprintf(stderr, "AE_ASSER FAILURE\n"); *((volatile int*)0) = 1; } while(0)
+    /* Keeps new striped sections from being entered and waits for those in
+     * progress, or with fWait false gives up if there are any */
+    bool excludeStripes(bool fWait)
+    {
+        AE_ASSERT(t_cStripedSection == 0);  // we would wait for ourselves
+        g_cStripesExcluded.fetch_add(1);
+        int cslots = std::min(g_creaderslots.load(), MAX_READER_SLOTS);
+        for (int islot = 0; islot < cslots; ++islot)
+        {
+            unsigned cloops = 0;
+            while (g_rgreaderslots[islot].fStriped.load())
+            {
+                if (!fWait)
+                {
+                    g_cStripesExcluded.fetch_sub(1);
+                    return false;
+                }
+#if defined(__i386__) || defined(__amd64__)
+                __asm__ ("pause");
+#endif
+                if ((++cloops % 1024) == 0)
+                    sched_yield();
+            }
+        }
+        return true;
+    }
+
+    void readersExcludedDone()
+    {
+        if (s_fReadersExcluded)
+        {
+            s_fReadersExcluded = false;
+            g_cWriters.fetch_sub(1);
+        }
+    }
+
+public:
+    readgatedlock()
+    {
+        fastlock_setname(&m_lock, "global");
+        m_lockCohort.setname("global");
+    }
+
+    /* Must be called while only one thread exists, if that thread holds the
+     * lock it continues to hold it after the switch */
+    void setCohort(bool fCohort)
+    {
+        AE_ASSERT(s_cdepth <= 1);
+        bool fHeld = (s_cdepth == 1);
+        if (fHeld)
+            unlockInner();
+        m_fCohort = fCohort;
+        if (fHeld)
+            lockInner();
+    }
+
+    void lock()
+    {
+        lockInner();
+        if (++s_cdepth == 1)
+            excludeStripes(true /*fWait*/);
+    }
+
+    bool try_lock(bool fWeak = false)
+    {
+        if (!tryLockInner(fWeak))
+            return false;
+        /* Don't wait for striped commands, the caller may hold a client lock
+         * one of them needs (see AeLocker::arm) */
+        if (s_cdepth == 0 && !excludeStripes(false /*fWait*/))
+        {
+            unlockInner();
+            return false;
+        }
+        ++s_cdepth;
+        return true;
+    }
+
+    void unlock()
+    {
+        if (--s_cdepth == 0)
+        {
+            readersExcludedDone();
+            g_cStripesExcluded.fetch_sub(1);
+        }
+        unlockInner();
+    }
+
+    /* Only has an effect when called with the lock held or in a striped
+     * section */
+    void excludeReaders()
+    {
+        if ((s_cdepth == 0 && t_cStripedSection == 0) || s_fReadersExcluded)
+            return;
+        drainReaders();
+        s_fReadersExcluded = true;
+    }
+
+    void leaveStripedSection()
+    {
+        AE_ASSERT(s_cdepth == 0);
+        readersExcludedDone();
+    }
+
+    /* Racy, only meant for statistics */
+    bool fHeld()
+    {
+        return (m_fCohort ? m_lockCohort.m_pidOwner : m_lock.m_pidOwner) >= 0;
+    }
+
+    bool fOwnLock()
+    {
+        return m_fCohort ? m_lockCohort.fOwnLock() : m_lock.fOwnLock();
+    }
+};
+thread_local int readgatedlock::s_cdepth = 0;
+thread_local bool readgatedlock::s_fReadersExcluded = false;
+readgatedlock g_lock;
+#endif
+thread_local aeEventLoop *g_eventLoopThisThread = NULL;
 
 /* Include the best multiplexing layer supported by this system.
  * The following should be ordered by performances, descending. */
 #ifdef HAVE_EVPORT
 #include "ae_evport.c"
 #else
-    #ifdef HAVE_EPOLL
+    #if defined(USE_IOURING) && defined(__linux__)
+    #include "ae_iouring.cpp"
+    #elif defined(HAVE_EPOLL)
     #include "ae_epoll.cpp"
     #else
         #ifdef HAVE_KQUEUE
@@ -328,6 +543,7 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
         eventLoop->events[i].mask = AE_NONE;
 
     fastlock_init(&eventLoop->flock);
+    fastlock_setname(&eventLoop->flock, "event-loop");
     int rgfd[2];
     if (pipe(rgfd) < 0)
         goto err;
@@ -441,7 +657,7 @@ extern "C" void aeDeleteFileEvent(aeEventLoop *eventLoop, int fd, int mask)
     if (mask & AE_WRITABLE) mask |= AE_BARRIER;
 
     if (mask & AE_WRITABLE) mask |= AE_WRITE_THREADSAFE;
-    if (mask & AE_READABLE) mask |= AE_READ_THREADSAFE;
+    if (mask & AE_READABLE) mask |= AE_READ_THREADSAFE|AE_READ_BUFFERED;
 
     aeApiDelEvent(eventLoop, fd, mask);
     fe->mask = fe->mask & (~mask);
@@ -462,6 +678,49 @@ extern "C" int aeGetFileEvents(aeEventLoop *eventLoop, int fd) {
     return fe->mask;
 }
 
+/* Read from a descriptor whose read handler was registered with
+ * AE_READ_BUFFERED.  Data the event loop already received is returned first,
+ * then the descriptor is read directly.  Same return value as read(). */
+extern "C" ssize_t aeRead(aeEventLoop *eventLoop, int fd, void *buf, size_t cb) {
+    AE_ASSERT(g_eventLoopThisThread == NULL || g_eventLoopThisThread == eventLoop);
+#ifdef AE_API_HAS_IO
+    return aeApiRead(eventLoop, fd, buf, cb);
+#else
+    AE_NOTUSED(eventLoop);
+    return read(fd, buf, cb);
+#endif
+}
+
+/* Returns 1 if the event loop holds data received for fd that wasn't read
+ * with aeRead() yet.  It is dropped once the read handler is removed. */
+extern "C" int aeHasBufferedInput(aeEventLoop *eventLoop, int fd) {
+#ifdef AE_API_HAS_IO
+    return aeApiHasBufferedInput(eventLoop, fd);
+#else
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(fd);
+    return 0;
+#endif
+}
+
+/* Perform the writev() of every op, each op gets its own result.  Backends
+ * that can submit them together do it with a single system call. */
+extern "C" void aeWritevBatch(aeEventLoop *eventLoop, aeWritevOp *ops, int cops) {
+    AE_ASSERT(g_eventLoopThisThread == NULL || g_eventLoopThisThread == eventLoop);
+#ifdef AE_API_HAS_IO
+    if (cops > 1) {
+        aeApiWritevBatch(eventLoop, ops, cops);
+        return;
+    }
+#else
+    AE_NOTUSED(eventLoop);
+#endif
+    for (int i = 0; i < cops; ++i) {
+        ops[i].nwritten = writev(ops[i].fd, ops[i].iov, ops[i].iovcnt);
+        ops[i].err = (ops[i].nwritten == -1) ? errno : 0;
+    }
+}
+
 static void aeGetTime(long *seconds, long *milliseconds)
 {
     struct timeval tv;
@@ -829,14 +1088,21 @@ void aeSetAfterSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *aftersleep,
     eventLoop->aftersleepFlags = flags;
 }
 
+/* The lock profiler keys samples by call site, without this every
+ * acquisition of g_lock would be charged to these two wrappers */
 void aeAcquireLock()
 {
+    fastlock_setcallsite(__builtin_return_address(0));
     g_lock.lock();
+    fastlock_setcallsite(nullptr);
 }
 
 int aeTryAcquireLock(int fWeak)
 {
-    return g_lock.try_lock(!!fWeak);
+    fastlock_setcallsite(__builtin_return_address(0));
+    int fAcquired = g_lock.try_lock(!!fWeak);
+    fastlock_setcallsite(nullptr);
+    return fAcquired;
 }
 
 void aeReleaseLock()
@@ -848,3 +1114,120 @@ int aeThreadOwnsLock()
 {
     return g_lock.fOwnLock();
 }
+
+void aeSetNumaAwareLock(int fEnable)
+{
+#ifdef USE_MUTEX
+    (void)fEnable;
+#else
+    g_lock.setCohort(!!fEnable);
+#endif
+}
+
+int aeTryEnterReadSection()
+{
+#ifdef USE_MUTEX
+    return 0;
+#else
+    AE_ASSERT(t_cReadSection == 0);
+    readerslot *pslot = readerSlotThisThread();
+    if (pslot == nullptr)
+        return 0;
+    pslot->fActive.store(1);
+    if (g_cWriters.load())
+    {
+        /* The g_lock holder is modifying the keyspace, let it finish */
+        pslot->fActive.store(0);
+        return 0;
+    }
+    t_cReadSection = 1;
+    return 1;
+#endif
+}
+
+void aeExitReadSection()
+{
+#ifndef USE_MUTEX
+    AE_ASSERT(t_cReadSection == 1);
+    t_cReadSection = 0;
+    g_rgreaderslots[t_ireaderslot].fActive.store(0);
+#endif
+}
+
+int aeThreadInReadSection()
+{
+#ifdef USE_MUTEX
+    return 0;
+#else
+    return t_cReadSection;
+#endif
+}
+
+int aeTryEnterStripedSection()
+{
+#ifdef USE_MUTEX
+    return 0;
+#else
+    AE_ASSERT(t_cStripedSection == 0 && t_cReadSection == 0);
+    readerslot *pslot = readerSlotThisThread();
+    if (pslot == nullptr)
+        return 0;
+    pslot->fStriped.store(1);
+    if (g_cStripesExcluded.load())
+    {
+        /* The g_lock holder may touch any database, let it finish */
+        pslot->fStriped.store(0);
+        return 0;
+    }
+    t_cStripedSection = 1;
+    return 1;
+#endif
+}
+
+void aeExitStripedSection()
+{
+#ifndef USE_MUTEX
+    AE_ASSERT(t_cStripedSection == 1);
+    g_lock.leaveStripedSection();
+    t_cStripedSection = 0;
+    g_rgreaderslots[t_ireaderslot].fStriped.store(0);
+#endif
+}
+
+/* For g_lock holders that release it for a while but keep holding a db lock
+ * a striped command could wait on, see processEventsWhileBlocked() */
+void aeKeepStripesOut(int fKeep)
+{
+#ifndef USE_MUTEX
+    AE_ASSERT(g_lock.fOwnLock());
+    if (fKeep)
+        g_cStripesExcluded.fetch_add(1);
+    else
+        g_cStripesExcluded.fetch_sub(1);
+#endif
+}
+
+int aeThreadInStripedSection()
+{
+#ifdef USE_MUTEX
+    return 0;
+#else
+    return t_cStripedSection;
+#endif
+}
+
+void aeExcludeReaders()
+{
+#ifndef USE_MUTEX
+    g_lock.excludeReaders();
+#endif
+}
+
+int aeLockHeld()
+{
+#ifdef USE_MUTEX
+    return 0;
+#else
+    return g_lock.fHeld();
+#endif
+}
@@ -37,6 +37,8 @@
 #include <functional>
 #endif
 #include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include "fastlock.h"
 
 #ifdef __cplusplus
@@ -57,6 +59,9 @@ extern "C" {
 #define AE_READ_THREADSAFE 8
 #define AE_WRITE_THREADSAFE 16
 #define AE_SLEEP_THREADSAFE 32
+#define AE_READ_BUFFERED 64 /* With READABLE, the event loop may receive the
+                               data before calling the handler, which must
+                               then read the descriptor with aeRead(). */
 
 #define AE_FILE_EVENTS 1
 #define AE_TIME_EVENTS 2
@@ -99,6 +104,15 @@ typedef struct aeTimeEvent {
     struct aeTimeEvent *next;
 } aeTimeEvent;
 
+/* A write submitted with aeWritevBatch() */
+typedef struct aeWritevOp {
+    int fd;
+    const struct iovec *iov;
+    int iovcnt;
+    ssize_t nwritten;   /* result as returned by writev() */
+    int err;            /* errno when nwritten is -1 */
+} aeWritevOp;
+
 /* A fired event */
 typedef struct aeFiredEvent {
     int fd;
@@ -145,6 +159,9 @@ int aeCreateRemoteFileEvent(aeEventLoop *eventLoop, int fd, int mask,
 void aeDeleteFileEvent(aeEventLoop *eventLoop, int fd, int mask);
 void aeDeleteFileEventAsync(aeEventLoop *eventLoop, int fd, int mask);
 int aeGetFileEvents(aeEventLoop *eventLoop, int fd);
+ssize_t aeRead(aeEventLoop *eventLoop, int fd, void *buf, size_t cb);
+int aeHasBufferedInput(aeEventLoop *eventLoop, int fd);
+void aeWritevBatch(aeEventLoop *eventLoop, aeWritevOp *ops, int cops);
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc);
@@ -162,6 +179,16 @@ void aeAcquireLock();
 int aeTryAcquireLock(int fWeak);
 void aeReleaseLock();
 int aeThreadOwnsLock();
+void aeSetNumaAwareLock(int fEnable);
+int aeTryEnterReadSection();
+void aeExitReadSection();
+int aeThreadInReadSection();
+int aeTryEnterStripedSection();
+void aeExitStripedSection();
+int aeThreadInStripedSection();
+void aeKeepStripesOut(int fKeep);
+void aeExcludeReaders();
+int aeLockHeld();
 
 #ifdef __cplusplus
 }
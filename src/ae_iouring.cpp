@@ -0,0 +1,621 @@
+/* Linux io_uring(7) based ae.c module
+ *
+ * Copyright (c) 2019, John Sully <john at eqalpha dot com>
+ * All rights reserved.
+ *
+ * Readiness is tracked with one-shot IORING_OP_POLL_ADD requests, one per
+ * file descriptor.  Arming, re-arming and cancelling polls only queues
+ * submission entries; everything queued during an event loop iteration is
+ * submitted by the same io_uring_enter() call that waits for completions.
+ * Compared to epoll this removes the epoll_ctl() calls made whenever a write
+ * handler is installed or removed.
+ *
+ * Client sockets are registered with AE_READ_BUFFERED.  When the poll of such
+ * a socket reports it readable an IORING_OP_RECV is queued instead, picking a
+ * buffer from a provided buffer ring, and all the receives queued while
+ * processing the completions are submitted by one io_uring_enter().  They
+ * carry MSG_DONTWAIT so they complete during that call rather than wait for
+ * data.  The read handler then copies the data out with aeRead(), which hands
+ * the buffer back to the kernel.  Whatever the handler leaves is reported
+ * readable again at the next poll, and dropped when the read handler is
+ * removed: protectClient() drains it into the query buffer first.
+ *
+ * aeWritevBatch() turns the writes of all the clients with pending replies
+ * into IORING_OP_SENDMSG requests, submitted (again with MSG_DONTWAIT) and
+ * completed by a single io_uring_enter().
+ *
+ * Sockets are not registered as fixed files.  Clients connect, disconnect,
+ * get protected and move between threads often enough that keeping the table
+ * in sync would cost about the file lookups it saves.
+ *
+ * Requires Linux 5.11 or newer (IORING_FEAT_EXT_ARG for the wait timeout).
+ * Receiving into provided buffers needs 5.19 (IORING_REGISTER_PBUF_RING), on
+ * older kernels the read handlers read(2) the sockets themselves.
+ * Build with USE_IOURING=yes.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <algorithm>
+
+#define AE_IOURING_SQ_ENTRIES 4096
+#define AE_IOURING_MAX_CQ_ENTRIES 65536
+#define AE_IOURING_UD_IGNORE (~0ULL)    /* completions we don't care about */
+#define AE_IOURING_UD_RECV (1ULL << 62) /* or'ed with the fd */
+#define AE_IOURING_UD_SEND (1ULL << 61) /* or'ed with the index in the batch */
+#define AE_IOURING_BUF_SIZE (16*1024)   /* one client read (PROTO_IOBUF_LEN) */
+#define AE_IOURING_BUF_COUNT 128        /* must be a power of two */
+#define AE_IOURING_BGID 0
+#define AE_IOURING_EOF (-1)
+
+typedef struct aeIouringFd {
+    uint32_t gen;       /* generation of the last armed poll, used to drop stale completions */
+    int maskArmed;      /* events of the outstanding poll, AE_NONE if there is none */
+    int fDirty;         /* in the dirty list, (re)armed at the next aeApiPoll() */
+    int maskReady;      /* events to return from the next aeApiPoll() */
+    int fStashed;       /* in the stashed list */
+    int bid;            /* provided buffer holding received data, -1 if none */
+    unsigned offRecv, cbRecv;   /* the part of it aeRead() didn't return yet */
+    int errRecv;        /* errno of a failed receive (or AE_IOURING_EOF), returned by aeRead() */
+} aeIouringFd;
+
+typedef struct aeApiState {
+    int ringfd;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned sqEntries;
+    struct io_uring_sqe *sqes;
+    unsigned cpending;  /* queued but not yet submitted SQEs */
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    void *pvSqRing, *pvCqRing;
+    size_t cbSqRing, cbCqRing, cbSqes;
+    aeIouringFd *fds;   /* never shrunk, so generations survive set size changes */
+    int cfds;
+    int *dirty;
+    int cdirty;
+    int *ready;         /* fds with maskReady set */
+    int cready;
+    int *stashed;       /* fds that had received data or an error, see aeIouringHasRecv() */
+    int cstashed;
+    unsigned cinflight; /* receives and sends not completed yet */
+    int bufRingState;   /* 0 until the first AE_READ_BUFFERED fd, then 1 if registered, -1 if unsupported */
+    struct io_uring_buf_ring *bufRing;
+    char *bufs;
+    uint16_t bufTail;
+    aeWritevOp *sendOps;        /* the batch aeApiWritevBatch() is waiting for */
+    struct msghdr *msgs;
+    int cmsgs;
+} aeApiState;
+
+static int aeIouringEnter(aeApiState *state, unsigned to_submit, unsigned min_complete, unsigned flags, struct timespec *ts) {
+    struct io_uring_getevents_arg arg = {0};
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uint64_t)(uintptr_t)ts;
+    return (int)syscall(__NR_io_uring_enter, state->ringfd, to_submit, min_complete,
+        flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+static void aeIouringSubmit(aeApiState *state) {
+    while (state->cpending) {
+        int ret = aeIouringEnter(state, state->cpending, 0, 0, NULL);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            /* EAGAIN/EBUSY: the CQ is backed up, the entries stay queued
+             * and go out with the next wait. */
+            return;
+        }
+        state->cpending -= ret;
+    }
+}
+
+static struct io_uring_sqe *aeIouringGetSqe(aeApiState *state) {
+    unsigned tail = *state->sqTail;
+    if (tail - __atomic_load_n(state->sqHead, __ATOMIC_ACQUIRE) == state->sqEntries) {
+        aeIouringSubmit(state);
+        if (tail - __atomic_load_n(state->sqHead, __ATOMIC_ACQUIRE) == state->sqEntries)
+            return NULL;
+    }
+    unsigned idx = tail & *state->sqMask;
+    struct io_uring_sqe *sqe = &state->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    state->sqArray[idx] = idx;
+    return sqe;
+}
+
+static void aeIouringCommitSqe(aeApiState *state) {
+    __atomic_store_n(state->sqTail, *state->sqTail + 1, __ATOMIC_RELEASE);
+    state->cpending++;
+}
+
+static void aeIouringMarkDirty(aeApiState *state, int fd) {
+    if (state->fds[fd].fDirty) return;
+    state->fds[fd].fDirty = 1;
+    state->dirty[state->cdirty++] = fd;
+}
+
+static int aeIouringArm(aeApiState *state, int fd, int mask) {
+    struct io_uring_sqe *sqe = aeIouringGetSqe(state);
+    if (sqe == NULL) return -1;
+    aeIouringFd *f = &state->fds[fd];
+    f->gen++;
+    f->maskArmed = mask;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = ((mask & AE_READABLE) ? POLLIN : 0) | ((mask & AE_WRITABLE) ? POLLOUT : 0);
+    sqe->user_data = ((uint64_t)fd << 32) | f->gen;
+    aeIouringCommitSqe(state);
+    return 0;
+}
+
+static void aeIouringDisarm(aeApiState *state, int fd) {
+    aeIouringFd *f = &state->fds[fd];
+    if (f->maskArmed == AE_NONE) return;
+    struct io_uring_sqe *sqe = aeIouringGetSqe(state);
+    if (sqe != NULL) {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = ((uint64_t)fd << 32) | f->gen;
+        sqe->user_data = AE_IOURING_UD_IGNORE;
+        aeIouringCommitSqe(state);
+    }
+    /* Even if the remove could not be queued, the completion of the old poll
+     * no longer matches an armed poll and is dropped. */
+    f->maskArmed = AE_NONE;
+}
+
+static void aeIouringSetReady(aeApiState *state, int fd, int mask) {
+    aeIouringFd *f = &state->fds[fd];
+    if (mask == AE_NONE) return;
+    if (f->maskReady == AE_NONE) state->ready[state->cready++] = fd;
+    f->maskReady |= mask;
+}
+
+static int aeIouringHasRecv(aeIouringFd *f) {
+    return f->bid >= 0 || f->errRecv != 0;
+}
+
+/* Give a buffer (back) to the kernel */
+static void aeIouringProvideBuf(aeApiState *state, int bid) {
+    /* Not bufRing->bufs: the header's flexible array sits behind an empty
+     * struct, which isn't empty in C++ and moves it 8 bytes up */
+    struct io_uring_buf *buf = (struct io_uring_buf*)state->bufRing + (state->bufTail & (AE_IOURING_BUF_COUNT-1));
+    buf->addr = (uint64_t)(uintptr_t)(state->bufs + (size_t)bid*AE_IOURING_BUF_SIZE);
+    buf->len = AE_IOURING_BUF_SIZE;
+    buf->bid = bid;
+    state->bufTail++;
+    __atomic_store_n(&state->bufRing->tail, state->bufTail, __ATOMIC_RELEASE);
+}
+
+static void aeIouringDropRecv(aeApiState *state, aeIouringFd *f) {
+    if (f->bid >= 0) aeIouringProvideBuf(state, f->bid);
+    f->bid = -1;
+    f->cbRecv = 0;
+    f->errRecv = 0;
+}
+
+static void aeIouringSetupBufRing(aeApiState *state) {
+    size_t cbRing = sizeof(struct io_uring_buf)*AE_IOURING_BUF_COUNT;
+    size_t cbBufs = (size_t)AE_IOURING_BUF_SIZE*AE_IOURING_BUF_COUNT;
+
+    state->bufRingState = -1;
+    void *ring = mmap(NULL, cbRing, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) return;
+    void *bufs = mmap(NULL, cbBufs, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (bufs == MAP_FAILED) {
+        munmap(ring, cbRing);
+        return;
+    }
+    /* Fault the ring in before the kernel pins it, writing to a page it
+     * pinned as the shared zero page would leave the kernel on the old one */
+    memset(ring, 0, cbRing);
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring;
+    reg.ring_entries = AE_IOURING_BUF_COUNT;
+    reg.bgid = AE_IOURING_BGID;
+    if (syscall(__NR_io_uring_register, state->ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        munmap(bufs, cbBufs);
+        munmap(ring, cbRing);
+        return;
+    }
+    state->bufRing = (struct io_uring_buf_ring*)ring;
+    state->bufs = (char*)bufs;
+    state->bufTail = 0;
+    for (int bid = 0; bid < AE_IOURING_BUF_COUNT; ++bid)
+        aeIouringProvideBuf(state, bid);
+    state->bufRingState = 1;
+}
+
+static int aeIouringQueueRecv(aeApiState *state, int fd) {
+    struct io_uring_sqe *sqe = aeIouringGetSqe(state);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->len = AE_IOURING_BUF_SIZE;
+    sqe->msg_flags = MSG_DONTWAIT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = AE_IOURING_BGID;
+    sqe->user_data = AE_IOURING_UD_RECV | (uint64_t)fd;
+    aeIouringCommitSqe(state);
+    state->cinflight++;
+    return 0;
+}
+
+static void aeIouringCompleteRecv(aeApiState *state, int fd, int res, uint32_t flags) {
+    aeIouringFd *f = &state->fds[fd];
+    int bid = (flags & IORING_CQE_F_BUFFER) ? (int)(flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+
+    if (res > 0 && bid >= 0) {
+        f->bid = bid;
+        f->offRecv = 0;
+        f->cbRecv = res;
+    } else {
+        if (bid >= 0) aeIouringProvideBuf(state, bid);
+        if (res == -EAGAIN) return;     // nothing to read after all, the poll is re-armed
+        if (res == -ENOBUFS) {
+            /* Every buffer is taken, let the handler read the socket */
+            aeIouringSetReady(state, fd, AE_READABLE);
+            return;
+        }
+        f->errRecv = (res == 0) ? AE_IOURING_EOF : -res;
+    }
+    if (!f->fStashed) {
+        f->fStashed = 1;
+        state->stashed[state->cstashed++] = fd;
+    }
+    aeIouringSetReady(state, fd, AE_READABLE);
+}
+
+/* Process the completions available in the CQ */
+static void aeIouringReap(aeEventLoop *eventLoop, aeApiState *state) {
+    unsigned head = *state->cqHead;
+    unsigned tail = __atomic_load_n(state->cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &state->cqes[head & *state->cqMask];
+        head++;
+        if (cqe->user_data == AE_IOURING_UD_IGNORE) continue;
+        if (cqe->user_data & AE_IOURING_UD_SEND) {
+            aeWritevOp *op = &state->sendOps[cqe->user_data & ~AE_IOURING_UD_SEND];
+            op->nwritten = (cqe->res < 0) ? -1 : cqe->res;
+            op->err = (cqe->res < 0) ? -cqe->res : 0;
+            state->cinflight--;
+            continue;
+        }
+        if (cqe->user_data & AE_IOURING_UD_RECV) {
+            aeIouringCompleteRecv(state, (int)(cqe->user_data & ~AE_IOURING_UD_RECV), cqe->res, cqe->flags);
+            state->cinflight--;
+            continue;
+        }
+        int fd = (int)(cqe->user_data >> 32);
+        uint32_t gen = (uint32_t)cqe->user_data;
+        if (fd >= eventLoop->setsize) continue;
+        aeIouringFd *f = &state->fds[fd];
+        if (gen != f->gen || f->maskArmed == AE_NONE) continue;   // cancelled or superseded
+
+        /* Polls are one-shot, re-arm next time for level triggered semantics */
+        f->maskArmed = AE_NONE;
+        aeIouringMarkDirty(state, fd);
+
+        int mask = 0;
+        if (cqe->res < 0) {
+            mask = eventLoop->events[fd].mask & (AE_READABLE|AE_WRITABLE);
+        } else {
+            if (cqe->res & POLLIN) mask |= AE_READABLE;
+            if (cqe->res & POLLOUT) mask |= AE_WRITABLE;
+            if (cqe->res & POLLERR) mask |= AE_WRITABLE;
+            if (cqe->res & POLLHUP) mask |= AE_WRITABLE;
+        }
+        /* Receive the data now, the read event fires once it is in.  Not if
+         * the handler didn't consume the last receive yet, it would reorder
+         * the stream. */
+        if ((mask & AE_READABLE) && (eventLoop->events[fd].mask & AE_READ_BUFFERED)
+            && state->bufRingState == 1 && !aeIouringHasRecv(f) && aeIouringQueueRecv(state, fd) == 0)
+            mask &= ~AE_READABLE;
+        aeIouringSetReady(state, fd, mask);
+    }
+    __atomic_store_n(state->cqHead, head, __ATOMIC_RELEASE);
+}
+
+/* Submit what is queued and wait for the receives and sends to complete.
+ * They can't block, so this doesn't sleep. */
+static void aeIouringWaitInflight(aeEventLoop *eventLoop, aeApiState *state) {
+    while (state->cinflight) {
+        if (__atomic_load_n(state->cqTail, __ATOMIC_ACQUIRE) == *state->cqHead) {
+            int ret = aeIouringEnter(state, state->cpending, 1, IORING_ENTER_GETEVENTS, NULL);
+            if (ret > 0) state->cpending -= ret;
+            else if (ret < 0) AE_ASSERT(errno == EINTR || errno == EAGAIN || errno == EBUSY);
+        }
+        aeIouringReap(eventLoop, state);
+    }
+}
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state = (aeApiState*)zcalloc(sizeof(aeApiState), MALLOC_LOCAL);
+    if (!state) return -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    unsigned cqEntries = AE_IOURING_SQ_ENTRIES*2;
+    while (cqEntries < (unsigned)eventLoop->setsize*2 && cqEntries < AE_IOURING_MAX_CQ_ENTRIES)
+        cqEntries *= 2;
+    params.cq_entries = cqEntries;
+    state->ringfd = (int)syscall(__NR_io_uring_setup, AE_IOURING_SQ_ENTRIES, &params);
+    if (state->ringfd < 0) {
+        perror("io_uring_setup failed");
+        zfree(state);
+        return -1;
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+        fprintf(stderr, "io_uring on this kernel is too old for the event loop (Linux 5.11+ required)\n");
+        close(state->ringfd);
+        zfree(state);
+        return -1;
+    }
+
+    state->cbSqRing = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+    state->cbCqRing = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    state->cbSqes = params.sq_entries*sizeof(struct io_uring_sqe);
+    state->pvSqRing = mmap(NULL, state->cbSqRing, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+        state->ringfd, IORING_OFF_SQ_RING);
+    state->pvCqRing = mmap(NULL, state->cbCqRing, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+        state->ringfd, IORING_OFF_CQ_RING);
+    state->sqes = (struct io_uring_sqe*)mmap(NULL, state->cbSqes, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+        state->ringfd, IORING_OFF_SQES);
+    if (state->pvSqRing == MAP_FAILED || state->pvCqRing == MAP_FAILED || state->sqes == MAP_FAILED) {
+        perror("io_uring mmap failed");
+        if (state->pvSqRing != MAP_FAILED) munmap(state->pvSqRing, state->cbSqRing);
+        if (state->pvCqRing != MAP_FAILED) munmap(state->pvCqRing, state->cbCqRing);
+        if (state->sqes != MAP_FAILED) munmap(state->sqes, state->cbSqes);
+        close(state->ringfd);
+        zfree(state);
+        return -1;
+    }
+
+    char *sq = (char*)state->pvSqRing;
+    state->sqHead = (unsigned*)(sq + params.sq_off.head);
+    state->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    state->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    state->sqArray = (unsigned*)(sq + params.sq_off.array);
+    state->sqEntries = params.sq_entries;
+    char *cq = (char*)state->pvCqRing;
+    state->cqHead = (unsigned*)(cq + params.cq_off.head);
+    state->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    state->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    state->fds = (aeIouringFd*)zcalloc(sizeof(aeIouringFd)*eventLoop->setsize, MALLOC_LOCAL);
+    for (int fd = 0; fd < eventLoop->setsize; ++fd)
+        state->fds[fd].bid = -1;
+    state->cfds = eventLoop->setsize;
+    state->dirty = (int*)zmalloc(sizeof(int)*eventLoop->setsize, MALLOC_LOCAL);
+    state->ready = (int*)zmalloc(sizeof(int)*state->cfds, MALLOC_LOCAL);
+    state->stashed = (int*)zmalloc(sizeof(int)*state->cfds, MALLOC_LOCAL);
+    eventLoop->apidata = state;
+    return 0;
+}
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = (aeApiState*)eventLoop->apidata;
+
+    if (setsize > state->cfds) {
+        state->fds = (aeIouringFd*)zrealloc(state->fds, sizeof(aeIouringFd)*setsize, MALLOC_LOCAL);
+        memset(state->fds + state->cfds, 0, sizeof(aeIouringFd)*(setsize - state->cfds));
+        for (int fd = state->cfds; fd < setsize; ++fd)
+            state->fds[fd].bid = -1;
+        state->cfds = setsize;
+        state->ready = (int*)zrealloc(state->ready, sizeof(int)*setsize, MALLOC_LOCAL);
+        state->stashed = (int*)zrealloc(state->stashed, sizeof(int)*setsize, MALLOC_LOCAL);
+    }
+    state->dirty = (int*)zrealloc(state->dirty, sizeof(int)*setsize, MALLOC_LOCAL);
+    return 0;
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = (aeApiState*)eventLoop->apidata;
+
+    munmap(state->sqes, state->cbSqes);
+    munmap(state->pvCqRing, state->cbCqRing);
+    munmap(state->pvSqRing, state->cbSqRing);
+    close(state->ringfd);
+    if (state->bufRingState == 1) {
+        munmap(state->bufs, (size_t)AE_IOURING_BUF_SIZE*AE_IOURING_BUF_COUNT);
+        munmap(state->bufRing, sizeof(struct io_uring_buf)*AE_IOURING_BUF_COUNT);
+    }
+    zfree(state->fds);
+    zfree(state->dirty);
+    zfree(state->ready);
+    zfree(state->stashed);
+    zfree(state->msgs);
+    zfree(state);
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = (aeApiState*)eventLoop->apidata;
+    aeIouringFd *f = &state->fds[fd];
+
+    if ((mask & AE_READ_BUFFERED) && state->bufRingState == 0)
+        aeIouringSetupBufRing(state);
+    mask = (mask | eventLoop->events[fd].mask) & (AE_READABLE|AE_WRITABLE);
+    /* A poll that doesn't cover the new events is cancelled and re-armed
+     * with the full mask at the next poll. */
+    if (f->maskArmed != AE_NONE && (mask & ~f->maskArmed))
+        aeIouringDisarm(state, fd);
+    if (f->maskArmed == AE_NONE)
+        aeIouringMarkDirty(state, fd);
+    return 0;
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeApiState *state = (aeApiState*)eventLoop->apidata;
+    int mask = eventLoop->events[fd].mask & (~delmask) & (AE_READABLE|AE_WRITABLE);
+
+    /* Received data belongs to the read handler, the next one registered
+     * for this fd may well be for another connection. */
+    if (delmask & AE_READABLE)
+        aeIouringDropRecv(state, &state->fds[fd]);
+    /* The poll has to go once nothing is watched, it holds a reference on the
+     * file and the fd is usually closed right after.  If some events remain
+     * the poll is left alone: a completion for a removed event is ignored by
+     * aeProcessEvents() and the re-arm uses the new mask. */
+    if (mask == AE_NONE)
+        aeIouringDisarm(state, fd);
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = (aeApiState*)eventLoop->apidata;
+    int numevents = 0;
+
+    int i = 0;
+    for (; i < state->cdirty; ++i) {
+        int fd = state->dirty[i];
+        aeIouringFd *f = &state->fds[fd];
+        int mask = eventLoop->events[fd].mask & (AE_READABLE|AE_WRITABLE);
+        if (mask != AE_NONE && f->maskArmed == AE_NONE && aeIouringArm(state, fd, mask) == -1)
+            break;  /* the SQ is full even after submitting, retry the rest next time */
+        f->fDirty = 0;
+    }
+    memmove(state->dirty, state->dirty+i, sizeof(int)*(state->cdirty-i));
+    state->cdirty -= i;
+
+    /* Data a handler left unread is still readable */
+    int j = 0;
+    for (i = 0; i < state->cstashed; ++i) {
+        int fd = state->stashed[i];
+        aeIouringFd *f = &state->fds[fd];
+        if (!aeIouringHasRecv(f)) {
+            f->fStashed = 0;
+            continue;
+        }
+        state->stashed[j++] = fd;
+        aeIouringSetReady(state, fd, AE_READABLE);
+    }
+    state->cstashed = j;
+
+    /* Submit everything queued since the last poll and wait in one call */
+    unsigned flags = 0, min_complete = 0;
+    struct timespec ts, *pts = NULL;
+    bool fWait = __atomic_load_n(state->cqTail, __ATOMIC_ACQUIRE) == *state->cqHead
+        && state->cready == 0 && (tvp == NULL || tvp->tv_sec != 0 || tvp->tv_usec != 0);
+    if (fWait) {
+        flags |= IORING_ENTER_GETEVENTS;
+        min_complete = 1;
+        if (tvp != NULL) {
+            ts.tv_sec = tvp->tv_sec;
+            ts.tv_nsec = tvp->tv_usec * 1000;
+            pts = &ts;
+        }
+    }
+    if (state->cpending || fWait) {
+        int ret = aeIouringEnter(state, state->cpending, min_complete, flags, pts);
+        if (ret > 0) state->cpending -= ret;
+    }
+
+    aeIouringReap(eventLoop, state);
+    aeIouringWaitInflight(eventLoop, state);    // the receives queued by the reap
+
+    for (i = 0; i < state->cready; ++i) {
+        int fd = state->ready[i];
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = state->fds[fd].maskReady;
+        state->fds[fd].maskReady = AE_NONE;
+        numevents++;
+    }
+    state->cready = 0;
+    return numevents;
+}
+
+static ssize_t aeApiRead(aeEventLoop *eventLoop, int fd, void *buf, size_t cb) {
+    aeApiState *state = (aeApiState*)eventLoop->apidata;
+    if (fd < 0 || fd >= state->cfds || !aeIouringHasRecv(&state->fds[fd]))
+        return read(fd, buf, cb);
+
+    aeIouringFd *f = &state->fds[fd];
+    if (f->bid >= 0) {
+        size_t cbCopy = std::min(cb, (size_t)f->cbRecv);
+        memcpy(buf, state->bufs + (size_t)f->bid*AE_IOURING_BUF_SIZE + f->offRecv, cbCopy);
+        f->offRecv += cbCopy;
+        f->cbRecv -= cbCopy;
+        if (f->cbRecv == 0) {
+            aeIouringProvideBuf(state, f->bid);
+            f->bid = -1;
+        }
+        return cbCopy;
+    }
+    int err = f->errRecv;
+    f->errRecv = 0;
+    if (err == AE_IOURING_EOF) return 0;
+    errno = err;
+    return -1;
+}
+
+static int aeApiHasBufferedInput(aeEventLoop *eventLoop, int fd) {
+    aeApiState *state = (aeApiState*)eventLoop->apidata;
+    return fd >= 0 && fd < state->cfds && state->fds[fd].bid >= 0;
+}
+
+static void aeApiWritevBatch(aeEventLoop *eventLoop, aeWritevOp *ops, int cops) {
+    aeApiState *state = (aeApiState*)eventLoop->apidata;
+
+    if (cops > state->cmsgs) {
+        state->msgs = (struct msghdr*)zrealloc(state->msgs, sizeof(struct msghdr)*cops, MALLOC_LOCAL);
+        state->cmsgs = cops;
+    }
+    state->sendOps = ops;
+    for (int i = 0; i < cops; ++i) {
+        struct msghdr *msg = &state->msgs[i];
+        memset(msg, 0, sizeof(*msg));
+        msg->msg_iov = (struct iovec*)ops[i].iov;
+        msg->msg_iovlen = ops[i].iovcnt;
+        struct io_uring_sqe *sqe = aeIouringGetSqe(state);
+        if (sqe == NULL) {
+            ops[i].nwritten = writev(ops[i].fd, ops[i].iov, ops[i].iovcnt);
+            ops[i].err = (ops[i].nwritten == -1) ? errno : 0;
+            continue;
+        }
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = ops[i].fd;
+        sqe->addr = (uint64_t)(uintptr_t)msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_DONTWAIT|MSG_NOSIGNAL;
+        sqe->user_data = AE_IOURING_UD_SEND | (uint64_t)i;
+        aeIouringCommitSqe(state);
+        state->cinflight++;
+    }
+    aeIouringWaitInflight(eventLoop, state);
+    state->sendOps = NULL;
+}
+
+#define AE_API_HAS_IO 1
+
+static const char *aeApiName(void) {
+    return "io_uring";
+}
@@ -71,4 +71,77 @@ public:
         if (m_fArmed)
             aeReleaseLock();
     }
-};
\ No newline at end of file
+};
+// Now that we may take the global lock again, hand over clients freed without it
+inline void freeClientsPendingAsyncFree()
+{
+    std::vector<client*> vecclients;
+    vecclients.swap(serverTL->clients_pending_asyncfree);
+    for (client *c : vecclients)
+        freeClientAsync(c);
+}
+
+class AeReadGate
+{
+    bool m_fEntered = false;
+
+public:
+    bool tryEnter()
+    {
+        serverAssert(!m_fEntered);
+        m_fEntered = !!aeTryEnterReadSection();
+        return m_fEntered;
+    }
+
+    void exit()
+    {
+        serverAssert(m_fEntered);
+        m_fEntered = false;
+        aeExitReadSection();
+        freeClientsPendingAsyncFree();
+    }
+
+    bool isEntered() const
+    {
+        return m_fEntered;
+    }
+
+    ~AeReadGate()
+    {
+        if (m_fEntered)
+            exit();
+    }
+};
+
+// Runs a command holding only the lock of its database, see FStripingAllowed()
+class AeStripeGate
+{
+    bool m_fEntered = false;
+
+public:
+    bool tryEnter()
+    {
+        serverAssert(!m_fEntered);
+        m_fEntered = !!aeTryEnterStripedSection();
+        return m_fEntered;
+    }
+
+    void exit()
+    {
+        serverAssert(m_fEntered);
+        m_fEntered = false;
+        aeExitStripedSection();
+        freeClientsPendingAsyncFree();
+    }
+
+    bool isEntered() const
+    {
+        return m_fEntered;
+    }
+
+    ~AeStripeGate()
+    {
+        if (m_fEntered)
+            exit();
+    }
+};
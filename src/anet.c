@@ -45,6 +45,9 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
 
 #include "anet.h"
 
@@ -256,6 +259,48 @@ static int anetSetReusePort(char *err, int fd) {
     return ANET_OK;
 }
 
+/* Ask the kernel to prefer this SO_REUSEPORT listener for connections whose
+ * packets are processed on the given CPU. */
+int anetSetIncomingCpu(char *err, int fd, int cpu) {
+#ifdef HAVE_SO_INCOMING_CPU
+    if (setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1) {
+        anetSetError(err, "setsockopt SO_INCOMING_CPU: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    (void)fd; (void)cpu;
+    anetSetError(err, "SO_INCOMING_CPU is not supported on this platform");
+    return ANET_ERR;
+#endif
+}
+
+/* Attach a classic BPF program to the SO_REUSEPORT group of fd that picks the
+ * listener by the CPU the connection arrived on: the socket at index
+ * (cpu % cgroup), in the order the listeners were opened.  fd must already be
+ * listening alongside the other members of the group. */
+int anetSetReusePortCpuSteering(char *err, int fd, int cgroup) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter code[] = {
+        { BPF_LD  | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU) },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)cgroup },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code)/sizeof(code[0]);
+    prog.filter = code;
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1) {
+        anetSetError(err, "setsockopt SO_ATTACH_REUSEPORT_CBPF: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    (void)fd; (void)cgroup;
+    anetSetError(err, "SO_ATTACH_REUSEPORT_CBPF is not supported on this platform");
+    return ANET_ERR;
+#endif
+}
+
 static int anetCreateSocket(char *err, int domain) {
     int s;
     if ((s = socket(domain, SOCK_STREAM, 0)) == -1) {
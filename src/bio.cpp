@@ -199,6 +199,22 @@ void *bioProcessBackgroundJobs(void *arg) {
                 lazyfreeFreeDatabaseFromBioThread((dict*)job->arg2,(expireset*)job->arg3);
             else if (job->arg3)
                 lazyfreeFreeSlotsMapFromBioThread((rax*)job->arg3);
+        } else if (type == BIO_REHASH) {
+            /* Hash the keys of the batch without the lock, then let the
+             * main thread move the entries under it.  Abandoned batches are
+             * released by dictRehashAsync() itself. */
+            if (dictRehashAsync((dictAsyncRehashCtl*)job->arg1)) {
+                aePostFunction(g_pserver->rgthreadvar[IDX_EVENT_LOOP_MAIN].el, [](void *ctl){
+                    dictCompleteRehashAsync((dictAsyncRehashCtl*)ctl);
+                }, job->arg1);
+            }
+        } else if (type == BIO_QUICKLIST_COMPRESS) {
+            /* Same for quicklist nodes: compress a copy here, swap it in
+             * under the lock. */
+            quicklistRunCompressJob((quicklistCompressJob*)job->arg1);
+            aePostFunction(g_pserver->rgthreadvar[IDX_EVENT_LOOP_MAIN].el, [](void *job){
+                quicklistCompleteCompressJob((quicklistCompressJob*)job);
+            }, job->arg1);
         } else {
             serverPanic("Wrong job type in bioProcessBackgroundJobs().");
         }
@@ -43,7 +43,9 @@ void bioKillThreads(void);
 #define BIO_CLOSE_FILE    0 /* Deferred close(2) syscall. */
 #define BIO_AOF_FSYNC     1 /* Deferred AOF fsync. */
 #define BIO_LAZY_FREE     2 /* Deferred objects freeing. */
-#define BIO_NUM_OPS       3
+#define BIO_REHASH        3 /* Hashing of dict rehash batches. */
+#define BIO_QUICKLIST_COMPRESS 4 /* Compression of quicklist nodes. */
+#define BIO_NUM_OPS       5
 
 #ifdef __cplusplus
 }
@@ -621,7 +621,10 @@ void unblockClientWaitingData(client *c) {
  * the same key again and again in the list in case of multiple pushes
  * made by a script or in the context of MULTI/EXEC.
  *
- * The list will be finally processed by handleClientsBlockedOnLists() */
+ * The list will be finally processed by handleClientsBlockedOnLists().
+ * Commands run holding only the lock of their database queue the key on
+ * serverTL->ready_keys instead, which processCommand() moves over once it
+ * holds the global lock. */
 void signalKeyAsReady(redisDb *db, robj *key) {
     readyList *rl;
 
@@ -636,7 +639,7 @@ void signalKeyAsReady(redisDb *db, robj *key) {
     rl->key = key;
     rl->db = db;
     incrRefCount(key);
-    listAddNodeTail(g_pserver->ready_keys,rl);
+    listAddNodeTail(aeThreadInStripedSection() ? serverTL->ready_keys : g_pserver->ready_keys,rl);
 
     /* We also add the key in the db->ready_keys dictionary in order
      * to avoid adding it multiple times into a list with a simple O(1)
@@ -86,6 +86,35 @@ configEnum supervised_mode_enum[] = {
     {NULL, 0}
 };
 
+configEnum thread_steering_enum[] = {
+    {"none", THREAD_STEERING_NONE},
+    {"incoming-cpu", THREAD_STEERING_INCOMING_CPU},
+    {"bpf", THREAD_STEERING_BPF},
+    {NULL, 0}
+};
+
+configEnum list_compress_codec_enum[] = {
+    {"lzf", QUICKLIST_NODE_ENCODING_LZF},
+#ifdef USE_LZ4
+    {"lz4", QUICKLIST_NODE_ENCODING_LZ4},
+#endif
+#ifdef USE_ZSTD
+    {"zstd", QUICKLIST_NODE_ENCODING_ZSTD},
+#endif
+    {NULL, 0}
+};
+
+configEnum rdb_compression_codec_enum[] = {
+    {"lzf", RDB_ENC_LZF},
+#ifdef USE_LZ4
+    {"lz4", RDB_ENC_LZ4},
+#endif
+#ifdef USE_ZSTD
+    {"zstd", RDB_ENC_ZSTD},
+#endif
+    {NULL, 0}
+};
+
 configEnum aof_fsync_enum[] = {
     {"everysec", AOF_FSYNC_EVERYSEC},
     {"always", AOF_FSYNC_ALWAYS},
@@ -115,10 +144,19 @@ configYesNo configs_yesno[] = {
     {"rdbchecksum",NULL,&g_pserver->rdb_checksum,0,CONFIG_DEFAULT_RDB_CHECKSUM},
     {"daemonize",NULL,&cserver.daemonize,0,0},
     {"always-show-logo",NULL,&g_pserver->always_show_logo,0,CONFIG_DEFAULT_ALWAYS_SHOW_LOGO},
+    {"numa-aware-lock",NULL,&cserver.fNumaAwareLock,0,CONFIG_DEFAULT_NUMA_AWARE_LOCK},
+    {"keyspace-open-addressing",NULL,&cserver.keyspace_open_addressing,0,CONFIG_DEFAULT_KEYSPACE_OPEN_ADDRESSING},
+    {"keyspace-embedded-keys",NULL,&cserver.keyspace_embedded_keys,0,CONFIG_DEFAULT_KEYSPACE_EMBEDDED_KEYS},
     /* Modifiable */
     {"protected-mode",NULL,&g_pserver->protected_mode,1,CONFIG_DEFAULT_PROTECTED_MODE},
     {"rdbcompression",NULL,&g_pserver->rdb_compression,1,CONFIG_DEFAULT_RDB_COMPRESSION},
+    {"rdb-compression-zstd-dict",NULL,&g_pserver->rdb_compression_zstd_dict,1,CONFIG_DEFAULT_RDB_COMPRESSION_ZSTD_DICT},
+    {"forkless-bgsave",NULL,&g_pserver->forkless_bgsave,1,CONFIG_DEFAULT_FORKLESS_BGSAVE},
     {"activerehashing",NULL,&g_pserver->activerehashing,1,CONFIG_DEFAULT_ACTIVE_REHASHING},
+    {"async-rehash",NULL,&dictAsyncRehash,1,CONFIG_DEFAULT_ASYNC_REHASH},
+    {"active-expire-timing-wheel",NULL,&g_pserver->active_expire_wheel,1,CONFIG_DEFAULT_ACTIVE_EXPIRE_WHEEL},
+    {"keyspace-inline-values",NULL,&g_pserver->keyspace_inline_values,1,CONFIG_DEFAULT_KEYSPACE_INLINE_VALUES},
+    {"list-compress-async",NULL,&quicklistCompressAsync,1,CONFIG_DEFAULT_LIST_COMPRESS_ASYNC},
     {"stop-writes-on-bgsave-error",NULL,&g_pserver->stop_writes_on_bgsave_err,1,CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR},
     {"dynamic-hz",NULL,&g_pserver->dynamic_hz,1,CONFIG_DEFAULT_DYNAMIC_HZ},
     {"lazyfree-lazy-eviction",NULL,&g_pserver->lazyfree_lazy_eviction,1,CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION},
@@ -138,6 +176,10 @@ configYesNo configs_yesno[] = {
     {"replica-read-only","slave-read-only",&g_pserver->repl_slave_ro,1,CONFIG_DEFAULT_SLAVE_READ_ONLY},
     {"replica-ignore-maxmemory","slave-ignore-maxmemory",&g_pserver->repl_slave_ignore_maxmemory,1,CONFIG_DEFAULT_SLAVE_IGNORE_MAXMEMORY},
     {"multi-master",NULL,&g_pserver->enable_multimaster,false,CONFIG_DEFAULT_ENABLE_MULTIMASTER},
+    {"lockless-reads",NULL,&g_pserver->lockless_reads,1,CONFIG_DEFAULT_LOCKLESS_READS},
+    {"db-lock-striping",NULL,&g_pserver->db_lock_striping,1,CONFIG_DEFAULT_DB_LOCK_STRIPING},
+    {"lock-profiling",NULL,&g_fLockProfiling,1,CONFIG_DEFAULT_LOCK_PROFILING},
+    {"client-rebalance",NULL,&g_pserver->client_rebalance,1,CONFIG_DEFAULT_CLIENT_REBALANCE},
     {NULL, NULL, 0, 0}
 };
 
@@ -380,6 +422,12 @@ void loadServerConfigFromString(char *config) {
                 err = "Invalid maxmemory policy";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"lock-batch-size") && argc == 2) {
+            g_pserver->lock_batch_size = atoi(argv[1]);
+            if (g_pserver->lock_batch_size < 0) {
+                err = "lock-batch-size must be 0 or greater";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"maxmemory-samples") && argc == 2) {
             g_pserver->maxmemory_samples = atoi(argv[1]);
             if (g_pserver->maxmemory_samples <= 0) {
@@ -555,10 +603,12 @@ void loadServerConfigFromString(char *config) {
                 err = "active-defrag-max-scan-fields must be positive";
                 goto loaderr;
             }
-        } else if (!strcasecmp(argv[0],"hash-max-ziplist-entries") && argc == 2) {
-            g_pserver->hash_max_ziplist_entries = memtoll(argv[1], NULL);
-        } else if (!strcasecmp(argv[0],"hash-max-ziplist-value") && argc == 2) {
-            g_pserver->hash_max_ziplist_value = memtoll(argv[1], NULL);
+        } else if ((!strcasecmp(argv[0],"hash-max-listpack-entries") ||
+                    !strcasecmp(argv[0],"hash-max-ziplist-entries")) && argc == 2) {
+            g_pserver->hash_max_listpack_entries = memtoll(argv[1], NULL);
+        } else if ((!strcasecmp(argv[0],"hash-max-listpack-value") ||
+                    !strcasecmp(argv[0],"hash-max-ziplist-value")) && argc == 2) {
+            g_pserver->hash_max_listpack_value = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"stream-node-max-bytes") && argc == 2) {
             g_pserver->stream_node_max_bytes = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"stream-node-max-entries") && argc == 2) {
@@ -571,12 +621,56 @@ void loadServerConfigFromString(char *config) {
             g_pserver->list_max_ziplist_size = atoi(argv[1]);
         } else if (!strcasecmp(argv[0],"list-compress-depth") && argc == 2) {
             g_pserver->list_compress_depth = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0],"list-compress-codec") && argc == 2) {
+            quicklistCompressCodec =
+                configEnumGetValue(list_compress_codec_enum,argv[1]);
+            if (quicklistCompressCodec == INT_MIN) {
+                err = "Invalid or unsupported codec for 'list-compress-codec'. "
+                    "lz4 and zstd are available only when built with "
+                    "USE_LZ4=yes and USE_ZSTD=yes respectively";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-compression-codec") && argc == 2) {
+            g_pserver->rdb_compression_codec =
+                configEnumGetValue(rdb_compression_codec_enum,argv[1]);
+            if (g_pserver->rdb_compression_codec == INT_MIN) {
+                err = "Invalid or unsupported codec for 'rdb-compression-codec'. "
+                    "lz4 and zstd are available only when built with "
+                    "USE_LZ4=yes and USE_ZSTD=yes respectively";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"list-compress-zstd-dict") && argc == 2) {
+            FILE *fp = fopen(argv[1],"r");
+            if (fp == NULL) {
+                err = sdscatprintf(sdsempty(),
+                    "Can't open the zstd dictionary '%s': %s",
+                    argv[1], strerror(errno));
+                goto loaderr;
+            }
+            sds dictbuf = sdsempty();
+            char buf[16384];
+            size_t nread;
+            while ((nread = fread(buf,1,sizeof(buf),fp)) > 0)
+                dictbuf = sdscatlen(dictbuf,buf,nread);
+            fclose(fp);
+            int ret = quicklistSetZstdDictionary(dictbuf,sdslen(dictbuf));
+            sdsfree(dictbuf);
+            if (ret == -1) {
+                err = "Can't use the zstd dictionary: the server must be "
+                    "built with USE_ZSTD=yes and the file created with "
+                    "zstd --train";
+                goto loaderr;
+            }
+            zfree(cserver.list_compress_zstd_dict);
+            cserver.list_compress_zstd_dict = zstrdup(argv[1]);
         } else if (!strcasecmp(argv[0],"set-max-intset-entries") && argc == 2) {
             g_pserver->set_max_intset_entries = memtoll(argv[1], NULL);
-        } else if (!strcasecmp(argv[0],"zset-max-ziplist-entries") && argc == 2) {
-            g_pserver->zset_max_ziplist_entries = memtoll(argv[1], NULL);
-        } else if (!strcasecmp(argv[0],"zset-max-ziplist-value") && argc == 2) {
-            g_pserver->zset_max_ziplist_value = memtoll(argv[1], NULL);
+        } else if ((!strcasecmp(argv[0],"zset-max-listpack-entries") ||
+                    !strcasecmp(argv[0],"zset-max-ziplist-entries")) && argc == 2) {
+            g_pserver->zset_max_listpack_entries = memtoll(argv[1], NULL);
+        } else if ((!strcasecmp(argv[0],"zset-max-listpack-value") ||
+                    !strcasecmp(argv[0],"zset-max-ziplist-value")) && argc == 2) {
+            g_pserver->zset_max_listpack_value = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"hll-sparse-max-bytes") && argc == 2) {
             g_pserver->hll_sparse_max_bytes = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0],"rename-command") && argc == 3) {
@@ -651,6 +745,22 @@ void loadServerConfigFromString(char *config) {
                 err = "cluster replica validity factor must be zero or positive";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"rdb-load-threads") && argc == 2) {
+            g_pserver->rdb_load_threads = atoi(argv[1]);
+            if (g_pserver->rdb_load_threads < 0 ||
+                g_pserver->rdb_load_threads > CONFIG_RDB_LOAD_THREADS_MAX)
+            {
+                err = "rdb-load-threads must be between 0 and 256";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-save-threads") && argc == 2) {
+            g_pserver->rdb_save_threads = atoi(argv[1]);
+            if (g_pserver->rdb_save_threads < 0 ||
+                g_pserver->rdb_save_threads > CONFIG_RDB_SAVE_THREADS_MAX)
+            {
+                err = "rdb-save-threads must be between 0 and 64";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"lua-time-limit") && argc == 2) {
             g_pserver->lua_time_limit = strtoll(argv[1],NULL,10);
         } else if (!strcasecmp(argv[0],"lua-replicate-commands") && argc == 2) {
@@ -785,6 +895,15 @@ void loadServerConfigFromString(char *config) {
                 err = "Unknown argument: server-thread-affinity expects either true or false";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"server-thread-steering") && argc == 2) {
+            cserver.thread_steering =
+                configEnumGetValue(thread_steering_enum,argv[1]);
+
+            if (cserver.thread_steering == INT_MIN) {
+                err = "Invalid option for 'server-thread-steering'. "
+                    "Allowed values: 'none', 'incoming-cpu', or 'bpf'";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0], "active-replica") && argc == 2) {
             g_pserver->fActiveReplica = yesnotoi(argv[1]);
             if (g_pserver->repl_slave_ro) {
@@ -881,6 +1000,14 @@ void loadServerConfig(char *filename, char *options) {
         if (max != LLONG_MAX && ll > max) goto badfmt; \
         _var = ll;
 
+#define config_set_numerical_field_with_alias(_name1,_name2,_var,min,max) \
+    } else if (!strcasecmp(szFromObj(c->argv[2]),_name1) || \
+               !strcasecmp(szFromObj(c->argv[2]),_name2)) { \
+        if (getLongLongFromObject(o,&ll) == C_ERR) goto badfmt; \
+        if (min != LLONG_MIN && ll < min) goto badfmt; \
+        if (max != LLONG_MAX && ll > max) goto badfmt; \
+        _var = ll;
+
 #define config_set_memory_field(_name,_var) \
     } else if (!strcasecmp(szFromObj(c->argv[2]),_name)) { \
         ll = memtoll(szFromObj(o),&err); \
@@ -1108,6 +1235,8 @@ void configSetCommand(client *c) {
      * config_set_numerical_field(name,var,min,max) */
     } config_set_numerical_field(
       "tcp-keepalive",cserver.tcpkeepalive,0,INT_MAX) {
+    } config_set_numerical_field(
+      "lock-batch-size",g_pserver->lock_batch_size,0,INT_MAX) {
     } config_set_numerical_field(
       "maxmemory-samples",g_pserver->maxmemory_samples,1,INT_MAX) {
     } config_set_numerical_field(
@@ -1130,10 +1259,12 @@ void configSetCommand(client *c) {
       "active-defrag-max-scan-fields",cserver.active_defrag_max_scan_fields,1,LONG_MAX) {
     } config_set_numerical_field(
       "auto-aof-rewrite-percentage",g_pserver->aof_rewrite_perc,0,INT_MAX){
-    } config_set_numerical_field(
-      "hash-max-ziplist-entries",g_pserver->hash_max_ziplist_entries,0,LONG_MAX) {
-    } config_set_numerical_field(
-      "hash-max-ziplist-value",g_pserver->hash_max_ziplist_value,0,LONG_MAX) {
+    } config_set_numerical_field_with_alias(
+      "hash-max-listpack-entries","hash-max-ziplist-entries",
+      g_pserver->hash_max_listpack_entries,0,LONG_MAX) {
+    } config_set_numerical_field_with_alias(
+      "hash-max-listpack-value","hash-max-ziplist-value",
+      g_pserver->hash_max_listpack_value,0,LONG_MAX) {
     } config_set_numerical_field(
       "stream-node-max-bytes",g_pserver->stream_node_max_bytes,0,LONG_MAX) {
     } config_set_numerical_field(
@@ -1144,12 +1275,18 @@ void configSetCommand(client *c) {
       "list-compress-depth",g_pserver->list_compress_depth,0,INT_MAX) {
     } config_set_numerical_field(
       "set-max-intset-entries",g_pserver->set_max_intset_entries,0,LONG_MAX) {
+    } config_set_numerical_field_with_alias(
+      "zset-max-listpack-entries","zset-max-ziplist-entries",
+      g_pserver->zset_max_listpack_entries,0,LONG_MAX) {
+    } config_set_numerical_field_with_alias(
+      "zset-max-listpack-value","zset-max-ziplist-value",
+      g_pserver->zset_max_listpack_value,0,LONG_MAX) {
     } config_set_numerical_field(
-      "zset-max-ziplist-entries",g_pserver->zset_max_ziplist_entries,0,LONG_MAX) {
+      "hll-sparse-max-bytes",g_pserver->hll_sparse_max_bytes,0,LONG_MAX) {
     } config_set_numerical_field(
-      "zset-max-ziplist-value",g_pserver->zset_max_ziplist_value,0,LONG_MAX) {
+      "rdb-load-threads",g_pserver->rdb_load_threads,0,CONFIG_RDB_LOAD_THREADS_MAX) {
     } config_set_numerical_field(
-      "hll-sparse-max-bytes",g_pserver->hll_sparse_max_bytes,0,LONG_MAX) {
+      "rdb-save-threads",g_pserver->rdb_save_threads,0,CONFIG_RDB_SAVE_THREADS_MAX) {
     } config_set_numerical_field(
       "lua-time-limit",g_pserver->lua_time_limit,0,LONG_MAX) {
     } config_set_numerical_field(
@@ -1241,6 +1378,10 @@ void configSetCommand(client *c) {
       "maxmemory-policy",g_pserver->maxmemory_policy,maxmemory_policy_enum) {
     } config_set_enum_field(
       "appendfsync",g_pserver->aof_fsync,aof_fsync_enum) {
+    } config_set_enum_field(
+      "list-compress-codec",quicklistCompressCodec,list_compress_codec_enum) {
+    } config_set_enum_field(
+      "rdb-compression-codec",g_pserver->rdb_compression_codec,rdb_compression_codec_enum) {
 
     /* Everyhing else is an error... */
     } config_set_else {
@@ -1313,6 +1454,7 @@ void configGetCommand(client *c) {
     config_get_string_field("logfile",g_pserver->logfile);
     config_get_string_field("aclfile",g_pserver->acl_filename);
     config_get_string_field("pidfile",cserver.pidfile);
+    config_get_string_field("list-compress-zstd-dict",cserver.list_compress_zstd_dict);
     config_get_string_field("slave-announce-ip",g_pserver->slave_announce_ip);
     config_get_string_field("replica-announce-ip",g_pserver->slave_announce_ip);
     config_get_string_field("version-override",KEYDB_SET_VERSION);
@@ -1322,6 +1464,7 @@ void configGetCommand(client *c) {
     config_get_numerical_field("proto-max-bulk-len",g_pserver->proto_max_bulk_len);
     config_get_numerical_field("client-query-buffer-limit",cserver.client_max_querybuf_len);
     config_get_numerical_field("maxmemory-samples",g_pserver->maxmemory_samples);
+    config_get_numerical_field("lock-batch-size",g_pserver->lock_batch_size);
     config_get_numerical_field("lfu-log-factor",g_pserver->lfu_log_factor);
     config_get_numerical_field("lfu-decay-time",g_pserver->lfu_decay_time);
     config_get_numerical_field("timeout",cserver.maxidletime);
@@ -1335,10 +1478,14 @@ void configGetCommand(client *c) {
             g_pserver->aof_rewrite_perc);
     config_get_numerical_field("auto-aof-rewrite-min-size",
             g_pserver->aof_rewrite_min_size);
+    config_get_numerical_field("hash-max-listpack-entries",
+            g_pserver->hash_max_listpack_entries);
     config_get_numerical_field("hash-max-ziplist-entries",
-            g_pserver->hash_max_ziplist_entries);
+            g_pserver->hash_max_listpack_entries);
+    config_get_numerical_field("hash-max-listpack-value",
+            g_pserver->hash_max_listpack_value);
     config_get_numerical_field("hash-max-ziplist-value",
-            g_pserver->hash_max_ziplist_value);
+            g_pserver->hash_max_listpack_value);
     config_get_numerical_field("stream-node-max-bytes",
             g_pserver->stream_node_max_bytes);
     config_get_numerical_field("stream-node-max-entries",
@@ -1349,12 +1496,18 @@ void configGetCommand(client *c) {
             g_pserver->list_compress_depth);
     config_get_numerical_field("set-max-intset-entries",
             g_pserver->set_max_intset_entries);
+    config_get_numerical_field("zset-max-listpack-entries",
+            g_pserver->zset_max_listpack_entries);
     config_get_numerical_field("zset-max-ziplist-entries",
-            g_pserver->zset_max_ziplist_entries);
+            g_pserver->zset_max_listpack_entries);
+    config_get_numerical_field("zset-max-listpack-value",
+            g_pserver->zset_max_listpack_value);
     config_get_numerical_field("zset-max-ziplist-value",
-            g_pserver->zset_max_ziplist_value);
+            g_pserver->zset_max_listpack_value);
     config_get_numerical_field("hll-sparse-max-bytes",
             g_pserver->hll_sparse_max_bytes);
+    config_get_numerical_field("rdb-load-threads",g_pserver->rdb_load_threads);
+    config_get_numerical_field("rdb-save-threads",g_pserver->rdb_save_threads);
     config_get_numerical_field("lua-time-limit",g_pserver->lua_time_limit);
     config_get_numerical_field("slowlog-log-slower-than",
             g_pserver->slowlog_log_slower_than);
@@ -1410,8 +1563,14 @@ void configGetCommand(client *c) {
             cserver.supervised_mode,supervised_mode_enum);
     config_get_enum_field("appendfsync",
             g_pserver->aof_fsync,aof_fsync_enum);
+    config_get_enum_field("list-compress-codec",
+            quicklistCompressCodec,list_compress_codec_enum);
+    config_get_enum_field("rdb-compression-codec",
+            g_pserver->rdb_compression_codec,rdb_compression_codec_enum);
     config_get_enum_field("syslog-facility",
             g_pserver->syslog_facility,syslog_facility_enum);
+    config_get_enum_field("server-thread-steering",
+            cserver.thread_steering,thread_steering_enum);
 
     /* Everything we can't handle with macros follows. */
 
@@ -1668,6 +1827,17 @@ struct rewriteConfigState *rewriteConfigReadOldFile(char *path) {
             sdsfree(argv[0]);
             argv[0] = alt;
         }
+        /* Same for the old "ziplist" names of the hash and sorted set
+         * encoding thresholds, that are now called "listpack". */
+        if (!strncmp(argv[0],"hash-max-ziplist-",17) ||
+            !strncmp(argv[0],"zset-max-ziplist-",17))
+        {
+            sds alt = sdsnewlen(argv[0],9);
+            alt = sdscat(alt,"listpack");
+            alt = sdscat(alt,argv[0]+16);
+            sdsfree(argv[0]);
+            argv[0] = alt;
+        }
         rewriteConfigAddLineNumberToOption(state,argv[0],linenum);
         sdsfreesplitres(argv,argc);
     }
@@ -2181,6 +2351,7 @@ int rewriteConfig(char *path) {
     rewriteConfigBytesOption(state,"client-query-buffer-limit",cserver.client_max_querybuf_len,PROTO_MAX_QUERYBUF_LEN);
     rewriteConfigEnumOption(state,"maxmemory-policy",g_pserver->maxmemory_policy,maxmemory_policy_enum,CONFIG_DEFAULT_MAXMEMORY_POLICY);
     rewriteConfigNumericalOption(state,"maxmemory-samples",g_pserver->maxmemory_samples,CONFIG_DEFAULT_MAXMEMORY_SAMPLES);
+    rewriteConfigNumericalOption(state,"lock-batch-size",g_pserver->lock_batch_size,CONFIG_DEFAULT_LOCK_BATCH_SIZE);
     rewriteConfigNumericalOption(state,"lfu-log-factor",g_pserver->lfu_log_factor,CONFIG_DEFAULT_LFU_LOG_FACTOR);
     rewriteConfigNumericalOption(state,"lfu-decay-time",g_pserver->lfu_decay_time,CONFIG_DEFAULT_LFU_DECAY_TIME);
     rewriteConfigNumericalOption(state,"active-defrag-threshold-lower",cserver.active_defrag_threshold_lower,CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER);
@@ -2194,6 +2365,8 @@ int rewriteConfig(char *path) {
     rewriteConfigEnumOption(state,"appendfsync",g_pserver->aof_fsync,aof_fsync_enum,CONFIG_DEFAULT_AOF_FSYNC);
     rewriteConfigNumericalOption(state,"auto-aof-rewrite-percentage",g_pserver->aof_rewrite_perc,AOF_REWRITE_PERC);
     rewriteConfigBytesOption(state,"auto-aof-rewrite-min-size",g_pserver->aof_rewrite_min_size,AOF_REWRITE_MIN_SIZE);
+    rewriteConfigNumericalOption(state,"rdb-load-threads",g_pserver->rdb_load_threads,CONFIG_DEFAULT_RDB_LOAD_THREADS);
+    rewriteConfigNumericalOption(state,"rdb-save-threads",g_pserver->rdb_save_threads,CONFIG_DEFAULT_RDB_SAVE_THREADS);
     rewriteConfigNumericalOption(state,"lua-time-limit",g_pserver->lua_time_limit,LUA_SCRIPT_TIME_LIMIT);
     rewriteConfigYesNoOption(state,"cluster-enabled",g_pserver->cluster_enabled,0);
     rewriteConfigStringOption(state,"cluster-config-file",g_pserver->cluster_configfile,CONFIG_DEFAULT_CLUSTER_CONFIG_FILE);
@@ -2204,20 +2377,24 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"latency-monitor-threshold",g_pserver->latency_monitor_threshold,CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD);
     rewriteConfigNumericalOption(state,"slowlog-max-len",g_pserver->slowlog_max_len,CONFIG_DEFAULT_SLOWLOG_MAX_LEN);
     rewriteConfigNotifykeyspaceeventsOption(state);
-    rewriteConfigNumericalOption(state,"hash-max-ziplist-entries",g_pserver->hash_max_ziplist_entries,OBJ_HASH_MAX_ZIPLIST_ENTRIES);
-    rewriteConfigNumericalOption(state,"hash-max-ziplist-value",g_pserver->hash_max_ziplist_value,OBJ_HASH_MAX_ZIPLIST_VALUE);
+    rewriteConfigNumericalOption(state,"hash-max-listpack-entries",g_pserver->hash_max_listpack_entries,OBJ_HASH_MAX_LISTPACK_ENTRIES);
+    rewriteConfigNumericalOption(state,"hash-max-listpack-value",g_pserver->hash_max_listpack_value,OBJ_HASH_MAX_LISTPACK_VALUE);
     rewriteConfigNumericalOption(state,"stream-node-max-bytes",g_pserver->stream_node_max_bytes,OBJ_STREAM_NODE_MAX_BYTES);
     rewriteConfigNumericalOption(state,"stream-node-max-entries",g_pserver->stream_node_max_entries,OBJ_STREAM_NODE_MAX_ENTRIES);
     rewriteConfigNumericalOption(state,"list-max-ziplist-size",g_pserver->list_max_ziplist_size,OBJ_LIST_MAX_ZIPLIST_SIZE);
     rewriteConfigNumericalOption(state,"list-compress-depth",g_pserver->list_compress_depth,OBJ_LIST_COMPRESS_DEPTH);
+    rewriteConfigEnumOption(state,"list-compress-codec",quicklistCompressCodec,list_compress_codec_enum,CONFIG_DEFAULT_LIST_COMPRESS_CODEC);
+    rewriteConfigEnumOption(state,"rdb-compression-codec",g_pserver->rdb_compression_codec,rdb_compression_codec_enum,CONFIG_DEFAULT_RDB_COMPRESSION_CODEC);
+    rewriteConfigStringOption(state,"list-compress-zstd-dict",cserver.list_compress_zstd_dict,NULL);
     rewriteConfigNumericalOption(state,"set-max-intset-entries",g_pserver->set_max_intset_entries,OBJ_SET_MAX_INTSET_ENTRIES);
-    rewriteConfigNumericalOption(state,"zset-max-ziplist-entries",g_pserver->zset_max_ziplist_entries,OBJ_ZSET_MAX_ZIPLIST_ENTRIES);
-    rewriteConfigNumericalOption(state,"zset-max-ziplist-value",g_pserver->zset_max_ziplist_value,OBJ_ZSET_MAX_ZIPLIST_VALUE);
+    rewriteConfigNumericalOption(state,"zset-max-listpack-entries",g_pserver->zset_max_listpack_entries,OBJ_ZSET_MAX_LISTPACK_ENTRIES);
+    rewriteConfigNumericalOption(state,"zset-max-listpack-value",g_pserver->zset_max_listpack_value,OBJ_ZSET_MAX_LISTPACK_VALUE);
     rewriteConfigNumericalOption(state,"hll-sparse-max-bytes",g_pserver->hll_sparse_max_bytes,CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES);
     rewriteConfigYesNoOption(state,"activedefrag",cserver.active_defrag_enabled,CONFIG_DEFAULT_ACTIVE_DEFRAG);
     rewriteConfigClientoutputbufferlimitOption(state);
     rewriteConfigNumericalOption(state,"hz",g_pserver->config_hz,CONFIG_DEFAULT_HZ);
     rewriteConfigEnumOption(state,"supervised",cserver.supervised_mode,supervised_mode_enum,SUPERVISED_NONE);
+    rewriteConfigEnumOption(state,"server-thread-steering",cserver.thread_steering,thread_steering_enum,THREAD_STEERING_NONE);
     rewriteConfigYesNoOption(state,"active-replica",g_pserver->fActiveReplica,CONFIG_DEFAULT_ACTIVE_REPLICA);
     rewriteConfigStringOption(state, "version-override",KEYDB_SET_VERSION,KEYDB_REAL_VERSION);
 
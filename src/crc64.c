@@ -38,6 +38,14 @@
  * POSSIBILITY OF SUCH DAMAGE. */
 
 #include <stdint.h>
+#include <string.h>
+#include "config.h"
+#include "crc64.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define CRC64_HAVE_CLMUL 1
+#endif
 
 static const uint64_t crc64_tab[256] = {
     UINT64_C(0x0000000000000000), UINT64_C(0x7ad870c830358979),
@@ -170,7 +178,20 @@ static const uint64_t crc64_tab[256] = {
     UINT64_C(0x536fa08fdfd90e51), UINT64_C(0x29b7d047efec8728),
 };
 
-uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+/* The byte at a time loop above is the reference, the other implementations
+ * are all checked against it by crc64Init() before being used.
+ *
+ * Slicing-by-8 and slicing-by-16 xor 8 (or 16) bytes of input to the CRC at
+ * once and look each of them up in a table telling its effect after the
+ * remaining bytes of the word. With PCLMULQDQ, 64 bytes at a time are folded
+ * into four 128 bit lanes with carry-less multiplications by x^n mod P, the
+ * lanes are folded into one, and the tables reduce its 16 bytes to the CRC.
+ *
+ * crc64Init() builds the tables and picks the fastest implementation the CPU
+ * supports. Until it's called crc64() uses the byte at a time loop. */
+static uint64_t crc64_slice[16][256];
+
+static uint64_t crc64Bytewise(uint64_t crc, const unsigned char *s, uint64_t l) {
     uint64_t j;
 
     for (j = 0; j < l; j++) {
@@ -180,16 +201,234 @@ uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
     return crc;
 }
 
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+static inline uint64_t crc64Load(const unsigned char *s) {
+    uint64_t v;
+    memcpy(&v,s,sizeof(v));
+    return v;
+}
+
+static uint64_t crc64Slice8(uint64_t crc, const unsigned char *s, uint64_t l) {
+    for (; l >= 8; l -= 8, s += 8) {
+        crc ^= crc64Load(s);
+        crc = crc64_slice[7][crc & 0xff] ^
+              crc64_slice[6][(crc >> 8) & 0xff] ^
+              crc64_slice[5][(crc >> 16) & 0xff] ^
+              crc64_slice[4][(crc >> 24) & 0xff] ^
+              crc64_slice[3][(crc >> 32) & 0xff] ^
+              crc64_slice[2][(crc >> 40) & 0xff] ^
+              crc64_slice[1][(crc >> 48) & 0xff] ^
+              crc64_slice[0][crc >> 56];
+    }
+    return crc64Bytewise(crc,s,l);
+}
+
+static uint64_t crc64Slice16(uint64_t crc, const unsigned char *s, uint64_t l) {
+    for (; l >= 16; l -= 16, s += 16) {
+        uint64_t next = crc64Load(s+8);
+        crc ^= crc64Load(s);
+        crc = crc64_slice[15][crc & 0xff] ^
+              crc64_slice[14][(crc >> 8) & 0xff] ^
+              crc64_slice[13][(crc >> 16) & 0xff] ^
+              crc64_slice[12][(crc >> 24) & 0xff] ^
+              crc64_slice[11][(crc >> 32) & 0xff] ^
+              crc64_slice[10][(crc >> 40) & 0xff] ^
+              crc64_slice[9][(crc >> 48) & 0xff] ^
+              crc64_slice[8][crc >> 56] ^
+              crc64_slice[7][next & 0xff] ^
+              crc64_slice[6][(next >> 8) & 0xff] ^
+              crc64_slice[5][(next >> 16) & 0xff] ^
+              crc64_slice[4][(next >> 24) & 0xff] ^
+              crc64_slice[3][(next >> 32) & 0xff] ^
+              crc64_slice[2][(next >> 40) & 0xff] ^
+              crc64_slice[1][(next >> 48) & 0xff] ^
+              crc64_slice[0][next >> 56];
+    }
+    return crc64Slice8(crc,s,l);
+}
+#endif
+
+#ifdef CRC64_HAVE_CLMUL
+/* Folding constants, bit reflected like the CRC: a 128 bit lane is carried
+ * 'd' bits ahead multiplying its low half by x^(d+63) mod P and its high
+ * half by x^(d-1) mod P (one less than the distance, as the product of two
+ * reflected operands comes out shifted by one bit). */
+#define CRC64_FOLD(lo,hi) _mm_set_epi64x((long long)UINT64_C(hi),(long long)UINT64_C(lo))
+
+__attribute__((target("pclmul,sse4.1")))
+static inline __m128i crc64Fold(__m128i x, __m128i k) {
+    return _mm_xor_si128(_mm_clmulepi64_si128(x,k,0x00),
+                         _mm_clmulepi64_si128(x,k,0x11));
+}
+
+__attribute__((target("pclmul,sse4.1")))
+static uint64_t crc64Clmul(uint64_t crc, const unsigned char *s, uint64_t l) {
+    const __m128i k512 = CRC64_FOLD(0xaf86efb16d9ab4fb,0xf49784a634f014e4);
+    const __m128i k384 = CRC64_FOLD(0xa062b2319d66692f,0x7b3211a760160db8);
+    const __m128i k256 = CRC64_FOLD(0x6ba4d760ab38201e,0xef3d1d18ed889ed2);
+    const __m128i k128 = CRC64_FOLD(0xd9d7be7d505da32c,0x381d0015c96f4444);
+    unsigned char lane[16];
+    __m128i x0, x1, x2, x3;
+
+    if (l < 128) return crc64Slice16(crc,s,l);
+
+    x0 = _mm_loadu_si128((const __m128i*)s);
+    x1 = _mm_loadu_si128((const __m128i*)(s+16));
+    x2 = _mm_loadu_si128((const __m128i*)(s+32));
+    x3 = _mm_loadu_si128((const __m128i*)(s+48));
+    x0 = _mm_xor_si128(x0,_mm_cvtsi64_si128((long long)crc));
+    s += 64; l -= 64;
+
+    for (; l >= 64; l -= 64, s += 64) {
+        x0 = _mm_xor_si128(crc64Fold(x0,k512),_mm_loadu_si128((const __m128i*)s));
+        x1 = _mm_xor_si128(crc64Fold(x1,k512),_mm_loadu_si128((const __m128i*)(s+16)));
+        x2 = _mm_xor_si128(crc64Fold(x2,k512),_mm_loadu_si128((const __m128i*)(s+32)));
+        x3 = _mm_xor_si128(crc64Fold(x3,k512),_mm_loadu_si128((const __m128i*)(s+48)));
+    }
+
+    x0 = _mm_xor_si128(crc64Fold(x0,k384),crc64Fold(x1,k256));
+    x0 = _mm_xor_si128(x0,_mm_xor_si128(crc64Fold(x2,k128),x3));
+    for (; l >= 16; l -= 16, s += 16)
+        x0 = _mm_xor_si128(crc64Fold(x0,k128),_mm_loadu_si128((const __m128i*)s));
+
+    /* The CRC of the lane's bytes is the one of all the input folded in it */
+    _mm_storeu_si128((__m128i*)lane,x0);
+    crc = crc64Slice16(0,lane,sizeof(lane));
+    return crc64Slice16(crc,s,l);
+}
+#endif
+
+typedef uint64_t crc64Fn(uint64_t crc, const unsigned char *s, uint64_t l);
+
+static const struct crc64Impl {
+    const char *name;
+    crc64Fn *fn;
+} crc64_impls[] = {
+#ifdef CRC64_HAVE_CLMUL
+    {"pclmulqdq", crc64Clmul},
+#endif
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    {"slicing-by-16", crc64Slice16},
+    {"slicing-by-8", crc64Slice8},
+#endif
+    {"bytewise", crc64Bytewise},
+};
+#define CRC64_IMPLS (sizeof(crc64_impls)/sizeof(crc64_impls[0]))
+
+static crc64Fn *crc64_fn = crc64Bytewise;
+static const char *crc64_name = "bytewise";
+
+static int crc64Supported(const struct crc64Impl *impl) {
+#ifdef CRC64_HAVE_CLMUL
+    if (impl->fn == crc64Clmul)
+        return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+    (void)impl;
+    return 1;
+}
+
+/* Check 'fn' against the byte at a time loop on every length up to a few
+ * folding rounds, at every alignment of the input. */
+static int crc64SelfTest(crc64Fn *fn) {
+    unsigned char buf[320+8];
+    uint64_t seed = UINT64_C(0x9e3779b97f4a7c15);
+
+    for (size_t j = 0; j < sizeof(buf); j++) {
+        seed = seed*UINT64_C(6364136223846793005)+1;
+        buf[j] = seed >> 56;
+    }
+    if (fn(0,(const unsigned char*)"123456789",9) != UINT64_C(0xe9c6d914c4b8d9ca))
+        return 0;
+    for (size_t off = 0; off < 8; off++) {
+        for (size_t len = 0; len + off <= sizeof(buf); len++) {
+            if (fn(seed,buf+off,len) != crc64Bytewise(seed,buf+off,len))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* Build the slicing tables and switch crc64() to the fastest implementation
+ * supported by the CPU that passes the self test. Has to be called before
+ * other threads are started. */
+void crc64Init(void) {
+    for (int n = 0; n < 256; n++) {
+        crc64_slice[0][n] = crc64_tab[n];
+        for (int k = 1; k < 16; k++) {
+            uint64_t c = crc64_slice[k-1][n];
+            crc64_slice[k][n] = crc64_tab[c & 0xff] ^ (c >> 8);
+        }
+    }
+    for (size_t j = 0; j < CRC64_IMPLS; j++) {
+        if (crc64Supported(&crc64_impls[j]) && crc64SelfTest(crc64_impls[j].fn)) {
+            crc64_fn = crc64_impls[j].fn;
+            crc64_name = crc64_impls[j].name;
+            break;
+        }
+    }
+}
+
+/* Name of the implementation used by crc64(). */
+const char *crc64Implementation(void) {
+    return crc64_name;
+}
+
+uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l) {
+    return crc64_fn(crc,s,l);
+}
+
 /* Test main */
 #ifdef REDIS_TEST
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
 
 #define UNUSED(x) (void)(x)
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
 int crc64Test(int argc, char *argv[]) {
     UNUSED(argc);
     UNUSED(argv);
+    size_t bufsize = 64*1024*1024;
+    unsigned char *buf;
+    int failed = 0;
+
+    crc64Init();
     printf("e9c6d914c4b8d9ca == %016llx\n",
         (unsigned long long) crc64(0,(unsigned char*)"123456789",9));
-    return 0;
+    printf("Using %s\n", crc64Implementation());
+
+    if ((buf = malloc(bufsize)) == NULL) return 1;
+    for (size_t j = 0; j < bufsize; j++) buf[j] = rand();
+    uint64_t expected = crc64Bytewise(0,buf,bufsize);
+    for (size_t j = 0; j < CRC64_IMPLS; j++) {
+        const struct crc64Impl *impl = &crc64_impls[j];
+        if (!crc64Supported(impl)) {
+            printf("%s: not supported by this CPU\n", impl->name);
+            continue;
+        }
+        int ok = crc64SelfTest(impl->fn) && impl->fn(0,buf,bufsize) == expected;
+        failed |= !ok;
+
+        /* Buffers the size of a typical RDB write, and very large ones */
+        long long start = usec();
+        for (size_t off = 0; off < bufsize; off += 4096)
+            impl->fn(0,buf+off,4096);
+        long long small = usec()-start;
+        start = usec();
+        impl->fn(0,buf,bufsize);
+        long long large = usec()-start;
+        printf("%s: %s, 4KB writes %.0f MB/s, 64MB %.0f MB/s\n",
+            impl->name, ok ? "OK" : "FAILED",
+            (double)bufsize/(small ? small : 1),
+            (double)bufsize/(large ? large : 1));
+    }
+    free(buf);
+    return failed;
 }
 #endif
@@ -7,6 +7,8 @@
 extern "C" {
 #endif
 
+void crc64Init(void);
+const char *crc64Implementation(void);
 uint64_t crc64(uint64_t crc, const unsigned char *s, uint64_t l);
 
 #ifdef REDIS_TEST
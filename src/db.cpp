@@ -34,6 +34,7 @@
 
 #include <signal.h>
 #include <ctype.h>
+#include <mutex>
 
 /*-----------------------------------------------------------------------------
  * C-level DB API
@@ -73,6 +74,16 @@ static robj *lookupKey(redisDb *db, robj *key, int flags) {
     dictEntry *de = dictFind(db->pdict,ptrFromObj(key));
     if (de) {
         robj *val = (robj*)dictGetVal(de);
+        if (flags & LOOKUP_UPDATEMVCC)
+            dbBeforeWrite(db, (sds)dictGetKey(de));
+
+        if (FInlineVal(val)) {
+            /* Readers get a temporary copy of an inlined value, writers may
+             * modify the value in place so it must become a real object. */
+            if (!(flags & LOOKUP_MATERIALIZE))
+                return dbEntryValue(de);
+            val = dbMaterializeValue(db, de);
+        }
 
         /* Update the access time for the ageing algorithm.
          * Don't do it if we have a saving child, as this will trigger
@@ -121,14 +132,14 @@ static robj *lookupKey(redisDb *db, robj *key, int flags) {
  * expiring our key via DELs in the replication link. */
 robj_roptr lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
     robj *val;
-    serverAssert(GlobalLocksAcquired());
+    serverAssert(CommandLocksAcquired() || aeThreadInReadSection());
 
     if (expireIfNeeded(db,key) == 1) {
         /* Key expired. If we are in the context of a master, expireIfNeeded()
          * returns 0 only when the key does not exist at all, so it's safe
          * to return NULL ASAP. */
         if (listLength(g_pserver->masters) == 0) {
-            g_pserver->stat_keyspace_misses++;
+            atomicIncr(g_pserver->stat_keyspace_misses, 1);
             notifyKeyspaceEvent(NOTIFY_KEY_MISS, "keymiss", key, db->id);
             return NULL;
         }
@@ -150,18 +161,18 @@ robj_roptr lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
             serverTL->current_client->cmd &&
             serverTL->current_client->cmd->flags & CMD_READONLY)
         {
-            g_pserver->stat_keyspace_misses++;
+            atomicIncr(g_pserver->stat_keyspace_misses, 1);
             notifyKeyspaceEvent(NOTIFY_KEY_MISS, "keymiss", key, db->id);
             return NULL;
         }
     }
     val = lookupKey(db,key,flags);
     if (val == NULL) {
-        g_pserver->stat_keyspace_misses++;
+        atomicIncr(g_pserver->stat_keyspace_misses, 1);
         notifyKeyspaceEvent(NOTIFY_KEY_MISS, "keymiss", key, db->id);
     }
     else
-        g_pserver->stat_keyspace_hits++;
+        atomicIncr(g_pserver->stat_keyspace_hits, 1);
     return val;
 }
 
@@ -177,7 +188,7 @@ robj_roptr lookupKeyRead(redisDb *db, robj *key) {
  * Returns the linked value object if the key exists or NULL if the key
  * does not exist in the specified DB. */
 robj *lookupKeyWrite(redisDb *db, robj *key) {
-    robj *o = lookupKey(db,key,LOOKUP_UPDATEMVCC);
+    robj *o = lookupKey(db,key,LOOKUP_UPDATEMVCC|LOOKUP_MATERIALIZE);
     if (expireIfNeeded(db,key))
         o = NULL;
     return o;
@@ -195,20 +206,58 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply) {
     return o;
 }
 
+/* Returns the value of a keyspace entry.  A value inlined in the entry is
+ * returned as a temporary object, valid until the end of the command. */
+robj *dbEntryValue(dictEntry *de) {
+    robj *val = (robj*)dictGetVal(de);
+    if (FInlineVal(val)) {
+        val = createObjectFromInline(val);
+        autoreleaseObject(val);
+    }
+    return val;
+}
+
+/* Replace a value inlined in a keyspace entry by a real object, for callers
+ * that modify the value in place or set an expire on the key. */
+robj *dbMaterializeValue(redisDb *db, dictEntry *de) {
+    robj *val = (robj*)dictGetVal(de);
+    if (FInlineVal(val)) {
+        val = createObjectFromInline(val);
+        if (val->getrefcount(std::memory_order_relaxed) == OBJ_SHARED_REFCOUNT)
+            val = dupStringObject(val);
+        dictSetVal(db->pdict, de, val);
+    }
+    return val;
+}
+
+/* The value to store in a keyspace entry for 'val', that is 'val' itself or
+ * its inlined form.  Once inlined the reference the keyspace took must be
+ * released, but only at the end of the command as the caller may still be
+ * using the object. */
+static void *dbStoredValue(robj *val) {
+    return objectCanInline(val) ? objectToInline(val) : val;
+}
+
 int dbAddCore(redisDb *db, robj *key, robj *val) {
     serverAssert(!val->FExpires());
-    sds copy = sdsdup(szFromObj(key));
-    int retval = dictAdd(db->pdict, copy, val);
+    dbBeforeWrite(db, szFromObj(key));
+    /* Dicts embedding their keys copy them into the entry themselves */
+    bool fEmbedded = dictEmbedsKeys(db->pdict);
+    sds copy = fEmbedded ? szFromObj(key) : sdsdup(szFromObj(key));
+    void *stored = dbStoredValue(val);
+    int retval = dictAdd(db->pdict, copy, stored);
     val->mvcc_tstamp = key->mvcc_tstamp = getMvccTstamp();
 
     if (retval == DICT_OK)
     {
+        if (stored != val)
+            autoreleaseObject(val);
         if (val->type == OBJ_LIST ||
             val->type == OBJ_ZSET)
             signalKeyAsReady(db, key);
         if (g_pserver->cluster_enabled) slotToKeyAdd(key);
     }
-    else
+    else if (!fEmbedded)
     {
         sdsfree(copy);
     }
@@ -228,10 +277,13 @@ void dbAdd(redisDb *db, robj *key, robj *val)
 
 void dbOverwriteCore(redisDb *db, dictEntry *de, robj *key, robj *val, bool fUpdateMvcc, bool fRemoveExpire)
 {
+    dbBeforeWrite(db, (sds)dictGetKey(de));
+
     dictEntry auxentry = *de;
     robj *old = (robj*)dictGetVal(de);
+    bool fOldInline = FInlineVal(old);
 
-    if (old->FExpires()) {
+    if (!fOldInline && old->FExpires()) {
         if (fRemoveExpire) {
             removeExpire(db, key);
         }
@@ -242,7 +294,7 @@ void dbOverwriteCore(redisDb *db, dictEntry *de, robj *key, robj *val, bool fUpd
         }
     }
 
-    if (g_pserver->maxmemory_policy & MAXMEMORY_FLAG_LFU) {
+    if (!fOldInline && (g_pserver->maxmemory_policy & MAXMEMORY_FLAG_LFU)) {
         val->lru = old->lru;
     }
     if (fUpdateMvcc) {
@@ -251,9 +303,12 @@ void dbOverwriteCore(redisDb *db, dictEntry *de, robj *key, robj *val, bool fUpd
         val->mvcc_tstamp = getMvccTstamp();
     }
 
-    dictSetVal(db->pdict, de, val);
+    void *stored = dbStoredValue(val);
+    dictSetVal(db->pdict, de, stored);
+    if (stored != val)
+        autoreleaseObject(val);
 
-    if (g_pserver->lazyfree_lazy_server_del) {
+    if (g_pserver->lazyfree_lazy_server_del && !fOldInline) {
         freeObjAsync(old);
         dictSetVal(db->pdict, &auxentry, NULL);
     }
@@ -283,7 +338,8 @@ int dbMerge(redisDb *db, robj *key, robj *val, int fReplace)
             return (dbAddCore(db, key, val) == DICT_OK);
 
         robj *old = (robj*)dictGetVal(de);
-        if (old->mvcc_tstamp <= val->mvcc_tstamp)
+        uint64_t mvccOld = FInlineVal(old) ? OBJ_MVCC_INVALID : old->mvcc_tstamp;
+        if (mvccOld <= val->mvcc_tstamp)
         {
             dbOverwriteCore(db, de, key, val, false, true);
             return true;
@@ -339,7 +395,7 @@ robj *dbRandomKey(redisDb *db) {
         key = (sds)dictGetKey(de);
         keyobj = createStringObject(key,sdslen(key));
 
-        if (((robj*)dictGetVal(de))->FExpires())
+        if (FEntryExpires(de))
         {
             if (allvolatile && listLength(g_pserver->masters) && --maxtries == 0) {
                 /* If the DB is composed only of keys with an expire set,
@@ -354,7 +410,7 @@ robj *dbRandomKey(redisDb *db) {
             }
         }
             
-        if (((robj*)dictGetVal(de))->FExpires())
+        if (FEntryExpires(de))
         {
              if (expireIfNeeded(db,keyobj)) {
                 decrRefCount(keyobj);
@@ -371,8 +427,9 @@ int dbSyncDelete(redisDb *db, robj *key) {
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
 
+    dbBeforeWrite(db, szFromObj(key));
     dictEntry *de = dictFind(db->pdict, szFromObj(key));
-    if (de != nullptr && ((robj*)dictGetVal(de))->FExpires())
+    if (de != nullptr && FEntryExpires(de))
         removeExpireCore(db, key, de);
     if (dictDelete(db->pdict,ptrFromObj(key)) == DICT_OK) {
         if (g_pserver->cluster_enabled) slotToKeyDel(key);
@@ -449,6 +506,9 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
         errno = EINVAL;
         return -1;
     }
+    if (g_pserver->rdb_forkless_tracking)
+        rdbForklessSaveAbort("the dataset was flushed");
+    aeExcludeReaders();
 
     int startdb, enddb;
     if (dbnum == -1) {
@@ -467,6 +527,7 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
             delete g_pserver->db[j].setexpire;
             g_pserver->db[j].setexpire = new (MALLOC_LOCAL) expireset();
             g_pserver->db[j].expireitr = g_pserver->db[j].setexpire->end();
+            expireWheelReset(&g_pserver->db[j]);
         }
     }
     if (g_pserver->cluster_enabled) {
@@ -642,8 +703,10 @@ void keysCommand(client *c) {
     int plen = sdslen(pattern), allkeys;
     unsigned long numkeys = 0;
     void *replylen = addReplyDeferredLen(c);
+    bool fGlobalLock = !aeThreadInStripedSection(); // otherwise we only hold the DB lock already
 
-    aeReleaseLock();
+    if (fGlobalLock)
+        aeReleaseLock();
 
     di = dictGetSafeIterator(c->db->pdict);
     allkeys = (pattern[0] == '*' && pattern[1] == '\0');
@@ -663,11 +726,14 @@ void keysCommand(client *c) {
     dictReleaseIterator(di);
     setDeferredArrayLen(c,replylen,numkeys);
     
-    fastlock_unlock(&c->db->lock);  // we must release the DB lock before acquiring the AE lock to prevent deadlocks
-    AeLocker lock;
-    lock.arm(c);
-    fastlock_lock(&c->db->lock);    // we still need the DB lock
-    lock.release();
+    if (fGlobalLock)
+    {
+        fastlock_unlock(&c->db->lock);  // we must release the DB lock before acquiring the AE lock to prevent deadlocks
+        AeLocker lock;
+        lock.arm(c);
+        fastlock_lock(&c->db->lock);    // we still need the DB lock
+        lock.release();
+    }
 }
 
 /* This callback is used by scanGenericCommand in order to collect elements
@@ -692,7 +758,7 @@ void scanCallback(void *privdata, const dictEntry *de) {
     } else if (o->type == OBJ_ZSET) {
         sds sdskey = (sds)dictGetKey(de);
         key = createStringObject(sdskey,sdslen(sdskey));
-        val = createStringObjectFromLongDouble(*(double*)dictGetVal(de),0);
+        val = createStringObjectFromLongDouble(dictGetDoubleVal(de),0);
     } else {
         serverPanic("Type not handled in SCAN callback.");
     }
@@ -786,11 +852,13 @@ void scanGenericCommand(client *c, robj_roptr o, unsigned long cursor) {
 
     /* Step 2: Iterate the collection.
      *
-     * Note that if the object is encoded with a ziplist, intset, or any other
+     * Note that if the object is encoded with a listpack, intset, or any other
      * representation that is not a hash table, we are sure that it is also
      * composed of a small number of elements. So to avoid taking state we
      * just return everything inside the object in a single call, setting the
-     * cursor to zero to signal the end of the iteration. */
+     * cursor to zero to signal the end of the iteration. Roaring bitmaps are
+     * the exception: they can be huge, but they are ordered, so their cursor
+     * is simply derived from the next member to return. */
 
     /* Handle the case of a hash table. */
     ht = NULL;
@@ -801,7 +869,7 @@ void scanGenericCommand(client *c, robj_roptr o, unsigned long cursor) {
     } else if (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_HT) {
         ht = (dict*)ptrFromObj(o);
         count *= 2; /* We return key / value for this type. */
-    } else if (o->type == OBJ_ZSET && o->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (o->type == OBJ_ZSET && o->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)ptrFromObj(o);
         ht = zs->pdict;
         count *= 2; /* We return key / value for this type. */
@@ -825,6 +893,28 @@ void scanGenericCommand(client *c, robj_roptr o, unsigned long cursor) {
         } while (cursor &&
               maxiterations-- &&
               listLength(keys) < (unsigned long)count);
+    } else if (o->type == OBJ_SET && o->encoding == OBJ_ENCODING_ROARING) {
+        /* The cursor is the next member with its sign bit flipped, plus one
+         * so that zero still means "start" and "done". Members present for
+         * the whole iteration are returned exactly once, whatever happens to
+         * the set between calls. */
+        roaringIterator ri;
+        int64_t ll;
+
+        roaringIterInit(&ri,(roaring*)ptrFromObj(o));
+        if (cursor) roaringIterSeek(&ri,(int64_t)((uint64_t)(cursor-1) ^ (1ULL<<63)));
+        cursor = 0;
+        while (roaringIterNext(&ri,&ll)) {
+            uint64_t next = ((uint64_t)ll ^ (1ULL<<63)) + 1;
+
+            /* INT64_MAX has no representable cursor, but it is also the last
+             * possible member, so it can just be returned right away. */
+            if (listLength(keys) >= (unsigned long)count && next != 0) {
+                cursor = next;
+                break;
+            }
+            listAddNodeTail(keys,createStringObjectFromLongLong(ll));
+        }
     } else if (o->type == OBJ_SET) {
         int pos = 0;
         int64_t ll;
@@ -833,17 +923,17 @@ void scanGenericCommand(client *c, robj_roptr o, unsigned long cursor) {
             listAddNodeTail(keys,createStringObjectFromLongLong(ll));
         cursor = 0;
     } else if (o->type == OBJ_HASH || o->type == OBJ_ZSET) {
-        unsigned char *p = ziplistIndex((unsigned char*)ptrFromObj(o),0);
+        unsigned char *p = lpFirst((unsigned char*)ptrFromObj(o));
         unsigned char *vstr;
         unsigned int vlen;
         long long vll;
 
         while(p) {
-            ziplistGet(p,&vstr,&vlen,&vll);
+            vstr = lpGetValue(p,&vlen,&vll);
             listAddNodeTail(keys,
                 (vstr != NULL) ? createStringObject((char*)vstr,vlen) :
                                  createStringObjectFromLongLong(vll));
-            p = ziplistNext((unsigned char*)ptrFromObj(o),p);
+            p = lpNext((unsigned char*)ptrFromObj(o),p);
         }
         cursor = 0;
     } else {
@@ -1141,6 +1231,9 @@ int dbSwapDatabases(int id1, int id2) {
     if (id1 < 0 || id1 >= cserver.dbnum ||
         id2 < 0 || id2 >= cserver.dbnum) return C_ERR;
     if (id1 == id2) return C_OK;
+    if (g_pserver->rdb_forkless_tracking)
+        rdbForklessSaveAbort("databases were swapped");
+    aeExcludeReaders();
     redisDb aux; 
     memcpy(&aux, &g_pserver->db[id1], sizeof(redisDb));
     redisDb *db1 = &g_pserver->db[id1], *db2 = &g_pserver->db[id2];
@@ -1151,12 +1244,14 @@ int dbSwapDatabases(int id1, int id2) {
     db1->pdict = db2->pdict;
     db1->setexpire = db2->setexpire;
     db1->expireitr = db2->expireitr;
+    db1->wheelexpire = db2->wheelexpire;
     db1->avg_ttl = db2->avg_ttl;
     db1->last_expire_set = db2->last_expire_set;
 
     db2->pdict = aux.pdict;
     db2->setexpire = aux.setexpire;
     db2->expireitr = aux.expireitr;
+    db2->wheelexpire = aux.wheelexpire;
     db2->avg_ttl = aux.avg_ttl;
     db2->last_expire_set = aux.last_expire_set;
 
@@ -1215,9 +1310,10 @@ int removeExpireCore(redisDb *db, robj *key, dictEntry *de) {
      * main dict. Otherwise, the key will never be freed. */
     serverAssertWithInfo(NULL,key,de != NULL);
 
-    robj *val = (robj*)dictGetVal(de);
-    if (!val->FExpires())
+    if (!FEntryExpires(de))
         return 0;
+    dbBeforeWrite(db, (sds)dictGetKey(de));
+    robj *val = (robj*)dictGetVal(de);
 
     auto itr = db->setexpire->find((sds)dictGetKey(de));
     serverAssert(itr != db->setexpire->end());
@@ -1231,9 +1327,9 @@ int removeSubkeyExpire(redisDb *db, robj *key, robj *subkey) {
     dictEntry *de = dictFind(db->pdict,ptrFromObj(key));
     serverAssertWithInfo(NULL,key,de != NULL);
     
-    robj *val = (robj*)dictGetVal(de);
-    if (!val->FExpires())
+    if (!FEntryExpires(de))
         return 0;
+    dbBeforeWrite(db, (sds)dictGetKey(de));
     
     auto itr = db->setexpire->find((sds)dictGetKey(de));
     serverAssert(itr != db->setexpire->end());
@@ -1256,6 +1352,8 @@ int removeSubkeyExpire(redisDb *db, robj *key, robj *subkey) {
 
     if (itr->pfatentry()->size() == 0)
         removeExpireCore(db, key, de);
+    else if (found)
+        expireWheelTrack(db, itr->key(), itr->when());
 
     return found;
 }
@@ -1267,13 +1365,14 @@ int removeSubkeyExpire(redisDb *db, robj *key, robj *subkey) {
 void setExpire(client *c, redisDb *db, robj *key, robj *subkey, long long when) {
     dictEntry *kde;
 
-    serverAssert(GlobalLocksAcquired());
+    serverAssert(CommandLocksAcquired());
 
     /* Reuse the sds from the main dict in the expire dict */
     kde = dictFind(db->pdict,ptrFromObj(key));
     serverAssertWithInfo(NULL,key,kde != NULL);
+    dbBeforeWrite(db, (sds)dictGetKey(kde));
 
-    if (((robj*)dictGetVal(kde))->getrefcount(std::memory_order_relaxed) == OBJ_SHARED_REFCOUNT)
+    if (dbMaterializeValue(db, kde)->getrefcount(std::memory_order_relaxed) == OBJ_SHARED_REFCOUNT)
     {
         // shared objects cannot have the expire bit set, create a real object
         dictSetVal(db->pdict, kde, dupStringObject((robj*)dictGetVal(kde)));
@@ -1299,6 +1398,7 @@ void setExpire(client *c, redisDb *db, robj *key, robj *subkey, long long when)
         serverAssert(itr != db->setexpire->end());
         expireEntry eNew(std::move(*itr));
         eNew.update(szSubKey, when);
+        expireWheelTrack(db, eNew.key(), eNew.when());
         db->setexpire->erase(itr);
         db->setexpire->insert(eNew);
     }
@@ -1306,6 +1406,7 @@ void setExpire(client *c, redisDb *db, robj *key, robj *subkey, long long when)
     {
         expireEntry e((sds)dictGetKey(kde), szSubKey, when);
         ((robj*)dictGetVal(kde))->SetFExpires(true);
+        expireWheelTrack(db, e.key(), e.when());
         db->setexpire->insert(e);
     }
 
@@ -1318,13 +1419,14 @@ void setExpire(client *c, redisDb *db, robj *key, expireEntry &&e)
 {
     dictEntry *kde;
 
-    serverAssert(GlobalLocksAcquired());
+    serverAssert(CommandLocksAcquired());
 
     /* Reuse the sds from the main dict in the expire dict */
     kde = dictFind(db->pdict,ptrFromObj(key));
     serverAssertWithInfo(NULL,key,kde != NULL);
+    dbBeforeWrite(db, (sds)dictGetKey(kde));
 
-    if (((robj*)dictGetVal(kde))->getrefcount(std::memory_order_relaxed) == OBJ_SHARED_REFCOUNT)
+    if (dbMaterializeValue(db, kde)->getrefcount(std::memory_order_relaxed) == OBJ_SHARED_REFCOUNT)
     {
         // shared objects cannot have the expire bit set, create a real object
         dictSetVal(db->pdict, kde, dupStringObject((robj*)dictGetVal(kde)));
@@ -1334,6 +1436,7 @@ void setExpire(client *c, redisDb *db, robj *key, expireEntry &&e)
         removeExpire(db, key);
 
     e.setKeyUnsafe((sds)dictGetKey(kde));
+    expireWheelTrack(db, e.key(), e.when());
     db->setexpire->insert(e);
     ((robj*)dictGetVal(kde))->SetFExpires(true);
 
@@ -1355,8 +1458,7 @@ expireEntry *getExpire(redisDb *db, robj_roptr key) {
     de = dictFind(db->pdict, ptrFromObj(key));
     if (de == NULL)
         return nullptr;
-    robj *obj = (robj*)dictGetVal(de);
-    if (!obj->FExpires())
+    if (!FEntryExpires(de))
         return nullptr;
 
     auto itr = db->setexpire->find((sds)dictGetKey(de));
@@ -1372,8 +1474,11 @@ expireEntry *getExpire(redisDb *db, robj_roptr key) {
  * will be consistent even if we allow write operations against expiring
  * keys. */
 void propagateExpire(redisDb *db, robj *key, int lazy) {
-    serverAssert(GlobalLocksAcquired());
+    serverAssert(CommandLocksAcquired());
     robj *argv[2];
+    std::unique_lock<fastlock> ulock(g_pserver->lockPropagate, std::defer_lock);
+    if (aeThreadInStripedSection())
+        ulock.lock();   // other databases may be propagating concurrently
 
     argv[0] = lazy ? shared.unlink : shared.del;
     argv[1] = key;
@@ -1452,8 +1557,12 @@ int expireIfNeeded(redisDb *db, robj *key) {
      * we think the key is expired at this time. */
     if (listLength(g_pserver->masters)) return 1;
 
+    /* Lockless readers may not modify the keyspace, same as above the key is
+     * reported as expired and left for active expiry or the next writer. */
+    if (aeThreadInReadSection()) return 1;
+
     /* Delete the key */
-    g_pserver->stat_expiredkeys++;
+    atomicIncr(g_pserver->stat_expiredkeys, 1);
     propagateExpire(db,key,g_pserver->lazyfree_lazy_expire);
     notifyKeyspaceEvent(NOTIFY_EXPIRED,
         "expired",key,db->id);
@@ -156,7 +156,7 @@ void xorObjectDigest(redisDb *db, robj_roptr keyobj, unsigned char *digest, robj
     } else if (o->type == OBJ_ZSET) {
         unsigned char eledigest[20];
 
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
             unsigned char *zl = (unsigned char*)ptrFromObj(o);
             unsigned char *eptr, *sptr;
             unsigned char *vstr;
@@ -164,13 +164,13 @@ void xorObjectDigest(redisDb *db, robj_roptr keyobj, unsigned char *digest, robj
             long long vll;
             double score;
 
-            eptr = ziplistIndex(zl,0);
+            eptr = lpSeek(zl,0);
             serverAssert(eptr != NULL);
-            sptr = ziplistNext(zl,eptr);
+            sptr = lpNext(zl,eptr);
             serverAssert(sptr != NULL);
 
             while (eptr != NULL) {
-                serverAssert(ziplistGet(eptr,&vstr,&vlen,&vll));
+                vstr = lpGetValue(eptr,&vlen,&vll);
                 score = zzlGetScore(sptr);
 
                 memset(eledigest,0,20);
@@ -186,16 +186,16 @@ void xorObjectDigest(redisDb *db, robj_roptr keyobj, unsigned char *digest, robj
                 xorDigest(digest,eledigest,20);
                 zzlNext(zl,&eptr,&sptr);
             }
-        } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = (zset*)ptrFromObj(o);
             dictIterator *di = dictGetIterator(zs->pdict);
             dictEntry *de;
 
             while((de = dictNext(di)) != NULL) {
                 sds sdsele = (sds)dictGetKey(de);
-                double *score = (double*)dictGetVal(de);
+                double score = dictGetDoubleVal(de);
 
-                snprintf(buf,sizeof(buf),"%.17g",*score);
+                snprintf(buf,sizeof(buf),"%.17g",score);
                 memset(eledigest,0,20);
                 mixDigest(eledigest,sdsele,sdslen(sdsele));
                 mixDigest(eledigest,buf,strlen(buf));
@@ -296,7 +296,12 @@ void computeDatasetDigest(unsigned char *final) {
             mixDigest(digest,key,sdslen(key));
 
             o = (robj*)dictGetVal(de);
+            bool fInline = FInlineVal(o);
+            if (fInline)
+                o = createObjectFromInline(o);
             xorObjectDigest(db,keyobj,digest,o);
+            if (fInline)
+                decrRefCount(o);
 
             /* We can finally xor the key-val digest to the final digest */
             xorDigest(final,digest,20);
@@ -328,9 +333,11 @@ void debugCommand(client *c) {
 "SDSLEN <key> -- Show low level SDS string info representing key and value.",
 "SEGFAULT -- Crash the server with sigsegv.",
 "SET-ACTIVE-EXPIRE <0|1> -- Setting it to 0 disables expiring keys in background when they are not accessed (otherwise the Redis behavior). Setting it to 1 reenables back the default.",
+"SET-FORKLESS-SAVE-DELAY <microseconds> -- Make a fork-less BGSAVE sleep after each batch of keys it saves. 0 (the default) disables the delay.",
 "SLEEP <seconds> -- Stop the server for <seconds>. Decimals allowed.",
 "STRUCTSIZE -- Return the size of different Redis core C structures.",
 "ZIPLIST <key> -- Show low level info about the ziplist encoding.",
+"LISTPACK <key> -- Show low level info about the listpack encoding.",
 "STRINGMATCH-TEST -- Run a fuzz tester against the stringmatchlen() function.",
 NULL
         };
@@ -402,11 +409,14 @@ NULL
             addReply(c,shared.nokeyerr);
             return;
         }
-        val = (robj*)dictGetVal(de);
+        bool fInline = FInlineVal(dictGetVal(de));
+        val = dbEntryValue(de);
         strenc = strEncoding(val->encoding);
 
-        char extra[138] = {0};
-        if (val->encoding == OBJ_ENCODING_QUICKLIST) {
+        char extra[180] = {0};
+        if (fInline) {
+            snprintf(extra, sizeof(extra), " inline:1");
+        } else if (val->encoding == OBJ_ENCODING_QUICKLIST) {
             char *nextra = extra;
             int remaining = sizeof(extra);
             quicklist *ql = (quicklist*)val->m_ptr;
@@ -428,14 +438,18 @@ NULL
             used = snprintf(nextra, remaining, " ql_compressed:%d", compressed);
             nextra += used;
             remaining -= used;
-            /* Add total uncompressed size */
-            unsigned long sz = 0;
+            /* Add total uncompressed size and compressed node count */
+            unsigned long sz = 0, compressed_nodes = 0;
             for (quicklistNode *node = ql->head; node; node = node->next) {
                 sz += node->sz;
+                compressed_nodes += quicklistNodeIsCompressed(node);
             }
             used = snprintf(nextra, remaining, " ql_uncompressed_size:%lu", sz);
             nextra += used;
             remaining -= used;
+            used = snprintf(nextra, remaining, " ql_compressed_nodes:%lu", compressed_nodes);
+            nextra += used;
+            remaining -= used;
         }
 
         addReplyStatusFormat(c,
@@ -454,7 +468,7 @@ NULL
             addReply(c,shared.nokeyerr);
             return;
         }
-        val = (robj*)dictGetVal(de);
+        val = dbEntryValue(de);
         key = (sds)dictGetKey(de);
 
         if (val->type != OBJ_STRING || !sdsEncodedObject(val)) {
@@ -465,7 +479,8 @@ NULL
                 "val_sds_len:%lld, val_sds_avail:%lld, val_zmalloc: %lld",
                 (long long) sdslen(key),
                 (long long) sdsavail(key),
-                (long long) sdsZmallocSize(key),
+                /* Embedded keys share the allocation of their dictEntry */
+                (long long) (dictEmbedsKeys(c->db->pdict) ? zmalloc_size(de) : sdsZmallocSize(key)),
                 (long long) sdslen(szFromObj(val)),
                 (long long) sdsavail(szFromObj(val)),
                 (long long) getStringObjectSdsUsedMemory(val));
@@ -482,6 +497,18 @@ NULL
             ziplistRepr((unsigned char*)ptrFromObj(o));
             addReplyStatus(c,"Ziplist structure printed on stdout");
         }
+    } else if (!strcasecmp(szFromObj(c->argv[1]),"listpack") && c->argc == 3) {
+        robj *o;
+
+        if ((o = objectCommandLookupOrReply(c,c->argv[2],shared.nokeyerr))
+                == NULL) return;
+
+        if (o->encoding != OBJ_ENCODING_LISTPACK) {
+            addReplyError(c,"Not a listpack encoded object.");
+        } else {
+            lpRepr((unsigned char*)ptrFromObj(o));
+            addReplyStatus(c,"Listpack structure printed on stdout");
+        }
     } else if (!strcasecmp(szFromObj(c->argv[1]),"populate") &&
                c->argc >= 3 && c->argc <= 5) {
         long keys, j;
@@ -605,6 +632,11 @@ NULL
     {
         g_pserver->active_expire_enabled = atoi(szFromObj(c->argv[2]));
         addReply(c,shared.ok);
+    } else if (!strcasecmp(szFromObj(c->argv[1]),"set-forkless-save-delay") &&
+               c->argc == 3)
+    {
+        g_pserver->rdb_forkless_save_delay = atoi(szFromObj(c->argv[2]));
+        addReply(c,shared.ok);
     } else if (!strcasecmp(szFromObj(c->argv[1]),"lua-always-replicate-commands") &&
                c->argc == 3)
     {
@@ -658,7 +690,7 @@ NULL
 
         /* Get the hash table reference from the object, if possible. */
         switch (o->encoding) {
-        case OBJ_ENCODING_SKIPLIST:
+        case OBJ_ENCODING_BTREE:
             {
                 zset *zs = (zset*)ptrFromObj(o);
                 ht = zs->pdict;
@@ -752,8 +784,8 @@ void serverLogObjectDebugInfo(robj_roptr o) {
         serverLog(LL_WARNING,"Hash size: %d", (int) hashTypeLength(o));
     } else if (o->type == OBJ_ZSET) {
         serverLog(LL_WARNING,"Sorted set size: %d", (int) zsetLength(o));
-        if (o->encoding == OBJ_ENCODING_SKIPLIST)
-            serverLog(LL_WARNING,"Skiplist level: %d", (int) ((const zset*)ptrFromObj(o))->zsl->level);
+        if (o->encoding == OBJ_ENCODING_BTREE)
+            serverLog(LL_WARNING,"B+tree height: %d", (int) ((const zset*)ptrFromObj(o))->zbt->height);
     }
 }
 
@@ -1261,7 +1293,7 @@ void logCurrentClient(void) {
         key = getDecodedObject(cc->argv[1]);
         de = dictFind(cc->db->pdict, ptrFromObj(key));
         if (de) {
-            val = (robj*)dictGetVal(de);
+            val = dbEntryValue(de);
             serverLog(LL_WARNING,"key '%s' found in DB containing the following object:", (char*)ptrFromObj(key));
             serverLogObjectDebugInfo(val);
         }
@@ -1362,6 +1394,24 @@ void dumpX86Calls(void *addr, size_t len) {
     }
 }
 
+/* Append a short human readable name for a code address, e.g.
+ * "processCommand+0x1a3", falling back to the raw address when the symbol
+ * is unknown.  Used to label call sites in INFO lockstats. */
+sds catCodeAddress(sds s, void *addr) {
+    Dl_info info;
+    if (dladdr(addr, &info) == 0 || info.dli_sname == NULL)
+        return sdscatprintf(s, "%p", addr);
+
+    int status = 0;
+    char *szDemangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    const char *szName = (status == 0) ? szDemangled : info.dli_sname;
+    size_t cchName = strcspn(szName, "(");  // drop the argument list
+    s = sdscatlen(s, szName, cchName);
+    s = sdscatprintf(s, "+0x%lx", (unsigned long)((char*)addr - (char*)info.dli_saddr));
+    free(szDemangled);
+    return s;
+}
+
 void sigsegvHandler(int sig, siginfo_t *info, void *secret) {
     ucontext_t *uc = (ucontext_t*) secret;
     g_fInCrash = true;
@@ -48,7 +48,7 @@ extern "C" int je_get_defrag_hint(void* ptr, int *bin_util, int *run_util);
 /* forward declarations*/
 void defragDictBucketCallback(void *privdata, dictEntry **bucketref);
 dictEntry* replaceSateliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey, sds newkey, uint64_t hash, long *defragged);
-void replaceSateliteOSetKeyPtr(expireset &set, sds oldkey, sds newkey);
+void replaceSateliteOSetKeyPtr(redisDb *db, sds oldkey, sds newkey);
 
 /* Defrag helper for generic allocations.
  *
@@ -185,79 +185,67 @@ long dictDefragTables(dict* d) {
     return defragged;
 }
 
-/* Internal function used by zslDefrag */
-void zslUpdateNode(zskiplist *zsl, zskiplistNode *oldnode, zskiplistNode *newnode, zskiplistNode **update) {
-    int i;
-    for (i = 0; i < zsl->level; i++) {
-        if (update[i]->level(i)->forward == oldnode)
-            update[i]->level(i)->forward = newnode;
-    }
-    serverAssert(zsl->header!=oldnode);
-    if (newnode->level(0)->forward) {
-        serverAssert(newnode->level(0)->forward->backward==oldnode);
-        newnode->level(0)->forward->backward = newnode;
-    } else {
-        serverAssert(zsl->tail==oldnode);
-        zsl->tail = newnode;
-    }
-}
-
 /* Defrag helper for sorted set.
- * Update the robj pointer, defrag the skiplist struct and return the new score
- * reference. We may not access oldele pointer (not even the pointer stored in
- * the skiplist), as it was already freed. Newele may be null, in which case we
- * only need to defrag the skiplist, but not update the obj pointer.
- * When return value is non-NULL, it is the score reference that must be updated
- * in the dict record. */
-double *zslDefrag(zskiplist *zsl, double score, sds oldele, sds newele) {
-    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x, *newx;
-    int i;
+ * Update the element pointer inside the B+tree and defrag the nodes on its
+ * path, including the copies of the element kept by the inner nodes when it
+ * is the greatest of its subtree. We may not access oldele pointer (not even
+ * the pointer stored in the tree), as it was already freed. Newele may be
+ * null, in which case we only need to defrag the nodes. */
+long zbtDefrag(zbtree *zbt, double score, sds oldele, sds newele) {
     sds ele = newele? newele: oldele;
+    long defragged = 0;
+    void **ref = &zbt->root;
+
+    /* Returns true when score/e sorts before the element, making sure not
+     * to access 'e' if it matches oldele. */
+    auto before = [&](double s, sds e) {
+        if (e == oldele) return false;
+        return s < score || (s == score && sdscmp(e,ele) < 0);
+    };
+    auto lowerBound = [&](const double *scores, const sds *eles, unsigned int count) {
+        unsigned int lo = 0, hi = count;
+        while (lo < hi) {
+            unsigned int mid = (lo+hi)/2;
+            if (before(scores[mid],eles[mid])) lo = mid+1; else hi = mid;
+        }
+        return lo;
+    };
+
+    for (int h = zbt->height; h > 0; h--) {
+        zbtreeInner *in = (zbtreeInner*)*ref, *newin;
+        if ((newin = (zbtreeInner*)activeDefragAlloc(in)))
+            defragged++, *ref = in = newin;
+        unsigned int i = lowerBound(in->maxscore,in->maxele,in->count-1);
+        if (newele && in->maxele[i] == oldele)
+            in->maxele[i] = newele;
+        ref = &in->child[i];
+    }
 
-    /* find the skiplist node referring to the object that was moved,
-     * and all pointers that need to be updated if we'll end up moving the skiplist node. */
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level(i)->forward &&
-            x->level(i)->forward->ele != oldele && /* make sure not to access the
-                                                     ->obj pointer if it matches
-                                                     oldele */
-            (x->level(i)->forward->score < score ||
-                (x->level(i)->forward->score == score &&
-                sdscmp(x->level(i)->forward->ele,ele) < 0)))
-            x = x->level(i)->forward;
-        update[i] = x;
+    zbtreeLeaf *leaf = (zbtreeLeaf*)*ref, *newleaf;
+    if ((newleaf = (zbtreeLeaf*)activeDefragAlloc(leaf))) {
+        defragged++, *ref = leaf = newleaf;
+        if (leaf->prev) leaf->prev->next = leaf; else zbt->head = leaf;
+        if (leaf->next) leaf->next->prev = leaf; else zbt->tail = leaf;
     }
 
-    /* update the robj pointer inside the skip list record. */
-    x = x->level(0)->forward;
-    serverAssert(x && score == x->score && x->ele==oldele);
+    /* update the element pointer inside the leaf. */
+    unsigned int idx = lowerBound(leaf->score,leaf->ele,leaf->count);
+    serverAssert(idx < leaf->count && score == leaf->score[idx] &&
+                 leaf->ele[idx] == oldele);
     if (newele)
-        x->ele = newele;
-
-    /* try to defrag the skiplist record itself */
-    newx = (zskiplistNode*)activeDefragAlloc(x);
-    if (newx) {
-        zslUpdateNode(zsl, x, newx, update);
-        return &newx->score;
-    }
-    return NULL;
+        leaf->ele[idx] = newele;
+    return defragged;
 }
 
 /* Defrag helpler for sorted set.
- * Defrag a single dict entry key name, and corresponding skiplist struct */
+ * Defrag a single dict entry key name, and corresponding B+tree nodes */
 long activeDefragZsetEntry(zset *zs, dictEntry *de) {
     sds newsds;
-    double* newscore;
     long defragged = 0;
     sds sdsele = (sds)dictGetKey(de);
     if ((newsds = activeDefragSds(sdsele)))
         defragged++, de->key = newsds;
-    newscore = zslDefrag(zs->zsl, *(double*)dictGetVal(de), sdsele, newsds);
-    if (newscore) {
-        dictSetVal(zs->pdict, de, newscore);
-        defragged++;
-    }
+    defragged += zbtDefrag(zs->zbt, dictGetDoubleVal(de), sdsele, newsds);
     return defragged;
 }
 
@@ -271,6 +259,7 @@ long activeDefragSdsDict(dict* d, int val_type) {
     dictIterator *di;
     dictEntry *de;
     long defragged = 0;
+    dictAbandonRehashAsync(d); /* the entries are about to move */
     di = dictGetIterator(d);
     while((de = dictNext(di)) != NULL) {
         sds sdsele = (sds)dictGetKey(de), newsds;
@@ -407,12 +396,14 @@ dictEntry* replaceSateliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey, sd
     return NULL;
 }
 
-void replaceSateliteOSetKeyPtr(expireset &set, sds oldkey, sds newkey) {
+void replaceSateliteOSetKeyPtr(redisDb *db, sds oldkey, sds newkey) {
+    expireset &set = *db->setexpire;
     auto itr = set.find(oldkey);
     if (itr != set.end())
     {
         expireEntry eNew(std::move(*itr));
         eNew.setKeyUnsafe(newkey);
+        expireWheelTrack(db, eNew.key(), eNew.when());
         set.erase(itr);
         set.insert(eNew);
     }
@@ -423,7 +414,10 @@ long activeDefragQuickListNodes(quicklist *ql) {
     long defragged = 0;
     unsigned char *newzl;
     while (node) {
-        if ((newnode = (quicklistNode*)activeDefragAlloc(node))) {
+        /* Nodes being compressed in the background are referenced by their
+         * job, so they can't be moved. */
+        if (!node->compress_pending &&
+            (newnode = (quicklistNode*)activeDefragAlloc(node))) {
             if (newnode->prev)
                 newnode->prev->next = newnode;
             else
@@ -471,7 +465,7 @@ void scanLaterZsetCallback(void *privdata, const dictEntry *_de) {
 }
 
 long scanLaterZset(robj *ob, unsigned long *cursor) {
-    if (ob->type != OBJ_ZSET || ob->encoding != OBJ_ENCODING_SKIPLIST)
+    if (ob->type != OBJ_ZSET || ob->encoding != OBJ_ENCODING_BTREE)
         return 0;
     zset *zs = (zset*)ptrFromObj(ob);
     dict *d = zs->pdict;
@@ -494,6 +488,7 @@ long scanLaterSet(robj *ob, unsigned long *cursor) {
     if (ob->type != OBJ_SET || ob->encoding != OBJ_ENCODING_HT)
         return 0;
     dict *d = (dict*)ptrFromObj(ob);
+    dictAbandonRehashAsync(d);
     *cursor = dictScan(d, *cursor, scanLaterSetCallback, defragDictBucketCallback, &defragged);
     return defragged;
 }
@@ -515,6 +510,7 @@ long scanLaterHash(robj *ob, unsigned long *cursor) {
     if (ob->type != OBJ_HASH || ob->encoding != OBJ_ENCODING_HT)
         return 0;
     dict *d = (dict*)ptrFromObj(ob);
+    dictAbandonRehashAsync(d);
     *cursor = dictScan(d, *cursor, scanLaterHashCallback, defragDictBucketCallback, &defragged);
     return defragged;
 }
@@ -533,22 +529,19 @@ long defragQuicklist(redisDb *db, dictEntry *kde) {
     return defragged;
 }
 
-long defragZsetSkiplist(redisDb *db, dictEntry *kde) {
+long defragZsetBtree(redisDb *db, dictEntry *kde) {
     robj *ob = (robj*)dictGetVal(kde);
     long defragged = 0;
     zset *zs = (zset*)ptrFromObj(ob);
     zset *newzs;
-    zskiplist *newzsl;
+    zbtree *newzbt;
     dict *newdict;
     dictEntry *de;
-    struct zskiplistNode *newheader;
-    serverAssert(ob->type == OBJ_ZSET && ob->encoding == OBJ_ENCODING_SKIPLIST);
+    serverAssert(ob->type == OBJ_ZSET && ob->encoding == OBJ_ENCODING_BTREE);
     if ((newzs = (zset*)activeDefragAlloc(zs)))
         defragged++, ob->m_ptr = zs = newzs;
-    if ((newzsl = (zskiplist*)activeDefragAlloc(zs->zsl)))
-        defragged++, zs->zsl = newzsl;
-    if ((newheader = (zskiplistNode*)activeDefragAlloc(zs->zsl->header)))
-        defragged++, zs->zsl->header = newheader;
+    if ((newzbt = (zbtree*)activeDefragAlloc(zs->zbt)))
+        defragged++, zs->zbt = newzbt;
     if (dictSize(zs->pdict) > cserver.active_defrag_max_scan_fields)
         defragLater(db, kde);
     else {
@@ -602,6 +595,26 @@ long defragSet(redisDb *db, dictEntry *kde) {
     return defragged;
 }
 
+/* Defrag a roaring bitmap encoded set: the header, the container array and
+ * the payload of every container. */
+long defragRoaringSet(robj *ob) {
+    long defragged = 0;
+    roaring *r = (roaring*)ptrFromObj(ob), *newr;
+    roaringContainer *newc;
+    void *newdata;
+
+    if ((newr = (roaring*)activeDefragAlloc(r)))
+        defragged++, ob->m_ptr = r = newr;
+    if (r->containers &&
+        (newc = (roaringContainer*)activeDefragAlloc(r->containers)))
+        defragged++, r->containers = newc;
+    for (uint32_t i = 0; i < r->len; i++) {
+        if ((newdata = activeDefragAlloc(r->containers[i].data)))
+            defragged++, r->containers[i].data = newdata;
+    }
+    return defragged;
+}
+
 /* Defrag callback for radix tree iterator, called for each node,
  * used in order to defrag the nodes allocations. */
 int defragRaxNode(raxNode **noderef) {
@@ -777,16 +790,22 @@ long defragKey(redisDb *db, dictEntry *de) {
     long defragged = 0;
     sds newsds;
 
-    /* Try to defrag the key name. */
-    newsds = activeDefragSds(keysds);
-    if (newsds)
-        defragged++, de->key = newsds;
-    if (!db->setexpire->empty()) {
-        replaceSateliteOSetKeyPtr(*db->setexpire, keysds, newsds);
+    /* Try to defrag the key name.  Keys embedded in their dictEntry were
+     * already moved along with it by defragKeyspaceBucketCallback(). */
+    if (!dictEmbedsKeys(db->pdict)) {
+        newsds = activeDefragSds(keysds);
+        if (newsds)
+            defragged++, de->key = newsds;
+        if (newsds && !db->setexpire->empty()) {
+            replaceSateliteOSetKeyPtr(db, keysds, newsds);
+        }
     }
 
-    /* Try to defrag robj and / or string value. */
+    /* Try to defrag robj and / or string value.  Inlined values live in the
+     * entry itself. */
     ob = (robj*)dictGetVal(de);
+    if (FInlineVal(ob))
+        return defragged;
     if ((newob = activeDefragStringOb(ob, &defragged))) {
         de->v.val = newob;
         ob = newob;
@@ -810,20 +829,22 @@ long defragKey(redisDb *db, dictEntry *de) {
             intset *newis, *is = (intset*)ptrFromObj(ob);
             if ((newis = (intset*)activeDefragAlloc(is)))
                 defragged++, ob->m_ptr = newis;
+        } else if (ob->encoding == OBJ_ENCODING_ROARING) {
+            defragged += defragRoaringSet(ob);
         } else {
             serverPanic("Unknown set encoding");
         }
     } else if (ob->type == OBJ_ZSET) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = (unsigned char*)activeDefragAlloc(ptrFromObj(ob))))
                 defragged++, ob->m_ptr = newzl;
-        } else if (ob->encoding == OBJ_ENCODING_SKIPLIST) {
-            defragged += defragZsetSkiplist(db, de);
+        } else if (ob->encoding == OBJ_ENCODING_BTREE) {
+            defragged += defragZsetBtree(db, de);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (ob->type == OBJ_HASH) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_LISTPACK) {
             if ((newzl = (unsigned char*)activeDefragAlloc(ptrFromObj(ob))))
                 defragged++, ob->m_ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_HT) {
@@ -866,6 +887,37 @@ void defragDictBucketCallback(void *privdata, dictEntry **bucketref) {
     }
 }
 
+/* Defrag scan callback for the buckets of the keyspace.  When keys are
+ * embedded in their dictEntry they move along with it, so the key pointer of
+ * the entry and of its expire entry must follow. */
+void defragKeyspaceBucketCallback(void *privdata, dictEntry **bucketref) {
+    redisDb *db = (redisDb*)privdata;
+    if (!dictEmbedsKeys(db->pdict)) {
+        defragDictBucketCallback(privdata, bucketref);
+        return;
+    }
+    while(*bucketref) {
+        dictEntry *de = *bucketref, *newde;
+        size_t keyoffset = (char*)de->key - (char*)de;
+        /* The expire set hashes keys by pointer, find the entry while the
+         * old key is still alive and re-insert it under the new one. */
+        bool fExpires = FEntryExpires(de);
+        expireset::setiter itrExpire = fExpires ? db->setexpire->find((sds)de->key) : db->setexpire->end();
+        if ((newde = (dictEntry*)activeDefragAlloc(de))) {
+            newde->key = (char*)newde + keyoffset;
+            *bucketref = newde;
+            if (itrExpire != db->setexpire->end()) {
+                expireEntry eNew(std::move(*itrExpire));
+                eNew.setKeyUnsafe((sds)newde->key);
+                expireWheelTrack(db, eNew.key(), eNew.when());
+                db->setexpire->erase(itrExpire);
+                db->setexpire->insert(eNew);
+            }
+        }
+        bucketref = &(*bucketref)->next;
+    }
+}
+
 /* Utility function to get the fragmentation ratio from jemalloc.
  * It is critical to do that by comparing only heap maps that belong to
  * jemalloc, and skip ones the jemalloc keeps as spare. Since we use this
@@ -905,7 +957,9 @@ long defragOtherGlobals() {
 int defragLaterItem(dictEntry *de, unsigned long *cursor, long long endtime) {
     if (de) {
         robj *ob = (robj*)dictGetVal(de);
-        if (ob->type == OBJ_LIST) {
+        if (FInlineVal(ob)) {
+            *cursor = 0; /* the key was replaced by an inlined string */
+        } else if (ob->type == OBJ_LIST) {
             g_pserver->stat_active_defrag_hits += scanLaterList(ob);
             *cursor = 0; /* list has no scan, we must finish it in one go */
         } else if (ob->type == OBJ_SET) {
@@ -1056,6 +1110,9 @@ void activeDefragCycle(void) {
     if (!g_pserver->active_defrag_running)
         return;
 
+    /* Keys and values are moved behind the back of the dicts holding them */
+    aeExcludeReaders();
+
     /* See activeExpireCycle for how timelimit is handled. */
     start = ustime();
     timelimit = 1000000*g_pserver->active_defrag_running/g_pserver->hz/100;
@@ -1112,7 +1169,10 @@ void activeDefragCycle(void) {
                 break; /* this will exit the function and we'll continue on the next cycle */
             }
 
-            cursor = dictScan(db->pdict, cursor, defragScanCallback, defragDictBucketCallback, db);
+            /* Keys and entries are about to move, no rehash batch may
+             * reference them. */
+            dictAbandonRehashAsync(db->pdict);
+            cursor = dictScan(db->pdict, cursor, defragScanCallback, defragKeyspaceBucketCallback, db);
 
             /* Once in 16 scan iterations, 512 pointer reallocations. or 64 keys
              * (if we have a lot of pointers in one hash bucket or rehasing),
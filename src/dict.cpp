@@ -3,7 +3,8 @@
  * This file implements in memory hash tables with insert/del/replace/find/
  * get-random-element operations. Hash tables will auto resize if needed
  * tables of power of two in size are used, collisions are handled by
- * chaining. See the source code for more information... :)
+ * chaining, or by open addressing for dict types that ask for it. See the
+ * source code for more information... :)
  *
  * Copyright (c) 2006-2012, Salvatore Sanfilippo <antirez at gmail dot com>
  * All rights reserved.
@@ -42,6 +43,12 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <sys/time.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "dict.h"
 #include "zmalloc.h"
@@ -68,6 +75,9 @@ static int _dictExpandIfNeeded(dict *ht);
 static unsigned long _dictNextPower(unsigned long size);
 static long _dictKeyIndex(dict *ht, const void *key, uint64_t hash, dictEntry **existing);
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
+static int _dictRehashAsyncStep(dict *d);
+static void _dictFreeEntry(dict *d, dictEntry *he);
+static inline void _dictWillModify(dict *d);
 
 /* -------------------------- hash functions -------------------------------- */
 
@@ -95,6 +105,220 @@ uint64_t dictGenCaseHashFunction(const unsigned char *buf, int len) {
     return siphash_nocase(buf,len,dict_hash_function_seed);
 }
 
+/* ------------------------- open addressing tables ------------------------- */
+
+/* Dicts whose type has DICT_TYPE_OPEN_ADDRESSING set do not chain entries:
+ * table[] holds at most one entry per slot and entry->next is always NULL.
+ * After the slots the same allocation holds one control byte per slot, plus
+ * a mirror of the first DICT_GROUP_WIDTH control bytes so that a group can
+ * be loaded at any index without wrapping, plus the count of tombstones.
+ *
+ * The control byte of an occupied slot is the low 7 bits of the key hash,
+ * otherwise it is DICT_CTRL_EMPTY or DICT_CTRL_DELETED.  Lookups compare the
+ * control bytes of a whole group at once (a single SSE2 compare when
+ * available) and only dereference the entries whose tag matches, instead of
+ * walking a chain of entries.  Groups are probed in triangular steps, which
+ * visits every group of a power of two sized table exactly once, and a probe
+ * stops at the first group that has an empty slot.
+ *
+ * The home slot of a key is (hash >> 7) & sizemask.  It plays the role of the
+ * bucket of chained tables: incremental rehashing and dictScan() work on home
+ * slots, so the scan cursor keeps the same guarantees for both layouts.
+ *
+ * A table at its load limit normally grows, but growing moves entries, which
+ * safe iterators must not see.  While they pause the rehashing, a rehashing
+ * target at its load limit instead chains new entries to the entry in their
+ * home slot.  A key may then also be in the chain of its home slot, which
+ * lookups only check when the table has such overflow entries.  Chains are
+ * dissolved by the next growth once no safe iterator is left. */
+
+#define DICT_GROUP_WIDTH 16
+#define DICT_CTRL_EMPTY ((int8_t)-128)
+#define DICT_CTRL_DELETED ((int8_t)-2)
+
+static inline int dictIsOpenAddressing(const dict *d) {
+    return d->type->flags & DICT_TYPE_OPEN_ADDRESSING;
+}
+
+static inline int8_t *_dictOACtrl(const dictht *ht) {
+    return (int8_t*)(ht->table + ht->size);
+}
+
+static inline unsigned long *_dictOADeleted(const dictht *ht) {
+    return (unsigned long*)(_dictOACtrl(ht) + ht->size + DICT_GROUP_WIDTH);
+}
+
+/* Number of entries chained behind the entry of a slot, see above */
+static inline unsigned long *_dictOAOverflow(const dictht *ht) {
+    return _dictOADeleted(ht) + 1;
+}
+
+static inline unsigned long _dictOAHome(const dictht *ht, uint64_t hash) {
+    return (hash >> 7) & ht->sizemask;
+}
+
+static inline int8_t _dictOATag(uint64_t hash) {
+    return (int8_t)(hash & 0x7f);
+}
+
+/* Bitmask of the slots in the group starting at 'ctrl' whose control byte
+ * equals 'c'. */
+static inline uint32_t _dictGroupMatch(const int8_t *ctrl, int8_t c) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(c)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < DICT_GROUP_WIDTH; i++)
+        if (ctrl[i] == c) mask |= 1u << i;
+    return mask;
+#endif
+}
+
+/* Bitmask of the empty or deleted slots of the group: both have the high bit
+ * set, while tags of occupied slots never do. */
+static inline uint32_t _dictGroupMatchFree(const int8_t *ctrl) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < DICT_GROUP_WIDTH; i++)
+        if (ctrl[i] < 0) mask |= 1u << i;
+    return mask;
+#endif
+}
+
+static void _dictOASetCtrl(dictht *ht, unsigned long idx, int8_t c) {
+    int8_t *ctrl = _dictOACtrl(ht);
+    ctrl[idx] = c;
+    if (idx < DICT_GROUP_WIDTH) ctrl[ht->size + idx] = c;
+}
+
+/* Smallest table keeping 'used' entries under the 7/8 maximum load. */
+static unsigned long _dictOASizeFor(unsigned long used) {
+    unsigned long size = _dictNextPower(used + used/7 + 1);
+    return size < DICT_GROUP_WIDTH ? DICT_GROUP_WIDTH : size;
+}
+
+static int _dictOANeedsGrowth(const dictht *ht) {
+    return (ht->used + *_dictOADeleted(ht) + 1) * 8 > ht->size * 7;
+}
+
+static void _dictOAInit(dictht *ht, unsigned long size) {
+    size_t bytes = size*sizeof(dictEntry*) + size + DICT_GROUP_WIDTH + 2*sizeof(unsigned long);
+    ht->table = (dictEntry**)zcalloc(bytes, MALLOC_SHARED);
+    ht->size = size;
+    ht->sizemask = size-1;
+    ht->used = 0;
+    memset(_dictOACtrl(ht), (uint8_t)DICT_CTRL_EMPTY, size + DICT_GROUP_WIDTH);
+}
+
+/* Returns the slot holding 'key' in 'ht', or -1 if it is not there. */
+static long _dictOAFind(dict *d, dictht *ht, const void *key, uint64_t hash) {
+    if (ht->size == 0) return -1;
+    const int8_t *ctrl = _dictOACtrl(ht);
+    int8_t tag = _dictOATag(hash);
+    unsigned long pos = _dictOAHome(ht, hash);
+    unsigned long step = 0;
+    for (;;) {
+        uint32_t match = _dictGroupMatch(ctrl + pos, tag);
+        while (match) {
+            unsigned long idx = (pos + __builtin_ctz(match)) & ht->sizemask;
+            dictEntry *he = ht->table[idx];
+            if (key==he->key || dictCompareKeys(d, key, he->key))
+                return idx;
+            match &= match - 1;
+        }
+        if (_dictGroupMatch(ctrl + pos, DICT_CTRL_EMPTY)) return -1;
+        step += DICT_GROUP_WIDTH;
+        if (step >= ht->size) return -1;
+        pos = (pos + step) & ht->sizemask;
+    }
+}
+
+/* Returns a reference to the overflow entry of 'key' in the chain of its home
+ * slot, or NULL if it is not there. */
+static dictEntry **_dictOAFindChained(dict *d, dictht *ht, const void *key, uint64_t hash) {
+    if (ht->size == 0 || *_dictOAOverflow(ht) == 0) return NULL;
+    dictEntry *head = ht->table[_dictOAHome(ht, hash)];
+    if (head == NULL) return NULL;
+    for (dictEntry **ref = &head->next; *ref != NULL; ref = &(*ref)->next) {
+        if (key==(*ref)->key || dictCompareKeys(d, key, (*ref)->key))
+            return ref;
+    }
+    return NULL;
+}
+
+/* Returns the first empty or deleted slot along the probe sequence of
+ * 'hash'.  The caller makes sure the table is not full. */
+static unsigned long _dictOAFindFree(dictht *ht, uint64_t hash) {
+    const int8_t *ctrl = _dictOACtrl(ht);
+    unsigned long pos = _dictOAHome(ht, hash);
+    unsigned long step = 0;
+    for (;;) {
+        uint32_t match = _dictGroupMatchFree(ctrl + pos);
+        if (match) return (pos + __builtin_ctz(match)) & ht->sizemask;
+        step += DICT_GROUP_WIDTH;
+        assert(step < ht->size);
+        pos = (pos + step) & ht->sizemask;
+    }
+}
+
+static void _dictOAInsertAt(dictht *ht, unsigned long idx, dictEntry *de, uint64_t hash) {
+    if (ht->table[idx] != NULL) {
+        /* An overflow entry, 'idx' is its home slot */
+        de->next = ht->table[idx]->next;
+        ht->table[idx]->next = de;
+        (*_dictOAOverflow(ht))++;
+        ht->used++;
+        return;
+    }
+    if (_dictOACtrl(ht)[idx] == DICT_CTRL_DELETED) (*_dictOADeleted(ht))--;
+    ht->table[idx] = de;
+    de->next = NULL;
+    _dictOASetCtrl(ht, idx, _dictOATag(hash));
+    ht->used++;
+}
+
+/* Empty slot 'idx'.  It only needs a tombstone if a probe may have walked
+ * past it, that is if it sits in a run of DICT_GROUP_WIDTH non empty slots. */
+static void _dictOAEraseAt(dict *d, dictht *ht, unsigned long idx) {
+    const int8_t *ctrl = _dictOACtrl(ht);
+    dictEntry *next = ht->table[idx]->next;
+
+    if (next != NULL) {
+        /* The first overflow entry takes the slot, which is its home */
+        ht->table[idx] = next;
+        _dictOASetCtrl(ht, idx, _dictOATag(dictHashKey(d, next->key)));
+        (*_dictOAOverflow(ht))--;
+        ht->used--;
+        return;
+    }
+    unsigned long before = (idx - DICT_GROUP_WIDTH) & ht->sizemask;
+    uint32_t empty_after = _dictGroupMatch(ctrl + idx, DICT_CTRL_EMPTY);
+    uint32_t empty_before = _dictGroupMatch(ctrl + before, DICT_CTRL_EMPTY);
+    int was_never_full = empty_before && empty_after &&
+        (__builtin_ctz(empty_after) + (__builtin_clz(empty_before) - 16)) < DICT_GROUP_WIDTH;
+
+    ht->table[idx] = NULL;
+    if (was_never_full) {
+        _dictOASetCtrl(ht, idx, DICT_CTRL_EMPTY);
+    } else {
+        _dictOASetCtrl(ht, idx, DICT_CTRL_DELETED);
+        (*_dictOADeleted(ht))++;
+    }
+    ht->used--;
+}
+
+/* Slot where a new entry with 'hash' goes: the first free one along its probe
+ * sequence, or its home slot if the table is at its load limit, the entry is
+ * then chained there unless the slot is free.  Only safe iterators keep a
+ * table at its load limit from growing, see _dictExpandIfNeeded(). */
+static unsigned long _dictOASlotForInsert(dictht *ht, uint64_t hash) {
+    if (_dictOANeedsGrowth(ht)) return _dictOAHome(ht, hash);
+    return _dictOAFindFree(ht, hash);
+}
+
 /* ----------------------------- API implementation ------------------------- */
 
 /* Reset a hash table already initialized with ht_init().
@@ -127,6 +351,7 @@ int _dictInit(dict *d, dictType *type,
     d->privdata = privDataPtr;
     d->rehashidx = -1;
     d->iterators = 0;
+    d->asyncdata = NULL;
     return DICT_OK;
 }
 
@@ -152,16 +377,29 @@ int dictExpand(dict *d, unsigned long size)
         return DICT_ERR;
 
     dictht n; /* the new hash table */
-    unsigned long realsize = _dictNextPower(size);
+    if (dictIsOpenAddressing(d)) {
+        unsigned long realsize = _dictOASizeFor(size);
+
+        /* Rehashing to the same table size is only useful to drop the
+         * tombstones left by deletions, or to dissolve overflow chains. */
+        if (realsize == d->ht[0].size && *_dictOADeleted(&d->ht[0]) == 0 &&
+            *_dictOAOverflow(&d->ht[0]) == 0)
+            return DICT_ERR;
+        _dictOAInit(&n, realsize);
+    } else {
+        unsigned long realsize = _dictNextPower(size);
 
-    /* Rehashing to the same table size is not useful. */
-    if (realsize == d->ht[0].size) return DICT_ERR;
+        /* Rehashing to the same table size is not useful. */
+        if (realsize == d->ht[0].size) return DICT_ERR;
+
+        /* Allocate the new hash table and initialize all pointers to NULL */
+        n.size = realsize;
+        n.sizemask = realsize-1;
+        n.table = (dictEntry**)zcalloc(realsize*sizeof(dictEntry*), MALLOC_SHARED);
+        n.used = 0;
+    }
 
-    /* Allocate the new hash table and initialize all pointers to NULL */
-    n.size = realsize;
-    n.sizemask = realsize-1;
-    n.table = (dictEntry**)zcalloc(realsize*sizeof(dictEntry*), MALLOC_SHARED);
-    n.used = 0;
+    _dictWillModify(d);
 
     /* Is this the first initialization? If so it's not really a rehashing
      * we just set the first hash table so that it can accept keys. */
@@ -188,6 +426,8 @@ int dictExpand(dict *d, unsigned long size)
 int dictRehash(dict *d, int n) {
     int empty_visits = n*10; /* Max number of empty buckets to visit. */
     if (!dictIsRehashing(d)) return 0;
+    if (d->asyncdata) return 1; /* ht[0] is being moved by a helper */
+    _dictWillModify(d);
 
     while(n-- && d->ht[0].used != 0) {
         dictEntry *de, *nextde;
@@ -200,6 +440,18 @@ int dictRehash(dict *d, int n) {
             if (--empty_visits == 0) return 1;
         }
         de = d->ht[0].table[d->rehashidx];
+        if (dictIsOpenAddressing(d)) {
+            /* The entry of the slot and its overflow chain, if any.  The old
+             * slot becomes a tombstone so that lookups still probe past it
+             * until ht[0] is released. */
+            while ((de = d->ht[0].table[d->rehashidx]) != NULL) {
+                uint64_t h = dictHashKey(d, de->key);
+                _dictOAEraseAt(d, &d->ht[0], d->rehashidx);
+                _dictOAInsertAt(&d->ht[1], _dictOASlotForInsert(&d->ht[1], h), de, h);
+            }
+            d->rehashidx++;
+            continue;
+        }
         /* Move all the keys in this bucket from the old to the new hash HT */
         while(de) {
             uint64_t h;
@@ -237,11 +489,21 @@ long long timeInMilliseconds(void) {
     return (((long long)tv.tv_sec)*1000)+(tv.tv_usec/1000);
 }
 
+static long long timeInMicroseconds(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
 /* Rehash for an amount of time between ms milliseconds and ms+1 milliseconds */
 int dictRehashMilliseconds(dict *d, int ms) {
     long long start = timeInMilliseconds();
     int rehashes = 0;
 
+    /* Dicts rehashed by a helper only need it to be kept busy */
+    if (_dictRehashAsyncStep(d)) return 0;
+
     while(dictRehash(d,100)) {
         rehashes += 100;
         if (timeInMilliseconds()-start > ms) break;
@@ -249,6 +511,28 @@ int dictRehashMilliseconds(dict *d, int ms) {
     return rehashes;
 }
 
+/* Set by threads that look up dictionaries they do not exclusively own (see
+ * the lockless read path in processCommand()).  While set no incremental
+ * rehashing is performed on behalf of this thread. */
+__thread int dictNoRehashThisThread = 0;
+
+/* Called before a dict of a DICT_TYPE_READ_SHARED type is modified in any way,
+ * rehashing included, so that its owner can keep lockless readers out first.
+ * Other structures shared with the same readers call dictWillModify() too. */
+static dictModifyProc *dict_modify_proc = NULL;
+
+void dictSetModifyProc(dictModifyProc *proc) {
+    dict_modify_proc = proc;
+}
+
+void dictWillModify(void) {
+    if (dict_modify_proc != NULL) dict_modify_proc();
+}
+
+static inline void _dictWillModify(dict *d) {
+    if (d->type->flags & DICT_TYPE_READ_SHARED) dictWillModify();
+}
+
 /* This function performs just a step of rehashing, and only if there are
  * no safe iterators bound to our hash table. When we have iterators in the
  * middle of a rehashing we can't mess with the two hash tables otherwise
@@ -258,7 +542,267 @@ int dictRehashMilliseconds(dict *d, int ms) {
  * dictionary so that the hash table automatically migrates from H1 to H2
  * while it is actively used. */
 static void _dictRehashStep(dict *d) {
-    if (d->iterators == 0) dictRehash(d,1);
+    if (d->iterators != 0 || dictNoRehashThisThread) return;
+    if (!_dictRehashAsyncStep(d)) dictRehash(d,1);
+}
+
+/* ------------------------- asynchronous rehashing ------------------------- */
+
+/* Rehashing inline costs every operation on the dict a bucket worth of key
+ * hashing, and on large tables that is mostly cache misses on the keys.  Large
+ * dicts whose type sets DICT_TYPE_ASYNC_REHASH instead have the keys hashed
+ * by a helper thread, a batch of buckets at a time:
+ *
+ *  1. _dictRehashAsyncStart() collects the entries of the next buckets of
+ *     ht[0] and passes them to the proc set with dictSetAsyncRehashProc().
+ *  2. The helper thread calls dictRehashAsync(), which only reads the keys of
+ *     those entries, without any lock, to compute their hashes.
+ *  3. Back under the lock, dictCompleteRehashAsync() or the next operation on
+ *     the dict, whichever comes first, moves the entries to ht[1] with the
+ *     precomputed hashes and starts the next batch.
+ *
+ * While a batch is in flight lookups use both tables and new entries go to
+ * ht[1] as usual, no inline rehashing is done, and entries deleted from the
+ * dict are unlinked right away but only released once the helper is done with
+ * their keys.  Code moving entries around (defrag) or releasing the dict
+ * outside of the lock has to call dictAbandonRehashAsync() first.
+ *
+ * The helper hashes a batch a chunk of keys at a time, and checks before each
+ * chunk that the batch wasn't abandoned.  Abandoning a batch thus only waits
+ * for the chunk being hashed, if any, and the helper releases the batch. */
+
+#define DICT_ASYNC_REHASH_BUCKETS 1024  /* buckets per batch */
+#define DICT_ASYNC_REHASH_CHUNK 64      /* keys hashed between abandon checks */
+#define DICT_ASYNC_REHASH_MAX_INFLIGHT 64 /* batches not completed yet */
+
+struct dictAsyncRehashCtl {
+    struct workItem {
+        dictEntry *de;
+        uint64_t hash;
+    };
+
+    dict *d;                        /* NULL once moved or abandoned */
+    dictType *type;
+    unsigned long idxStart, idxEnd; /* the buckets of ht[0] in the batch */
+    std::vector<workItem> queue;    /* their entries, in chain order */
+    dictEntry *deGCList = nullptr;  /* entries deleted while in flight */
+    std::atomic<bool> fHashed {false};
+    enum { Idle, Hashing, Abandoned };
+    std::atomic<int> state {Idle};  /* Hashing while the helper reads keys */
+
+    dictAsyncRehashCtl(dict *d) : d(d), type(d->type) {}
+};
+
+int dictAsyncRehash = 0;
+static dictAsyncRehashProc *dict_async_rehash_proc = NULL;
+static std::atomic<int> dict_async_rehash_inflight {0};
+static std::atomic<unsigned long long> dict_async_rehash_batches {0};
+static std::atomic<unsigned long long> dict_async_rehash_entries {0};
+static std::atomic<unsigned long long> dict_async_rehash_abandoned {0};
+static std::atomic<unsigned long long> dict_async_rehash_hash_usec {0};
+static std::atomic<unsigned long long> dict_async_rehash_move_usec {0};
+
+void dictSetAsyncRehashProc(dictAsyncRehashProc *proc) {
+    dict_async_rehash_proc = proc;
+}
+
+static int _dictCanRehashAsync(dict *d) {
+    return dictAsyncRehash && dict_async_rehash_proc != NULL &&
+        (d->type->flags & DICT_TYPE_ASYNC_REHASH) && !dictIsOpenAddressing(d) &&
+        d->ht[0].size >= DICT_ASYNC_REHASH_MIN_SIZE &&
+        dict_async_rehash_inflight.load(std::memory_order_relaxed) < DICT_ASYNC_REHASH_MAX_INFLIGHT;
+}
+
+static void _dictFreeGCList(dict *d, dictEntry *de) {
+    while (de) {
+        dictEntry *next = de->next;
+        dictFreeKey(d, de);
+        zfree(de);
+        de = next;
+    }
+}
+
+/* Collect the entries of the next buckets to rehash and hand them to the
+ * helper. */
+static void _dictRehashAsyncStart(dict *d) {
+    int empty_visits = DICT_ASYNC_REHASH_BUCKETS*10;
+    int buckets = DICT_ASYNC_REHASH_BUCKETS;
+    unsigned long idx = d->rehashidx;
+    dictAsyncRehashCtl *ctl = new (MALLOC_LOCAL) dictAsyncRehashCtl(d);
+
+    ctl->queue.reserve(DICT_ASYNC_REHASH_BUCKETS);
+    while (buckets && idx < d->ht[0].size) {
+        dictEntry *de = d->ht[0].table[idx++];
+        if (de == NULL) {
+            if (--empty_visits == 0) break;
+            continue;
+        }
+        for (; de != NULL; de = de->next)
+            ctl->queue.push_back({de, 0});
+        buckets--;
+    }
+    ctl->idxStart = d->rehashidx;
+    ctl->idxEnd = idx;
+
+    if (ctl->queue.empty()) {
+        /* Nothing but empty buckets, or deletions emptied ht[0] */
+        d->rehashidx = idx;
+        if (d->ht[0].used == 0 || idx == d->ht[0].size) dictRehash(d,0);
+        delete ctl;
+        return;
+    }
+    d->asyncdata = ctl;
+    dict_async_rehash_inflight++;
+    dict_async_rehash_proc(ctl);
+}
+
+/* Move the entries of a batch the helper hashed to ht[1]. */
+static void _dictRehashAsyncMove(dict *d, dictAsyncRehashCtl *ctl) {
+    long long start = timeInMicroseconds();
+
+    _dictWillModify(d);
+    d->asyncdata = NULL;
+    ctl->d = NULL;
+    if (d->iterators == 0) {
+        size_t iitem = 0;
+
+        assert((unsigned long)d->rehashidx == ctl->idxStart);
+        for (unsigned long idx = ctl->idxStart; idx < ctl->idxEnd; idx++) {
+            dictEntry *de = d->ht[0].table[idx];
+            while (de) {
+                dictEntry *nextde = de->next;
+                uint64_t h;
+
+                /* The chain can only have lost entries since the batch was
+                 * collected, new ones go to ht[1]. */
+                while (ctl->queue[iitem].de != de) {
+                    iitem++;
+                    assert(iitem < ctl->queue.size());
+                }
+                h = ctl->queue[iitem].hash & d->ht[1].sizemask;
+                de->next = d->ht[1].table[h];
+                d->ht[1].table[h] = de;
+                d->ht[0].used--;
+                d->ht[1].used++;
+                de = nextde;
+            }
+            d->ht[0].table[idx] = NULL;
+        }
+        d->rehashidx = ctl->idxEnd;
+        dictRehash(d,0); /* releases ht[0] if this was the last batch */
+        dict_async_rehash_batches++;
+        dict_async_rehash_entries += ctl->queue.size();
+    } else {
+        /* Moving entries would confuse the safe iterator */
+        dict_async_rehash_abandoned++;
+    }
+    _dictFreeGCList(d, ctl->deGCList);
+    ctl->deGCList = nullptr;
+    dict_async_rehash_move_usec += timeInMicroseconds()-start;
+}
+
+/* The rehashing step of dicts rehashed with a helper: move the batch it is
+ * done with, if any, and start the next one.  Returns 0 if the dict is to be
+ * rehashed inline instead. */
+static int _dictRehashAsyncStep(dict *d) {
+    dictAsyncRehashCtl *ctl = d->asyncdata;
+
+    if (ctl != NULL) {
+        if (!ctl->fHashed.load(std::memory_order_acquire))
+            return 1; /* the helper is still on it */
+        _dictRehashAsyncMove(d, ctl);
+    }
+    if (!dictIsRehashing(d) || !_dictCanRehashAsync(d)) return ctl != NULL;
+    _dictRehashAsyncStart(d);
+    return 1;
+}
+
+/* Called by the helper thread, without holding any lock, with a batch passed
+ * to the dictAsyncRehashProc.  Returns 1 once done, the batch then has to be
+ * passed to dictCompleteRehashAsync() under the lock.  Returns 0 if the batch
+ * was abandoned meanwhile, in which case it was released. */
+int dictRehashAsync(dictAsyncRehashCtl *ctl) {
+    long long start = timeInMicroseconds();
+
+    for (size_t iitem = 0; iitem < ctl->queue.size(); iitem += DICT_ASYNC_REHASH_CHUNK) {
+        int expected = dictAsyncRehashCtl::Idle;
+        if (!ctl->state.compare_exchange_strong(expected, dictAsyncRehashCtl::Hashing,
+                std::memory_order_acquire))
+        {
+            /* Abandoned: the keys may be gone already, and nobody else
+             * references the batch anymore */
+            dict_async_rehash_hash_usec += timeInMicroseconds()-start;
+            dict_async_rehash_inflight--;
+            delete ctl;
+            return 0;
+        }
+        size_t iend = std::min(iitem+DICT_ASYNC_REHASH_CHUNK, ctl->queue.size());
+        for (size_t i = iitem; i < iend; i++)
+            ctl->queue[i].hash = ctl->type->hashFunction(ctl->queue[i].de->key);
+        ctl->state.store(dictAsyncRehashCtl::Idle, std::memory_order_release);
+    }
+    dict_async_rehash_hash_usec += timeInMicroseconds()-start;
+    ctl->fHashed.store(true, std::memory_order_release);
+    return 1;
+}
+
+/* Move the entries of a batch hashed by dictRehashAsync(), unless that was
+ * already done or the batch was abandoned, and release it. */
+void dictCompleteRehashAsync(dictAsyncRehashCtl *ctl) {
+    dict *d = ctl->d;
+
+    assert(ctl->fHashed.load(std::memory_order_acquire));
+    dict_async_rehash_inflight--;
+    if (d != NULL) {
+        _dictRehashAsyncMove(d, ctl);
+        if (dictIsRehashing(d) && d->iterators == 0 && _dictCanRehashAsync(d))
+            _dictRehashAsyncStart(d);
+    }
+    delete ctl;
+}
+
+/* Drop the batch in flight for 'd', if any: its entries are simply left in
+ * ht[0].  The helper stops reading their keys at its next chunk, this only
+ * waits for the chunk it is hashing right now, if any. */
+void dictAbandonRehashAsync(dict *d) {
+    dictAsyncRehashCtl *ctl = d->asyncdata;
+
+    if (ctl == NULL) return;
+    d->asyncdata = NULL;
+    ctl->d = NULL;
+    dict_async_rehash_abandoned++;
+
+    /* Once hashed the batch waits for dictCompleteRehashAsync(), which only
+     * releases it now that it has no dict.  Otherwise the helper releases it
+     * as soon as it sees it abandoned, so take the deleted entries first. */
+    dictEntry *deGCList = ctl->deGCList;
+    ctl->deGCList = nullptr;
+    if (!ctl->fHashed.load(std::memory_order_acquire)) {
+        for (;;) {
+            int expected = dictAsyncRehashCtl::Idle;
+            if (ctl->state.compare_exchange_weak(expected, dictAsyncRehashCtl::Abandoned,
+                    std::memory_order_acq_rel))
+                break;
+            std::this_thread::yield();
+        }
+    }
+    _dictFreeGCList(d, deGCList);
+}
+
+void dictGetAsyncRehashStats(dictAsyncRehashStats *stats) {
+    stats->batches = dict_async_rehash_batches.load(std::memory_order_relaxed);
+    stats->entries = dict_async_rehash_entries.load(std::memory_order_relaxed);
+    stats->abandoned = dict_async_rehash_abandoned.load(std::memory_order_relaxed);
+    stats->hash_usec = dict_async_rehash_hash_usec.load(std::memory_order_relaxed);
+    stats->move_usec = dict_async_rehash_move_usec.load(std::memory_order_relaxed);
+}
+
+void dictResetAsyncRehashStats(void) {
+    dict_async_rehash_batches = 0;
+    dict_async_rehash_entries = 0;
+    dict_async_rehash_abandoned = 0;
+    dict_async_rehash_hash_usec = 0;
+    dict_async_rehash_move_usec = 0;
 }
 
 /* Add an element to the target hash table */
@@ -294,12 +838,15 @@ dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
     long index;
     dictEntry *entry;
     dictht *ht;
+    uint64_t hash;
 
+    _dictWillModify(d);
     if (dictIsRehashing(d)) _dictRehashStep(d);
 
     /* Get the index of the new element, or -1 if
      * the element already exists. */
-    if ((index = _dictKeyIndex(d, key, dictHashKey(d,key), existing)) == -1)
+    hash = dictHashKey(d,key);
+    if ((index = _dictKeyIndex(d, key, hash, existing)) == -1)
         return NULL;
 
     /* Allocate the memory and store the new entry.
@@ -307,13 +854,24 @@ dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing)
      * system it is more likely that recently added entries are accessed
      * more frequently. */
     ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
-    entry = (dictEntry*)zmalloc(sizeof(*entry), MALLOC_SHARED);
-    entry->next = ht->table[index];
-    ht->table[index] = entry;
-    ht->used++;
+    if (dictEmbedsKeys(d)) {
+        entry = (dictEntry*)zmalloc(sizeof(*entry) + d->type->embedKeyLen(key), MALLOC_SHARED);
+    } else {
+        entry = (dictEntry*)zmalloc(sizeof(*entry), MALLOC_SHARED);
+    }
+    if (dictIsOpenAddressing(d)) {
+        _dictOAInsertAt(ht, index, entry, hash);
+    } else {
+        entry->next = ht->table[index];
+        ht->table[index] = entry;
+        ht->used++;
+    }
 
     /* Set the hash entry fields. */
-    dictSetKey(d, entry, key);
+    if (dictEmbedsKeys(d))
+        entry->key = d->type->embedKey(entry + 1, key);
+    else
+        dictSetKey(d, entry, key);
     return entry;
 }
 
@@ -368,10 +926,31 @@ static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
 
     if (d->ht[0].used == 0 && d->ht[1].used == 0) return NULL;
 
+    _dictWillModify(d);
     if (dictIsRehashing(d)) _dictRehashStep(d);
     h = dictHashKey(d, key);
 
     for (table = 0; table <= 1; table++) {
+        if (dictIsOpenAddressing(d)) {
+            long slot = _dictOAFind(d, &d->ht[table], key, h);
+            if (slot != -1) {
+                he = d->ht[table].table[slot];
+                _dictOAEraseAt(d, &d->ht[table], slot);
+                if (!nofree) _dictFreeEntry(d, he);
+                return he;
+            }
+            dictEntry **ref = _dictOAFindChained(d, &d->ht[table], key, h);
+            if (ref != NULL) {
+                he = *ref;
+                *ref = he->next;
+                (*_dictOAOverflow(&d->ht[table]))--;
+                d->ht[table].used--;
+                if (!nofree) _dictFreeEntry(d, he);
+                return he;
+            }
+            if (!dictIsRehashing(d)) break;
+            continue;
+        }
         idx = h & d->ht[table].sizemask;
         he = d->ht[table].table[idx];
         prevHe = NULL;
@@ -382,11 +961,7 @@ static dictEntry *dictGenericDelete(dict *d, const void *key, int nofree) {
                     prevHe->next = he->next;
                 else
                     d->ht[table].table[idx] = he->next;
-                if (!nofree) {
-                    dictFreeKey(d, he);
-                    dictFreeVal(d, he);
-                    zfree(he);
-                }
+                if (!nofree) _dictFreeEntry(d, he);
                 d->ht[table].used--;
                 return he;
             }
@@ -433,8 +1008,19 @@ dictEntry *dictUnlink(dict *ht, const void *key) {
  * to dictUnlink(). It's safe to call this function with 'he' = NULL. */
 void dictFreeUnlinkedEntry(dict *d, dictEntry *he) {
     if (he == NULL) return;
-    dictFreeKey(d, he);
+    _dictFreeEntry(d, he);
+}
+
+/* Release an entry removed from the dict.  While a rehash batch is in flight
+ * the helper may still be reading its key, so only the value goes now. */
+static void _dictFreeEntry(dict *d, dictEntry *he) {
     dictFreeVal(d, he);
+    if (d->asyncdata != NULL) {
+        he->next = d->asyncdata->deGCList;
+        d->asyncdata->deGCList = he;
+        return;
+    }
+    dictFreeKey(d, he);
     zfree(he);
 }
 
@@ -442,6 +1028,7 @@ void dictFreeUnlinkedEntry(dict *d, dictEntry *he) {
 int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
     unsigned long i;
 
+    _dictWillModify(d);
     /* Free all the elements */
     for (i = 0; i < ht->size && ht->used > 0; i++) {
         dictEntry *he, *nextHe;
@@ -468,6 +1055,7 @@ int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
 /* Clear & Release the hash table */
 void dictRelease(dict *d)
 {
+    dictAbandonRehashAsync(d);
     _dictClear(d,&d->ht[0],NULL);
     _dictClear(d,&d->ht[1],NULL);
     zfree(d);
@@ -482,6 +1070,14 @@ dictEntry *dictFind(dict *d, const void *key)
     if (dictIsRehashing(d)) _dictRehashStep(d);
     h = dictHashKey(d, key);
     for (table = 0; table <= 1; table++) {
+        if (dictIsOpenAddressing(d)) {
+            long slot = _dictOAFind(d, &d->ht[table], key, h);
+            if (slot != -1) return d->ht[table].table[slot];
+            dictEntry **ref = _dictOAFindChained(d, &d->ht[table], key, h);
+            if (ref != NULL) return *ref;
+            if (!dictIsRehashing(d)) return NULL;
+            continue;
+        }
         idx = h & d->ht[table].sizemask;
         he = d->ht[table].table[idx];
         while(he) {
@@ -775,6 +1371,53 @@ static unsigned long rev(unsigned long v) {
     return v;
 }
 
+/* Emit the entries of bucket 'idx' of 't' for dictScan(): its chain, or for
+ * open addressing tables every entry whose home slot is 'idx'.  Those are
+ * found along the probe sequence starting at 'idx', the same way lookups
+ * find them, plus the overflow entries chained to slot 'idx'. */
+static void _dictScanBucket(dict *d, dictht *t, unsigned long idx,
+                            dictScanFunction *fn,
+                            dictScanBucketFunction *bucketfn,
+                            void *privdata)
+{
+    if (dictIsOpenAddressing(d)) {
+        const int8_t *ctrl = _dictOACtrl(t);
+        unsigned long pos = idx, step = 0;
+        if (*_dictOAOverflow(t) != 0 && t->table[idx] != NULL) {
+            const dictEntry *de, *next;
+            for (de = t->table[idx]->next; de != NULL; de = next) {
+                next = de->next;
+                fn(privdata, de);
+            }
+        }
+        for (;;) {
+            uint32_t full = ~_dictGroupMatchFree(ctrl + pos) & ((1u << DICT_GROUP_WIDTH) - 1);
+            while (full) {
+                unsigned long slot = (pos + __builtin_ctz(full)) & t->sizemask;
+                full &= full - 1;
+                if (t->table[slot] == NULL ||
+                    _dictOAHome(t, dictHashKey(d, t->table[slot]->key)) != idx)
+                    continue;
+                if (bucketfn) bucketfn(privdata, &t->table[slot]);
+                fn(privdata, t->table[slot]);
+            }
+            if (_dictGroupMatch(ctrl + pos, DICT_CTRL_EMPTY)) return;
+            step += DICT_GROUP_WIDTH;
+            if (step >= t->size) return;
+            pos = (pos + step) & t->sizemask;
+        }
+    }
+
+    const dictEntry *de, *next;
+    if (bucketfn) bucketfn(privdata, &t->table[idx]);
+    de = t->table[idx];
+    while (de) {
+        next = de->next;
+        fn(privdata, de);
+        de = next;
+    }
+}
+
 /* dictScan() is used to iterate over the elements of a dictionary.
  *
  * Iterating works the following way:
@@ -866,7 +1509,6 @@ unsigned long dictScan(dict *d,
                        void *privdata)
 {
     dictht *t0, *t1;
-    const dictEntry *de, *next;
     unsigned long m0, m1;
 
     if (dictSize(d) == 0) return 0;
@@ -876,13 +1518,7 @@ unsigned long dictScan(dict *d,
         m0 = t0->sizemask;
 
         /* Emit entries at cursor */
-        if (bucketfn) bucketfn(privdata, &t0->table[v & m0]);
-        de = t0->table[v & m0];
-        while (de) {
-            next = de->next;
-            fn(privdata, de);
-            de = next;
-        }
+        _dictScanBucket(d, t0, v & m0, fn, bucketfn, privdata);
 
         /* Set unmasked bits so incrementing the reversed cursor
          * operates on the masked bits */
@@ -907,25 +1543,13 @@ unsigned long dictScan(dict *d,
         m1 = t1->sizemask;
 
         /* Emit entries at cursor */
-        if (bucketfn) bucketfn(privdata, &t0->table[v & m0]);
-        de = t0->table[v & m0];
-        while (de) {
-            next = de->next;
-            fn(privdata, de);
-            de = next;
-        }
+        _dictScanBucket(d, t0, v & m0, fn, bucketfn, privdata);
 
         /* Iterate over indices in larger table that are the expansion
          * of the index pointed to by the cursor in the smaller table */
         do {
             /* Emit entries at cursor */
-            if (bucketfn) bucketfn(privdata, &t1->table[v & m1]);
-            de = t1->table[v & m1];
-            while (de) {
-                next = de->next;
-                fn(privdata, de);
-                de = next;
-            }
+            _dictScanBucket(d, t1, v & m1, fn, bucketfn, privdata);
 
             /* Increment the reverse cursor not covered by the smaller mask.*/
             v |= ~m1;
@@ -940,11 +1564,89 @@ unsigned long dictScan(dict *d,
     return v;
 }
 
+/* Returns non zero if an iteration of dictScan() that started from cursor 0
+ * and returned 'v' (not yet 0 again) already visited the bucket of 'key'.
+ *
+ * The buckets dictScan() visited so far are the ones whose reversed index is
+ * smaller than the reversed cursor.  The cursor only has bits set within the
+ * mask of the smaller table, so comparing with the whole reversed hash gives
+ * the same answer whatever the size of the tables, and it stays true for the
+ * rest of the iteration.  Note that after the table shrinks dictScan() may
+ * return again entries this function already reported as visited. */
+int dictScanCovered(dict *d, unsigned long v, const void *key) {
+    return dictScanKeyOrder(d, key) < dictScanCursorOrder(v);
+}
+
+/* Returns the position of 'key' in the order dictScan() visits the entries:
+ * the reversed bits of the hash it is bucketed by, regardless of the size of
+ * the tables.  A scan that starts from the cursor dictScanCursorOrder(o)
+ * visits every key of order o or above before returning a cursor 'v' with
+ * dictScanCursorOrder(v) above the order of the key, so disjoint ranges of
+ * the order space can be scanned independently. */
+unsigned long dictScanKeyOrder(dict *d, const void *key) {
+    uint64_t h = dictHashKey(d, key);
+    unsigned long bucket = dictIsOpenAddressing(d) ? (unsigned long)(h >> 7) : (unsigned long)h;
+    return rev(bucket);
+}
+
+/* Returns the order of the cursor 'v', see dictScanKeyOrder().  The mapping
+ * is its own inverse: it also returns the cursor starting at an order. */
+unsigned long dictScanCursorOrder(unsigned long v) {
+    return rev(v);
+}
+
 /* ------------------------- private functions ------------------------------ */
 
+/* Move the entries of both tables of a rehashing open addressing dict to a
+ * new table at once, dissolving overflow chains.  Only done when no safe
+ * iterator is left: unlike incremental rehashing this reorders every entry,
+ * but it can't fail for lack of room in the rehashing target. */
+static void _dictOARebuild(dict *d) {
+    dictht n;
+
+    assert(d->iterators == 0);
+    _dictOAInit(&n, _dictOASizeFor((d->ht[0].used + d->ht[1].used)*2));
+    for (int table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+        for (unsigned long idx = 0; idx < ht->size; idx++) {
+            dictEntry *de = ht->table[idx];
+            while (de != NULL) {
+                dictEntry *next = de->next;
+                uint64_t h = dictHashKey(d, de->key);
+                _dictOAInsertAt(&n, _dictOAFindFree(&n, h), de, h);
+                de = next;
+            }
+        }
+        zfree(ht->table);
+        _dictReset(ht);
+    }
+    d->ht[0] = n;
+    d->rehashidx = -1;
+}
+
 /* Expand the hash table if needed */
 static int _dictExpandIfNeeded(dict *d)
 {
+    if (dictIsOpenAddressing(d)) {
+        /* Open addressing tables can't exceed their capacity, so they grow
+         * regardless of dict_can_resize.  If the rehashing target itself
+         * fills up (rehashing is paused by safe iterators, or too slow) both
+         * tables are rebuilt into a larger one, but that moves entries the
+         * safe iterators may not have returned yet: while there are any new
+         * entries are chained instead, see _dictOASlotForInsert(). */
+        if (dictIsRehashing(d)) {
+            if (!_dictOANeedsGrowth(&d->ht[1]) && *_dictOAOverflow(&d->ht[1]) == 0)
+                return DICT_OK;
+            if (d->iterators != 0) return DICT_OK;
+            _dictOARebuild(d);
+            return DICT_OK;
+        }
+        if (d->ht[0].size == 0) return dictExpand(d, DICT_HT_INITIAL_SIZE);
+        if (_dictOANeedsGrowth(&d->ht[0]) || *_dictOAOverflow(&d->ht[0]) != 0)
+            return dictExpand(d, d->ht[0].used*2);
+        return DICT_OK;
+    }
+
     /* Incremental rehashing already in progress. Return. */
     if (dictIsRehashing(d)) return DICT_OK;
 
@@ -993,6 +1695,22 @@ static long _dictKeyIndex(dict *d, const void *key, uint64_t hash, dictEntry **e
     /* Expand the hash table if needed */
     if (_dictExpandIfNeeded(d) == DICT_ERR)
         return -1;
+    if (dictIsOpenAddressing(d)) {
+        for (table = 0; table <= 1; table++) {
+            long slot = _dictOAFind(d, &d->ht[table], key, hash);
+            if (slot != -1) {
+                if (existing) *existing = d->ht[table].table[slot];
+                return -1;
+            }
+            dictEntry **ref = _dictOAFindChained(d, &d->ht[table], key, hash);
+            if (ref != NULL) {
+                if (existing) *existing = *ref;
+                return -1;
+            }
+            if (!dictIsRehashing(d)) break;
+        }
+        return _dictOASlotForInsert(&d->ht[dictIsRehashing(d) ? 1 : 0], hash);
+    }
     for (table = 0; table <= 1; table++) {
         idx = hash & d->ht[table].sizemask;
         /* Search if this slot does not already contain the given key */
@@ -1010,6 +1728,7 @@ static long _dictKeyIndex(dict *d, const void *key, uint64_t hash, dictEntry **e
 }
 
 void dictEmpty(dict *d, void(callback)(void*)) {
+    dictAbandonRehashAsync(d);
     _dictClear(d,&d->ht[0],callback);
     _dictClear(d,&d->ht[1],callback);
     d->rehashidx = -1;
@@ -1039,6 +1758,31 @@ dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t h
 
     if (d->ht[0].used + d->ht[1].used == 0) return NULL; /* dict is empty */
     for (table = 0; table <= 1; table++) {
+        if (dictIsOpenAddressing(d)) {
+            dictht *ht = &d->ht[table];
+            const int8_t *ctrl = _dictOACtrl(ht);
+            unsigned long pos = _dictOAHome(ht, hash), step = 0;
+            for (;;) {
+                uint32_t match = _dictGroupMatch(ctrl + pos, _dictOATag(hash));
+                while (match) {
+                    idx = (pos + __builtin_ctz(match)) & ht->sizemask;
+                    if (oldptr == ht->table[idx]->key) return &ht->table[idx];
+                    match &= match - 1;
+                }
+                step += DICT_GROUP_WIDTH;
+                if (_dictGroupMatch(ctrl + pos, DICT_CTRL_EMPTY) || step >= ht->size)
+                    break;
+                pos = (pos + step) & ht->sizemask;
+            }
+            if (*_dictOAOverflow(ht) != 0 && ht->table[_dictOAHome(ht, hash)] != NULL) {
+                heref = &ht->table[_dictOAHome(ht, hash)]->next;
+                for (he = *heref; he != NULL; heref = &he->next, he = *heref) {
+                    if (oldptr == he->key) return heref;
+                }
+            }
+            if (!dictIsRehashing(d)) return NULL;
+            continue;
+        }
         idx = hash & d->ht[table].sizemask;
         heref = &d->ht[table].table[idx];
         he = *heref;
@@ -1117,11 +1861,55 @@ size_t _dictGetStatsHt(char *buf, size_t bufsize, dictht *ht, int tableid) {
     return strlen(buf);
 }
 
+/* Open addressing tables have no chains, report how far entries sit from
+ * their home slot instead. */
+size_t _dictGetStatsOAHt(char *buf, size_t bufsize, dict *d, dictht *ht, int tableid) {
+    unsigned long i, disp, maxdisp = 0, totdisp = 0;
+
+    if (ht->used == 0) {
+        return snprintf(buf,bufsize,
+            "No stats available for empty dictionaries\n");
+    }
+
+    for (i = 0; i < ht->size; i++) {
+        if (ht->table[i] == NULL) continue;
+        disp = (i - _dictOAHome(ht, dictHashKey(d, ht->table[i]->key))) & ht->sizemask;
+        if (disp > maxdisp) maxdisp = disp;
+        totdisp += disp;
+    }
+
+    snprintf(buf,bufsize,
+        "Hash table %d stats (%s):\n"
+        " table size: %ld\n"
+        " number of elements: %ld\n"
+        " tombstones: %ld\n"
+        " overflow entries: %ld\n"
+        " open addressing, probe group width: %d\n"
+        " max distance from home slot: %ld\n"
+        " avg distance from home slot: %.02f\n",
+        tableid, (tableid == 0) ? "main hash table" : "rehashing target",
+        ht->size, ht->used, *_dictOADeleted(ht), *_dictOAOverflow(ht), DICT_GROUP_WIDTH,
+        maxdisp, (float)totdisp/ht->used);
+
+    if (bufsize) buf[bufsize-1] = '\0';
+    return strlen(buf);
+}
+
 void dictGetStats(char *buf, size_t bufsize, dict *d) {
     size_t l;
     char *orig_buf = buf;
     size_t orig_bufsize = bufsize;
 
+    if (dictIsOpenAddressing(d)) {
+        l = _dictGetStatsOAHt(buf,bufsize,d,&d->ht[0],0);
+        buf += l;
+        bufsize -= l;
+        if (dictIsRehashing(d) && bufsize > 0)
+            _dictGetStatsOAHt(buf,bufsize,d,&d->ht[1],1);
+        if (orig_bufsize) orig_buf[orig_bufsize-1] = '\0';
+        return;
+    }
+
     l = _dictGetStatsHt(buf,bufsize,&d->ht[0],0);
     buf += l;
     bufsize -= l;
@@ -1132,12 +1920,104 @@ void dictGetStats(char *buf, size_t bufsize, dict *d) {
     if (orig_bufsize) orig_buf[orig_bufsize-1] = '\0';
 }
 
+/* ------------------------------- Test ------------------------------------*/
+
+#ifdef REDIS_TEST
+#include <stdio.h>
+
+#define UNUSED(x) (void)(x)
+
+static uint64_t dictTestHash(const void *key) {
+    uintptr_t v = (uintptr_t)key;
+    return dictGenHashFunction(&v, sizeof(v));
+}
+
+/* Insert well past the capacity of the rehashing target while a safe iterator
+ * is walking the dict, then check that it returned every key that was there
+ * before exactly once, and that nothing was lost. */
+static int dictTestInsertUnderIterator(unsigned flags) {
+    dictType type = {dictTestHash, NULL, NULL, NULL, NULL, NULL, flags, NULL, NULL};
+    dict *d = dictCreate(&type, NULL);
+    const uintptr_t initial = 1000, total = 200000;
+    unsigned char *seen = (unsigned char*)zcalloc(initial+1, MALLOC_LOCAL);
+    uintptr_t next = initial+1;
+    dictEntry *de;
+    int ok = 1;
+
+    for (uintptr_t i = 1; i <= initial; i++) dictAdd(d, (void*)i, NULL);
+    dictIterator *iter = dictGetSafeIterator(d);
+    while ((de = dictNext(iter)) != NULL) {
+        uintptr_t key = (uintptr_t)dictGetKey(de);
+        if (key <= initial && seen[key]++) ok = 0;
+        for (int j = 0; j < 200 && next <= total; j++, next++) {
+            if (dictAdd(d, (void*)next, NULL) != DICT_OK) ok = 0;
+        }
+    }
+    dictReleaseIterator(iter);
+    for (uintptr_t i = 1; i <= initial; i++) {
+        if (seen[i] != 1) ok = 0;
+    }
+    zfree(seen);
+
+    if (dictSize(d) != total) ok = 0;
+    for (uintptr_t i = 1; i <= total; i++) {
+        if (dictFind(d, (void*)i) == NULL) ok = 0;
+    }
+    unsigned long count = 0;
+    iter = dictGetSafeIterator(d);
+    while (dictNext(iter) != NULL) count++;
+    dictReleaseIterator(iter);
+    if (count != total) ok = 0;
+
+    /* Deleting under a safe iterator promotes overflow entries */
+    iter = dictGetSafeIterator(d);
+    while ((de = dictNext(iter)) != NULL) {
+        if ((uintptr_t)dictGetKey(de) % 2 == 0 && dictDelete(d, dictGetKey(de)) != DICT_OK) ok = 0;
+    }
+    dictReleaseIterator(iter);
+    if (dictSize(d) != total/2) ok = 0;
+    for (uintptr_t i = 1; i <= total; i++) {
+        if ((dictFind(d, (void*)i) == NULL) != (i % 2 == 0)) ok = 0;
+    }
+    dictRelease(d);
+    return ok;
+}
+
+int dictTest(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+    int failed = 0;
+
+    printf("Insert under a safe iterator, chained: ");
+    if (dictTestInsertUnderIterator(0)) {
+        printf("OK\n");
+    } else {
+        printf("FAILED\n");
+        failed = 1;
+    }
+    printf("Insert under a safe iterator, open addressing: ");
+    if (dictTestInsertUnderIterator(DICT_TYPE_OPEN_ADDRESSING)) {
+        printf("OK\n");
+    } else {
+        printf("FAILED\n");
+        failed = 1;
+    }
+    return failed;
+}
+#endif
+
 /* ------------------------------- Benchmark ---------------------------------*/
 
 #ifdef DICT_BENCHMARK_MAIN
 
 #include "sds.h"
 
+/* The server gets this one from new.cpp */
+void *operator new(size_t size, enum MALLOC_CLASS mclass) {
+    (void)mclass;
+    return ::operator new(size);
+}
+
 uint64_t hashCallback(const void *key) {
     return dictGenHashFunction((unsigned char*)key, sdslen((char*)key));
 }
@@ -1155,7 +2035,7 @@ int compareCallback(void *privdata, const void *key1, const void *key2) {
 void freeCallback(void *privdata, void *val) {
     DICT_NOTUSED(privdata);
 
-    sdsfree(val);
+    sdsfree((sds)val);
 }
 
 dictType BenchmarkDictType = {
@@ -1167,24 +2047,37 @@ dictType BenchmarkDictType = {
     NULL
 };
 
+dictType BenchmarkOpenAddressingDictType = {
+    hashCallback,
+    NULL,
+    NULL,
+    compareCallback,
+    freeCallback,
+    NULL,
+    DICT_TYPE_OPEN_ADDRESSING
+};
+
 #define start_benchmark() start = timeInMilliseconds()
 #define end_benchmark(msg) do { \
     elapsed = timeInMilliseconds()-start; \
     printf(msg ": %ld items in %lld ms\n", count, elapsed); \
 } while(0);
 
-/* dict-benchmark [count] */
+/* dict-benchmark [count] [chained|open-addressing] */
 int main(int argc, char **argv) {
     long j;
     long long start, elapsed;
-    dict *dict = dictCreate(&BenchmarkDictType,NULL);
+    dictType *type = &BenchmarkDictType;
     long count = 0;
 
-    if (argc == 2) {
+    if (argc >= 2) {
         count = strtol(argv[1],NULL,10);
     } else {
         count = 5000000;
     }
+    if (argc >= 3 && !strcmp(argv[2],"open-addressing"))
+        type = &BenchmarkOpenAddressingDictType;
+    dict *dict = dictCreate(type,NULL);
 
     start_benchmark();
     for (j = 0; j < count; j++) {
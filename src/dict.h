@@ -70,8 +70,31 @@ typedef struct dictType {
     int (*keyCompare)(void *privdata, const void *key1, const void *key2);
     void (*keyDestructor)(void *privdata, void *key);
     void (*valDestructor)(void *privdata, void *obj);
+    unsigned flags;     /* DICT_TYPE_* */
+    /* Optional: store keys inside the dictEntry allocation rather than
+     * referencing them.  embedKeyLen() returns how many bytes 'key' needs and
+     * embedKey() copies it into 'buf', returning the pointer to store in the
+     * entry.  The caller of dictAdd() keeps ownership of the key it passed,
+     * and embedded keys are released along with their entry. */
+    size_t (*embedKeyLen)(const void *key);
+    void *(*embedKey)(void *buf, const void *key);
 } dictType;
 
+/* Store the entries of the dict in open addressing tables probed a group of
+ * control bytes at a time, rather than in chained buckets.  See the
+ * "open addressing" section of dict.c. */
+#define DICT_TYPE_OPEN_ADDRESSING (1<<0)
+/* Let large tables of this type be rehashed with the help of another thread,
+ * see the "asynchronous rehashing" section of dict.c.  Only for dicts that are
+ * never accessed without holding the lock the helper's results are applied
+ * under. */
+#define DICT_TYPE_ASYNC_REHASH (1<<1)
+/* Dicts of this type may be read without the lock, so the proc set with
+ * dictSetModifyProc() is called before they are changed. */
+#define DICT_TYPE_READ_SHARED (1<<2)
+
+struct dictAsyncRehashCtl;
+
 /* This is our hash table structure. Every dictionary has two of this as we
  * implement incremental rehashing, for the old to the new table. */
 typedef struct dictht {
@@ -87,6 +110,7 @@ typedef struct dict {
     dictht ht[2];
     long rehashidx; /* rehashing not in progress if rehashidx == -1 */
     unsigned long iterators; /* number of iterators currently running */
+    struct dictAsyncRehashCtl *asyncdata; /* rehash batch being hashed by a helper */
 } dict;
 
 /* If safe is set to 1 this is a safe iterator, that means, you can call
@@ -103,11 +127,25 @@ typedef struct dictIterator {
 } dictIterator;
 
 typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
+typedef void (dictAsyncRehashProc)(struct dictAsyncRehashCtl *ctl);
+typedef void (dictModifyProc)(void);
+
+/* Counters of the rehashing done through dictRehashAsync() */
+typedef struct dictAsyncRehashStats {
+    unsigned long long batches;     /* batches moved to the new table */
+    unsigned long long entries;     /* entries moved by those batches */
+    unsigned long long abandoned;   /* batches dropped before being moved */
+    unsigned long long hash_usec;   /* time helpers spent hashing keys */
+    unsigned long long move_usec;   /* time spent moving the hashed entries */
+} dictAsyncRehashStats;
 typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
 
 /* This is the initial size of every hash table */
 #define DICT_HT_INITIAL_SIZE     4
 
+/* Tables with fewer buckets than this are always rehashed inline */
+#define DICT_ASYNC_REHASH_MIN_SIZE (1<<14)
+
 /* ------------------------------- Macros ------------------------------------*/
 #define dictFreeVal(d, entry) \
     if ((d)->type->valDestructor) \
@@ -154,6 +192,7 @@ typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
 #define dictSlots(d) ((d)->ht[0].size+(d)->ht[1].size)
 #define dictSize(d) ((d)->ht[0].used+(d)->ht[1].used)
 #define dictIsRehashing(d) ((d)->rehashidx != -1)
+#define dictEmbedsKeys(d) ((d)->type->embedKey != NULL)
 
 /* API */
 dict *dictCreate(dictType *type, void *privDataPtr);
@@ -187,14 +226,35 @@ int dictRehashMilliseconds(dict *d, int ms);
 void dictSetHashFunctionSeed(uint8_t *seed);
 uint8_t *dictGetHashFunctionSeed(void);
 unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, dictScanBucketFunction *bucketfn, void *privdata);
+int dictScanCovered(dict *d, unsigned long v, const void *key);
+unsigned long dictScanKeyOrder(dict *d, const void *key);
+unsigned long dictScanCursorOrder(unsigned long v);
 uint64_t dictGetHash(dict *d, const void *key);
 dictEntry **dictFindEntryRefByPtrAndHash(dict *d, const void *oldptr, uint64_t hash);
+void dictSetAsyncRehashProc(dictAsyncRehashProc *proc);
+int dictRehashAsync(struct dictAsyncRehashCtl *ctl);
+void dictCompleteRehashAsync(struct dictAsyncRehashCtl *ctl);
+void dictAbandonRehashAsync(dict *d);
+void dictGetAsyncRehashStats(dictAsyncRehashStats *stats);
+void dictResetAsyncRehashStats(void);
+void dictSetModifyProc(dictModifyProc *proc);
+void dictWillModify(void);
+
+/* When non zero lookups made by this thread never rehash */
+extern __thread int dictNoRehashThisThread;
+
+/* When zero every dict is rehashed inline, see dictSetAsyncRehashProc() */
+extern int dictAsyncRehash;
 
 /* Hash table types */
 extern dictType dictTypeHeapStringCopyKey;
 extern dictType dictTypeHeapStrings;
 extern dictType dictTypeHeapStringCopyKeyValue;
 
+#ifdef REDIS_TEST
+int dictTest(int argc, char *argv[]);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
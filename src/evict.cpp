@@ -157,7 +157,11 @@ void processEvictionCandidate(int dbid, sds key, robj *o, const expireEntry *e,
     /* Calculate the idle time according to the policy. This is called
         * idle just because the code initially handled LRU, but is in fact
         * just a score where an higher score means better candidate. */
-    if (g_pserver->maxmemory_policy & MAXMEMORY_FLAG_LRU) {
+    if ((g_pserver->maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU)) && o != nullptr && FInlineVal(o)) {
+        /* Values were inlined while no access time was tracked for them, they
+         * are the first to go once it is. */
+        idle = ULLONG_MAX;
+    } else if (g_pserver->maxmemory_policy & MAXMEMORY_FLAG_LRU) {
         idle = (o != nullptr) ? estimateObjectIdleTime(o) : 0;
     } else if (g_pserver->maxmemory_policy & MAXMEMORY_FLAG_LFU) {
         /* When we use an LRU policy, we sort the keys by idle time
@@ -526,7 +530,7 @@ int freeMemoryIfNeeded(void) {
                     sds key = nullptr;
 
                     dictEntry *de = dictFind(g_pserver->db[pool[k].dbid].pdict,pool[k].key);
-                    if (de != nullptr && (g_pserver->maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS || ((robj*)dictGetVal(de))->FExpires()))
+                    if (de != nullptr && (g_pserver->maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS || FEntryExpires(de)))
                         key = (sds)dictGetKey(de);
 
                     /* Remove the entry from the pool. */
@@ -77,6 +77,7 @@ void activeExpireCycleExpire(redisDb *db, expireEntry &e, long long now) {
     dictEntry *de = dictFind(db->pdict, e.key());
     robj *val = (robj*)dictGetVal(de);
     int deleted = 0;
+    dbBeforeWrite(db, (sds)dictGetKey(de));
     while (!pfat->FEmpty())
     {
         if (pfat->nextExpireEntry().when > now)
@@ -128,6 +129,54 @@ void activeExpireCycleExpire(redisDb *db, expireEntry &e, long long now) {
         removeExpire(db, keyobj);
         decrRefCount(keyobj);
     }
+    else
+    {
+        expireWheelTrack(db, e.key(), e.when());
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ * Timing wheel of due times
+ *
+ * With active-expire-timing-wheel enabled every entry of a DB expire set has a
+ * record of its key and due time in db->wheelexpire, so the active expire
+ * cycle only visits the keys that came due instead of scanning the set.
+ *
+ * Records are not removed when an expire changes or goes away, a record for
+ * the new due time is added instead. Records that no longer match the entry
+ * of their key are skipped when they come due, and once they outnumber the
+ * entries the wheel is rebuilt from the set.
+ *----------------------------------------------------------------------------*/
+
+#define EXPIRE_WHEEL_REBUILD_SLACK 4096
+
+static void expireWheelRebuild(redisDb *db) {
+    db->wheelexpire->clear();
+    auto fn = [db](expireEntry &e) {
+        db->wheelexpire->insert(e.key(), e.when());
+        return true;
+    };
+    db->setexpire->random_visit(fn);
+}
+
+/* Called each time the due time of the expire entry of 'key' changes. */
+void expireWheelTrack(redisDb *db, const char *key, long long when) {
+    if (db->wheelexpire == nullptr)
+        return;
+    db->wheelexpire->insert(key, when);
+    if (db->wheelexpire->size() > db->setexpire->size()*2 + EXPIRE_WHEEL_REBUILD_SLACK)
+        expireWheelRebuild(db);
+}
+
+/* Create or drop the wheel of 'db' according to active-expire-timing-wheel,
+ * to be called when its expire set is replaced or the option changes. */
+void expireWheelReset(redisDb *db) {
+    delete db->wheelexpire;
+    db->wheelexpire = nullptr;
+    if (g_pserver->active_expire_wheel) {
+        db->wheelexpire = new (MALLOC_LOCAL) expirewheel(mstime());
+        expireWheelRebuild(db);
+    }
 }
 
 int parseUnitString(const char *sz)
@@ -295,6 +344,10 @@ void activeExpireCycle(int type) {
         iteration++;
         now = mstime();
 
+        /* Pick up changes of active-expire-timing-wheel. */
+        if ((db->wheelexpire != nullptr) != (g_pserver->active_expire_wheel != 0))
+            expireWheelReset(db);
+
         /* If there is nothing to expire try next DB ASAP. */
         if (db->setexpire->empty())
         {
@@ -305,6 +358,35 @@ void activeExpireCycle(int type) {
         
         size_t expired = 0;
         size_t tried = 0;
+
+        if (db->wheelexpire != nullptr) {
+            /* Visit only the keys that came due. What we can't visit before
+             * the time limit stays in the due list for the next cycle. */
+            expirewheel::entry rec;
+            db->wheelexpire->advance(now);
+            while (db->wheelexpire->due_size()) {
+                if (tried && (tried % ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP) == 0) {
+                    elapsed = ustime()-start;
+                    if (elapsed > timelimit) {
+                        timelimit_exit = 1;
+                        g_pserver->stat_expired_time_cap_reached_count++;
+                        break;
+                    }
+                }
+                db->wheelexpire->pop_due(&rec);
+                ++tried;
+
+                /* Skip records of deleted keys or changed expires. */
+                auto itr = db->setexpire->find(rec.key);
+                if (itr == db->setexpire->end() || itr->when() != rec.when)
+                    continue;
+                activeExpireCycleExpire(db, *itr, now);
+                ++expired;
+            }
+            total_expired += expired;
+            continue;
+        }
+
         long long check = ACTIVE_EXPIRE_CYCLE_FAST_DURATION;    // assume a check is roughly 1us.  It isn't but good enough
         db->expireitr = db->setexpire->enumerate(db->expireitr, now, [&](expireEntry &e) __attribute__((always_inline)) {
             if (e.when() < now)
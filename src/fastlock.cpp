@@ -41,6 +41,16 @@
 #include <linux/futex.h>
 #endif
 #include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <algorithm>
+#if defined(__i386__) || defined(__amd64__)
+#include <x86intrin.h>
+#endif
 
 #ifdef __APPLE__
 #include <TargetConditionals.h>
@@ -190,7 +200,172 @@ uint64_t fastlock_getlongwaitcount()
     return rval;
 }
 
-#ifndef ASM_SPINLOCK
+/****************************************************
+ *
+ *      Contention profiler.  When g_fLockProfiling is set every
+ *      outermost acquisition records how long it waited and, on
+ *      release, how long the lock was held.  Samples are bucketed by
+ *      log2(cycles) and keyed by lock name and call site in a fixed
+ *      size open addressed table, so recording never allocates or
+ *      takes a lock itself.
+ *
+ ****************************************************/
+
+int g_fLockProfiling = 0;
+
+#define PROFILE_TABLE_SIZE 1024  /* must be a power of 2 */
+struct profileentry
+{
+    std::atomic<int> state;     // 0 empty, 1 being claimed, 2 ready
+    const char *szLock;
+    void *callsite;
+    std::atomic<uint64_t> cacquires;
+    std::atomic<uint64_t> ccontended;
+    std::atomic<uint64_t> cyclesWait;
+    std::atomic<uint64_t> rgwait[FASTLOCK_PROFILE_BUCKETS];
+    std::atomic<uint64_t> cholds;
+    std::atomic<uint64_t> cyclesHold;
+    std::atomic<uint64_t> rghold[FASTLOCK_PROFILE_BUCKETS];
+};
+static profileentry g_rgprofile[PROFILE_TABLE_SIZE];
+
+static inline uint64_t profileclock()
+{
+#if defined(__i386__) || defined(__amd64__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline int profilebucket(uint64_t cycles)
+{
+    if (cycles == 0)
+        return 0;
+    int bucket = 64 - __builtin_clzll(cycles);
+    return bucket < FASTLOCK_PROFILE_BUCKETS ? bucket : FASTLOCK_PROFILE_BUCKETS-1;
+}
+
+static profileentry *profilelookup(const char *szLock, void *callsite)
+{
+    uint64_t hash = ((uintptr_t)callsite ^ ((uintptr_t)szLock << 7)) * 0x9E3779B97F4A7C15ULL;
+    for (unsigned iprobe = 0; iprobe < PROFILE_TABLE_SIZE; ++iprobe)
+    {
+        profileentry &entry = g_rgprofile[(hash + iprobe) & (PROFILE_TABLE_SIZE-1)];
+        int state = entry.state.load(std::memory_order_acquire);
+        if (state == 0)
+        {
+            if (entry.state.compare_exchange_strong(state, 1, std::memory_order_acquire))
+            {
+                entry.szLock = szLock;
+                entry.callsite = callsite;
+                entry.state.store(2, std::memory_order_release);
+                return &entry;
+            }
+        }
+        while (state == 1)
+            state = entry.state.load(std::memory_order_acquire);
+        if (entry.szLock == szLock && entry.callsite == callsite)
+            return &entry;
+    }
+    return nullptr; // table is full, drop the sample
+}
+
+/* Set by fastlock_setcallsite() while a wrapper is taking a lock for its caller */
+static thread_local void *t_callsiteOverride = nullptr;
+
+extern "C" void fastlock_setcallsite(void *callsite)
+{
+    t_callsiteOverride = callsite;
+}
+
+static void profilerecord(struct fastlock *lock, void *callsite, uint64_t cyclesWait, bool fContended)
+{
+    if (t_callsiteOverride != nullptr)
+        callsite = t_callsiteOverride;
+    lock->m_tscAcquired = profileclock();
+    lock->m_callsiteAcquired = callsite;
+    profileentry *entry = profilelookup(lock->m_szName, callsite);
+    if (entry == nullptr)
+        return;
+    entry->cacquires.fetch_add(1, std::memory_order_relaxed);
+    if (fContended)
+        entry->ccontended.fetch_add(1, std::memory_order_relaxed);
+    entry->cyclesWait.fetch_add(cyclesWait, std::memory_order_relaxed);
+    entry->rgwait[profilebucket(cyclesWait)].fetch_add(1, std::memory_order_relaxed);
+}
+
+static void profilerelease(struct fastlock *lock)
+{
+    uint64_t cyclesHold = profileclock() - lock->m_tscAcquired;
+    lock->m_tscAcquired = 0;
+    profileentry *entry = profilelookup(lock->m_szName, lock->m_callsiteAcquired);
+    if (entry == nullptr)
+        return;
+    entry->cholds.fetch_add(1, std::memory_order_relaxed);
+    entry->cyclesHold.fetch_add(cyclesHold, std::memory_order_relaxed);
+    entry->rghold[profilebucket(cyclesHold)].fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" const char *fastlock_implementation()
+{
+#ifdef ASM_SPINLOCK
+    return "asm";
+#else
+    return "c";
+#endif
+}
+
+extern "C" void fastlock_setname(struct fastlock *lock, const char *name)
+{
+    lock->m_szName = name;
+}
+
+extern "C" void fastlock_profile_visit(void (*fn)(const struct fastlock_profile_stats *stats, void *privdata), void *privdata)
+{
+    for (profileentry &entry : g_rgprofile)
+    {
+        if (entry.state.load(std::memory_order_acquire) != 2)
+            continue;
+        fastlock_profile_stats stats;
+        stats.szLock = entry.szLock ? entry.szLock : "unnamed";
+        stats.callsite = entry.callsite;
+        stats.cacquires = entry.cacquires.load(std::memory_order_relaxed);
+        stats.ccontended = entry.ccontended.load(std::memory_order_relaxed);
+        stats.cyclesWait = entry.cyclesWait.load(std::memory_order_relaxed);
+        stats.cholds = entry.cholds.load(std::memory_order_relaxed);
+        stats.cyclesHold = entry.cyclesHold.load(std::memory_order_relaxed);
+        for (int ibucket = 0; ibucket < FASTLOCK_PROFILE_BUCKETS; ++ibucket)
+        {
+            stats.rgwait[ibucket] = entry.rgwait[ibucket].load(std::memory_order_relaxed);
+            stats.rghold[ibucket] = entry.rghold[ibucket].load(std::memory_order_relaxed);
+        }
+        if (stats.cacquires == 0 && stats.cholds == 0)
+            continue;
+        fn(&stats, privdata);
+    }
+}
+
+extern "C" void fastlock_profile_reset()
+{
+    // Entries stay claimed, only their counters are cleared
+    for (profileentry &entry : g_rgprofile)
+    {
+        entry.cacquires = 0;
+        entry.ccontended = 0;
+        entry.cyclesWait = 0;
+        entry.cholds = 0;
+        entry.cyclesHold = 0;
+        for (int ibucket = 0; ibucket < FASTLOCK_PROFILE_BUCKETS; ++ibucket)
+        {
+            entry.rgwait[ibucket] = 0;
+            entry.rghold[ibucket] = 0;
+        }
+    }
+}
+
 #ifdef __linux__
 static int futex(volatile unsigned *uaddr, int futex_op, int val,
     const struct timespec *timeout, int val3)
@@ -199,7 +374,6 @@ static int futex(volatile unsigned *uaddr, int futex_op, int val,
                     timeout, uaddr, val3);
 }
 #endif
-#endif
 
 extern "C" pid_t gettid()
 {
@@ -225,11 +399,15 @@ extern "C" void fastlock_init(struct fastlock *lock)
     lock->m_depth = 0;
     lock->m_pidOwner = -1;
     lock->futex = 0;
+    lock->m_szName = nullptr;
+    lock->m_tscAcquired = 0;
+    lock->m_callsiteAcquired = nullptr;
     ANNOTATE_RWLOCK_CREATE(lock);
 }
 
-#ifndef ASM_SPINLOCK
-extern "C" void fastlock_lock(struct fastlock *lock)
+/* The C implementation.  It is always built: ASM_SPINLOCK builds still use it
+ * while the profiler is on, see fastlock_x64.asm. */
+static inline __attribute__((always_inline)) void fastlock_lock_impl(struct fastlock *lock, void *callsite)
 {
     int pidOwner;
     __atomic_load(&lock->m_pidOwner, &pidOwner, __ATOMIC_ACQUIRE);
@@ -240,6 +418,8 @@ extern "C" void fastlock_lock(struct fastlock *lock)
     }
 
     int tid = gettid();
+    uint64_t tscStart = g_fLockProfiling ? profileclock() : 0;
+    bool fContended = false;
     unsigned myticket = __atomic_fetch_add(&lock->m_ticket.m_avail, 1, __ATOMIC_RELEASE);
 #ifdef __linux__
     unsigned mask = (1U << (myticket % 32));
@@ -250,6 +430,7 @@ extern "C" void fastlock_lock(struct fastlock *lock)
     __atomic_load(&lock->m_ticket.u, &ticketT.u, __ATOMIC_ACQUIRE);
     if ((ticketT.u & 0xffff) != myticket)
     {
+        fContended = true;
         registerwait(lock, tid);
         for (;;)
         {
@@ -277,9 +458,11 @@ extern "C" void fastlock_lock(struct fastlock *lock)
     __atomic_store(&lock->m_pidOwner, &tid, __ATOMIC_RELEASE);
     ANNOTATE_RWLOCK_ACQUIRED(lock, true);
     std::atomic_thread_fence(std::memory_order_acquire);
+    if (tscStart != 0)
+        profilerecord(lock, callsite, profileclock() - tscStart, fContended);
 }
 
-extern "C" int fastlock_trylock(struct fastlock *lock, int fWeak)
+static inline __attribute__((always_inline)) int fastlock_trylock_impl(struct fastlock *lock, int fWeak, void *callsite)
 {
     int tid;
     __atomic_load(&lock->m_pidOwner, &tid, __ATOMIC_ACQUIRE);
@@ -306,6 +489,8 @@ extern "C" int fastlock_trylock(struct fastlock *lock, int fWeak)
         tid = gettid();
         __atomic_store(&lock->m_pidOwner, &tid,  __ATOMIC_RELEASE);
         ANNOTATE_RWLOCK_ACQUIRED(lock, true);
+        if (g_fLockProfiling)
+            profilerecord(lock, callsite, 0, false /*fContended*/);
         return true;
     }
     return false;
@@ -313,7 +498,7 @@ extern "C" int fastlock_trylock(struct fastlock *lock, int fWeak)
 
 #ifdef __linux__
 #define ROL32(v, shift) ((v << shift) | (v >> (32-shift)))
-void unlock_futex(struct fastlock *lock, uint16_t ifutex)
+static void unlock_futex(struct fastlock *lock, uint16_t ifutex)
 {
     unsigned mask = (1U << (ifutex % 32));
     unsigned futexT;
@@ -336,11 +521,13 @@ void unlock_futex(struct fastlock *lock, uint16_t ifutex)
 }
 #endif
 
-extern "C" void fastlock_unlock(struct fastlock *lock)
+static inline __attribute__((always_inline)) void fastlock_unlock_impl(struct fastlock *lock)
 {
     --lock->m_depth;
     if (lock->m_depth == 0)
     {
+        if (lock->m_tscAcquired != 0)
+            profilerelease(lock);
         int pidT;
         __atomic_load(&lock->m_pidOwner, &pidT, __ATOMIC_RELAXED);
         assert(pidT >= 0);  // unlock after free
@@ -356,6 +543,41 @@ extern "C" void fastlock_unlock(struct fastlock *lock)
 #endif
     }
 }
+
+#ifndef ASM_SPINLOCK
+extern "C" void fastlock_lock(struct fastlock *lock)
+{
+    fastlock_lock_impl(lock, __builtin_return_address(0));
+}
+
+extern "C" int fastlock_trylock(struct fastlock *lock, int fWeak)
+{
+    return fastlock_trylock_impl(lock, fWeak, __builtin_return_address(0));
+}
+
+extern "C" void fastlock_unlock(struct fastlock *lock)
+{
+    fastlock_unlock_impl(lock);
+}
+#else
+/* fastlock_x64.asm jumps (rather than calls) to these when it has to defer to
+ * the profiler, so our return address is still the one of its caller. */
+static_assert(offsetof(struct fastlock, m_tscAcquired) == 24, "fastlock_x64.asm reads m_tscAcquired at this offset");
+
+extern "C" void fastlock_lock_profiled(struct fastlock *lock)
+{
+    fastlock_lock_impl(lock, __builtin_return_address(0));
+}
+
+extern "C" int fastlock_trylock_profiled(struct fastlock *lock, int fWeak)
+{
+    return fastlock_trylock_impl(lock, fWeak, __builtin_return_address(0));
+}
+
+extern "C" void fastlock_unlock_profiled(struct fastlock *lock)
+{
+    fastlock_unlock_impl(lock);
+}
 #endif
 
 extern "C" void fastlock_free(struct fastlock *lock)
@@ -387,4 +609,284 @@ void fastlock_lock_recursive(struct fastlock *lock, int nesting)
 {
     fastlock_lock(lock);
     lock->m_depth = nesting;
-}
\ No newline at end of file
+}
+/****************************************************
+ *
+ *      Cohort lock, see fastlock.h
+ *
+ ****************************************************/
+
+#ifdef __linux__
+static int numaNodeOfCpu(int cpu)
+{
+    char szPath[64];
+    snprintf(szPath, sizeof(szPath), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(szPath);
+    if (dir == nullptr)
+        return 0;
+    int node = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != nullptr)
+    {
+        if (strncmp(de->d_name, "node", 4) == 0 && isdigit(de->d_name[4]))
+        {
+            node = atoi(de->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+#endif
+
+/* The node is sampled once per thread, threads that should stay on a node
+ * are expected to be pinned (server-thread-affinity).  A thread that later
+ * migrates still works correctly, it just gets the wrong cohort. */
+static int currentCohort()
+{
+    static thread_local int icohort = -1;
+    if (icohort < 0)
+    {
+        int node = 0;
+#ifdef __linux__
+        int cpu = sched_getcpu();
+        if (cpu >= 0)
+            node = numaNodeOfCpu(cpu);
+#endif
+        icohort = node % COHORT_MAX_NODES;
+    }
+    return icohort;
+}
+
+int fastlock_numa_node_count()
+{
+    int cnodes = 0;
+#ifdef __linux__
+    char szPath[64];
+    for (;;)
+    {
+        snprintf(szPath, sizeof(szPath), "/sys/devices/system/node/node%d", cnodes);
+        if (access(szPath, F_OK) != 0)
+            break;
+        ++cnodes;
+    }
+#endif
+    return std::max(cnodes, 1);
+}
+
+/* The fastlocks a cohortlock takes internally are charged to its own caller */
+class cohortcallsite
+{
+    void *m_callsitePrev;
+public:
+    cohortcallsite(void *callsite)
+        : m_callsitePrev(t_callsiteOverride)
+    {
+        if (m_callsitePrev == nullptr && g_fLockProfiling)
+            t_callsiteOverride = callsite;
+    }
+
+    ~cohortcallsite()
+    {
+        t_callsiteOverride = m_callsitePrev;
+    }
+};
+
+cohortlock::cohortlock()
+{
+    fastlock_setname(&m_lockGlobal, "cohort");
+    for (cohort &c : m_rgcohort)
+        fastlock_setname(&c.lockLocal, "cohort-local");
+}
+
+void cohortlock::setname(const char *name)
+{
+    fastlock_setname(&m_lockGlobal, name);
+}
+
+void cohortlock::lock()
+{
+    int tid = gettid();
+    if (m_pidOwner == tid)
+    {
+        ++m_depth;
+        return;
+    }
+
+    cohortcallsite callsite(__builtin_return_address(0));
+    uint64_t tscStart = g_fLockProfiling ? profileclock() : 0;
+    int icohort = currentCohort();
+    cohort &c = m_rgcohort[icohort];
+    c.lockLocal.lock();
+    if (c.fGlobalOwned)
+    {
+        // Handed off by the previous holder on our node
+        __atomic_store(&m_lockGlobal.m_pidOwner, &tid, __ATOMIC_RELAXED);
+        if (tscStart != 0)
+            profilerecord(&m_lockGlobal, __builtin_return_address(0), profileclock() - tscStart, true /*fContended*/);
+    }
+    else
+    {
+        m_lockGlobal.lock();
+        c.fGlobalOwned = true;
+    }
+    m_icohortOwner = icohort;
+    m_depth = 1;
+    __atomic_store(&m_pidOwner, &tid, __ATOMIC_RELEASE);
+}
+
+bool cohortlock::try_lock(bool fWeak)
+{
+    int tid = gettid();
+    if (m_pidOwner == tid)
+    {
+        ++m_depth;
+        return true;
+    }
+
+    cohortcallsite callsite(__builtin_return_address(0));
+    int icohort = currentCohort();
+    cohort &c = m_rgcohort[icohort];
+    if (!c.lockLocal.try_lock(fWeak))
+        return false;
+    if (c.fGlobalOwned)
+    {
+        __atomic_store(&m_lockGlobal.m_pidOwner, &tid, __ATOMIC_RELAXED);
+        if (g_fLockProfiling)
+            profilerecord(&m_lockGlobal, __builtin_return_address(0), 0, false /*fContended*/);
+    }
+    else if (m_lockGlobal.try_lock(fWeak))
+    {
+        c.fGlobalOwned = true;
+    }
+    else
+    {
+        c.lockLocal.unlock();
+        return false;
+    }
+    m_icohortOwner = icohort;
+    m_depth = 1;
+    __atomic_store(&m_pidOwner, &tid, __ATOMIC_RELEASE);
+    return true;
+}
+
+void cohortlock::unlock()
+{
+    if (--m_depth > 0)
+        return;
+
+    cohort &c = m_rgcohort[m_icohortOwner];
+    int pidNone = -1;
+    m_icohortOwner = -1;
+    __atomic_store(&m_pidOwner, &pidNone, __ATOMIC_RELEASE);
+
+    struct ticket ticketT;
+    __atomic_load(&c.lockLocal.m_ticket.u, &ticketT.u, __ATOMIC_ACQUIRE);
+    bool fLocalWaiters = (uint16_t)(ticketT.m_avail - ticketT.m_active) > 1;
+    if (fLocalWaiters && c.chandoffs < COHORT_MAX_LOCAL_HANDOFFS)
+    {
+        // Keep the global lock within our node, the next local owner takes it over.
+        //  Clear its owner so fastlock's recursion check can't mistake us for the holder.
+        //  Our hold on it ends here as far as the profiler is concerned, the next owner
+        //  starts its own.
+        ++c.chandoffs;
+        __atomic_store(&m_lockGlobal.m_pidOwner, &pidNone, __ATOMIC_RELAXED);
+        if (m_lockGlobal.m_tscAcquired != 0)
+            profilerelease(&m_lockGlobal);
+    }
+    else
+    {
+        c.chandoffs = 0;
+        c.fGlobalOwned = false;
+        m_lockGlobal.unlock();
+    }
+    c.lockLocal.unlock();
+}
+
+bool cohortlock::fOwnLock()
+{
+    int tid;
+    __atomic_load(&m_pidOwner, &tid, __ATOMIC_RELAXED);
+    return gettid() == tid;
+}
+
+#ifdef FASTLOCK_BENCHMARK_MAIN
+#include <thread>
+#include <vector>
+#include <chrono>
+
+/* Compares the ticket lock with the cohort lock under contention.  Every
+ * thread repeatedly takes the lock, updates a few shared cache lines, then
+ * does a little private work.  Threads are pinned round robin over the CPUs.
+ *
+ *   make lock-benchmark
+ *   ./lock-benchmark [seconds per run] */
+
+static volatile uint64_t g_rgshared[4*8] __attribute__((aligned(64)));
+static std::atomic<bool> g_fStop;
+
+template<typename T_LOCK>
+static void benchThread(T_LOCK *plock, int cpu, uint64_t *pcops)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    UNUSED(cpu);
+#endif
+    uint64_t cops = 0;
+    while (!g_fStop.load(std::memory_order_relaxed))
+    {
+        plock->lock();
+        for (int iline = 0; iline < 4; ++iline)
+            g_rgshared[iline*8] = g_rgshared[iline*8] + 1;
+        plock->unlock();
+        ++cops;
+        for (volatile int i = 0; i < 50; ++i) {}
+    }
+    *pcops = cops;
+}
+
+template<typename T_LOCK>
+static void benchRun(const char *szName, int cthreads, int seconds)
+{
+    T_LOCK lock;
+    std::vector<std::thread> vecthreads;
+    std::vector<uint64_t> veccops(cthreads);
+    int ccpus = (int)std::thread::hardware_concurrency();
+    g_fStop = false;
+    for (int ithread = 0; ithread < cthreads; ++ithread)
+        vecthreads.emplace_back(benchThread<T_LOCK>, &lock, ithread % ccpus, &veccops[ithread]);
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    g_fStop = true;
+    for (auto &thread : vecthreads)
+        thread.join();
+
+    uint64_t ctotal = 0, cmin = UINT64_MAX, cmax = 0;
+    for (uint64_t cops : veccops)
+    {
+        ctotal += cops;
+        cmin = std::min(cmin, cops);
+        cmax = std::max(cmax, cops);
+    }
+    printf("%-8s threads=%-3d %10.2f Mops/sec  (per thread min %" PRIu64 " max %" PRIu64 ")\n",
+        szName, cthreads, ctotal / (double)seconds / 1000000.0, cmin, cmax);
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = (argc > 1) ? atoi(argv[1]) : 2;
+    if (seconds < 1)
+        seconds = 1;
+    printf("%d NUMA node(s), %u CPUs, %d second(s) per run\n",
+        fastlock_numa_node_count(), std::thread::hardware_concurrency(), seconds);
+    for (int cthreads : {2, 4, 8, 16, 32})
+    {
+        benchRun<fastlock>("ticket", cthreads, seconds);
+        benchRun<cohortlock>("cohort", cthreads, seconds);
+    }
+    return 0;
+}
+#endif
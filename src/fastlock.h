@@ -17,6 +17,28 @@ void fastlock_lock_recursive(struct fastlock *lock, int nesting);
 
 uint64_t fastlock_getlongwaitcount();   // this is a global value
 
+/* Contention profiling, see INFO lockstats.  ASM_SPINLOCK builds switch to the
+ * C implementation of the lock while profiling is enabled. */
+#define FASTLOCK_PROFILE_BUCKETS 40    /* log2(cycles) histogram buckets */
+struct fastlock_profile_stats
+{
+    const char *szLock;     /* name given by fastlock_setname() or "unnamed" */
+    void *callsite;         /* return address of the acquiring call */
+    uint64_t cacquires;
+    uint64_t ccontended;    /* acquisitions that had to wait for another owner */
+    uint64_t cyclesWait;
+    uint64_t rgwait[FASTLOCK_PROFILE_BUCKETS];
+    uint64_t cholds;
+    uint64_t cyclesHold;
+    uint64_t rghold[FASTLOCK_PROFILE_BUCKETS];
+};
+extern int g_fLockProfiling;
+void fastlock_setname(struct fastlock *lock, const char *name);
+void fastlock_setcallsite(void *callsite);   /* charge this thread's acquisitions to callsite, NULL to stop */
+const char *fastlock_implementation();   /* "asm" or "c", which lock_profiling is wired into */
+void fastlock_profile_visit(void (*fn)(const struct fastlock_profile_stats *stats, void *privdata), void *privdata);
+void fastlock_profile_reset();
+
 /* End C API */
 #ifdef __cplusplus
 }
@@ -45,6 +67,9 @@ struct fastlock
     volatile int m_pidOwner;
     volatile int m_depth;
     unsigned futex;
+    const char *m_szName;       /* only used by the profiler */
+    uint64_t m_tscAcquired;     /* 0 if the acquisition was not profiled */
+    void *m_callsiteAcquired;
 
 #ifdef __cplusplus
     fastlock()
@@ -80,3 +105,39 @@ struct fastlock
     bool fOwnLock();   // true if this thread owns the lock, NOTE: not 100% reliable, use for debugging only
 #endif
 };
+
+#ifdef __cplusplus
+/* NUMA aware cohort lock built from fastlocks (C-TKT-TKT).  Threads first
+ * take the lock of their own NUMA node and then the global lock.  When
+ * releasing, a holder with waiters on its node hands the global lock
+ * directly to the next local waiter, so the lock's cache lines stay on one
+ * socket.  At most COHORT_MAX_LOCAL_HANDOFFS consecutive handoffs are made
+ * before the global lock is released to let other nodes in.  Recursive like
+ * fastlock. */
+#define COHORT_MAX_NODES 8
+#define COHORT_MAX_LOCAL_HANDOFFS 64
+struct cohortlock
+{
+    struct alignas(64) cohort
+    {
+        fastlock lockLocal;
+        int fGlobalOwned = false;  // protected by lockLocal
+        int chandoffs = 0;
+    };
+
+    fastlock m_lockGlobal;
+    cohort m_rgcohort[COHORT_MAX_NODES];
+    volatile int m_pidOwner = -1;
+    int m_depth = 0;
+    int m_icohortOwner = -1;
+
+    cohortlock();
+    void setname(const char *name);
+    void lock();
+    bool try_lock(bool fWeak = false);
+    void unlock();
+    bool fOwnLock();
+};
+
+int fastlock_numa_node_count();
+#endif
@@ -5,6 +5,10 @@ extern sched_yield
 extern g_longwaits
 extern registerwait
 extern clearwait
+extern g_fLockProfiling
+extern fastlock_lock_profiled
+extern fastlock_trylock_profiled
+extern fastlock_unlock_profiled
 
 ;	This is the first use of assembly in this codebase, a valid question is WHY?
 ;	The spinlock we implement here is performance critical, and simply put GCC
@@ -19,7 +23,13 @@ fastlock_lock:
 	;	uint16_t avail
 	;	int32_t m_pidOwner
 	;	int32_t m_depth
-	
+
+	; The lock profiler is only implemented in C, while it's on let the C code take
+	;	the lock.  We jump so it sees our caller's return address as its own.
+	mov rax, g_fLockProfiling
+	cmp dword [rax], 0
+	jne fastlock_lock_profiled
+
 	; First get our TID and put it in ecx
 	push rdi                ; we need our struct pointer (also balance the stack for the call)
 	call gettid             ; get our thread ID (TLS is nasty in ASM so don't bother inlining)
@@ -104,7 +114,11 @@ fastlock_trylock:
 	;	uint16_t avail
 	;	int32_t m_pidOwner
 	;	int32_t m_depth
-	
+
+	mov rax, g_fLockProfiling   ; see fastlock_lock
+	cmp dword [rax], 0
+	jne fastlock_trylock_profiled
+
 	; First get our TID and put it in ecx
 	push rdi                ; we need our struct pointer (also balance the stack for the call)
 	call gettid             ; get our thread ID (TLS is nasty in ASM so don't bother inlining)
@@ -148,6 +162,10 @@ fastlock_unlock:
 	;	uint16_t avail
 	;	int32_t m_pidOwner
 	;	int32_t m_depth
+	;	...
+	;	uint64_t m_tscAcquired (offset 24)
+	cmp qword [rdi+24], 0        ; was this acquisition profiled?
+	jne fastlock_unlock_profiled ;	then the C code must record the hold time
 	push r11
 	sub dword [rdi+8], 1         ; decrement m_depth, don't use dec because it partially writes the flag register and we don't know its state
 	jnz .LDone                   ; if depth is non-zero this is a recursive unlock, and we still hold it
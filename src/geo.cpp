@@ -229,7 +229,7 @@ int geoGetPointsInRange(robj_roptr zobj, double min, double max, double lon, dou
     size_t origincount = ga->used;
     sds member;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = (unsigned char*)zobj->m_ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr = NULL;
@@ -242,7 +242,7 @@ int geoGetPointsInRange(robj_roptr zobj, double min, double max, double lon, dou
             return 0;
         }
 
-        sptr = ziplistNext(zl, eptr);
+        sptr = lpNext(zl, eptr);
         while (eptr) {
             score = zzlGetScore(sptr);
 
@@ -250,34 +250,32 @@ int geoGetPointsInRange(robj_roptr zobj, double min, double max, double lon, dou
             if (!zslValueLteMax(score, &range))
                 break;
 
-            /* We know the element exists. ziplistGet should always succeed */
-            ziplistGet(eptr, &vstr, &vlen, &vlong);
+            vstr = lpGetValue(eptr, &vlen, &vlong);
             member = (vstr == NULL) ? sdsfromlonglong(vlong) :
                                       sdsnewlen(vstr,vlen);
             if (geoAppendIfWithinRadius(ga,lon,lat,radius,score,member)
                 == C_ERR) sdsfree(member);
             zzlNext(zl, &eptr, &sptr);
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)zobj->m_ptr;
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *ln;
+        zbtreePos ln = zbtFirstInRange(zs->zbt, &range);
 
-        if ((ln = zslFirstInRange(zsl, &range)) == NULL) {
+        if (!ln.valid()) {
             /* Nothing exists starting at our min.  No results. */
             return 0;
         }
 
-        while (ln) {
-            sds ele = ln->ele;
+        while (ln.valid()) {
+            sds ele = ln.ele();
             /* Abort when the node is no longer in range. */
-            if (!zslValueLteMax(ln->score, &range))
+            if (!zslValueLteMax(ln.score(), &range))
                 break;
 
             ele = sdsdup(ele);
-            if (geoAppendIfWithinRadius(ga,lon,lat,radius,ln->score,ele)
+            if (geoAppendIfWithinRadius(ga,lon,lat,radius,ln.score(),ele)
                 == C_ERR) sdsfree(ele);
-            ln = ln->level(0)->forward;
+            ln.next();
         }
     }
     return ga->used - origincount;
@@ -643,20 +641,22 @@ void georadiusGeneric(client *c, int flags) {
         }
 
         for (i = 0; i < returned_items; i++) {
-            zskiplistNode *znode;
+            dictEntry *de;
             geoPoint *gp = ga->array+i;
             gp->dist /= conversion; /* Fix according to unit. */
             double score = storedist ? gp->dist : gp->score;
             size_t elelen = sdslen(gp->member);
 
             if (maxelelen < elelen) maxelelen = elelen;
-            znode = zslInsert(zs->zsl,score,gp->member);
-            serverAssert(dictAdd(zs->pdict,gp->member,&znode->score) == DICT_OK);
+            zbtInsert(zs->zbt,score,gp->member);
+            de = dictAddRaw(zs->pdict,gp->member,NULL);
+            serverAssert(de != NULL);
+            dictSetDoubleVal(de,score);
             gp->member = NULL;
         }
 
         if (returned_items) {
-            zsetConvertToZiplistIfNeeded(zobj,maxelelen);
+            zsetConvertToListpackIfNeeded(zobj,maxelelen);
             setKey(c->db,storekey,zobj);
             decrRefCount(zobj);
             notifyKeyspaceEvent(NOTIFY_ZSET,"georadiusstore",storekey,
@@ -41,6 +41,23 @@
 #define INTSET_ENC_INT32 (sizeof(int32_t))
 #define INTSET_ENC_INT64 (sizeof(int64_t))
 
+/* Lookups binary search down to INTSET_SCAN_BYTES worth of values and then
+ * scan those linearly. Counting the values smaller than the one we look for
+ * is branch free and vectorizes, while the last steps of a binary search are
+ * mostly mispredicted branches. When the toolchain supports function
+ * multiversioning the scan is built for AVX2 and SSE4.2 as well (the latter
+ * is the first to compare 64 bit integers) and the dynamic loader picks the
+ * best clone at startup. */
+#define INTSET_SCAN_BYTES 256
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && defined(__GLIBC__)
+#define INTSET_KERNEL __attribute__((target_clones("avx2","sse4.2","default")))
+#else
+#define INTSET_KERNEL
+#endif
+
+/* Number of lookups interleaved by intsetFindMany(). */
+#define INTSET_BATCH 8
+
 /* Return the required encoding for the provided value. */
 static uint8_t _intsetValueEncoding(int64_t v) {
     if (v < INT32_MIN || v > INT32_MAX)
@@ -52,7 +69,7 @@ static uint8_t _intsetValueEncoding(int64_t v) {
 }
 
 /* Return the value at pos, given an encoding. */
-static int64_t _intsetGetEncoded(intset *is, int pos, uint8_t enc) {
+static int64_t _intsetGetEncoded(const intset *is, int pos, uint8_t enc) {
     int64_t v64;
     int32_t v32;
     int16_t v16;
@@ -73,7 +90,7 @@ static int64_t _intsetGetEncoded(intset *is, int pos, uint8_t enc) {
 }
 
 /* Return the value at pos, using the configured encoding. */
-static int64_t _intsetGet(intset *is, int pos) {
+static int64_t _intsetGet(const intset *is, int pos) {
     return _intsetGetEncoded(is,pos,intrev32ifbe(is->encoding));
 }
 
@@ -108,13 +125,87 @@ static intset *intsetResize(intset *is, uint32_t len) {
     return is;
 }
 
+/* Return how many of the n values starting at 'v' are smaller than 'value'. */
+INTSET_KERNEL static uint32_t intsetCountLess16(const int16_t *v, uint32_t n, int16_t value) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n; i++) count += v[i] < value;
+    return count;
+}
+
+INTSET_KERNEL static uint32_t intsetCountLess32(const int32_t *v, uint32_t n, int32_t value) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n; i++) count += v[i] < value;
+    return count;
+}
+
+INTSET_KERNEL static uint32_t intsetCountLess64(const int64_t *v, uint32_t n, int64_t value) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n; i++) count += v[i] < value;
+    return count;
+}
+
+/* Return how many of the n values starting at position 'from' are smaller
+ * than 'value', which must fit the encoding of the intset. */
+static uint32_t intsetCountLess(const intset *is, uint32_t from, uint32_t n, int64_t value) {
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    uint32_t encoding = intrev32ifbe(is->encoding);
+
+    if (encoding == INTSET_ENC_INT64)
+        return intsetCountLess64((const int64_t*)is->contents+from,n,value);
+    else if (encoding == INTSET_ENC_INT32)
+        return intsetCountLess32((const int32_t*)is->contents+from,n,value);
+    else
+        return intsetCountLess16((const int16_t*)is->contents+from,n,value);
+#else
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n; i++) count += _intsetGet(is,from+i) < value;
+    return count;
+#endif
+}
+
+/* Return the position of the first value not smaller than 'value' in the
+ * range [lo,hi), or hi if there is none. */
+static uint32_t intsetLowerBound(const intset *is, int64_t value, uint32_t lo, uint32_t hi) {
+    uint8_t encoding = intrev32ifbe(is->encoding);
+    uint32_t window = INTSET_SCAN_BYTES/encoding;
+
+    /* A value that does not fit the encoding is beyond every member. */
+    if (_intsetValueEncoding(value) > encoding) return value < 0 ? lo : hi;
+
+    while (hi-lo > window) {
+        uint32_t mid = lo+(hi-lo)/2;
+        if (_intsetGetEncoded(is,mid,encoding) < value)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo+intsetCountLess(is,lo,hi-lo,value);
+}
+
+/* Like intsetLowerBound(), but probing lo+1, lo+3, lo+7... first. This finds
+ * positions close to 'lo' quickly, so walking one intset in order while
+ * looking up its values in another one costs O(n*log(m/n)) instead of
+ * O(n*log(m)), and degrades gracefully into a linear merge when the two have
+ * similar sizes. */
+static uint32_t intsetGallop(const intset *is, int64_t value, uint32_t lo, uint32_t hi) {
+    uint8_t encoding = intrev32ifbe(is->encoding);
+    uint64_t probe = lo, step = 1;
+
+    while (probe < hi && _intsetGetEncoded(is,probe,encoding) < value) {
+        lo = probe+1;
+        probe = lo+step;
+        step <<= 1;
+    }
+    return intsetLowerBound(is,value,lo,probe < hi ? probe : hi);
+}
+
 /* Search for the position of "value". Return 1 when the value was found and
  * sets "pos" to the position of the value within the intset. Return 0 when
  * the value is not present in the intset and sets "pos" to the position
  * where "value" can be inserted. */
 static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
-    int min = 0, max = intrev32ifbe(is->length)-1, mid = -1;
-    int64_t cur = -1;
+    uint32_t len = intrev32ifbe(is->length);
+    uint32_t p;
 
     /* The value can never be found when the set is empty */
     if (intrev32ifbe(is->length) == 0) {
@@ -123,7 +214,7 @@ static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
     } else {
         /* Check for the case where we know we cannot find the value,
          * but do know the insert position. */
-        if (value > _intsetGet(is,max)) {
+        if (value > _intsetGet(is,len-1)) {
             if (pos) *pos = intrev32ifbe(is->length);
             return 0;
         } else if (value < _intsetGet(is,0)) {
@@ -132,25 +223,9 @@ static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
         }
     }
 
-    while(max >= min) {
-        mid = ((unsigned int)min + (unsigned int)max) >> 1;
-        cur = _intsetGet(is,mid);
-        if (value > cur) {
-            min = mid+1;
-        } else if (value < cur) {
-            max = mid-1;
-        } else {
-            break;
-        }
-    }
-
-    if (value == cur) {
-        if (pos) *pos = mid;
-        return 1;
-    } else {
-        if (pos) *pos = min;
-        return 0;
-    }
+    p = intsetLowerBound(is,value,0,len);
+    if (pos) *pos = p;
+    return p < len && _intsetGet(is,p) == value;
 }
 
 /* Upgrades the intset to a larger encoding and inserts the given integer. */
@@ -256,6 +331,142 @@ uint8_t intsetFind(intset *is, int64_t value) {
     return valenc <= intrev32ifbe(is->encoding) && intsetSearch(is,value,NULL);
 }
 
+/* Look up 'count' values at once, setting found[i] to 1 if values[i] is a
+ * member and to 0 otherwise. The lookups are interleaved branch free binary
+ * searches, so the cache misses of INTSET_BATCH of them overlap instead of
+ * being paid one after the other. */
+void intsetFindMany(const intset *is, const int64_t *values, uint32_t count, uint8_t *found) {
+    uint8_t encoding = intrev32ifbe(is->encoding);
+    uint32_t len = intrev32ifbe(is->length);
+
+    for (uint32_t i = 0; i < count; i += INTSET_BATCH) {
+        uint32_t batch = count-i < INTSET_BATCH ? count-i : INTSET_BATCH;
+        uint32_t base[INTSET_BATCH] = {0};
+        uint32_t n = len;
+
+        if (len == 0) {
+            memset(found+i,0,batch);
+            continue;
+        }
+
+        /* After every round base[k] is the last position whose value is not
+         * greater than values[i+k], or 0 if there is none. */
+        while (n > 1) {
+            uint32_t half = n/2;
+            for (uint32_t k = 0; k < batch; k++) {
+                const int8_t *next = is->contents+(size_t)(base[k]+half/2)*encoding;
+                __builtin_prefetch(next);
+                __builtin_prefetch(next+(size_t)half*encoding);
+            }
+            for (uint32_t k = 0; k < batch; k++) {
+                int64_t cur = _intsetGetEncoded(is,base[k]+half,encoding);
+                base[k] = (cur <= values[i+k]) ? base[k]+half : base[k];
+            }
+            n -= half;
+        }
+        for (uint32_t k = 0; k < batch; k++)
+            found[i+k] = _intsetGetEncoded(is,base[k],encoding) == values[i+k];
+    }
+}
+
+/* Copy count values from src starting at 'from' into dst starting at 'to'. */
+static void intsetCopyRange(intset *dst, uint32_t to, const intset *src, uint32_t from, uint32_t count) {
+    uint8_t srcenc = intrev32ifbe(src->encoding);
+
+    if (srcenc == intrev32ifbe(dst->encoding)) {
+        memcpy(dst->contents+(size_t)to*srcenc,
+               src->contents+(size_t)from*srcenc,(size_t)count*srcenc);
+    } else {
+        for (uint32_t i = 0; i < count; i++)
+            _intsetSet(dst,to+i,_intsetGetEncoded(src,from+i,srcenc));
+    }
+}
+
+/* Allocate an intset with room for 'len' values of the given encoding. */
+static intset *intsetNewWithCapacity(uint8_t encoding, uint32_t len) {
+    intset *is = zmalloc(sizeof(intset)+(size_t)len*encoding, MALLOC_SHARED);
+    is->encoding = intrev32ifbe(encoding);
+    is->length = 0;
+    return is;
+}
+
+/* Shrink 'is' to its final length of 'len' values. */
+static intset *intsetFinish(intset *is, uint32_t len) {
+    is->length = intrev32ifbe(len);
+    return intsetResize(is,len);
+}
+
+/* Return a new intset with the values present in both a and b. Every value
+ * of the smaller set is galloped to in the larger one. */
+intset *intsetIntersect(const intset *a, const intset *b) {
+    if (intrev32ifbe(a->length) > intrev32ifbe(b->length)) {
+        const intset *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    uint32_t alen = intrev32ifbe(a->length), blen = intrev32ifbe(b->length);
+    uint8_t aenc = intrev32ifbe(a->encoding), benc = intrev32ifbe(b->encoding);
+    intset *dst = intsetNewWithCapacity(aenc < benc ? aenc : benc,alen);
+    uint32_t len = 0, pos = 0;
+
+    for (uint32_t i = 0; i < alen && pos < blen; i++) {
+        int64_t value = _intsetGetEncoded(a,i,aenc);
+        pos = intsetGallop(b,value,pos,blen);
+        if (pos < blen && _intsetGetEncoded(b,pos,benc) == value) {
+            _intsetSet(dst,len++,value);
+            pos++;
+        }
+    }
+    return intsetFinish(dst,len);
+}
+
+/* Return a new intset with the values present in a or b. The runs of the
+ * larger set between two values of the smaller one are copied in bulk. */
+intset *intsetUnion(const intset *a, const intset *b) {
+    if (intrev32ifbe(a->length) > intrev32ifbe(b->length)) {
+        const intset *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    uint32_t alen = intrev32ifbe(a->length), blen = intrev32ifbe(b->length);
+    uint8_t aenc = intrev32ifbe(a->encoding), benc = intrev32ifbe(b->encoding);
+    intset *dst = intsetNewWithCapacity(aenc > benc ? aenc : benc,alen+blen);
+    uint32_t len = 0, pos = 0;
+
+    for (uint32_t i = 0; i < alen; i++) {
+        int64_t value = _intsetGetEncoded(a,i,aenc);
+        uint32_t next = intsetGallop(b,value,pos,blen);
+        intsetCopyRange(dst,len,b,pos,next-pos);
+        len += next-pos;
+        pos = next;
+        if (pos < blen && _intsetGetEncoded(b,pos,benc) == value) pos++;
+        _intsetSet(dst,len++,value);
+    }
+    intsetCopyRange(dst,len,b,pos,blen-pos);
+    len += blen-pos;
+    return intsetFinish(dst,len);
+}
+
+/* Return a new intset with the values of a that are not in b. */
+intset *intsetDifference(const intset *a, const intset *b) {
+    uint32_t alen = intrev32ifbe(a->length), blen = intrev32ifbe(b->length);
+    uint8_t aenc = intrev32ifbe(a->encoding), benc = intrev32ifbe(b->encoding);
+    intset *dst = intsetNewWithCapacity(aenc,alen);
+    uint32_t len = 0, pos = 0, i;
+
+    for (i = 0; i < alen && pos < blen; i++) {
+        int64_t value = _intsetGetEncoded(a,i,aenc);
+        pos = intsetGallop(b,value,pos,blen);
+        if (pos < blen && _intsetGetEncoded(b,pos,benc) == value)
+            pos++;
+        else
+            _intsetSet(dst,len++,value);
+    }
+    intsetCopyRange(dst,len,a,i,alen-i);
+    len += alen-i;
+    return intsetFinish(dst,len);
+}
+
 /* Return random member */
 int64_t intsetRandom(intset *is) {
     return _intsetGet(is,rand()%intrev32ifbe(is->length));
@@ -316,13 +527,13 @@ static void _assert(char *estr, char *file, int line) {
 }
 
 static intset *createSet(int bits, int size) {
-    uint64_t mask = (1<<bits)-1;
+    uint64_t mask = (1ULL<<bits)-1;
     uint64_t value;
     intset *is = intsetNew();
 
     for (int i = 0; i < size; i++) {
         if (bits > 32) {
-            value = (rand()*rand()) & mask;
+            value = ((uint64_t)rand()*rand()) & mask;
         } else {
             value = rand() & mask;
         }
@@ -458,6 +669,68 @@ int intsetTest(int argc, char **argv) {
         ok();
     }
 
+    printf("Batched lookups: "); {
+        int64_t values[100];
+        uint8_t found[100];
+        for (int bits = 4; bits <= 40; bits += 12) {
+            is = createSet(bits,1000);
+            for (i = 0; i < 100; i++) {
+                values[i] = (bits > 32 ? (int64_t)rand()*rand() : rand()) & ((1LL<<bits)-1);
+                if (i % 10 == 0) values[i] = -values[i]-1;
+            }
+            values[0] = INT64_MAX;
+            values[1] = INT64_MIN;
+            intsetFindMany(is,values,100,found);
+            for (i = 0; i < 100; i++)
+                assert(found[i] == intsetFind(is,values[i]));
+            zfree(is);
+        }
+        is = intsetNew();
+        intsetFindMany(is,values,100,found);
+        for (i = 0; i < 100; i++) assert(!found[i]);
+        zfree(is);
+        ok();
+    }
+
+    printf("Intersection, union and difference: "); {
+        int sizes[] = {0, 1, 10, 300, 5000};
+        int bitsv[] = {8, 20, 40};
+        for (int x = 0; x < 15; x++) {
+            for (int y = 0; y < 15; y++) {
+                intset *a = createSet(bitsv[x/5],sizes[x%5]);
+                intset *b = createSet(bitsv[y/5],sizes[y%5]);
+                if (x % 2) a = intsetAdd(a,-x,NULL);
+                if (y % 3) b = intsetAdd(b,-x,NULL);
+                intset *and = intsetIntersect(a,b);
+                intset *or = intsetUnion(a,b);
+                intset *andnot = intsetDifference(a,b);
+                uint32_t inter = 0, diff = 0;
+                int64_t v;
+
+                for (uint32_t j = 0; intsetGet(a,j,&v); j++) {
+                    assert(intsetFind(or,v));
+                    if (intsetFind(b,v)) {
+                        assert(intsetFind(and,v) && !intsetFind(andnot,v));
+                        inter++;
+                    } else {
+                        assert(!intsetFind(and,v) && intsetFind(andnot,v));
+                        diff++;
+                    }
+                }
+                for (uint32_t j = 0; intsetGet(b,j,&v); j++)
+                    assert(intsetFind(or,v));
+                assert(intsetLen(and) == inter);
+                assert(intsetLen(andnot) == diff);
+                assert(intsetLen(or) == intsetLen(b)+diff);
+                if (intsetLen(and) > 1) checkConsistency(and);
+                if (intsetLen(or) > 1) checkConsistency(or);
+                if (intsetLen(andnot) > 1) checkConsistency(andnot);
+                zfree(a); zfree(b); zfree(and); zfree(or); zfree(andnot);
+            }
+        }
+        ok();
+    }
+
     printf("Stress lookups: "); {
         long num = 100000, size = 10000;
         int i, bits = 20;
@@ -54,6 +54,10 @@ intset *intsetNew(void);
 intset *intsetAdd(intset *is, int64_t value, uint8_t *success);
 intset *intsetRemove(intset *is, int64_t value, int *success);
 uint8_t intsetFind(intset *is, int64_t value);
+void intsetFindMany(const intset *is, const int64_t *values, uint32_t count, uint8_t *found);
+intset *intsetIntersect(const intset *a, const intset *b);
+intset *intsetUnion(const intset *a, const intset *b);
+intset *intsetDifference(const intset *a, const intset *b);
 int64_t intsetRandom(intset *is);
 uint8_t intsetGet(intset *is, uint32_t pos, int64_t *value);
 uint32_t intsetLen(const intset *is);
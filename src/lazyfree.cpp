@@ -35,9 +35,12 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
     } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_HT) {
         dict *ht = (dict*)ptrFromObj(obj);
         return dictSize(ht);
-    } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_SKIPLIST){
+    } else if (obj->type == OBJ_SET && obj->encoding == OBJ_ENCODING_ROARING) {
+        roaring *r = (roaring*)ptrFromObj(obj);
+        return r->len;
+    } else if (obj->type == OBJ_ZSET && obj->encoding == OBJ_ENCODING_BTREE){
         zset *zs = (zset*)ptrFromObj(obj);
-        return zs->zsl->length;
+        return zs->zbt->length;
     } else if (obj->type == OBJ_HASH && obj->encoding == OBJ_ENCODING_HT) {
         dict *ht = (dict*)ptrFromObj(obj);
         return dictSize(ht);
@@ -46,6 +49,16 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
     }
 }
 
+/* The bio thread frees objects without holding the lock, so their tables must
+ * not have a rehash batch in flight (see dictRehashAsync()). */
+static void lazyfreeAbandonRehash(robj *obj) {
+    if ((obj->type == OBJ_SET || obj->type == OBJ_HASH) &&
+        obj->encoding == OBJ_ENCODING_HT)
+    {
+        dictAbandonRehashAsync((dict*)ptrFromObj(obj));
+    }
+}
+
 /* Delete a key, value, and associated expiration entry if any, from the DB.
  * If there are enough allocations to free the value object may be put into
  * a lazy free list instead of being freed synchronously. The lazy free list
@@ -55,17 +68,18 @@ int dbAsyncDelete(redisDb *db, robj *key) {
     /* If the value is composed of a few allocations, to free in a lazy way
      * is actually just slower... So under a certain limit we just free
      * the object synchronously. */
+    dbBeforeWrite(db, szFromObj(key));
     dictEntry *de = dictUnlink(db->pdict,ptrFromObj(key));
     if (de) {
         robj *val = (robj*)dictGetVal(de);
-        if (val->FExpires())
+        if (FEntryExpires(de))
         {
             /* Deleting an entry from the expires dict will not free the sds of
              * the key, because it is shared with the main dictionary. */
             removeExpireCore(db,key,de);
         }
 
-        size_t free_effort = lazyfreeGetFreeEffort(val);
+        size_t free_effort = FInlineVal(val) ? 0 : lazyfreeGetFreeEffort(val);
 
         /* If releasing the object is too much work, do it in the background
          * by adding the object to the lazy free list.
@@ -77,6 +91,7 @@ int dbAsyncDelete(redisDb *db, robj *key) {
          * equivalent to just calling decrRefCount(). */
         if (free_effort > LAZYFREE_THRESHOLD && val->getrefcount(std::memory_order_relaxed) == 1) {
             atomicIncr(lazyfree_objects,1);
+            lazyfreeAbandonRehash(val);
             bioCreateBackgroundJob(BIO_LAZY_FREE,val,NULL,NULL);
             dictSetVal(db->pdict,de,NULL);
         }
@@ -98,6 +113,7 @@ void freeObjAsync(robj *o) {
     size_t free_effort = lazyfreeGetFreeEffort(o);
     if (free_effort > LAZYFREE_THRESHOLD && o->getrefcount(std::memory_order_relaxed) == 1) {
         atomicIncr(lazyfree_objects,1);
+        lazyfreeAbandonRehash(o);
         bioCreateBackgroundJob(BIO_LAZY_FREE,o,NULL,NULL);
     } else {
         decrRefCount(o);
@@ -112,7 +128,9 @@ void emptyDbAsync(redisDb *db) {
     auto *set = db->setexpire;
     db->setexpire = new (MALLOC_LOCAL) expireset();
     db->expireitr = db->setexpire->end();
-    db->pdict = dictCreate(&dbDictType,NULL);
+    expireWheelReset(db);
+    db->pdict = dictCreate(keyspaceDictType(),NULL);
+    dictAbandonRehashAsync(oldht1);
     atomicIncr(lazyfree_objects,dictSize(oldht1));
     bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht1,set);
 }
@@ -801,3 +801,135 @@ unsigned char *lpSeek(unsigned char *lp, long index) {
     }
 }
 
+
+/* Return the listpack element pointed by 'p' in the same way ziplistGet()
+ * does: if the element is a string a pointer to it is returned and its
+ * length is stored in '*slen', otherwise NULL is returned and the integer
+ * value is stored in '*lval'. */
+unsigned char *lpGetValue(unsigned char *p, unsigned int *slen, long long *lval) {
+    int64_t count;
+    unsigned char *vstr = lpGet(p,&count,NULL);
+    if (vstr) {
+        *slen = count;
+    } else {
+        *lval = count;
+    }
+    return vstr;
+}
+
+/* Return 1 if the listpack element pointed by 'p' is equal to the string
+ * 's' of length 'slen', otherwise 0 is returned. */
+int lpCompare(unsigned char *p, unsigned char *s, uint32_t slen) {
+    int64_t count, sval;
+    unsigned char *vstr = lpGet(p,&count,NULL);
+
+    /* Strings that can be represented as integers are always stored with
+     * the integer encoding, so a string element never equals a string that
+     * parses as an integer, and vice versa. */
+    if (vstr) return count == slen && memcmp(vstr,s,slen) == 0;
+    return lpStringToInt64((const char*)s,slen,&sval) && sval == count;
+}
+
+/* Find the element equal to the string 's' of length 'slen' starting the
+ * search at 'p', and return a pointer to it, or NULL if no element matches.
+ * After every compared element 'skip' elements are skipped without being
+ * compared, so that for instance the keys of a listpack of key/value pairs
+ * can be searched passing 'skip' as 1. */
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *s, uint32_t slen, unsigned int skip) {
+    int64_t sval = 0;
+    int sisint = lpStringToInt64((const char*)s,slen,&sval);
+    unsigned int skipcnt = 0;
+
+    while (p) {
+        if (skipcnt == 0) {
+            int64_t count;
+            unsigned char *vstr = lpGet(p,&count,NULL);
+            if (vstr) {
+                if (!sisint && count == slen && memcmp(vstr,s,slen) == 0)
+                    return p;
+            } else if (sisint && count == sval) {
+                return p;
+            }
+            skipcnt = skip;
+        } else {
+            skipcnt--;
+        }
+        p = lpNext(lp,p);
+    }
+    return NULL;
+}
+
+/* Delete up to 'num' consecutive elements starting at the element pointed
+ * by '*p', using a single memmove() and a single reallocation. On return
+ * '*p' points to the element that followed the deleted ones, or is set to
+ * NULL if they were the last ones. Returns the new listpack. */
+unsigned char *lpDeleteRangeWithEntry(unsigned char *lp, unsigned char **p, unsigned long num) {
+    unsigned char *first = *p, *tail = first;
+    unsigned long deleted = 0;
+
+    while (deleted < num && tail[0] != LP_EOF) {
+        tail = lpSkip(tail);
+        deleted++;
+    }
+
+    uint32_t bytes = lpGetTotalBytes(lp);
+    unsigned long poff = first-lp;
+    memmove(first,tail,lp+bytes-tail); /* Includes the EOF byte. */
+    bytes -= tail-first;
+    lpSetTotalBytes(lp,bytes);
+    uint32_t numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN)
+        lpSetNumElements(lp,numele-deleted);
+
+    lp = lp_realloc(lp,bytes);
+    *p = lp+poff;
+    if ((*p)[0] == LP_EOF) *p = NULL;
+    return lp;
+}
+
+/* Delete up to 'num' consecutive elements starting at the element at
+ * 'index', which may be negative as in lpSeek(). Returns the new listpack. */
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num) {
+    unsigned char *p;
+
+    if (num == 0 || (p = lpSeek(lp,index)) == NULL) return lp;
+    return lpDeleteRangeWithEntry(lp,&p,num);
+}
+
+/* Print a human readable representation of the listpack on stdout, like
+ * ziplistRepr() does for ziplists. Used by DEBUG LISTPACK. */
+void lpRepr(unsigned char *lp) {
+    unsigned char *p;
+    int index = 0;
+
+    printf("{total bytes %u} {num entries %u}\n",
+        lpGetTotalBytes(lp), lpLength(lp));
+    p = lpFirst(lp);
+    while (p) {
+        uint32_t encoded_size = lpCurrentEncodedSize(p);
+        unsigned long back_len = lpEncodeBacklen(NULL,encoded_size);
+        int64_t count;
+        unsigned char *vstr = lpGet(p,&count,NULL);
+
+        printf("{\n\taddr: 0x%08lx,\n\tindex: %2d,\n\toffset: %1lu,\n"
+               "\thdr+entrylen+backlen: %2lu,\n",
+            (unsigned long)p, index, (unsigned long)(p-lp),
+            encoded_size+back_len);
+        if (vstr) {
+            printf("\t[str]");
+            if (count > 40) {
+                if (fwrite(vstr,40,1,stdout) == 0) perror("fwrite");
+                printf("...");
+            } else if (count &&
+                       fwrite(vstr,count,1,stdout) == 0) {
+                perror("fwrite");
+            }
+        } else {
+            printf("\t[int]%lld", (long long)count);
+        }
+        printf("\n}\n");
+        index++;
+        p = lpNext(lp,p);
+    }
+    printf("{end}\n\n");
+}
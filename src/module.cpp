@@ -165,6 +165,7 @@ struct RedisModuleKey {
     uint32_t zstart;        /* Start pos for positional ranges. */
     uint32_t zend;          /* End pos for positional ranges. */
     void *zcurrent;         /* Zset iterator current node. */
+    unsigned int zcurrentidx; /* Element index in the zcurrent B+tree leaf. */
     int zer;                /* Zset iterator end reached flag
                                (true if end was reached). */
 };
@@ -439,7 +440,7 @@ int moduleCreateEmptyKey(RedisModuleKey *key, int type) {
                             g_pserver->list_compress_depth);
         break;
     case REDISMODULE_KEYTYPE_ZSET:
-        obj = createZsetZiplistObject();
+        obj = createZsetListpackObject();
         break;
     case REDISMODULE_KEYTYPE_HASH:
         obj = createHashObject();
@@ -1970,9 +1971,21 @@ int RM_ZsetScore(RedisModuleKey *key, RedisModuleString *ele, double *score) {
 void zsetKeyReset(RedisModuleKey *key) {
     key->ztype = REDISMODULE_ZSET_RANGE_NONE;
     key->zcurrent = NULL;
+    key->zcurrentidx = 0;
     key->zer = 1;
 }
 
+/* Position of a B+tree encoded zset iterator. */
+static zbtreePos zsetKeyPos(RedisModuleKey *key) {
+    zbtreePos pos = {(zbtreeLeaf*)key->zcurrent, key->zcurrentidx};
+    return pos;
+}
+
+static void zsetKeySetPos(RedisModuleKey *key, zbtreePos pos) {
+    key->zcurrent = pos.leaf;
+    key->zcurrentidx = pos.idx;
+}
+
 /* Stop a sorted set iteration. */
 void RM_ZsetRangeStop(RedisModuleKey *key) {
     /* Free resources if needed. */
@@ -2010,14 +2023,13 @@ int zsetInitScoreRange(RedisModuleKey *key, double min, double max, int minex, i
     zrs->minex = minex;
     zrs->maxex = maxex;
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         key->zcurrent = first ? zzlFirstInRange((unsigned char*)ptrFromObj(key->value),zrs) :
                                 zzlLastInRange((unsigned char*)ptrFromObj(key->value),zrs);
-    } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)ptrFromObj(key->value);
-        zskiplist *zsl = zs->zsl;
-        key->zcurrent = first ? zslFirstInRange(zsl,zrs) :
-                                zslLastInRange(zsl,zrs);
+        zsetKeySetPos(key, first ? zbtFirstInRange(zs->zbt,zrs) :
+                                   zbtLastInRange(zs->zbt,zrs));
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2074,14 +2086,13 @@ int zsetInitLexRange(RedisModuleKey *key, RedisModuleString *min, RedisModuleStr
      * otherwise we don't want the zlexrangespec to be freed. */
     key->ztype = REDISMODULE_ZSET_RANGE_LEX;
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         key->zcurrent = first ? zzlFirstInLexRange((unsigned char*)ptrFromObj(key->value),zlrs) :
                                 zzlLastInLexRange((unsigned char*)ptrFromObj(key->value),zlrs);
-    } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)ptrFromObj(key->value);
-        zskiplist *zsl = zs->zsl;
-        key->zcurrent = first ? zslFirstInLexRange(zsl,zlrs) :
-                                zslLastInLexRange(zsl,zlrs);
+        zsetKeySetPos(key, first ? zbtFirstInLexRange(zs->zbt,zlrs) :
+                                   zbtLastInLexRange(zs->zbt,zlrs));
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2119,19 +2130,19 @@ RedisModuleString *RM_ZsetRangeCurrentElement(RedisModuleKey *key, double *score
     RedisModuleString *str;
 
     if (key->zcurrent == NULL) return NULL;
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *eptr, *sptr;
         eptr = (unsigned char*)key->zcurrent;
-        sds ele = ziplistGetObject(eptr);
+        sds ele = lpGetObject(eptr);
         if (score) {
-            sptr = ziplistNext((unsigned char*)ptrFromObj(key->value),eptr);
+            sptr = lpNext((unsigned char*)ptrFromObj(key->value),eptr);
             *score = zzlGetScore(sptr);
         }
         str = createObject(OBJ_STRING,ele);
-    } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
-        zskiplistNode *ln = (zskiplistNode*)key->zcurrent;
-        if (score) *score = ln->score;
-        str = createStringObject(ln->ele,sdslen(ln->ele));
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtreePos ln = zsetKeyPos(key);
+        if (score) *score = ln.score();
+        str = createStringObject(ln.ele(),sdslen(ln.ele()));
     } else {
         serverPanic("Unsupported zset encoding");
     }
@@ -2145,12 +2156,12 @@ RedisModuleString *RM_ZsetRangeCurrentElement(RedisModuleKey *key, double *score
 int RM_ZsetRangeNext(RedisModuleKey *key) {
     if (!key->ztype || !key->zcurrent) return 0; /* No active iterator. */
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = (unsigned char*)ptrFromObj(key->value);
         unsigned char *eptr = (unsigned char*)key->zcurrent;
         unsigned char *next;
-        next = ziplistNext(zl,eptr); /* Skip element. */
-        if (next) next = ziplistNext(zl,next); /* Skip score. */
+        next = lpNext(zl,eptr); /* Skip element. */
+        if (next) next = lpNext(zl,next); /* Skip score. */
         if (next == NULL) {
             key->zer = 1;
             return 0;
@@ -2160,7 +2171,7 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
                 /* Fetch the next element score for the
                  * range check. */
                 unsigned char *saved_next = next;
-                next = ziplistNext(zl,next); /* Skip next element. */
+                next = lpNext(zl,next); /* Skip next element. */
                 double score = zzlGetScore(next); /* Obtain the next score. */
                 if (!zslValueLteMax(score,&key->zrs)) {
                     key->zer = 1;
@@ -2176,25 +2187,26 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
             key->zcurrent = next;
             return 1;
         }
-    } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
-        zskiplistNode *ln = (zskiplistNode*)key->zcurrent, *next = (zskiplistNode*)ln->level(0)->forward;
-        if (next == NULL) {
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtreePos next = zsetKeyPos(key);
+        next.next();
+        if (!next.valid()) {
             key->zer = 1;
             return 0;
         } else {
             /* Are we still within the range? */
             if (key->ztype == REDISMODULE_ZSET_RANGE_SCORE &&
-                !zslValueLteMax(next->score,&key->zrs))
+                !zslValueLteMax(next.score(),&key->zrs))
             {
                 key->zer = 1;
                 return 0;
             } else if (key->ztype == REDISMODULE_ZSET_RANGE_LEX) {
-                if (!zslLexValueLteMax(next->ele,&key->zlrs)) {
+                if (!zslLexValueLteMax(next.ele(),&key->zlrs)) {
                     key->zer = 1;
                     return 0;
                 }
             }
-            key->zcurrent = next;
+            zsetKeySetPos(key,next);
             return 1;
         }
     } else {
@@ -2208,12 +2220,12 @@ int RM_ZsetRangeNext(RedisModuleKey *key) {
 int RM_ZsetRangePrev(RedisModuleKey *key) {
     if (!key->ztype || !key->zcurrent) return 0; /* No active iterator. */
 
-    if (key->value->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (key->value->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = (unsigned char*)ptrFromObj(key->value);
         unsigned char *eptr = (unsigned char*)key->zcurrent;
         unsigned char *prev;
-        prev = ziplistPrev(zl,eptr); /* Go back to previous score. */
-        if (prev) prev = ziplistPrev(zl,prev); /* Back to previous ele. */
+        prev = lpPrev(zl,eptr); /* Go back to previous score. */
+        if (prev) prev = lpPrev(zl,prev); /* Back to previous ele. */
         if (prev == NULL) {
             key->zer = 1;
             return 0;
@@ -2223,7 +2235,7 @@ int RM_ZsetRangePrev(RedisModuleKey *key) {
                 /* Fetch the previous element score for the
                  * range check. */
                 unsigned char *saved_prev = prev;
-                prev = ziplistNext(zl,prev); /* Skip element to get the score.*/
+                prev = lpNext(zl,prev); /* Skip element to get the score.*/
                 double score = zzlGetScore(prev); /* Obtain the prev score. */
                 if (!zslValueGteMin(score,&key->zrs)) {
                     key->zer = 1;
@@ -2239,25 +2251,26 @@ int RM_ZsetRangePrev(RedisModuleKey *key) {
             key->zcurrent = prev;
             return 1;
         }
-    } else if (key->value->encoding == OBJ_ENCODING_SKIPLIST) {
-        zskiplistNode *ln = (zskiplistNode*)key->zcurrent, *prev = ln->backward;
-        if (prev == NULL) {
+    } else if (key->value->encoding == OBJ_ENCODING_BTREE) {
+        zbtreePos prev = zsetKeyPos(key);
+        prev.prev();
+        if (!prev.valid()) {
             key->zer = 1;
             return 0;
         } else {
             /* Are we still within the range? */
             if (key->ztype == REDISMODULE_ZSET_RANGE_SCORE &&
-                !zslValueGteMin(prev->score,&key->zrs))
+                !zslValueGteMin(prev.score(),&key->zrs))
             {
                 key->zer = 1;
                 return 0;
             } else if (key->ztype == REDISMODULE_ZSET_RANGE_LEX) {
-                if (!zslLexValueGteMin(prev->ele,&key->zlrs)) {
+                if (!zslLexValueGteMin(prev.ele(),&key->zlrs)) {
                     key->zer = 1;
                     return 0;
                 }
             }
-            key->zcurrent = prev;
+            zsetKeySetPos(key,prev);
             return 1;
         }
     } else {
@@ -3958,6 +3971,8 @@ void RM_ThreadSafeContextLock(RedisModuleCtx *ctx) {
 /* Release the server lock after a thread safe API call was executed. */
 void RM_ThreadSafeContextUnlock(RedisModuleCtx *ctx) {
     UNUSED(ctx);
+    /* Module threads have no event loop to release the objects for them */
+    releaseAutoreleasedObjects();
     moduleReleaseGIL(FALSE /*fServerThread*/);
 }
 
@@ -87,7 +87,7 @@ void flagTransaction(client *c) {
 }
 
 void multiCommand(client *c) {
-    serverAssert(GlobalLocksAcquired());
+    serverAssert(CommandLocksAcquired());
     if (c->flags & CLIENT_MULTI) {
         addReplyError(c,"MULTI calls can not be nested");
         return;
@@ -293,7 +293,7 @@ void unwatchAllKeys(client *c) {
 /* "Touch" a key, so that if this key is being WATCHed by some client the
  * next EXEC will fail. */
 void touchWatchedKey(redisDb *db, robj *key) {
-    serverAssert(GlobalLocksAcquired());
+    serverAssert(CommandLocksAcquired());
     list *clients;
     listIter li;
     listNode *ln;
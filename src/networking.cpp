@@ -64,12 +64,22 @@ size_t getStringObjectSdsUsedMemory(robj *o) {
 /* Client.reply list dup and free methods. */
 void *dupClientReplyValue(void *o) {
     clientReplyBlock *old = (clientReplyBlock*)o;
+    if (old->pobjRef != nullptr) {
+        /* Object references are shared, not copied */
+        clientReplyBlock *buf = (clientReplyBlock*)zmalloc(sizeof(clientReplyBlock), MALLOC_LOCAL);
+        memcpy(buf, o, sizeof(clientReplyBlock));
+        incrRefCount(buf->pobjRef);
+        return buf;
+    }
     clientReplyBlock *buf = (clientReplyBlock*)zmalloc(sizeof(clientReplyBlock) + old->size, MALLOC_LOCAL);
     memcpy(buf, o, sizeof(clientReplyBlock) + old->size);
     return buf;
 }
 
 void freeClientReplyValue(const void *o) {
+    const clientReplyBlock *block = (const clientReplyBlock*)o;
+    if (block != nullptr && block->pobjRef != nullptr)
+        decrRefCount(block->pobjRef);
     zfree(o);
 }
 
@@ -103,7 +113,7 @@ client *createClient(int fd, int iel) {
         anetEnableTcpNoDelay(NULL,fd);
         if (cserver.tcpkeepalive)
             anetKeepAlive(NULL,fd,cserver.tcpkeepalive);
-        if (aeCreateFileEvent(g_pserver->rgthreadvar[iel].el,fd,AE_READABLE|AE_READ_THREADSAFE,
+        if (aeCreateFileEvent(g_pserver->rgthreadvar[iel].el,fd,AE_READABLE|AE_READ_THREADSAFE|AE_READ_BUFFERED,
             readQueryFromClient, c) == AE_ERR)
         {
             close(fd);
@@ -117,6 +127,7 @@ client *createClient(int fd, int iel) {
     client_id = g_pserver->next_client_id.fetch_add(1);
     c->iel = iel;
     fastlock_init(&c->lock);
+    fastlock_setname(&c->lock, "client");
     c->id = client_id;
     c->resp = 2;
     c->fd = fd;
@@ -176,6 +187,8 @@ client *createClient(int fd, int iel) {
     c->bufposAsync = 0;
     c->client_tracking_redirection = 0;
     c->casyncOpsPending = 0;
+    c->commands_processed = 0;
+    c->commands_at_rebalance = 0;
     memset(c->uuid, 0, UUID_BINARY_LEN);
 
     listSetFreeMethod(c->pubsub_patterns,decrRefCountVoid);
@@ -216,7 +229,7 @@ void clientInstallWriteHandler(client *c) {
 }
 
 void clientInstallAsyncWriteHandler(client *c) {
-    serverAssert(GlobalLocksAcquired());
+    serverAssert(CommandLocksAcquired());
     if (!(c->fPendingAsyncWrite)) {
         c->fPendingAsyncWrite = TRUE;
         listAddNodeHead(serverTL->clients_pending_asyncwrite,c);
@@ -286,7 +299,7 @@ int _addReplyToBuffer(client *c, const char *s, size_t len, bool fAsync) {
     fAsync = fAsync && !FCorrectThread(c);  // Not async if we're on the right thread
     if (fAsync)
     {
-        serverAssert(GlobalLocksAcquired());
+        serverAssert(CommandLocksAcquired());
         if ((c->buflenAsync - c->bufposAsync) < (int)len)
         {
             int minsize = len + c->bufposAsync;
@@ -344,6 +357,7 @@ void _addReplyProtoToList(client *c, const char *s, size_t len) {
         /* take over the allocation's internal fragmentation */
         tail->size = zmalloc_usable(tail) - sizeof(clientReplyBlock);
         tail->used = len;
+        tail->pobjRef = nullptr;
         memcpy(tail->buf(), s, len);
         listAddNodeTail(c->reply, tail);
         c->reply_bytes += tail->size;
@@ -351,6 +365,28 @@ void _addReplyProtoToList(client *c, const char *s, size_t len) {
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
+/* Queue a reference to the string value of 'obj' instead of copying it.  The
+ * object is kept alive by the reply block until it has been written to the
+ * socket, so large values can be sent straight from the keyspace.  Values
+ * are never modified in place while shared (see dbUnshareStringValue()).
+ *
+ * The referenced bytes are still accounted in reply_bytes so the output
+ * buffer limits keep bounding how much memory a slow client may pin. */
+void _addReplyObjectRefToList(client *c, robj_roptr obj) {
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+    AssertCorrectThread(c);
+
+    size_t len = sdslen((sds)ptrFromObj(obj));
+    clientReplyBlock *block = (clientReplyBlock*)zmalloc(sizeof(clientReplyBlock), MALLOC_LOCAL);
+    block->size = len;
+    block->used = len;
+    block->pobjRef = (robj*)obj.unsafe_robjcast();
+    incrRefCount(obj);
+    listAddNodeTail(c->reply, block);
+    c->reply_bytes += block->size;
+    asyncCloseClientOnOutputBufferLimitReached(c);
+}
+
 /* -----------------------------------------------------------------------------
  * Higher level functions to queue data on the client output buffer.
  * The following functions are the ones that commands implementations will call.
@@ -563,6 +599,7 @@ void setDeferredAggregateLen(client *c, void *node, long length, char prefix) {
         /* Take over the allocation's internal fragmentation */
         buf->size = zmalloc_usable(buf) - sizeof(clientReplyBlock);
         buf->used = lenstr_len;
+        buf->pobjRef = nullptr;
         memcpy(buf->buf(), lenstr, lenstr_len);
         listNodeValue(ln) = buf;
         c->reply_bytes += buf->size;
@@ -837,7 +874,17 @@ void addReplyBulkLen(client *c, robj *obj)
 /* Add a Redis Object as a bulk reply */
 void addReplyBulkCore(client *c, robj_roptr obj, bool fAsync) {
     addReplyBulkLenCore(c,obj,fAsync);
-    addReplyCore(c,obj,fAsync);
+    if (!fAsync && obj->encoding == OBJ_ENCODING_RAW &&
+        sdslen((sds)ptrFromObj(obj)) >= PROTO_REPLY_ZEROCOPY_MIN_BYTES &&
+        obj->getrefcount(std::memory_order_relaxed) != OBJ_SHARED_REFCOUNT)
+    {
+        if (prepareClientToWrite(c, false) == C_OK)
+            _addReplyObjectRefToList(c,obj);
+    }
+    else
+    {
+        addReplyCore(c,obj,fAsync);
+    }
     addReplyCore(c,shared.crlf,fAsync);
 }
 
@@ -1241,6 +1288,16 @@ void unlinkClient(client *c) {
         c->flags &= ~CLIENT_PENDING_WRITE;
     }
 
+    /* Remove from the batch of clients waiting to be processed. The slot is
+     * cleared rather than erased as the batch may be being walked right now. */
+    if (c->flags & CLIENT_PENDING_READ) {
+        auto &vec = g_pserver->rgthreadvar[c->iel].clients_pending_read;
+        auto itr = std::find(vec.begin(), vec.end(), c);
+        serverAssert(itr != vec.end());
+        *itr = nullptr;
+        c->flags &= ~CLIENT_PENDING_READ;
+    }
+
     /* When client was just unblocked because of a blocking operation,
      * remove it from the list of unblocked clients. */
     if (c->flags & CLIENT_UNBLOCKED) {
@@ -1388,6 +1445,15 @@ void freeClientAsync(client *c) {
      * are in the context of the main thread while the other threads are
      * idle. */
     if (c->flags & CLIENT_CLOSE_ASAP || c->flags & CLIENT_LUA) return;  // check without the lock first
+    if (aeThreadInReadSection() || aeThreadInStripedSection()) {
+        /* We can't take the global lock here, processCommand() will queue
+         * the client once it leaves the read or striped section. */
+        AssertCorrectThread(c);
+        auto &vec = serverTL->clients_pending_asyncfree;
+        if (std::find(vec.begin(), vec.end(), c) == vec.end())
+            vec.push_back(c);
+        return;
+    }
     std::lock_guard<decltype(c->lock)> clientlock(c->lock);
     AeLocker lock;
     lock.arm(c);
@@ -1430,85 +1496,96 @@ client *lookupClientByID(uint64_t id) {
     return (c == raxNotFound) ? NULL : c;
 }
 
-/* Write data in output buffers to client. Return C_OK if the client
- * is still valid after the call, C_ERR if it was freed because of some
- * error.
- *
- * This function is called by threads, but always with handler_installed
- * set to 0. So when handler_installed is set to 0 the function must be
- * thread safe. */
-int writeToClient(int fd, client *c, int handler_installed) {
-    ssize_t nwritten = 0, totwritten = 0;
-    clientReplyBlock *o;
-    AssertCorrectThread(c);
+/* Gathers the static buffer and as many reply blocks as fit into one
+ * writev().  c->sentlen is the offset into the static buffer if it has data,
+ * otherwise into the first reply block.  Returns the iovec count, and the
+ * byte count in *pcb. */
+static int clientReplyIov(client *c, struct iovec *iov, size_t *pcb) {
+    int iovcnt = 0;
+    size_t iovbytes = 0;
+    if (c->bufpos > 0) {
+        iov[iovcnt].iov_base = c->buf+c->sentlen;
+        iov[iovcnt].iov_len = c->bufpos-c->sentlen;
+        iovbytes += iov[iovcnt++].iov_len;
+    }
+    size_t offset = (c->bufpos > 0) ? 0 : c->sentlen;
+    listIter li;
+    listNode *ln;
+    listRewind(c->reply,&li);
+    while (iovcnt < NET_MAX_WRITEV_IOV && iovbytes < NET_MAX_WRITES_PER_EVENT &&
+           (ln = listNext(&li)) != NULL)
+    {
+        clientReplyBlock *o = (clientReplyBlock*)listNodeValue(ln);
+        if (o->used > offset) {
+            iov[iovcnt].iov_base = o->buf()+offset;
+            iov[iovcnt].iov_len = o->used-offset;
+            iovbytes += iov[iovcnt++].iov_len;
+        }
+        offset = 0;
+    }
+    *pcb = iovbytes;
+    return iovcnt;
+}
 
-    std::unique_lock<decltype(c->lock)> lock(c->lock);
-   
-    while(clientHasPendingReplies(c)) {
-        if (c->bufpos > 0) {
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
-
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
-
-            /* If the buffer was sent, set bufpos to zero to continue with
-             * the remainder of the reply. */
-            if ((int)c->sentlen == c->bufpos) {
-                c->bufpos = 0;
-                c->sentlen = 0;
-            }
+/* Advance past what was sent, releasing fully sent (and empty) reply blocks */
+static void clientReplySent(client *c, size_t nwritten) {
+    size_t remaining = nwritten;
+    if (c->bufpos > 0) {
+        if (remaining < c->bufpos-c->sentlen) {
+            c->sentlen += remaining;
+            remaining = 0;
         } else {
-            o = (clientReplyBlock*)listNodeValue(listFirst(c->reply));
-            if (o->used == 0) {
-                c->reply_bytes -= o->size;
-                listDelNode(c->reply,listFirst(c->reply));
-                continue;
-            }
-
-            nwritten = write(fd, o->buf() + c->sentlen, o->used - c->sentlen);
-            if (nwritten <= 0)
-                break;
-                
-            c->sentlen += nwritten;
-            totwritten += nwritten;
-            
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == o->used) {
-                c->reply_bytes -= o->size;
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                /* If there are no longer objects in the list, we expect
-                    * the count of reply bytes to be exactly zero. */
-                if (listLength(c->reply) == 0)
-                    serverAssert(c->reply_bytes == 0);
-            }
+            remaining -= c->bufpos-c->sentlen;
+            c->bufpos = 0;
+            c->sentlen = 0;
         }
-        /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
-         * bytes, in a single threaded server it's a good idea to serve
-         * other clients as well, even if a very large request comes from
-         * super fast link that is always able to accept data (in real world
-         * scenario think about 'KEYS *' against the loopback interface).
-         *
-         * However if we are over the maxmemory limit we ignore that and
-         * just deliver as much data as it is possible to deliver.
-         *
-         * Moreover, we also send as much as possible if the client is
-         * a replica (otherwise, on high-speed traffic, the replication
-         * buffer will grow indefinitely) */
-        if (totwritten > NET_MAX_WRITES_PER_EVENT &&
-            (g_pserver->maxmemory == 0 ||
-             zmalloc_used_memory() < g_pserver->maxmemory) &&
-            !(c->flags & CLIENT_SLAVE)) break;
     }
-    
+    while (c->bufpos == 0 && listLength(c->reply)) {
+        clientReplyBlock *o = (clientReplyBlock*)listNodeValue(listFirst(c->reply));
+        if (remaining < o->used-c->sentlen) {
+            c->sentlen += remaining;
+            break;
+        }
+        remaining -= o->used-c->sentlen;
+        c->reply_bytes -= o->size;
+        listDelNode(c->reply,listFirst(c->reply));
+        c->sentlen = 0;
+        /* If there are no longer objects in the list, we expect
+         * the count of reply bytes to be exactly zero. */
+        if (listLength(c->reply) == 0)
+            serverAssert(c->reply_bytes == 0);
+    }
+}
+
+/* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
+ * bytes, in a single threaded server it's a good idea to serve
+ * other clients as well, even if a very large request comes from
+ * super fast link that is always able to accept data (in real world
+ * scenario think about 'KEYS *' against the loopback interface).
+ *
+ * However if we are over the maxmemory limit we ignore that and
+ * just deliver as much data as it is possible to deliver.
+ *
+ * Moreover, we also send as much as possible if the client is
+ * a replica (otherwise, on high-speed traffic, the replication
+ * buffer will grow indefinitely) */
+static bool FClientWriteBudgetLeft(client *c, ssize_t totwritten) {
+    return totwritten <= NET_MAX_WRITES_PER_EVENT ||
+        (g_pserver->maxmemory != 0 && zmalloc_used_memory() >= g_pserver->maxmemory) ||
+        (c->flags & CLIENT_SLAVE);
+}
+
+/* The rest of writeToClient(), totwritten bytes were sent already and the
+ * last write returned nwritten (with errno err if it failed). */
+static int writeToClientDone(client *c, ssize_t totwritten, ssize_t nwritten, int err,
+        int handler_installed, std::unique_lock<fastlock> &lock) {
     g_pserver->stat_net_output_bytes += totwritten;
     if (nwritten == -1) {
-        if (errno == EAGAIN) {
+        if (err == EAGAIN) {
             nwritten = 0;
         } else {
             serverLog(LL_VERBOSE,
-                "Error writing to client: %s", strerror(errno));
+                "Error writing to client: %s", strerror(err));
             lock.unlock();
             freeClientAsync(c);
             
@@ -1536,6 +1613,40 @@ int writeToClient(int fd, client *c, int handler_installed) {
     return C_OK;
 }
 
+/* writeToClient() after the caller already sent totwritten bytes */
+static int writeToClientFrom(int fd, client *c, int handler_installed, ssize_t totwritten) {
+    ssize_t nwritten = 0;
+    AssertCorrectThread(c);
+
+    std::unique_lock<decltype(c->lock)> lock(c->lock);
+   
+    while(clientHasPendingReplies(c) && FClientWriteBudgetLeft(c, totwritten)) {
+        struct iovec iov[NET_MAX_WRITEV_IOV];
+        size_t cb;
+        int iovcnt = clientReplyIov(c, iov, &cb);
+        if (iovcnt == 0) {
+            clientReplySent(c, 0);  // only empty blocks are left
+            continue;
+        }
+        nwritten = writev(fd,iov,iovcnt);
+        if (nwritten <= 0) break;
+        totwritten += nwritten;
+        clientReplySent(c, nwritten);
+    }
+    return writeToClientDone(c, totwritten, nwritten, errno, handler_installed, lock);
+}
+
+/* Write data in output buffers to client. Return C_OK if the client
+ * is still valid after the call, C_ERR if it was freed because of some
+ * error.
+ *
+ * This function is called by threads, but always with handler_installed
+ * set to 0. So when handler_installed is set to 0 the function must be
+ * thread safe. */
+int writeToClient(int fd, client *c, int handler_installed) {
+    return writeToClientFrom(fd, c, handler_installed, 0);
+}
+
 /* Write event handler. Just send data to the client. */
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     UNUSED(mask);
@@ -1582,6 +1693,7 @@ void ProcessPendingAsyncWrites()
         /* take over the allocation's internal fragmentation */
         reply->size = zmalloc_usable(reply) - sizeof(clientReplyBlock);
         reply->used = c->bufposAsync;
+        reply->pobjRef = nullptr;
         memcpy(reply->buf(), c->bufAsync, c->bufposAsync);
         listAddNodeTail(c->reply, reply);
         c->reply_bytes += reply->size;
@@ -1665,21 +1777,8 @@ int handleClientsWithPendingWrites(int iel) {
         ae_flags |= AE_BARRIER;
     }
 
-    while(!vec.empty()) {
-        client *c = vec.back();
-        AssertCorrectThread(c);
-
-        c->flags &= ~CLIENT_PENDING_WRITE;
-        vec.pop_back();
-
-        /* If a client is protected, don't do anything,
-         * that may trigger write error or recreate handler. */
-        if (c->flags & CLIENT_PROTECTED) continue;
-
-        std::unique_lock<decltype(c->lock)> lock(c->lock);
-
-        /* Try to write buffers to the client socket. */
-        if (writeToClient(c->fd,c,0) == C_ERR) 
+    auto fnWritten = [&](client *c, int rc, std::unique_lock<decltype(c->lock)> &lock) {
+        if (rc == C_ERR) 
         {
             if (c->flags & CLIENT_CLOSE_ASAP)
             {
@@ -1689,7 +1788,7 @@ int handleClientsWithPendingWrites(int iel) {
                 if (!freeClient(c))  // writeToClient will only async close, but there's no need to wait
                     c->lock.unlock();   // if we just got put on the async close list, then we need to remove the lock
             }
-            continue;
+            return;
         }
 
         /* If after the synchronous writes above we still have data to
@@ -1698,6 +1797,70 @@ int handleClientsWithPendingWrites(int iel) {
             if (aeCreateFileEvent(g_pserver->rgthreadvar[c->iel].el, c->fd, ae_flags, sendReplyToClient, c) == AE_ERR)
                 freeClientAsync(c);
         }
+    };
+
+    /* The first writev() of every client is gathered here and handed to
+     * aeWritevBatch(), which may send them all with one system call.  Nothing
+     * else runs on this thread until the results are applied, so the buffers
+     * stay put in between. */
+    struct clientWrite {
+        client *c;
+        size_t cb;
+        int iovcnt;
+        struct iovec iov[NET_MAX_WRITEV_IOV];
+    };
+    static thread_local std::vector<clientWrite> vecWrite;
+    static thread_local std::vector<aeWritevOp> vecOp;
+    vecWrite.clear();
+
+    while(!vec.empty()) {
+        client *c = vec.back();
+        AssertCorrectThread(c);
+
+        c->flags &= ~CLIENT_PENDING_WRITE;
+        vec.pop_back();
+
+        /* If a client is protected, don't do anything,
+         * that may trigger write error or recreate handler. */
+        if (c->flags & CLIENT_PROTECTED) continue;
+
+        std::unique_lock<decltype(c->lock)> lock(c->lock);
+
+        vecWrite.emplace_back();
+        clientWrite &write = vecWrite.back();
+        write.iovcnt = clientReplyIov(c, write.iov, &write.cb);
+        if (write.iovcnt == 0) {
+            /* Nothing to send, writeToClient() just tidies up */
+            vecWrite.pop_back();
+            fnWritten(c, writeToClient(c->fd,c,0), lock);
+            continue;
+        }
+        write.c = c;
+    }
+
+    vecOp.resize(vecWrite.size());
+    for (size_t iwrite = 0; iwrite < vecWrite.size(); ++iwrite) {
+        vecOp[iwrite].fd = vecWrite[iwrite].c->fd;
+        vecOp[iwrite].iov = vecWrite[iwrite].iov;
+        vecOp[iwrite].iovcnt = vecWrite[iwrite].iovcnt;
+    }
+    aeWritevBatch(g_pserver->rgthreadvar[iel].el, vecOp.data(), (int)vecWrite.size());
+
+    for (size_t iwrite = 0; iwrite < vecWrite.size(); ++iwrite) {
+        client *c = vecWrite[iwrite].c;
+        const aeWritevOp &op = vecOp[iwrite];
+        std::unique_lock<decltype(c->lock)> lock(c->lock);
+        int rc;
+        if (op.nwritten > 0)
+            clientReplySent(c, op.nwritten);
+        if (op.nwritten == (ssize_t)vecWrite[iwrite].cb) {
+            /* Everything went out, keep writing while the socket takes it */
+            rc = writeToClientFrom(c->fd, c, 0, op.nwritten);
+        } else {
+            std::unique_lock<decltype(c->lock)> lockWrite(c->lock);
+            rc = writeToClientDone(c, std::max(op.nwritten, (ssize_t)0), op.nwritten, op.err, 0, lockWrite);
+        }
+        fnWritten(c, rc, lock);
     }
 
     if (listLength(serverTL->clients_pending_asyncwrite))
@@ -1734,6 +1897,38 @@ void resetClient(client *c) {
     }
 }
 
+/* Account for nread bytes just read into the query buffer at offset qblen */
+static void queryBufferAppended(client *c, size_t qblen, ssize_t nread) {
+    if (c->flags & CLIENT_MASTER) {
+        /* Append the query buffer to the pending (not applied) buffer
+         * of the master. We'll use this buffer later in order to have a
+         * copy of the string applied by the last command executed. */
+        c->pending_querybuf = sdscatlen(c->pending_querybuf,
+                                        c->querybuf+qblen,nread);
+    }
+
+    sdsIncrLen(c->querybuf,nread);
+    c->lastinteraction = g_pserver->unixtime;
+    if (c->flags & CLIENT_MASTER) c->read_reploff += nread;
+    g_pserver->stat_net_input_bytes += nread;
+}
+
+/* The event loop may have received data for the client that its read
+ * handler didn't read yet (see AE_READ_BUFFERED).  It goes away with the
+ * handler, so move it to the query buffer, it is parsed once the command
+ * that protected the client returns. */
+static void readBufferedInput(client *c) {
+    aeEventLoop *el = g_pserver->rgthreadvar[c->iel].el;
+    if (c->fd == -1) return;
+    while (aeHasBufferedInput(el, c->fd)) {
+        size_t qblen = sdslen(c->querybuf);
+        c->querybuf = sdsMakeRoomFor(c->querybuf, PROTO_IOBUF_LEN);
+        ssize_t nread = aeRead(el, c->fd, c->querybuf+qblen, PROTO_IOBUF_LEN);
+        if (nread <= 0) break;
+        queryBufferAppended(c, qblen, nread);
+    }
+}
+
 /* This funciton is used when we want to re-enter the event loop but there
  * is the risk that the client we are dealing with will be freed in some
  * way. This happens for instance in:
@@ -1750,6 +1945,7 @@ void resetClient(client *c) {
 void protectClient(client *c) {
     c->flags |= CLIENT_PROTECTED;
     AssertCorrectThread(c);
+    readBufferedInput(c);
     aeDeleteFileEvent(g_pserver->rgthreadvar[c->iel].el,c->fd,AE_READABLE);
     aeDeleteFileEvent(g_pserver->rgthreadvar[c->iel].el,c->fd,AE_WRITABLE);
 }
@@ -1759,11 +1955,151 @@ void unprotectClient(client *c) {
     AssertCorrectThread(c);
     if (c->flags & CLIENT_PROTECTED) {
         c->flags &= ~CLIENT_PROTECTED;
-        aeCreateFileEvent(g_pserver->rgthreadvar[c->iel].el,c->fd,AE_READABLE|AE_READ_THREADSAFE,readQueryFromClient,c);
+        aeCreateFileEvent(g_pserver->rgthreadvar[c->iel].el,c->fd,AE_READABLE|AE_READ_THREADSAFE|AE_READ_BUFFERED,readQueryFromClient,c);
         if (clientHasPendingReplies(c)) clientInstallWriteHandler(c);
     }
 }
 
+/* Clients are assigned to a thread when they connect and normally stay there,
+ * so a few heavy connections landing on the same thread can leave it saturated
+ * while the others idle.  With client-rebalance enabled serverCron() calls
+ * rebalanceClients() once per second.  It compares how busy each event loop
+ * was during the last interval and moves the hottest clients of the busiest
+ * thread to the least busy one.
+ *
+ * A client is only moved while it is quiescent: nothing left in its query
+ * buffer and no replies queued, so no state tied to the old thread is left
+ * behind. */
+#define REBALANCE_MIN_GAP_USEC 50000      /* 5% of a one second interval */
+#define REBALANCE_MAX_MOVES_PER_PASS 4
+
+static bool FClientMigratable(client *c) {
+    const uint64_t flagsPinned = CLIENT_SLAVE|CLIENT_MASTER|CLIENT_MONITOR|CLIENT_MULTI|
+        CLIENT_BLOCKED|CLIENT_PUBSUB|CLIENT_TRACKING|CLIENT_CLOSE_ASAP|CLIENT_CLOSE_AFTER_REPLY|
+        CLIENT_PROTECTED|CLIENT_UNBLOCKED|CLIENT_LUA|CLIENT_MODULE|CLIENT_PENDING_WRITE|
+        CLIENT_PENDING_READ|CLIENT_PENDING_COMMAND;
+    if (c->fd == -1 || (c->flags & flagsPinned)) return false;
+    if (c->fPendingAsyncWrite || c->casyncOpsPending || c->bufposAsync) return false;
+    if (clientHasPendingReplies(c)) return false;
+    if (c->qb_pos < sdslen(c->querybuf)) return false;
+    if (aeHasBufferedInput(g_pserver->rgthreadvar[c->iel].el, c->fd)) return false;
+    return true;
+}
+
+/* Runs on the destination thread with the global lock held */
+static void finishClientMigration(uint64_t id, int ielDst) {
+    client *c = lookupClientByID(id);
+    if (c == nullptr || c->iel != ielDst) return;   // freed while in flight
+    std::unique_lock<decltype(c->lock)> lock(c->lock);
+    if (aeCreateFileEvent(g_pserver->rgthreadvar[ielDst].el,c->fd,AE_READABLE|AE_READ_THREADSAFE|AE_READ_BUFFERED,
+        readQueryFromClient, c) == AE_ERR)
+    {
+        freeClientAsync(c);
+        return;
+    }
+    if (clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+}
+
+/* Runs on the source thread with the global lock held */
+static void startClientMigration(uint64_t id, int ielSrc, int ielDst) {
+    client *c = lookupClientByID(id);
+    if (c == nullptr || c->iel != ielSrc) return;
+    std::unique_lock<decltype(c->lock)> lock(c->lock);
+    if (!FClientMigratable(c)) return;
+
+    aeDeleteFileEvent(g_pserver->rgthreadvar[ielSrc].el,c->fd,AE_READABLE);
+    aeDeleteFileEvent(g_pserver->rgthreadvar[ielSrc].el,c->fd,AE_WRITABLE);
+    atomicDecr(g_pserver->rgthreadvar[ielSrc].cclients, 1);
+    atomicIncr(g_pserver->rgthreadvar[ielDst].cclients, 1);
+    c->iel = ielDst;
+    g_pserver->stat_client_migrations++;
+    lock.unlock();
+
+    aePostFunction(g_pserver->rgthreadvar[ielDst].el, [id, ielDst]{
+        finishClientMigration(id, ielDst);
+    });
+}
+
+/* Called from beforeSleep() once the thread has flushed its pending writes.
+ * A busy client almost always has replies queued while its thread is still
+ * processing events, so this is the one point in the loop where it is likely
+ * to be quiescent.  Clients that still aren't are left where they are, the
+ * next pass will pick them again if the thread is still overloaded. */
+void processClientsPendingMigration(int iel) {
+    serverAssert(GlobalLocksAcquired());
+    auto &vec = g_pserver->rgthreadvar[iel].clients_pending_migration;
+    if (vec.empty()) return;
+    for (auto &pending : vec)
+        startClientMigration(pending.first, iel, pending.second);
+    vec.clear();
+}
+
+void rebalanceClients(void) {
+    static unsigned long rgcommandsLast[MAX_EVENT_LOOPS];
+    static long long rgbusyLast[MAX_EVENT_LOOPS];
+    static mstime_t mstimeLast = 0;
+    unsigned long rgcommands[MAX_EVENT_LOOPS] = {0};
+    long long rgbusy[MAX_EVENT_LOOPS] = {0};
+
+    serverAssert(GlobalLocksAcquired());
+    mstime_t now = mstime();
+    /* After a pause (or right after the option was enabled) the snapshots are
+     * stale, so just take new ones. */
+    bool fStale = (now - mstimeLast) > 2000;
+    mstimeLast = now;
+
+    int ielBusy = 0, ielIdle = 0;
+    for (int iel = 0; iel < cserver.cthreads; ++iel) {
+        unsigned long commands;
+        long long busy;
+        atomicGet(g_pserver->rgthreadvar[iel].commandsExecuted, commands);
+        atomicGet(g_pserver->rgthreadvar[iel].busy_usec, busy);
+        rgcommands[iel] = commands - rgcommandsLast[iel];
+        rgbusy[iel] = busy - rgbusyLast[iel];
+        rgcommandsLast[iel] = commands;
+        rgbusyLast[iel] = busy;
+        if (rgbusy[iel] > rgbusy[ielBusy]) ielBusy = iel;
+        if (rgbusy[iel] < rgbusy[ielIdle]) ielIdle = iel;
+    }
+
+    /* Per client command counts over the same interval */
+    std::vector<std::pair<long long, uint64_t>> vecCandidates;
+    long long gap = rgbusy[ielBusy] - rgbusy[ielIdle];
+    bool fImbalanced = !fStale && ielBusy != ielIdle && gap >= REBALANCE_MIN_GAP_USEC
+        && rgbusy[ielBusy]*4 > rgbusy[ielIdle]*5 && rgcommands[ielBusy] > 0;
+
+    listIter li;
+    listNode *ln;
+    listRewind(g_pserver->clients,&li);
+    while ((ln = listNext(&li)) != NULL) {
+        client *c = (client*)listNodeValue(ln);
+        unsigned long commands = c->commands_processed - c->commands_at_rebalance;
+        c->commands_at_rebalance = c->commands_processed;
+        if (!fImbalanced || c->iel != ielBusy || commands == 0) continue;
+
+        /* Estimate the client's share of the thread's busy time from its share
+         * of the commands.  Moving a client worth more than half the gap would
+         * just swap which thread is overloaded. */
+        long long share = (long long)((double)rgbusy[ielBusy] * commands / rgcommands[ielBusy]);
+        if (share > gap/2) continue;
+        vecCandidates.emplace_back(share, c->id);
+    }
+    if (vecCandidates.empty()) return;
+
+    std::sort(vecCandidates.begin(), vecCandidates.end(), std::greater<std::pair<long long, uint64_t>>());
+    long long moved = 0;
+    int cmoves = 0;
+    for (auto &candidate : vecCandidates) {
+        if (cmoves >= REBALANCE_MAX_MOVES_PER_PASS) break;
+        if (moved + candidate.first > gap/2) continue;
+        moved += candidate.first;
+        ++cmoves;
+        g_pserver->rgthreadvar[ielBusy].clients_pending_migration.emplace_back(candidate.second, ielIdle);
+    }
+    serverLog(LL_VERBOSE, "Rebalancing %d client(s) from thread %d (busy %lldus) to thread %d (busy %lldus)",
+        cmoves, ielBusy, rgbusy[ielBusy], ielIdle, rgbusy[ielIdle]);
+}
+
 /* Like processMultibulkBuffer(), but for the inline protocol instead of RESP,
  * this function consumes the client query buffer and creates a command ready
  * to be executed inside the client structure. Returns C_OK if the command
@@ -2176,7 +2512,7 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
     c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
     
-    nread = read(fd, c->querybuf+qblen, readlen);
+    nread = aeRead(el, fd, c->querybuf+qblen, readlen);
     
     if (nread == -1) {
         if (errno == EAGAIN) {
@@ -2190,18 +2526,9 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         serverLog(LL_VERBOSE, "Client closed connection");
         freeClientAsync(c);
         return;
-    } else if (c->flags & CLIENT_MASTER) {
-        /* Append the query buffer to the pending (not applied) buffer
-         * of the master. We'll use this buffer later in order to have a
-         * copy of the string applied by the last command executed. */
-        c->pending_querybuf = sdscatlen(c->pending_querybuf,
-                                        c->querybuf+qblen,nread);
     }
 
-    sdsIncrLen(c->querybuf,nread);
-    c->lastinteraction = g_pserver->unixtime;
-    if (c->flags & CLIENT_MASTER) c->read_reploff += nread;
-    g_pserver->stat_net_input_bytes += nread;
+    queryBufferAppended(c, qblen, nread);
     if (sdslen(c->querybuf) > cserver.client_max_querybuf_len) {
         sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
 
@@ -2219,6 +2546,23 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
      * was actually applied to the master state: this quantity, and its
      * corresponding part of the replication stream, will be propagated to
      * the sub-slaves and to the replication backlog. */
+    if (g_pserver->lock_batch_size > 0) {
+        /* Leave the parsing and execution to processClientsPendingRead() so
+         * the global lock is taken once for all the clients read in this
+         * event loop iteration. */
+        auto &vec = serverTL->clients_pending_read;
+        if (!(c->flags & CLIENT_PENDING_READ)) {
+            c->flags |= CLIENT_PENDING_READ;
+            vec.push_back(c);
+        }
+        if ((int)vec.size() >= g_pserver->lock_batch_size) {
+            /* Drop our lock first, c may be freed by another client's command */
+            lock.unlock();
+            processClientsPendingRead(ielFromEventLoop(el));
+        }
+        return;
+    }
+
     processInputBufferAndReplicate(c);
     if (listLength(serverTL->clients_pending_asyncwrite))
     {
@@ -2227,6 +2571,31 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 }
 
+/* Run the commands of the clients readQueryFromClient() queued when
+ * lock-batch-size is set, taking the global lock once for the whole batch.
+ * Called when the batch is full and before the event loop goes to sleep. */
+void processClientsPendingRead(int iel) {
+    auto &vec = g_pserver->rgthreadvar[iel].clients_pending_read;
+    serverAssert(&vec == &serverTL->clients_pending_read);
+    if (vec.empty()) return;
+
+    AeLocker locker;
+    locker.arm(nullptr);
+    /* Indexed because commands may free clients (clearing their slot) or, via
+     * processEventsWhileBlocked(), queue more. */
+    for (size_t i = 0; i < vec.size(); ++i) {
+        client *c = vec[i];
+        if (c == nullptr) continue;
+        vec[i] = nullptr;
+        std::unique_lock<decltype(c->lock)> lock(c->lock);
+        c->flags &= ~CLIENT_PENDING_READ;
+        processInputBufferAndReplicate(c);
+    }
+    vec.clear();
+    if (listLength(serverTL->clients_pending_asyncwrite))
+        ProcessPendingAsyncWrites();
+}
+
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer) {
     client *c;
@@ -3000,15 +3369,20 @@ int processEventsWhileBlocked(int iel) {
     int iterations = 4; /* See the function top-comment. */
     int count = 0;
 
+    /* Our caller may still hold the lock of a db a striped command would
+     * wait on, while we wait for that command to get the global lock back */
+    aeKeepStripesOut(TRUE);
     aeReleaseLock();
     while (iterations--) {
         int events = 0;
         events += aeProcessEvents(g_pserver->rgthreadvar[iel].el, AE_FILE_EVENTS|AE_DONT_WAIT);
+        processClientsPendingRead(iel);
         events += handleClientsWithPendingWrites(iel);
         if (!events) break;
         count += events;
     }
     aeAcquireLock();
+    aeKeepStripesOut(FALSE);
     return count;
 }
 
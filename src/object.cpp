@@ -245,10 +245,16 @@ robj *createIntsetObject(void) {
     return o;
 }
 
+robj *createRoaringSetObject(roaring *r) {
+    robj *o = createObject(OBJ_SET,r);
+    o->encoding = OBJ_ENCODING_ROARING;
+    return o;
+}
+
 robj *createHashObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(OBJ_HASH, zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+    unsigned char *lp = lpNew();
+    robj *o = createObject(OBJ_HASH, lp);
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -257,16 +263,16 @@ robj *createZsetObject(void) {
     robj *o;
 
     zs->pdict = dictCreate(&zsetDictType,NULL);
-    zs->zsl = zslCreate();
+    zs->zbt = zbtCreate();
     o = createObject(OBJ_ZSET,zs);
-    o->encoding = OBJ_ENCODING_SKIPLIST;
+    o->encoding = OBJ_ENCODING_BTREE;
     return o;
 }
 
-robj *createZsetZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(OBJ_ZSET,zl);
-    o->encoding = OBJ_ENCODING_ZIPLIST;
+robj *createZsetListpackObject(void) {
+    unsigned char *lp = lpNew();
+    robj *o = createObject(OBJ_ZSET,lp);
+    o->encoding = OBJ_ENCODING_LISTPACK;
     return o;
 }
 
@@ -306,6 +312,9 @@ void freeSetObject(robj_roptr o) {
     case OBJ_ENCODING_INTSET:
         zfree(ptrFromObj(o));
         break;
+    case OBJ_ENCODING_ROARING:
+        roaringFree((roaring*)ptrFromObj(o));
+        break;
     default:
         serverPanic("Unknown set encoding type");
     }
@@ -314,14 +323,14 @@ void freeSetObject(robj_roptr o) {
 void freeZsetObject(robj_roptr o) {
     zset *zs;
     switch (o->encoding) {
-    case OBJ_ENCODING_SKIPLIST:
+    case OBJ_ENCODING_BTREE:
         zs = (zset*)ptrFromObj(o);
         dictRelease(zs->pdict);
-        zslFree(zs->zsl);
+        zbtFree(zs->zbt);
         zfree(zs);
         break;
-    case OBJ_ENCODING_ZIPLIST:
-        zfree(ptrFromObj(o));
+    case OBJ_ENCODING_LISTPACK:
+        lpFree((unsigned char*)ptrFromObj(o));
         break;
     default:
         serverPanic("Unknown sorted set encoding");
@@ -333,8 +342,8 @@ void freeHashObject(robj_roptr o) {
     case OBJ_ENCODING_HT:
         dictRelease((dict*) ptrFromObj(o));
         break;
-    case OBJ_ENCODING_ZIPLIST:
-        zfree(ptrFromObj(o));
+    case OBJ_ENCODING_LISTPACK:
+        lpFree((unsigned char*)ptrFromObj(o));
         break;
     default:
         serverPanic("Unknown hash encoding type");
@@ -744,6 +753,9 @@ int getLongFromObjectOrReply(client *c, robj *o, long *target, const char *msg)
     return C_OK;
 }
 
+/* The names reported by OBJECT ENCODING and DEBUG OBJECT.  They always name
+ * the structure actually in use, even where it replaced an older one that
+ * clients may still expect ("ziplist", "skiplist"). */
 const char *strEncoding(int encoding) {
     switch(encoding) {
     case OBJ_ENCODING_RAW: return "raw";
@@ -751,13 +763,103 @@ const char *strEncoding(int encoding) {
     case OBJ_ENCODING_HT: return "hashtable";
     case OBJ_ENCODING_QUICKLIST: return "quicklist";
     case OBJ_ENCODING_ZIPLIST: return "ziplist";
+    case OBJ_ENCODING_LISTPACK: return "listpack";
     case OBJ_ENCODING_INTSET: return "intset";
-    case OBJ_ENCODING_SKIPLIST: return "skiplist";
+    case OBJ_ENCODING_ROARING: return "roaring";
+    case OBJ_ENCODING_BTREE: return "btree";
     case OBJ_ENCODING_EMBSTR: return "embstr";
     default: return "unknown";
     }
 }
 
+/* ===================== Values inlined in the keyspace ===================== */
+
+/* With keyspace-inline-values, string values that fit in a pointer are stored
+ * in the value slot of their keyspace dictEntry, saving the robj allocation:
+ *
+ *   bit 0        OBJ_INLINE_TAG
+ *   bit 1        0 for an integer, INLINE_STRING for a string
+ *   integers     the value in the upper 62 bits
+ *   strings      the length in bits 2-4 and up to 7 bytes in bytes 1-7
+ *
+ * An inlined value has no LRU/LFU clock or MVCC timestamp of its own, so
+ * values are only inlined while the maxmemory policy is neither LRU nor LFU
+ * and active replication is off.  As with shared integers, OBJECT IDLETIME
+ * does not track the accesses to such values. */
+#define INLINE_STRING (1<<1)
+#define INLINE_STRING_MAX 7
+#define INLINE_INT_MIN (-(1LL<<61))
+#define INLINE_INT_MAX ((1LL<<61)-1)
+
+int objectCanInline(robj *o) {
+    if (!g_pserver->keyspace_inline_values || g_pserver->fActiveReplica)
+        return 0;
+    if (g_pserver->maxmemory_policy & (MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_LFU))
+        return 0;
+    /* Shared objects cost no allocation of their own */
+    if (o->type != OBJ_STRING || o->FExpires() ||
+        o->getrefcount(std::memory_order_relaxed) == OBJ_SHARED_REFCOUNT)
+        return 0;
+    if (o->encoding == OBJ_ENCODING_INT) {
+        long long value = (long)o->m_ptr;
+        return value >= INLINE_INT_MIN && value <= INLINE_INT_MAX;
+    }
+    if (o->encoding == OBJ_ENCODING_EMBSTR)
+        return sdslen(szFromObj(o)) <= INLINE_STRING_MAX;
+    return 0;
+}
+
+/* Returns the inlined form of a string object accepted by objectCanInline().
+ * The object itself is left untouched. */
+void *objectToInline(robj *o) {
+    uint64_t val;
+    if (o->encoding == OBJ_ENCODING_INT) {
+        val = ((uint64_t)(long)o->m_ptr << 2) | OBJ_INLINE_TAG;
+    } else {
+        const char *s = szFromObj(o);
+        size_t len = sdslen(s);
+        val = OBJ_INLINE_TAG | INLINE_STRING | (len << 2);
+        for (size_t i = 0; i < len; ++i)
+            val |= (uint64_t)(unsigned char)s[i] << (8*(i+1));
+    }
+    return (void*)(uintptr_t)val;
+}
+
+/* Create a new object holding an inlined value, with the same encoding the
+ * value had before it was inlined. */
+robj *createObjectFromInline(const void *pv) {
+    uint64_t val = (uintptr_t)pv;
+    serverAssert(val & OBJ_INLINE_TAG);
+    if (!(val & INLINE_STRING))
+        return createStringObjectFromLongLongForValue((int64_t)val >> 2);
+
+    char buf[INLINE_STRING_MAX];
+    size_t len = (val >> 2) & 0x7;
+    for (size_t i = 0; i < len; ++i)
+        buf[i] = (char)(val >> (8*(i+1)));
+    return createEmbeddedStringObject(buf,len);
+}
+
+/* Objects handed out for inlined values, and the objects whose reference
+ * the keyspace dropped when inlining them, can still be in use by the
+ * command that got them.  Their release is deferred to the end of the
+ * command (or of the event loop iteration) on the thread that created them. */
+static thread_local std::vector<robj*> t_vecAutorelease;
+
+void autoreleaseObject(robj *o) {
+    t_vecAutorelease.push_back(o);
+}
+
+void releaseAutoreleasedObjects(void) {
+    if (t_vecAutorelease.empty())
+        return;
+    for (robj *o : t_vecAutorelease)
+        decrRefCount(o);
+    t_vecAutorelease.clear();
+    if (t_vecAutorelease.capacity() > 1024)
+        std::vector<robj*>().swap(t_vecAutorelease);
+}
+
 /* =========================== Memory introspection ========================= */
 
 
@@ -836,30 +938,33 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
         } else if (o->encoding == OBJ_ENCODING_INTSET) {
             intset *is = (intset*)ptrFromObj(o);
             asize = sizeof(*o)+sizeof(*is)+is->encoding*is->length;
+        } else if (o->encoding == OBJ_ENCODING_ROARING) {
+            asize = sizeof(*o)+roaringAllocSize((roaring*)ptrFromObj(o));
         } else {
             serverPanic("Unknown set encoding");
         }
     } else if (o->type == OBJ_ZSET) {
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+(ziplistBlobLen((unsigned char*)ptrFromObj(o)));
-        } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes((unsigned char*)ptrFromObj(o)));
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
             d = ((zset*)ptrFromObj(o))->pdict;
-            zskiplist *zsl = ((zset*)ptrFromObj(o))->zsl;
-            zskiplistNode *znode = zsl->header->level(0)->forward;
-            asize = sizeof(*o)+sizeof(zset)+(sizeof(struct dictEntry*)*dictSlots(d));
-            while(znode != NULL && samples < sample_size) {
-                elesize += sdsAllocSize(znode->ele);
-                elesize += sizeof(struct dictEntry) + zmalloc_size(znode);
+            zbtree *zbt = ((zset*)ptrFromObj(o))->zbt;
+            zbtreePos pos = zbtFirst(zbt);
+            asize = sizeof(*o)+sizeof(zset)+sizeof(zbtree)+(sizeof(struct dictEntry*)*dictSlots(d));
+            while(pos.valid() && samples < sample_size) {
+                elesize += sdsAllocSize(pos.ele());
+                /* Each element is charged its share of the leaf. */
+                elesize += sizeof(struct dictEntry) + zmalloc_size(pos.leaf)/pos.leaf->count;
                 samples++;
-                znode = znode->level(0)->forward;
+                pos.next();
             }
             if (samples) asize += (double)elesize/samples*dictSize(d);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (o->type == OBJ_HASH) {
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            asize = sizeof(*o)+(ziplistBlobLen((unsigned char*)ptrFromObj(o)));
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            asize = sizeof(*o)+(lpBytes((unsigned char*)ptrFromObj(o)));
         } else if (o->encoding == OBJ_ENCODING_HT) {
             d = (dict*)ptrFromObj(o);
             di = dictGetIterator(d);
@@ -1068,6 +1173,8 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
         mem_total+=mem;
 
         mem = db->setexpire->bytes_used();
+        if (db->wheelexpire)
+            mem += db->wheelexpire->bytes_used();
         mh->db[mh->num_dbs].overhead_ht_expires = mem;
         mem_total+=mem;
 
@@ -1250,7 +1357,7 @@ robj *objectCommandLookup(client *c, robj *key) {
     dictEntry *de;
 
     if ((de = dictFind(c->db->pdict,ptrFromObj(key))) == NULL) return NULL;
-    return (robj*) dictGetVal(de);
+    return dbEntryValue(de);
 }
 
 robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply) {
@@ -1350,7 +1457,8 @@ NULL
             addReplyNull(c, shared.nullbulk);
             return;
         }
-        size_t usage = objectComputeSize((robj*)dictGetVal(de),samples);
+        /* Inlined values take no memory beyond their entry */
+        size_t usage = FInlineVal(dictGetVal(de)) ? 0 : objectComputeSize((robj*)dictGetVal(de),samples);
         usage += sdsAllocSize((sds)dictGetKey(de));
         usage += sizeof(dictEntry);
         addReplyLongLong(c,usage);
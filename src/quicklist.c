@@ -29,11 +29,18 @@
  */
 
 #include <string.h> /* for memcpy */
+#include <pthread.h>
 #include "quicklist.h"
 #include "zmalloc.h"
 #include "ziplist.h"
 #include "util.h" /* for ll2string */
 #include "lzf.h"
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
 
 #if defined(REDIS_TEST) || defined(REDIS_TEST_VERBOSE)
 #include <stdio.h> /* for printf (debug printing), snprintf (genstr) */
@@ -58,6 +65,23 @@ static const size_t optimization_level[] = {4096, 8192, 16384, 32768, 65536};
  * resulted in a larger size than the original data. */
 #define MIN_COMPRESS_IMPROVE 8
 
+/* Maximum number of nodes being compressed in the background at once. Past
+ * that nodes are compressed inline, so that the copies handed to the
+ * background thread can't pile up when it falls behind. */
+#define MAX_ASYNC_COMPRESS_JOBS 1024
+
+/* zstd compression level, and of the dictionary when one is configured. */
+#define ZSTD_COMPRESS_LEVEL 3
+
+int quicklistCompressCodec = QUICKLIST_NODE_ENCODING_LZF;
+int quicklistCompressAsync = 0;
+__thread int quicklistNoAsyncCompressThisThread = 0;
+
+/* See "background compression" below. */
+static pthread_mutex_t async_compress_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int async_compress_used = 0;
+REDIS_STATIC void __quicklistFreeNode(quicklistNode *node);
+
 /* If not verbose testing, remove all debug printing. */
 #ifndef REDIS_TEST_VERBOSE
 #define D(...)
@@ -145,6 +169,8 @@ REDIS_STATIC quicklistNode *quicklistCreateNode(void) {
     node->encoding = QUICKLIST_NODE_ENCODING_RAW;
     node->container = QUICKLIST_NODE_CONTAINER_ZIPLIST;
     node->recompress = 0;
+    node->compress_pending = 0;
+    node->compress_stale = 0;
     return node;
 }
 
@@ -156,22 +182,159 @@ void quicklistRelease(quicklist *quicklist) {
     unsigned long len;
     quicklistNode *current, *next;
 
+    /* Lists are also released by the lazyfree thread, which may race with the
+     * completion of background compression jobs for their nodes. */
+    int lock = async_compress_used;
+    if (lock)
+        pthread_mutex_lock(&async_compress_mutex);
     current = quicklist->head;
     len = quicklist->len;
     while (len--) {
         next = current->next;
 
-        zfree(current->zl);
         quicklist->count -= current->count;
 
-        zfree(current);
+        __quicklistFreeNode(current);
 
         quicklist->len--;
         current = next;
     }
+    if (lock)
+        pthread_mutex_unlock(&async_compress_mutex);
     zfree(quicklist);
 }
 
+/* ------------------------------- codecs ----------------------------------- */
+
+#ifdef USE_ZSTD
+/* Contexts can't be shared between threads, and nodes are compressed and
+ * decompressed by the threads running commands as well as the background
+ * one. */
+static __thread ZSTD_CCtx *zstd_cctx = NULL;
+static __thread ZSTD_DCtx *zstd_dctx = NULL;
+static ZSTD_CDict *zstd_cdict = NULL;
+static ZSTD_DDict *zstd_ddict = NULL;
+#endif
+
+/* Return 1 if nodes can be compressed with 'codec' in this build. */
+int quicklistCodecAvailable(int codec) {
+    switch (codec) {
+    case QUICKLIST_NODE_ENCODING_LZF:
+#ifdef USE_LZ4
+    case QUICKLIST_NODE_ENCODING_LZ4:
+#endif
+#ifdef USE_ZSTD
+    case QUICKLIST_NODE_ENCODING_ZSTD:
+#endif
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Use a dictionary trained on typical list contents (zstd --train) for zstd
+ * compression. Has to be called before any node is compressed with zstd,
+ * since those nodes can only be decompressed with the same dictionary.
+ * Returns 0 on success, -1 if the dictionary can't be used. */
+int quicklistSetZstdDictionary(const void *dict, size_t len) {
+#ifdef USE_ZSTD
+    ZSTD_CDict *cdict = ZSTD_createCDict(dict, len, ZSTD_COMPRESS_LEVEL);
+    ZSTD_DDict *ddict = ZSTD_createDDict(dict, len);
+    if (cdict == NULL || ddict == NULL) {
+        ZSTD_freeCDict(cdict);
+        ZSTD_freeDDict(ddict);
+        return -1;
+    }
+    ZSTD_freeCDict(zstd_cdict);
+    ZSTD_freeDDict(zstd_ddict);
+    zstd_cdict = cdict;
+    zstd_ddict = ddict;
+    return 0;
+#else
+    (void)dict;
+    (void)len;
+    return -1;
+#endif
+}
+
+/* Compress the 'sz' bytes at 'src' into 'dst', which has room for 'sz' bytes
+ * too, with 'codec'. Returns the compressed length, or 0 if the data doesn't
+ * fit there once compressed. */
+REDIS_STATIC size_t __quicklistCodecCompress(int codec, const unsigned char *src,
+                                             size_t sz, char *dst) {
+    switch (codec) {
+#ifdef USE_LZ4
+    case QUICKLIST_NODE_ENCODING_LZ4: {
+        int len = LZ4_compress_default((const char *)src, dst, sz, sz);
+        return len > 0 ? (size_t)len : 0;
+    }
+#endif
+#ifdef USE_ZSTD
+    case QUICKLIST_NODE_ENCODING_ZSTD: {
+        size_t len;
+        if (zstd_cctx == NULL && (zstd_cctx = ZSTD_createCCtx()) == NULL)
+            return 0;
+        if (zstd_cdict)
+            len = ZSTD_compress_usingCDict(zstd_cctx, dst, sz, src, sz,
+                                           zstd_cdict);
+        else
+            len = ZSTD_compressCCtx(zstd_cctx, dst, sz, src, sz,
+                                    ZSTD_COMPRESS_LEVEL);
+        return ZSTD_isError(len) ? 0 : len;
+    }
+#endif
+    default:
+        return lzf_compress(src, sz, dst, sz);
+    }
+}
+
+/* Decompress 'sz' bytes at 'src', compressed with 'codec', into the 'dstsz'
+ * bytes at 'dst'. Returns 1 on success, 0 on failure. */
+REDIS_STATIC int __quicklistCodecDecompress(int codec, const char *src, size_t sz,
+                                            unsigned char *dst, size_t dstsz) {
+    switch (codec) {
+#ifdef USE_LZ4
+    case QUICKLIST_NODE_ENCODING_LZ4:
+        return LZ4_decompress_safe(src, (char *)dst, sz, dstsz) == (int)dstsz;
+#endif
+#ifdef USE_ZSTD
+    case QUICKLIST_NODE_ENCODING_ZSTD: {
+        size_t len;
+        if (zstd_dctx == NULL && (zstd_dctx = ZSTD_createDCtx()) == NULL)
+            return 0;
+        if (zstd_ddict)
+            len = ZSTD_decompress_usingDDict(zstd_dctx, dst, dstsz, src, sz,
+                                             zstd_ddict);
+        else
+            len = ZSTD_decompressDCtx(zstd_dctx, dst, dstsz, src, sz);
+        return !ZSTD_isError(len) && len == dstsz;
+    }
+#endif
+    case QUICKLIST_NODE_ENCODING_LZF:
+        return lzf_decompress(src, sz, dst, dstsz) != 0;
+    default:
+        return 0;
+    }
+}
+
+/* Compress 'sz' bytes of ziplist with 'codec'. Returns NULL when that would
+ * not save at least MIN_COMPRESS_IMPROVE bytes. */
+REDIS_STATIC quicklistLZF *__quicklistCompressZiplist(int codec,
+                                                      const unsigned char *zl,
+                                                      size_t sz) {
+    quicklistLZF *lzf = zmalloc(sizeof(*lzf) + sz, MALLOC_SHARED);
+
+    /* Cancel if compression fails or doesn't compress small enough */
+    if (((lzf->sz = __quicklistCodecCompress(codec, zl, sz,
+                                             lzf->compressed)) == 0) ||
+        lzf->sz + MIN_COMPRESS_IMPROVE >= sz) {
+        /* The codecs abort/reject compression if value not compressable. */
+        zfree(lzf);
+        return NULL;
+    }
+    return zrealloc(lzf, sizeof(*lzf) + lzf->sz, MALLOC_SHARED);
+}
+
 /* Compress the ziplist in 'node' and update encoding details.
  * Returns 1 if ziplist compressed successfully.
  * Returns 0 if compression failed or if ziplist too small to compress. */
@@ -184,24 +347,149 @@ REDIS_STATIC int __quicklistCompressNode(quicklistNode *node) {
     if (node->sz < MIN_COMPRESS_BYTES)
         return 0;
 
-    quicklistLZF *lzf = zmalloc(sizeof(*lzf) + node->sz, MALLOC_SHARED);
-
-    /* Cancel if compression fails or doesn't compress small enough */
-    if (((lzf->sz = lzf_compress(node->zl, node->sz, lzf->compressed,
-                                 node->sz)) == 0) ||
-        lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
-        /* lzf_compress aborts/rejects compression if value not compressable. */
-        zfree(lzf);
+    int codec = quicklistCompressCodec;
+    quicklistLZF *lzf = __quicklistCompressZiplist(codec, node->zl, node->sz);
+    if (lzf == NULL)
         return 0;
-    }
-    lzf = zrealloc(lzf, sizeof(*lzf) + lzf->sz, MALLOC_SHARED);
     zfree(node->zl);
     node->zl = (unsigned char *)lzf;
-    node->encoding = QUICKLIST_NODE_ENCODING_LZF;
+    node->encoding = codec;
     node->recompress = 0;
     return 1;
 }
 
+/* -------------------------- background compression -------------------------
+ *
+ * With list-compress-async enabled, nodes falling out of the uncompressed ends
+ * of a list are not compressed by the command that pushed them out. Instead
+ * a copy of their ziplist is handed to the proc set with
+ * quicklistSetAsyncCompressProc(), which has it compressed by another thread
+ * with quicklistRunCompressJob() and then calls quicklistCompleteCompressJob()
+ * back under the lock.
+ *
+ * Meanwhile the node stays uncompressed and usable, with compress_pending
+ * set. quicklistNodeUpdateSz(), which follows every change to a ziplist, marks
+ * it stale, in which case the result is thrown away and the node compressed
+ * anew. Pending nodes are not freed (only their ziplist is) until the job
+ * completes, since it refers to them; lists may be released by the lazyfree
+ * thread, hence the mutex. */
+
+struct quicklistCompressJob {
+    quicklistNode *node;
+    int depth;          /* compress depth of the list */
+    int codec;
+    size_t sz;
+    unsigned char *zl;  /* copy of the ziplist of the node */
+    quicklistLZF *lzf;  /* the compressed ziplist, if it paid off */
+};
+
+static quicklistAsyncCompressProc *async_compress_proc = NULL;
+static int async_compress_jobs = 0;
+
+void quicklistSetAsyncCompressProc(quicklistAsyncCompressProc *proc) {
+    async_compress_proc = proc;
+}
+
+/* Hand a copy of the ziplist of 'node' to the background thread. Returns 0 if
+ * the node has to be compressed inline instead. */
+REDIS_STATIC int __quicklistCompressNodeAsync(const quicklist *quicklist,
+                                              quicklistNode *node) {
+    if (!quicklistCompressAsync || async_compress_proc == NULL ||
+        quicklistNoAsyncCompressThisThread)
+        return 0;
+    if (node->compress_pending)
+        return 1; /* a copy of it is already being compressed */
+    if (node->sz < MIN_COMPRESS_BYTES ||
+        __atomic_load_n(&async_compress_jobs, __ATOMIC_RELAXED) >=
+            MAX_ASYNC_COMPRESS_JOBS)
+        return 0;
+
+    quicklistCompressJob *job = zmalloc(sizeof(*job), MALLOC_SHARED);
+    job->node = node;
+    job->depth = quicklist->compress;
+    job->codec = quicklistCompressCodec;
+    job->sz = node->sz;
+    job->zl = zmalloc(node->sz, MALLOC_SHARED);
+    memcpy(job->zl, node->zl, node->sz);
+    job->lzf = NULL;
+    node->compress_pending = 1;
+    node->compress_stale = 0;
+    async_compress_used = 1;
+    __atomic_add_fetch(&async_compress_jobs, 1, __ATOMIC_RELAXED);
+    async_compress_proc(job);
+    return 1;
+}
+
+/* Called by the background thread, without any lock. */
+void quicklistRunCompressJob(quicklistCompressJob *job) {
+    job->lzf = __quicklistCompressZiplist(job->codec, job->zl, job->sz);
+}
+
+/* Return 1 if 'node' is among the 'depth' nodes at either end of its list,
+ * which stay uncompressed. */
+REDIS_STATIC int __quicklistNodeWithinDepth(const quicklistNode *node,
+                                            int depth) {
+    const quicklistNode *prev = node, *next = node;
+    for (int i = 0; i < depth && prev && next; i++) {
+        prev = prev->prev;
+        next = next->next;
+    }
+    return prev == NULL || next == NULL;
+}
+
+/* Called under the lock with a job done by quicklistRunCompressJob(). Swaps
+ * the compressed ziplist in, unless the node changed or reached one of the
+ * uncompressed ends of the list meanwhile. */
+void quicklistCompleteCompressJob(quicklistCompressJob *job) {
+    quicklistNode *node = job->node;
+
+    pthread_mutex_lock(&async_compress_mutex);
+    __atomic_sub_fetch(&async_compress_jobs, 1, __ATOMIC_RELAXED);
+    if (node->zl == NULL) {
+        /* The node was deleted, only its job kept it around. */
+        zfree(node);
+    } else {
+        int stale = node->compress_stale;
+        node->compress_pending = 0;
+        node->compress_stale = 0;
+        if (node->encoding == QUICKLIST_NODE_ENCODING_RAW &&
+            !__quicklistNodeWithinDepth(node, job->depth)) {
+            if (!stale && job->lzf) {
+                zfree(node->zl);
+                node->zl = (unsigned char *)job->lzf;
+                node->encoding = job->codec;
+                node->recompress = 0;
+                job->lzf = NULL;
+            } else if (stale) {
+                quicklist ql = {.compress = job->depth};
+                if (!__quicklistCompressNodeAsync(&ql, node))
+                    __quicklistCompressNode(node);
+            }
+        }
+    }
+    pthread_mutex_unlock(&async_compress_mutex);
+    zfree(job->lzf);
+    zfree(job->zl);
+    zfree(job);
+}
+
+/* Free 'node' and its ziplist, or only the latter while it is being
+ * compressed in the background (see quicklistCompleteCompressJob()). */
+REDIS_STATIC void __quicklistFreeNode(quicklistNode *node) {
+    zfree(node->zl);
+    if (node->compress_pending)
+        node->zl = NULL;
+    else
+        zfree(node);
+}
+
+/* Compress 'node' in the background if enabled, or else right away. */
+REDIS_STATIC void __quicklistCompressNodeAuto(const quicklist *quicklist,
+                                              quicklistNode *node) {
+    if (!__quicklistCompressNodeAsync(quicklist, node))
+        __quicklistCompressNode(node);
+}
+
 /* Compress only uncompressed nodes. */
 #define quicklistCompressNode(_node)                                           \
     do {                                                                       \
@@ -210,6 +498,15 @@ REDIS_STATIC int __quicklistCompressNode(quicklistNode *node) {
         }                                                                      \
     } while (0)
 
+/* Same for nodes leaving the uncompressed ends of a list, which may be left
+ * to the background thread. */
+#define quicklistCompressNodeLeaving(_ql, _node)                               \
+    do {                                                                       \
+        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_RAW) {     \
+            __quicklistCompressNodeAuto((_ql), (_node));                       \
+        }                                                                      \
+    } while (0)
+
 /* Uncompress the ziplist in 'node' and update encoding details.
  * Returns 1 on successful decode, 0 on failure to decode. */
 REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
@@ -219,7 +516,8 @@ REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
 
     void *decompressed = zmalloc(node->sz, MALLOC_SHARED);
     quicklistLZF *lzf = (quicklistLZF *)node->zl;
-    if (lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz) == 0) {
+    if (!__quicklistCodecDecompress(node->encoding, lzf->compressed, lzf->sz,
+                                    decompressed, node->sz)) {
         /* Someone requested decompress, but we can't decompress.  Not good. */
         zfree(decompressed);
         return 0;
@@ -233,7 +531,7 @@ REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
 /* Decompress only compressed nodes. */
 #define quicklistDecompressNode(_node)                                         \
     do {                                                                       \
-        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
+        if ((_node) && quicklistNodeIsCompressed(_node)) {                     \
             __quicklistDecompressNode((_node));                                \
         }                                                                      \
     } while (0)
@@ -241,7 +539,7 @@ REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node) {
 /* Force node to not be immediately re-compresable */
 #define quicklistDecompressNodeForUse(_node)                                   \
     do {                                                                       \
-        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
+        if ((_node) && quicklistNodeIsCompressed(_node)) {                     \
             __quicklistDecompressNode((_node));                                \
             (_node)->recompress = 1;                                           \
         }                                                                      \
@@ -256,6 +554,19 @@ size_t quicklistGetLzf(const quicklistNode *node, void **data) {
     return lzf->sz;
 }
 
+/* Return a copy of the ziplist of a node compressed with any codec, which
+ * the caller has to free, or NULL if it can't be decompressed. */
+unsigned char *quicklistGetZiplistCopy(const quicklistNode *node) {
+    unsigned char *zl = zmalloc(node->sz, MALLOC_SHARED);
+    const quicklistLZF *lzf = (const quicklistLZF *)node->zl;
+    if (!__quicklistCodecDecompress(node->encoding, lzf->compressed, lzf->sz,
+                                    zl, node->sz)) {
+        zfree(zl);
+        return NULL;
+    }
+    return zl;
+}
+
 #define quicklistAllowsCompression(_ql) ((_ql)->compress != 0)
 
 /* Force 'quicklist' to meet compression guidelines set by compress depth.
@@ -321,12 +632,12 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist,
     }
 
     if (!in_depth)
-        quicklistCompressNode(node);
+        quicklistCompressNodeLeaving(quicklist, node);
 
     if (depth > 2) {
         /* At this point, forward and reverse are one node beyond depth */
-        quicklistCompressNode(forward);
-        quicklistCompressNode(reverse);
+        quicklistCompressNodeLeaving(quicklist, forward);
+        quicklistCompressNodeLeaving(quicklist, reverse);
     }
 }
 
@@ -471,6 +782,7 @@ REDIS_STATIC int _quicklistNodeAllowMerge(const quicklistNode *a,
 #define quicklistNodeUpdateSz(node)                                            \
     do {                                                                       \
         (node)->sz = ziplistBlobLen((node)->zl);                               \
+        (node)->compress_stale = (node)->compress_pending;                     \
     } while (0)
 
 /* Add new entry to head node of quicklist.
@@ -597,8 +909,7 @@ REDIS_STATIC void __quicklistDelNode(quicklist *quicklist,
 
     quicklist->count -= node->count;
 
-    zfree(node->zl);
-    zfree(node);
+    __quicklistFreeNode(node);
     quicklist->len--;
 }
 
@@ -1192,7 +1503,7 @@ quicklist *quicklistDup(quicklist *orig) {
          current = current->next) {
         quicklistNode *node = quicklistCreateNode();
 
-        if (current->encoding == QUICKLIST_NODE_ENCODING_LZF) {
+        if (quicklistNodeIsCompressed(current)) {
             quicklistLZF *lzf = (quicklistLZF *)current->zl;
             size_t lzf_sz = sizeof(*lzf) + lzf->sz;
             node->zl = zmalloc(lzf_sz, MALLOC_SHARED);
@@ -1446,6 +1757,25 @@ void quicklistPush(quicklist *quicklist, void *value, const size_t sz,
 
 #define QL_TEST_VERBOSE 0
 
+static quicklistCompressJob *test_jobs[MAX_ASYNC_COMPRESS_JOBS];
+static int test_jobs_count = 0;
+
+static void testQueueCompressJob(quicklistCompressJob *job) {
+    test_jobs[test_jobs_count++] = job;
+}
+
+/* Run the queued jobs, jobs queued meanwhile are left for the next call. */
+static void testRunCompressJobs(void) {
+    static quicklistCompressJob *jobs[MAX_ASYNC_COMPRESS_JOBS];
+    int count = test_jobs_count;
+    memcpy(jobs, test_jobs, sizeof(*jobs) * count);
+    test_jobs_count = 0;
+    for (int i = 0; i < count; i++)
+        quicklistRunCompressJob(jobs[i]);
+    for (int i = 0; i < count; i++)
+        quicklistCompleteCompressJob(jobs[i]);
+}
+
 #define UNUSED(x) (void)(x)
 static void ql_info(quicklist *ql) {
 #if QL_TEST_VERBOSE
@@ -1583,7 +1913,7 @@ static int _ql_verify(quicklist *ql, uint32_t len, uint32_t count,
                     errors++;
                 }
             } else {
-                if (node->encoding != QUICKLIST_NODE_ENCODING_LZF &&
+                if (!quicklistNodeIsCompressed(node) &&
                     !node->attempted_compress) {
                     yell("Incorrect non-compression: node %d is NOT "
                          "compressed at depth %d ((%u, %u); total "
@@ -2618,7 +2948,7 @@ int quicklistTest(int argc, char *argv[]) {
                                     node->sz);
                             }
                         } else {
-                            if (node->encoding != QUICKLIST_NODE_ENCODING_LZF) {
+                            if (!quicklistNodeIsCompressed(node)) {
                                 ERR("Incorrect non-compression: node %d is NOT "
                                     "compressed at depth %d ((%u, %u); total "
                                     "nodes: %u; size: %u; attempted: %d)",
@@ -2632,6 +2962,70 @@ int quicklistTest(int argc, char *argv[]) {
             }
         }
     }
+
+    /* Background compression, with a proc queueing the jobs so that the test
+     * decides when they run and complete. */
+    quicklistSetAsyncCompressProc(testQueueCompressJob);
+    quicklistCompressAsync = 1;
+    TEST("async compression of interior nodes") {
+        quicklist *ql = quicklistNew(-2, 1);
+        for (int i = 0; i < 2000; i++)
+            quicklistPushTail(ql, genstr("hello TAIL", i), 64);
+        int compressed = 0;
+        for (quicklistNode *node = ql->head; node; node = node->next)
+            compressed += quicklistNodeIsCompressed(node);
+        if (compressed || test_jobs_count == 0)
+            ERR("%d nodes compressed inline, %d jobs", compressed,
+                test_jobs_count);
+        testRunCompressJobs();
+        quicklistNode *node = ql->head;
+        for (unsigned int at = 0; at < ql->len; at++, node = node->next) {
+            int interior = at > 0 && at < ql->len - 1;
+            if (quicklistNodeIsCompressed(node) != interior)
+                ERR("Node %u of %lu: compressed %d", at, ql->len,
+                    quicklistNodeIsCompressed(node));
+        }
+        quicklistRelease(ql);
+    }
+
+    TEST("async compression of a node modified or deleted meanwhile") {
+        quicklist *ql = quicklistNew(-2, 1);
+        for (int i = 0; i < 2000; i++)
+            quicklistPushTail(ql, genstr("hello TAIL", i), 64);
+        assert(test_jobs_count > 2);
+        /* The second node gets modified, the third deleted. */
+        quicklistNode *modified = ql->head->next;
+        quicklistNode *deleted = modified->next;
+        long modified_at = ql->head->count;
+        quicklistReplaceAtIndex(ql, modified_at, "modified", 8);
+        quicklistDelRange(ql, modified_at + modified->count, deleted->count);
+        testRunCompressJobs();
+        /* Stale results were thrown away and the nodes compressed again. */
+        testRunCompressJobs();
+        int compressed = 0;
+        for (quicklistNode *node = ql->head; node; node = node->next)
+            compressed += quicklistNodeIsCompressed(node);
+        if (compressed != (int)ql->len - 2)
+            ERR("%d of %lu nodes compressed", compressed, ql->len);
+        quicklistEntry entry;
+        quicklistIndex(ql, modified_at, &entry);
+        if (entry.sz != 8 || memcmp(entry.value, "modified", 8))
+            ERR("Modified element lost: %.*s", (int)entry.sz, entry.value);
+        quicklistRelease(ql);
+    }
+
+    TEST("async compression of a released list") {
+        quicklist *ql = quicklistNew(-2, 1);
+        for (int i = 0; i < 2000; i++)
+            quicklistPushTail(ql, genstr("hello TAIL", i), 64);
+        assert(test_jobs_count > 0);
+        quicklistRelease(ql);
+        testRunCompressJobs();
+        OK;
+    }
+    quicklistCompressAsync = 0;
+    quicklistSetAsyncCompressProc(NULL);
+
     long long stop = mstime();
 
     printf("\n");
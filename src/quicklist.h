@@ -42,27 +42,33 @@
 /* quicklistNode is a 32 byte struct describing a ziplist for a quicklist.
  * We use bit fields keep the quicklistNode at 32 bytes.
  * count: 16 bits, max 65536 (max zl bytes is 65k, so max count actually < 32k).
- * encoding: 2 bits, RAW=1, LZF=2.
+ * encoding: 3 bits, RAW=1, LZF=2, LZ4=3, ZSTD=4.
  * container: 2 bits, NONE=1, ZIPLIST=2.
  * recompress: 1 bit, bool, true if node is temporarry decompressed for usage.
  * attempted_compress: 1 bit, boolean, used for verifying during testing.
- * extra: 10 bits, free for future use; pads out the remainder of 32 bits */
+ * compress_pending: 1 bit, bool, a copy of the ziplist is being compressed
+ *                   in the background.
+ * compress_stale: 1 bit, bool, the ziplist changed since that copy was made.
+ * extra: 7 bits, free for future use; pads out the remainder of 32 bits */
 typedef struct quicklistNode {
     struct quicklistNode *prev;
     struct quicklistNode *next;
     unsigned char *zl;
     unsigned int sz;             /* ziplist size in bytes */
     unsigned int count : 16;     /* count of items in ziplist */
-    unsigned int encoding : 2;   /* RAW==1 or LZF==2 */
+    unsigned int encoding : 3;   /* RAW==1, LZF==2, LZ4==3 or ZSTD==4 */
     unsigned int container : 2;  /* NONE==1 or ZIPLIST==2 */
     unsigned int recompress : 1; /* was this node previous compressed? */
     unsigned int attempted_compress : 1; /* node can't compress; too small */
-    unsigned int extra : 10; /* more bits to steal for future usage */
+    unsigned int compress_pending : 1; /* being compressed in the background */
+    unsigned int compress_stale : 1; /* changed while compress_pending */
+    unsigned int extra : 7; /* more bits to steal for future usage */
 } quicklistNode;
 
 /* quicklistLZF is a 4+N byte struct holding 'sz' followed by 'compressed'.
  * 'sz' is byte length of 'compressed' field.
- * 'compressed' is LZF data with total (compressed) length 'sz'
+ * 'compressed' is LZF data with total (compressed) length 'sz', or LZ4 or
+ * zstd data for nodes with those encodings.
  * NOTE: uncompressed length is stored in quicklistNode->sz.
  * When quicklistNode->zl is compressed, node->zl points to a quicklistLZF */
 typedef struct quicklistLZF {
@@ -111,6 +117,8 @@ typedef struct quicklistEntry {
 /* quicklist node encodings */
 #define QUICKLIST_NODE_ENCODING_RAW 1
 #define QUICKLIST_NODE_ENCODING_LZF 2
+#define QUICKLIST_NODE_ENCODING_LZ4 3
+#define QUICKLIST_NODE_ENCODING_ZSTD 4
 
 /* quicklist compression disable */
 #define QUICKLIST_NOCOMPRESS 0
@@ -120,12 +128,25 @@ typedef struct quicklistEntry {
 #define QUICKLIST_NODE_CONTAINER_ZIPLIST 2
 
 #define quicklistNodeIsCompressed(node)                                        \
-    ((node)->encoding == QUICKLIST_NODE_ENCODING_LZF)
+    ((node)->encoding != QUICKLIST_NODE_ENCODING_RAW)
+
+/* A node compressed in the background, see quicklistSetAsyncCompressProc(). */
+typedef struct quicklistCompressJob quicklistCompressJob;
+typedef void quicklistAsyncCompressProc(quicklistCompressJob *job);
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Codec used to compress nodes (a node encoding), and whether to compress them
+ * in the background. */
+extern int quicklistCompressCodec;
+extern int quicklistCompressAsync;
+
+/* When non zero the lists built by this thread are always compressed inline,
+ * it does not own them yet so the completions can't be applied safely. */
+extern __thread int quicklistNoAsyncCompressThisThread;
+
 /* Prototypes */
 quicklist *quicklistCreate(void);
 quicklist *quicklistNew(int fill, int compress);
@@ -169,6 +190,12 @@ int quicklistPop(quicklist *quicklist, int where, unsigned char **data,
 unsigned long quicklistCount(const quicklist *ql);
 int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len);
 size_t quicklistGetLzf(const quicklistNode *node, void **data);
+unsigned char *quicklistGetZiplistCopy(const quicklistNode *node);
+int quicklistCodecAvailable(int codec);
+int quicklistSetZstdDictionary(const void *dict, size_t len);
+void quicklistSetAsyncCompressProc(quicklistAsyncCompressProc *proc);
+void quicklistRunCompressJob(quicklistCompressJob *job);
+void quicklistCompleteCompressJob(quicklistCompressJob *job);
 
 #ifdef REDIS_TEST
 int quicklistTest(int argc, char *argv[]);
@@ -0,0 +1,406 @@
+#include "server.h"
+#include <thread>
+#include <atomic>
+#include <vector>
+
+/****************************************
+ * rdb-forkless.cpp:
+ *
+ * BGSAVE without fork(), enabled by forkless-bgsave.  A thread walks every
+ *  database with dictScan(), serializing a batch of keys at a time to memory
+ *  while holding the global lock, and writes the batch to the temp file once
+ *  the lock is released.
+ *
+ * The file must still hold the dataset as it was when BGSAVE started, which
+ *  the forked child got from copy-on-write.  Here the writers provide it: before
+ *  a key the saver didn't reach yet is modified, deleted or created,
+ *  rdbForklessPreserveKey() serializes its current value, if it has one, to a
+ *  buffer the saver appends to the file with its next batch, and records the
+ *  key so that the saver skips it when it gets there.  Whether the saver
+ *  reached a key only depends on the scan cursor, see dictScanCovered(), so
+ *  nothing is kept for the keys that aren't written during the save.
+ *
+ * The MVCC timestamps of the values can't tell which version of a key belongs
+ *  to the snapshot: the integers shared by many keys get their timestamp bumped
+ *  by writes to any of them, values loaded from an RDB or received from an
+ *  active replica carry timestamps of another server, and values inlined in
+ *  the keyspace have none.  The timestamp the save started at is only logged.
+ *
+ * Flushing or swapping databases, and loading a dataset, abort the save.
+ */
+
+#define RDB_FORKLESS_BATCH_KEYS 1024    /* Keys serialized per acquisition of the lock */
+
+/* Keys written ahead of the saver, the set owns the names */
+static dictType forklessTouchedDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    NULL,                       /* val destructor */
+    0                           /* flags */
+};
+
+struct rdbForklessSaveDb
+{
+    unsigned long cursor = 0;   /* dictScan() cursor of the saver */
+    bool fStarted = false;
+    bool fDone = false;
+    dict *touched = nullptr;    /* Keys already preserved, or created after the save started */
+};
+
+struct rdbForklessSave
+{
+    std::thread thread;
+    std::atomic<bool> fAbort {false};
+    std::atomic<bool> fFinished {false};
+    bool fRenamed = false;
+
+    char tmpfile[256];
+    FILE *fp = nullptr;
+    bool fChecksum = false;
+    bool fIncrementalFsync = false;
+    sds header = nullptr;       /* Magic and aux fields, as of the start of the save */
+    sds trailer = nullptr;      /* The script cache, as of the start of the save */
+    int dbOutput = -1;          /* Database selected at the end of the file so far */
+
+    /* Protected by the global lock */
+    std::vector<rdbForklessSaveDb> vecdb;
+    sds preserved = nullptr;    /* Records of the keys preserved by the writers */
+    int dbPreserved = -1;       /* Database selected at the end of 'preserved' */
+
+    ~rdbForklessSave();
+    bool saveBatch(sds *pbatch, int *pidb);
+    void run();
+};
+
+rdbForklessSave::~rdbForklessSave()
+{
+    for (auto &sdb : vecdb) {
+        if (sdb.touched != nullptr)
+            dictRelease(sdb.touched);
+    }
+    sdsfree(header);
+    sdsfree(trailer);
+    sdsfree(preserved);
+}
+
+/* The saver uses the dataset like a server thread */
+static bool forklessLock()
+{
+    bool fModules = moduleCount() > 0;
+    if (fModules) moduleAcquireGIL(TRUE /*fServerThread*/);
+    aeAcquireLock();
+    return fModules;
+}
+
+static void forklessUnlock(bool fModules)
+{
+    aeReleaseLock();
+    if (fModules) moduleReleaseGIL(TRUE /*fServerThread*/);
+}
+
+static void forklessSelectDb(rio *rdb, int id)
+{
+    rdbSaveType(rdb,RDB_OPCODE_SELECTDB);
+    rdbSaveLen(rdb,id);
+}
+
+static void forklessSaveEntry(rio *rdb, redisDb *db, sds key, robj *o)
+{
+    size_t processed = 0;
+    bool fInline = FInlineVal(o);
+    if (fInline)
+        o = createObjectFromInline(o);
+    saveKey(rdb, db, RDB_SAVE_NONE, &processed, key, o);
+    if (fInline)
+        decrRefCount(o);
+}
+
+/* Called by the writers, see dbBeforeWrite() */
+void rdbForklessPreserveKey(redisDb *db, sds key)
+{
+    serverAssert(GlobalLocksAcquired());
+    rdbForklessSave *save = g_pserver->rdb_forkless_save;
+    rdbForklessSaveDb &sdb = save->vecdb[db->id];
+
+    if (sdb.fDone)
+        return;
+    if (sdb.fStarted && dictScanCovered(db->pdict, sdb.cursor, key))
+        return;     // already saved
+    if (dictFind(sdb.touched, key) != nullptr)
+        return;     // already preserved
+    dictAdd(sdb.touched, sdsdup(key), nullptr);
+
+    dictEntry *de = dictFind(db->pdict, key);
+    if (de == nullptr)
+        return;     // created after the save started
+
+    rio rdb;
+    size_t cbStart = sdslen(save->preserved);
+    rioInitWithBuffer(&rdb, save->preserved);
+    if (save->dbPreserved != db->id) {
+        forklessSelectDb(&rdb, db->id);
+        save->dbPreserved = db->id;
+    }
+    forklessSaveEntry(&rdb, db, key, (robj*)dictGetVal(de));
+    save->preserved = rdb.io.buffer.ptr;
+
+    g_pserver->stat_rdb_forkless_preserved_keys++;
+    g_pserver->stat_rdb_forkless_preserved_bytes += sdslen(save->preserved) - cbStart;
+}
+
+struct forklessScanCtx
+{
+    rio *rdb;
+    redisDb *db;
+    dict *touched;
+    unsigned long cursor;       /* Cursor dictScan() was called with */
+    size_t ckeys;
+};
+
+static void forklessScanCallback(void *privdata, const dictEntry *de)
+{
+    forklessScanCtx *ctx = (forklessScanCtx*)privdata;
+    sds key = (sds)dictGetKey(de);
+
+    /* dictScan() returns some entries again after the table shrinks */
+    if (dictScanCovered(ctx->db->pdict, ctx->cursor, key))
+        return;
+    /* The writer saved the key as it was, or it didn't exist yet */
+    if (dictFind(ctx->touched, key) != nullptr)
+        return;
+
+    forklessSaveEntry(ctx->rdb, ctx->db, key, (robj*)dictGetVal(de));
+    ctx->ckeys++;
+}
+
+/* Serializes the next keys of the databases to 'batch', followed by the keys
+ * the writers preserved since the previous batch.  Returns true once every
+ * database was saved. */
+bool rdbForklessSave::saveBatch(sds *pbatch, int *pidb)
+{
+    serverAssert(GlobalLocksAcquired());
+    rio rdb;
+    size_t ckeys = 0;
+
+    rioInitWithBuffer(&rdb, *pbatch);
+    while (*pidb < cserver.dbnum && ckeys < RDB_FORKLESS_BATCH_KEYS) {
+        rdbForklessSaveDb &sdb = vecdb[*pidb];
+        redisDb *db = g_pserver->db + *pidb;
+
+        if (!sdb.fDone) {
+            if (dbOutput != *pidb) {
+                forklessSelectDb(&rdb, *pidb);
+                dbOutput = *pidb;
+            }
+            if (!sdb.fStarted) {
+                rdbSaveType(&rdb,RDB_OPCODE_RESIZEDB);
+                rdbSaveLen(&rdb,dictSize(db->pdict));
+                rdbSaveLen(&rdb,db->setexpire->size());
+                sdb.fStarted = true;
+            }
+
+            forklessScanCtx ctx = {&rdb, db, sdb.touched, 0, 0};
+            do {
+                ctx.cursor = sdb.cursor;
+                sdb.cursor = dictScan(db->pdict, sdb.cursor, forklessScanCallback, nullptr, &ctx);
+            } while (sdb.cursor != 0 && ckeys + ctx.ckeys < RDB_FORKLESS_BATCH_KEYS);
+            ckeys += ctx.ckeys;
+
+            if (sdb.cursor == 0) {
+                sdb.fDone = true;
+                dictRelease(sdb.touched);
+                sdb.touched = nullptr;
+            }
+        }
+        if (sdb.fDone)
+            ++*pidb;
+    }
+    *pbatch = rdb.io.buffer.ptr;
+
+    if (sdslen(preserved) > 0) {
+        *pbatch = sdscatsds(*pbatch, preserved);
+        sdsclear(preserved);
+        dbOutput = dbPreserved;
+        dbPreserved = -1;
+    }
+    return *pidb == cserver.dbnum;
+}
+
+void rdbForklessSave::run()
+{
+    rio rdb;
+    int idb = 0;
+    bool fOk = true;
+    bool fModules;
+    sds batch = sdsempty();
+
+    rioInitWithFile(&rdb, fp);
+    if (fIncrementalFsync)
+        rioSetAutoSync(&rdb,REDIS_AUTOSYNC_BYTES);
+    if (fChecksum)
+        rdb.update_cksum = rioGenericUpdateChecksum;
+    if (rioWrite(&rdb,header,sdslen(header)) == 0) fOk = false;
+
+    while (fOk) {
+        fModules = forklessLock();
+        if (fAbort) {
+            forklessUnlock(fModules);
+            break;
+        }
+        bool fDone = saveBatch(&batch, &idb);
+        if (fDone)
+            g_pserver->rdb_forkless_tracking = 0;
+        forklessUnlock(fModules);
+
+        if (rioWrite(&rdb,batch,sdslen(batch)) == 0) fOk = false;
+        sdsclear(batch);
+        if (fDone)
+            break;
+        if (g_pserver->rdb_forkless_save_delay)
+            usleep(g_pserver->rdb_forkless_save_delay);
+    }
+    sdsfree(batch);
+
+    if (fOk && !fAbort) {
+        uint64_t cksum;
+        if (rioWrite(&rdb,trailer,sdslen(trailer)) == 0) fOk = false;
+        if (fOk && rdbSaveType(&rdb,RDB_OPCODE_EOF) == -1) fOk = false;
+        cksum = rdb.cksum;
+        memrev64ifbe(&cksum);
+        if (fOk && rioWrite(&rdb,&cksum,8) == 0) fOk = false;
+        if (fOk && fflush(fp) == EOF) fOk = false;
+        if (fOk && fsync(fileno(fp)) == -1) fOk = false;
+        if (!fOk)
+            serverLog(LL_WARNING,"Write error saving DB on disk: %s", strerror(errno));
+    }
+    if (fclose(fp) == EOF && fOk) {
+        serverLog(LL_WARNING,"Write error saving DB on disk: %s", strerror(errno));
+        fOk = false;
+    }
+    fp = nullptr;
+
+    /* Under the lock, so that the save can't be aborted once the file is in place */
+    fModules = forklessLock();
+    if (fOk && !fAbort) {
+        if (rename(tmpfile,g_pserver->rdb_filename) == -1) {
+            serverLog(LL_WARNING,
+                "Error moving temp DB file %s on the final destination %s: %s",
+                tmpfile, g_pserver->rdb_filename, strerror(errno));
+        } else {
+            fRenamed = true;
+        }
+    }
+    forklessUnlock(fModules);
+    if (!fRenamed)
+        unlink(tmpfile);
+
+    fFinished = true;
+}
+
+/* Starts a BGSAVE on a thread, see the top of this file */
+int rdbSaveBackgroundForkless(rdbSaveInfo *rsi)
+{
+    serverAssert(GlobalLocksAcquired());
+    rdbForklessSave *save = new (MALLOC_LOCAL) rdbForklessSave();
+    char magic[10];
+    rio rdb;
+
+    snprintf(save->tmpfile,sizeof(save->tmpfile),"temp-forkless-%d.rdb", (int) getpid());
+    save->fp = fopen(save->tmpfile,"w");
+    if (save->fp == nullptr) {
+        serverLog(LL_WARNING,
+            "Failed opening the RDB file %s for saving: %s",
+            save->tmpfile, strerror(errno));
+        delete save;
+        g_pserver->lastbgsave_status = C_ERR;
+        return C_ERR;
+    }
+    save->fChecksum = g_pserver->rdb_checksum;
+    save->fIncrementalFsync = g_pserver->rdb_save_incremental_fsync;
+
+    rioInitWithBuffer(&rdb, sdsempty());
+    snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
+    rioWrite(&rdb,magic,9);
+    rdbSaveInfoAuxFields(&rdb,RDB_SAVE_NONE,rsi);
+    save->header = rdb.io.buffer.ptr;
+
+    rioInitWithBuffer(&rdb, sdsempty());
+    if (rsi && dictSize(g_pserver->lua_scripts)) {
+        dictIterator *di = dictGetIterator(g_pserver->lua_scripts);
+        dictEntry *de;
+        while((de = dictNext(di)) != NULL) {
+            robj *body = (robj*)dictGetVal(de);
+            rdbSaveAuxField(&rdb,"lua",3,szFromObj(body),sdslen(szFromObj(body)));
+        }
+        dictReleaseIterator(di);
+    }
+    save->trailer = rdb.io.buffer.ptr;
+
+    save->preserved = sdsempty();
+    save->vecdb.resize(cserver.dbnum);
+    for (int j = 0; j < cserver.dbnum; j++) {
+        rdbForklessSaveDb &sdb = save->vecdb[j];
+        sdb.fDone = dictSize(g_pserver->db[j].pdict) == 0;
+        if (!sdb.fDone)
+            sdb.touched = dictCreate(&forklessTouchedDictType,NULL);
+    }
+
+    uint64_t mvcc_tstamp = getMvccTstamp();
+    incrementMvccTstamp();
+
+    g_pserver->dirty_before_bgsave = g_pserver->dirty;
+    g_pserver->lastbgsave_try = time(NULL);
+    g_pserver->stat_rdb_forkless_preserved_keys = 0;
+    g_pserver->stat_rdb_forkless_preserved_bytes = 0;
+    g_pserver->rdb_forkless_save = save;
+    g_pserver->rdb_forkless_tracking = 1;
+    g_pserver->rdb_save_time_start = time(NULL);
+    g_pserver->rdb_child_type = RDB_CHILD_TYPE_DISK;
+    save->thread = std::thread([save]{ save->run(); });
+
+    serverLog(LL_NOTICE,"Background saving started by a thread (fork-less) at mvcc timestamp %llu",
+        (unsigned long long)mvcc_tstamp);
+    return C_OK;
+}
+
+/* Stops a fork-less BGSAVE, the thread exits when it gets the lock next and
+ * serverCron() reports the save as killed by SIGUSR1 */
+void rdbForklessSaveAbort(const char *reason)
+{
+    serverAssert(GlobalLocksAcquired());
+    rdbForklessSave *save = g_pserver->rdb_forkless_save;
+    if (save == nullptr || save->fAbort)
+        return;
+
+    serverLog(LL_WARNING,"Aborting the fork-less background saving: %s", reason);
+    save->fAbort = true;
+    g_pserver->rdb_forkless_tracking = 0;
+    unlink(save->tmpfile);
+}
+
+/* Called by serverCron() to handle the end of a fork-less BGSAVE */
+void rdbForklessSaveCheckDone(void)
+{
+    serverAssert(GlobalLocksAcquired());
+    rdbForklessSave *save = g_pserver->rdb_forkless_save;
+    if (save == nullptr || !save->fFinished)
+        return;
+
+    save->thread.join();
+    int exitcode = save->fRenamed ? 0 : 1;
+    int bysignal = (!save->fRenamed && save->fAbort) ? SIGUSR1 : 0;
+    g_pserver->rdb_forkless_save = nullptr;
+    g_pserver->rdb_forkless_tracking = 0;
+    delete save;
+
+    if (exitcode == 0) {
+        serverLog(LL_NOTICE,
+            "Fork-less background saving preserved %lld keys (%lld bytes) written during the save",
+            g_pserver->stat_rdb_forkless_preserved_keys,
+            g_pserver->stat_rdb_forkless_preserved_bytes);
+    }
+    backgroundSaveDoneHandler(exitcode,bysignal);
+}
@@ -0,0 +1,797 @@
+#include "server.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+
+/****************************************
+ * rdb-segments.cpp:
+ *
+ * Segmented RDB files, saved with rdb-save-threads > 1.  The keys are split
+ *  into segments by their position in the dictScan() order of every database
+ *  (see dictScanKeyOrder()), and each segment is serialized by its own thread.
+ *  The records of a segment are the same as in a plain RDB file: SELECTDB,
+ *  then for every key its EXPIRETIME_MS, IDLE or FREQ and mvcc-tstamp opcodes,
+ *  the key and value, and its subkey expires, up to an EOF opcode.
+ *
+ * The segments are written to the file as they are produced, in chunks which
+ *  are interleaved in the main stream after the header:
+ *
+ *      SEGMENT <segment id> <length> <bytes of the segment>
+ *
+ *  followed, once every segment reached its EOF, by a manifest with the number
+ *  of keys, the length and the CRC64 of every segment:
+ *
+ *      SEGMENT_MANIFEST <count> { <keys> <length> <crc64> } ...
+ *
+ *  The file stays a single stream with the usual trailer and checksum, so it
+ *  can be sent to replicas and stored in S3 like any other RDB file.
+ *
+ * On load the chunks of each segment are fed to a parser thread that decodes
+ *  its values, while the loading thread reads the file and adds the decoded
+ *  keys to the dataset.  The manifest is checked once every parser is done.
+ */
+
+#define RDB_SEGMENT_CHUNK_BYTES (256*1024)  /* Chunks are written once this big */
+#define RDB_SEGMENT_SAVE_QUEUED_CHUNKS 4    /* Per thread, before the savers wait for the file */
+#define RDB_SEGMENT_MAX 1024                /* Segments a file may have */
+#define RDB_SEGMENT_MAX_CHUNK_BYTES (64*1024*1024)
+/* Bounds of the data read ahead of the keys added to the dataset */
+#define RDB_SEGMENT_LOAD_MAX_BYTES (64*1024*1024)
+#define RDB_SEGMENT_LOAD_MAX_KEYS 16384
+#define RDB_SEGMENT_LOAD_BATCH_KEYS 256
+
+/* ------------------------------ Saving ---------------------------------- */
+
+class rdbSegmentWriter {
+    struct segment {
+        int id;
+        unsigned long lo, hi;   /* range of dictScanKeyOrder() */
+        bool fLast;             /* no upper bound */
+        rio r;
+        int dbOutput = -1;      /* database selected in the segment so far */
+        uint64_t keys = 0;
+        size_t processed = 0;
+        bool fError = false;
+        std::thread thread;
+    };
+    struct chunk {
+        int id;
+        sds buf;
+    };
+
+    std::vector<std::unique_ptr<segment>> m_vecsegments;
+    std::mutex m_mutex;
+    std::condition_variable m_cvChunks;     /* signaled when a chunk is queued or a segment ends */
+    std::condition_variable m_cvSpace;      /* signaled when a chunk is dequeued or on abort */
+    std::deque<chunk> m_queue;
+    int m_csegmentsRunning = 0;
+    bool m_fAbort = false;
+
+    bool queueChunk(segment *seg);
+    static void scanCallback(void *privdata, const dictEntry *de);
+    void segmentMain(segment *seg);
+
+    struct scanContext {
+        rdbSegmentWriter *writer;
+        segment *seg;
+        redisDb *db;
+        int idb;
+    };
+
+public:
+    rdbSegmentWriter(int csegments);
+    ~rdbSegmentWriter();
+    int save(rio *rdb);
+};
+
+rdbSegmentWriter::rdbSegmentWriter(int csegments)
+{
+    unsigned long step = ULONG_MAX / csegments + 1;
+    for (int iseg = 0; iseg < csegments; ++iseg) {
+        std::unique_ptr<segment> seg(new (MALLOC_LOCAL) segment);
+        seg->id = iseg;
+        seg->lo = step * iseg;
+        seg->fLast = (iseg == csegments-1);
+        seg->hi = seg->fLast ? ULONG_MAX : step * (iseg+1);
+        rioInitWithBuffer(&seg->r,sdsempty());
+        if (g_pserver->rdb_checksum)
+            seg->r.update_cksum = rioGenericUpdateChecksum;
+        m_vecsegments.push_back(std::move(seg));
+    }
+}
+
+rdbSegmentWriter::~rdbSegmentWriter()
+{
+    for (auto &seg : m_vecsegments)
+        sdsfree(seg->r.io.buffer.ptr);
+    for (auto &chunk : m_queue)
+        sdsfree(chunk.buf);
+}
+
+/* Hand the buffer of 'seg' to the thread writing the file, waiting if it
+ * lags behind. Returns false if the save was aborted. */
+bool rdbSegmentWriter::queueChunk(segment *seg)
+{
+    chunk c = {seg->id, seg->r.io.buffer.ptr};
+    seg->r.io.buffer.ptr = sdsempty();
+    seg->r.io.buffer.pos = 0;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cvSpace.wait(lock, [this]{
+        return m_fAbort || m_queue.size() < m_vecsegments.size()*RDB_SEGMENT_SAVE_QUEUED_CHUNKS;
+    });
+    if (m_fAbort) {
+        sdsfree(c.buf);
+        return false;
+    }
+    m_queue.push_back(c);
+    m_cvChunks.notify_one();
+    return true;
+}
+
+void rdbSegmentWriter::scanCallback(void *privdata, const dictEntry *de)
+{
+    scanContext *ctx = (scanContext*)privdata;
+    segment *seg = ctx->seg;
+    sds keystr = (sds)dictGetKey(de);
+
+    if (seg->fError)
+        return;
+    unsigned long order = dictScanKeyOrder(ctx->db->pdict,keystr);
+    if (order < seg->lo || (!seg->fLast && order >= seg->hi))
+        return; /* another segment has it */
+
+    if (seg->dbOutput != ctx->idb) {
+        if (rdbSaveType(&seg->r,RDB_OPCODE_SELECTDB) == -1 ||
+            rdbSaveLen(&seg->r,ctx->idb) == -1)
+        {
+            seg->fError = true;
+            return;
+        }
+        seg->dbOutput = ctx->idb;
+    }
+
+    robj *o = (robj*)dictGetVal(de);
+    bool fInline = FInlineVal(o);
+    if (fInline)
+        o = createObjectFromInline(o);
+    bool fSaved = saveKey(&seg->r,ctx->db,RDB_SAVE_NONE,&seg->processed,keystr,o);
+    if (fInline)
+        decrRefCount(o);
+    if (!fSaved) {
+        seg->fError = true;
+        return;
+    }
+    seg->keys++;
+
+    if (sdslen(seg->r.io.buffer.ptr) >= RDB_SEGMENT_CHUNK_BYTES &&
+        !ctx->writer->queueChunk(seg))
+        seg->fError = true;
+}
+
+void rdbSegmentWriter::segmentMain(segment *seg)
+{
+    /* Lookups of expires must leave the tables alone */
+    dictNoRehashThisThread = 1;
+
+    for (int j = 0; j < cserver.dbnum && !seg->fError; j++) {
+        redisDb *db = g_pserver->db+j;
+        if (dictSize(db->pdict) == 0) continue;
+
+        scanContext ctx = {this, seg, db, j};
+        unsigned long cursor = dictScanCursorOrder(seg->lo);
+        do {
+            cursor = dictScan(db->pdict,cursor,scanCallback,NULL,&ctx);
+        } while (cursor != 0 && !seg->fError &&
+                 (seg->fLast || dictScanCursorOrder(cursor) < seg->hi));
+    }
+
+    if (!seg->fError) {
+        if (rdbSaveType(&seg->r,RDB_OPCODE_EOF) == -1 || !queueChunk(seg))
+            seg->fError = true;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_csegmentsRunning--;
+    m_cvChunks.notify_one();
+}
+
+/* Write the segments and the manifest to 'rdb'. Returns -1 on error. */
+int rdbSegmentWriter::save(rio *rdb)
+{
+    bool fError = false;
+
+    m_csegmentsRunning = (int)m_vecsegments.size();
+    for (auto &seg : m_vecsegments)
+        seg->thread = std::thread(&rdbSegmentWriter::segmentMain, this, seg.get());
+
+    for (;;) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cvChunks.wait(lock, [this]{ return !m_queue.empty() || m_csegmentsRunning == 0; });
+        if (m_queue.empty())
+            break;
+        chunk c = m_queue.front();
+        m_queue.pop_front();
+        m_cvSpace.notify_one();
+        lock.unlock();
+
+        bool fWritten = rdbSaveType(rdb,RDB_OPCODE_SEGMENT) != -1 &&
+            rdbSaveLen(rdb,c.id) != -1 &&
+            rdbSaveLen(rdb,sdslen(c.buf)) != -1 &&
+            rioWrite(rdb,c.buf,sdslen(c.buf)) != 0;
+        sdsfree(c.buf);
+        if (!fWritten) {
+            lock.lock();
+            m_fAbort = true;
+            m_cvSpace.notify_all();
+            fError = true;
+            break;
+        }
+    }
+
+    for (auto &seg : m_vecsegments) {
+        seg->thread.join();
+        if (seg->fError) fError = true;
+    }
+    if (fError)
+        return -1;
+
+    if (rdbSaveType(rdb,RDB_OPCODE_SEGMENT_MANIFEST) == -1) return -1;
+    if (rdbSaveLen(rdb,m_vecsegments.size()) == -1) return -1;
+    for (auto &seg : m_vecsegments) {
+        uint64_t cksum = seg->r.cksum;
+        memrev64ifbe(&cksum);
+        if (rdbSaveLen(rdb,seg->keys) == -1) return -1;
+        if (rdbSaveLen(rdb,seg->r.processed_bytes) == -1) return -1;
+        if (rioWrite(rdb,&cksum,8) == 0) return -1;
+    }
+    return 0;
+}
+
+/* Save the keyspace to 'rdb' as 'csegments' segments serialized in parallel.
+ * The caller already wrote the header and writes the trailer. Returns -1 on
+ * error. */
+int rdbSaveSegments(rio *rdb, int csegments)
+{
+    /* Size hints for the loader, which reads them before any segment */
+    for (int j = 0; j < cserver.dbnum; j++) {
+        redisDb *db = g_pserver->db+j;
+        if (dictSize(db->pdict) == 0) continue;
+        if (rdbSaveType(rdb,RDB_OPCODE_SELECTDB) == -1) return -1;
+        if (rdbSaveLen(rdb,j) == -1) return -1;
+        if (rdbSaveType(rdb,RDB_OPCODE_RESIZEDB) == -1) return -1;
+        if (rdbSaveLen(rdb,dictSize(db->pdict)) == -1) return -1;
+        if (rdbSaveLen(rdb,db->setexpire->size()) == -1) return -1;
+    }
+
+    rdbSegmentWriter writer(csegments);
+    return writer.save(rdb);
+}
+
+/* ------------------------------ Loading --------------------------------- */
+
+void rdbCheckInfo(const char *fmt, ...);
+
+/* A key decoded by a parser, with the subkey expires that followed it */
+struct rdbSegmentKey {
+    int dbid;
+    robj *key;
+    robj *val;
+    long long expiretime, lfu_freq, lru_idle;
+    std::vector<std::pair<robj*,long long>> vecsubexpires;
+};
+
+class rdbSegmentLoader {
+    struct segment;
+    /* The rio a parser reads its segment from, see segmentRead() */
+    struct segmentRio {
+        rio r;
+        rdbSegmentLoader *loader;
+        segment *seg;
+    };
+    struct segment {
+        segmentRio sr;
+        std::thread thread;
+        sds cur = nullptr;          /* chunk being parsed */
+        size_t pos = 0;
+        uint64_t keys = 0;
+        /* Guarded by the mutex */
+        std::deque<sds> chunks;
+        bool fDone = false;
+        sds err = nullptr;
+    };
+
+    bool m_fCheckOnly;
+    bool m_fDropExpired;
+    long long m_now;
+    long long m_lru_clock;
+    bool m_fForceSetKey;
+    std::vector<std::unique_ptr<segment>> m_vecsegments;  /* by id, NULL until its first chunk */
+    sds m_err = nullptr;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cvParsers;    /* signaled on new chunks, dequeued keys and at the end */
+    std::condition_variable m_cvLoader;     /* signaled on new keys, parsed chunks and when a parser ends */
+    std::deque<std::vector<rdbSegmentKey>> m_queueReady;
+    size_t m_cReady = 0;
+    size_t m_cbQueued = 0;
+    bool m_fEnd = false;        /* no more chunks */
+    bool m_fAbort = false;
+    int m_cparsersRunning = 0;
+    bool m_fParserError = false;
+
+    /* Stats */
+    unsigned long m_keys = 0, m_expires = 0, m_already_expired = 0;
+
+    static size_t segmentRead(rio *r, void *buf, size_t len);
+    void parserMain(segment *seg);
+    bool publish(std::vector<rdbSegmentKey> &batch);
+    void freeKey(rdbSegmentKey &sk);
+    void insertReady(bool fWait);
+
+public:
+    rdbSegmentLoader(bool fCheckOnly, bool fDropExpired, long long lru_clock, bool fForceSetKey);
+    ~rdbSegmentLoader();
+    int feed(rio *rdb);
+    int finish(rio *rdb);
+    const char *error() const { return m_err; }
+    void getStats(unsigned long *keys, unsigned long *expires, unsigned long *already_expired) {
+        *keys = m_keys;
+        *expires = m_expires;
+        *already_expired = m_already_expired;
+    }
+};
+
+static const rio rdbSegmentRioTemplate = {
+    nullptr,    /* set by the loader */
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,    /* update_cksum */
+    0,          /* current checksum */
+    0,          /* bytes read or written */
+    0,          /* read/write chunk size */
+    { { NULL, 0 } } /* union for io-specific vars */
+};
+
+rdbSegmentLoader::rdbSegmentLoader(bool fCheckOnly, bool fDropExpired, long long lru_clock, bool fForceSetKey)
+    : m_fCheckOnly(fCheckOnly), m_fDropExpired(fDropExpired), m_now(mstime()),
+      m_lru_clock(lru_clock), m_fForceSetKey(fForceSetKey)
+{
+}
+
+rdbSegmentLoader::~rdbSegmentLoader()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_fAbort = true;
+        m_cvParsers.notify_all();
+    }
+    for (auto &seg : m_vecsegments) {
+        if (seg == nullptr) continue;
+        if (seg->thread.joinable())
+            seg->thread.join();
+        sdsfree(seg->cur);
+        for (sds chunk : seg->chunks)
+            sdsfree(chunk);
+        sdsfree(seg->err);
+    }
+    for (auto &batch : m_queueReady) {
+        for (auto &sk : batch)
+            freeKey(sk);
+    }
+    sdsfree(m_err);
+}
+
+/* Read from the chunks of the segment, waiting for the loading thread to
+ * read them from the file. */
+size_t rdbSegmentLoader::segmentRead(rio *r, void *buf, size_t len)
+{
+    segmentRio *sr = (segmentRio*)r;
+    rdbSegmentLoader *loader = sr->loader;
+    segment *seg = sr->seg;
+
+    while (len) {
+        if (seg->cur == nullptr || seg->pos == sdslen(seg->cur)) {
+            sdsfree(seg->cur);
+            seg->cur = nullptr;
+            std::unique_lock<std::mutex> lock(loader->m_mutex);
+            loader->m_cvParsers.wait(lock, [loader,seg]{
+                return loader->m_fAbort || loader->m_fEnd || !seg->chunks.empty();
+            });
+            if (seg->chunks.empty() || loader->m_fAbort)
+                return 0;   /* the segment is truncated */
+            seg->cur = seg->chunks.front();
+            seg->pos = 0;
+            seg->chunks.pop_front();
+            loader->m_cbQueued -= sdslen(seg->cur);
+            loader->m_cvLoader.notify_one();
+        }
+        size_t cb = std::min(len, sdslen(seg->cur) - seg->pos);
+        memcpy(buf, seg->cur + seg->pos, cb);
+        seg->pos += cb;
+        buf = (char*)buf + cb;
+        len -= cb;
+    }
+    return 1;
+}
+
+void rdbSegmentLoader::freeKey(rdbSegmentKey &sk)
+{
+    decrRefCount(sk.key);
+    decrRefCount(sk.val);
+    for (auto &subexpire : sk.vecsubexpires)
+        decrRefCount(subexpire.first);
+}
+
+/* Hand decoded keys to the loading thread. Returns false on abort. */
+bool rdbSegmentLoader::publish(std::vector<rdbSegmentKey> &batch)
+{
+    if (batch.empty())
+        return true;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cvParsers.wait(lock, [this]{ return m_fAbort || m_cReady < RDB_SEGMENT_LOAD_MAX_KEYS; });
+    if (m_fAbort)
+        return false;
+    m_cReady += batch.size();
+    m_queueReady.push_back(std::move(batch));
+    batch.clear();
+    m_cvLoader.notify_one();
+    return true;
+}
+
+void rdbSegmentLoader::parserMain(segment *seg)
+{
+    rio *rdb = &seg->sr.r;
+    int dbid = 0;
+    long long lru_idle = -1, lfu_freq = -1, expiretime = -1;
+    uint64_t mvcc_tstamp = OBJ_MVCC_INVALID;
+    robj *subexpireKey = nullptr;
+    bool fLastDropped = false;  /* the subkey expires that follow belong to a dropped key */
+    std::vector<rdbSegmentKey> batch;
+    const char *err = nullptr;
+
+    dictNoRehashThisThread = 1;
+    quicklistNoAsyncCompressThisThread = 1;
+
+    for (;;) {
+        int type = rdbLoadType(rdb);
+        if (type == -1) {
+            err = "Unexpected end of segment";
+            break;
+        }
+
+        if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            expiretime = rdbLoadMillisecondTime(rdb,RDB_VERSION);
+        } else if (type == RDB_OPCODE_EXPIRETIME) {
+            expiretime = rdbLoadTime(rdb)*1000;
+        } else if (type == RDB_OPCODE_FREQ) {
+            uint8_t byte;
+            if (rioRead(rdb,&byte,1) == 0) {
+                err = "Unexpected end of segment";
+                break;
+            }
+            lfu_freq = byte;
+        } else if (type == RDB_OPCODE_IDLE) {
+            uint64_t qword;
+            if ((qword = rdbLoadLen(rdb,NULL)) == RDB_LENERR) {
+                err = "Unexpected end of segment";
+                break;
+            }
+            lru_idle = qword;
+        } else if (type == RDB_OPCODE_SELECTDB) {
+            uint64_t id = rdbLoadLen(rdb,NULL);
+            if (id == RDB_LENERR || id >= (unsigned)cserver.dbnum) {
+                err = "Invalid database in segment";
+                break;
+            }
+            dbid = (int)id;
+        } else if (type == RDB_OPCODE_AUX) {
+            robj *auxkey, *auxval;
+            if ((auxkey = rdbLoadStringObject(rdb)) == NULL) {
+                err = "Unexpected end of segment";
+                break;
+            }
+            if ((auxval = rdbLoadStringObject(rdb)) == NULL) {
+                decrRefCount(auxkey);
+                err = "Unexpected end of segment";
+                break;
+            }
+            if (!strcasecmp(szFromObj(auxkey),"mvcc-tstamp")) {
+                mvcc_tstamp = strtoull(szFromObj(auxval), nullptr, 10);
+            } else if (!strcasecmp(szFromObj(auxkey),"keydb-subexpire-key")) {
+                if (subexpireKey) decrRefCount(subexpireKey);
+                subexpireKey = auxval;
+                incrRefCount(subexpireKey);
+            } else if (!strcasecmp(szFromObj(auxkey),"keydb-subexpire-when")) {
+                if (subexpireKey != nullptr && !fLastDropped && !batch.empty()) {
+                    batch.back().vecsubexpires.emplace_back(subexpireKey,
+                        strtoll(szFromObj(auxval), nullptr, 10));
+                } else if (subexpireKey != nullptr) {
+                    decrRefCount(subexpireKey);
+                }
+                subexpireKey = nullptr;
+            }
+            decrRefCount(auxkey);
+            decrRefCount(auxval);
+        } else if (type == RDB_OPCODE_EOF) {
+            break;
+        } else if (rdbIsObjectType(type)) {
+            /* The subkey expires of the last key of the batch are complete */
+            if (batch.size() >= RDB_SEGMENT_LOAD_BATCH_KEYS) {
+                rdbSegmentKey last = std::move(batch.back());
+                batch.pop_back();
+                if (!publish(batch)) {
+                    freeKey(last);
+                    err = "Aborted";
+                    break;
+                }
+                batch.push_back(std::move(last));
+            }
+
+            robj *key, *val;
+            if ((key = rdbLoadStringObject(rdb)) == NULL) {
+                err = "Unexpected end of segment";
+                break;
+            }
+            if ((val = rdbLoadObject(type,rdb,key,mvcc_tstamp)) == NULL) {
+                decrRefCount(key);
+                err = "Unexpected end of segment";
+                break;
+            }
+            seg->keys++;
+
+            bool fExpired = expiretime != -1 && expiretime < m_now;
+            if (m_fCheckOnly) {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_keys++;
+                if (expiretime != -1) m_expires++;
+                if (fExpired) m_already_expired++;
+            }
+            fLastDropped = m_fCheckOnly || (m_fDropExpired && fExpired);
+            if (fLastDropped) {
+                decrRefCount(key);
+                decrRefCount(val);
+            } else {
+                rdbSegmentKey sk;
+                sk.dbid = dbid;
+                sk.key = key;
+                sk.val = val;
+                sk.expiretime = expiretime;
+                sk.lfu_freq = lfu_freq;
+                sk.lru_idle = lru_idle;
+                batch.push_back(std::move(sk));
+            }
+            expiretime = -1;
+            lfu_freq = -1;
+            lru_idle = -1;
+        } else {
+            err = "Invalid opcode in segment";
+            break;
+        }
+    }
+
+    if (subexpireKey != nullptr)
+        decrRefCount(subexpireKey);
+    if (err == nullptr && !publish(batch))
+        err = "Aborted";
+    for (auto &sk : batch)
+        freeKey(sk);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (err != nullptr) {
+        seg->err = sdsnew(err);
+        m_fParserError = true;
+    }
+    seg->fDone = true;
+    m_cparsersRunning--;
+    m_cvLoader.notify_one();
+}
+
+/* Add the keys decoded so far to the dataset. With 'fWait' first waits for
+ * keys to add, for the parsers to end, or before the manifest, for them to
+ * consume enough of the chunks read ahead. */
+void rdbSegmentLoader::insertReady(bool fWait)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (fWait) {
+        m_cvLoader.wait(lock, [this]{
+            return !m_queueReady.empty() || m_fParserError || m_cparsersRunning == 0 ||
+                (!m_fEnd && m_cbQueued <= RDB_SEGMENT_LOAD_MAX_BYTES);
+        });
+    }
+    while (!m_queueReady.empty()) {
+        std::vector<rdbSegmentKey> batch = std::move(m_queueReady.front());
+        m_queueReady.pop_front();
+        m_cReady -= batch.size();
+        m_cvParsers.notify_all();
+        lock.unlock();
+
+        for (auto &sk : batch) {
+            redisDb *db = g_pserver->db+sk.dbid;
+            bool fInserted = rdbLoadAddKey(db,sk.key,sk.val,sk.expiretime,sk.lfu_freq,
+                sk.lru_idle,m_lru_clock,m_fForceSetKey);
+            for (auto &subexpire : sk.vecsubexpires) {
+                if (fInserted)
+                    setExpire(NULL,db,sk.key,subexpire.first,subexpire.second);
+                decrRefCount(subexpire.first);
+            }
+            decrRefCount(sk.key);
+        }
+        lock.lock();
+    }
+}
+
+/* Read the chunk following a SEGMENT opcode and queue it for its parser.
+ * Returns C_ERR on a short read or an invalid chunk, see error(). */
+int rdbSegmentLoader::feed(rio *rdb)
+{
+    uint64_t id, len;
+
+    if ((id = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return C_ERR;
+    if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return C_ERR;
+    if (id >= RDB_SEGMENT_MAX || len > RDB_SEGMENT_MAX_CHUNK_BYTES) {
+        m_err = sdscatprintf(sdsempty(),"Invalid chunk of %llu bytes for segment %llu",
+            (unsigned long long)len, (unsigned long long)id);
+        return C_ERR;
+    }
+    sds chunk = sdsnewlen(SDS_NOINIT,len);
+    if (len && rioRead(rdb,chunk,len) == 0) {
+        sdsfree(chunk);
+        return C_ERR;
+    }
+
+    if (id >= m_vecsegments.size())
+        m_vecsegments.resize(id+1);
+    if (m_vecsegments[id] == nullptr) {
+        std::unique_ptr<segment> seg(new (MALLOC_LOCAL) segment);
+        seg->sr.r = rdbSegmentRioTemplate;
+        seg->sr.r.read = segmentRead;
+        seg->sr.r.update_cksum = rioGenericUpdateChecksum;
+        seg->sr.loader = this;
+        seg->sr.seg = seg.get();
+        m_vecsegments[id] = std::move(seg);
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cparsersRunning++;
+        }
+        m_vecsegments[id]->thread = std::thread(&rdbSegmentLoader::parserMain, this, m_vecsegments[id].get());
+        if (!m_fCheckOnly)
+            g_pserver->loading_threads++;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_vecsegments[id]->chunks.push_back(chunk);
+        m_cbQueued += len;
+        m_cvParsers.notify_all();
+    }
+
+    /* Add what is decoded, and wait for the parsers if we read too far */
+    insertReady(false);
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_fParserError || m_cparsersRunning == 0 || m_cbQueued <= RDB_SEGMENT_LOAD_MAX_BYTES)
+                break;
+        }
+        insertReady(true);
+    }
+    return C_OK;
+}
+
+/* Read the manifest following a SEGMENT_MANIFEST opcode, wait for the parsers
+ * and check the segments. Returns C_ERR on a short read or an invalid
+ * segment, see error(). */
+int rdbSegmentLoader::finish(rio *rdb)
+{
+    uint64_t csegments;
+    std::vector<uint64_t> veckeys, vecbytes, veccksum;
+
+    if ((csegments = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return C_ERR;
+    if (csegments > RDB_SEGMENT_MAX) {
+        m_err = sdscatprintf(sdsempty(),"Invalid number of segments %llu",
+            (unsigned long long)csegments);
+        return C_ERR;
+    }
+    for (uint64_t iseg = 0; iseg < csegments; ++iseg) {
+        uint64_t keys, bytes, cksum;
+        if ((keys = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return C_ERR;
+        if ((bytes = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return C_ERR;
+        if (rioRead(rdb,&cksum,8) == 0) return C_ERR;
+        memrev64ifbe(&cksum);
+        veckeys.push_back(keys);
+        vecbytes.push_back(bytes);
+        veccksum.push_back(cksum);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_fEnd = true;
+        m_cvParsers.notify_all();
+    }
+    for (;;) {
+        insertReady(true);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_fParserError) {
+            /* No point in parsing the rest */
+            m_fAbort = true;
+            m_cvParsers.notify_all();
+            break;
+        }
+        if (m_cparsersRunning == 0 && m_queueReady.empty())
+            break;
+    }
+
+    if (m_vecsegments.size() != csegments) {
+        m_err = sdscatprintf(sdsempty(),"The manifest lists %llu segments but the file has %zu",
+            (unsigned long long)csegments, m_vecsegments.size());
+        return C_ERR;
+    }
+    for (uint64_t iseg = 0; iseg < csegments; ++iseg) {
+        segment *seg = m_vecsegments[iseg].get();
+        if (seg == nullptr) {
+            m_err = sdscatprintf(sdsempty(),"Segment %llu is missing", (unsigned long long)iseg);
+            return C_ERR;
+        }
+        seg->thread.join();
+        if (seg->err != nullptr) {
+            m_err = sdscatprintf(sdsempty(),"Segment %llu: %s", (unsigned long long)iseg, seg->err);
+            return C_ERR;
+        }
+        if (seg->sr.r.processed_bytes != vecbytes[iseg] || seg->keys != veckeys[iseg]) {
+            m_err = sdscatprintf(sdsempty(),
+                "Segment %llu has %llu keys in %llu bytes, the manifest lists %llu keys in %llu bytes",
+                (unsigned long long)iseg, (unsigned long long)seg->keys,
+                (unsigned long long)seg->sr.r.processed_bytes,
+                (unsigned long long)veckeys[iseg], (unsigned long long)vecbytes[iseg]);
+            return C_ERR;
+        }
+        if (g_pserver->rdb_checksum && veccksum[iseg] != 0 && veccksum[iseg] != seg->sr.r.cksum) {
+            m_err = sdscatprintf(sdsempty(),"Segment %llu CRC error", (unsigned long long)iseg);
+            return C_ERR;
+        }
+        if (m_fCheckOnly)
+            rdbCheckInfo("Segment %llu: %llu keys, %llu bytes, %s",
+                (unsigned long long)iseg, (unsigned long long)seg->keys,
+                (unsigned long long)seg->sr.r.processed_bytes,
+                (g_pserver->rdb_checksum && veccksum[iseg] != 0) ? "checksum OK" : "no checksum");
+    }
+    if (!m_fCheckOnly)
+        g_pserver->loading_threads -= (int)csegments;
+    return C_OK;
+}
+
+rdbSegmentLoader *rdbSegmentLoaderCreate(bool fCheckOnly, bool fDropExpired, long long lru_clock, bool fForceSetKey)
+{
+    return new (MALLOC_LOCAL) rdbSegmentLoader(fCheckOnly, fDropExpired, lru_clock, fForceSetKey);
+}
+
+int rdbSegmentLoaderFeed(rdbSegmentLoader *loader, rio *rdb)
+{
+    return loader->feed(rdb);
+}
+
+int rdbSegmentLoaderFinish(rdbSegmentLoader *loader, rio *rdb)
+{
+    return loader->finish(rdb);
+}
+
+const char *rdbSegmentLoaderError(rdbSegmentLoader *loader)
+{
+    return loader->error();
+}
+
+void rdbSegmentLoaderGetStats(rdbSegmentLoader *loader, unsigned long *keys,
+        unsigned long *expires, unsigned long *already_expired)
+{
+    loader->getStats(keys,expires,already_expired);
+}
+
+void rdbSegmentLoaderRelease(rdbSegmentLoader *loader)
+{
+    delete loader;
+}
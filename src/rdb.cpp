@@ -29,6 +29,13 @@
 
 #include "server.h"
 #include "lzf.h"    /* LZF compression library */
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
 #include "zipmap.h"
 #include "endianconv.h"
 #include "stream.h"
@@ -42,6 +49,10 @@
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <sys/param.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 #define rdbExitReportCorruptRDB(...) rdbCheckThenExit(__LINE__,__VA_ARGS__)
 
@@ -314,13 +325,229 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
     return rdbEncodeInteger(value,enc);
 }
 
-ssize_t rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
-                       size_t original_len) {
+/* ------------------------- compression codecs ---------------------------
+ *
+ * Strings are compressed with the codec of rdb-compression-codec, and saved
+ * with the RDB_ENC_* encoding of the codec followed by the compressed and
+ * the original lengths, so every codec this build has can be loaded whatever
+ * the configuration.
+ *
+ * With rdb-compression-zstd-dict an RDB file compressed with zstd starts with
+ * a dictionary trained from a sample of the string values, saved in the
+ * zstd-dict AUX field. It is only used by the file it is saved in: DUMP
+ * payloads and the files of a fork-less BGSAVE don't have one. */
+
+#define RDB_ZSTD_LEVEL 3
+#define RDB_ZSTD_DICT_BYTES (64*1024)       /* Size of the trained dictionaries */
+#define RDB_ZSTD_DICT_SAMPLES 4096          /* Values sampled for the training */
+#define RDB_ZSTD_DICT_SAMPLE_BYTES (4*1024*1024)
+#define RDB_ZSTD_DICT_MAX_SAMPLE (16*1024)  /* Only the start of larger values is sampled */
+
+#ifdef USE_ZSTD
+/* Contexts are per thread since values are saved and loaded from several
+ * threads, see rdb-save-threads and rdb-load-threads. */
+struct rdbZstdContexts {
+    ZSTD_CCtx *cctx = nullptr;
+    ZSTD_DCtx *dctx = nullptr;
+    ~rdbZstdContexts() {
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+    }
+};
+static thread_local rdbZstdContexts rdbZstd;
+static ZSTD_CDict *rdbZstdSaveDict = NULL;  /* dictionary of the file being saved */
+static ZSTD_DDict *rdbZstdLoadDict = NULL;  /* dictionary of the file being loaded */
+#endif
+
+/* Return 1 if strings compressed with the RDB_ENC_* encoding 'enc' can be
+ * saved and loaded by this build. */
+int rdbCompressionCodecAvailable(int enc) {
+    switch (enc) {
+    case RDB_ENC_LZF:
+#ifdef USE_LZ4
+    case RDB_ENC_LZ4:
+#endif
+#ifdef USE_ZSTD
+    case RDB_ENC_ZSTD:
+#endif
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static const char *rdbCompressionCodecName(int enc) {
+    switch (enc) {
+    case RDB_ENC_LZF: return "LZF";
+    case RDB_ENC_LZ4: return "LZ4";
+    case RDB_ENC_ZSTD: return "zstd";
+    default: return "unknown";
+    }
+}
+
+/* Use the 'len' bytes at 'dict' as the zstd dictionary of the file being
+ * loaded, or none if 'dict' is NULL. Returns -1 if the dictionary can't be
+ * used. */
+int rdbSetZstdLoadDictionary(const void *dict, size_t len) {
+#ifdef USE_ZSTD
+    ZSTD_freeDDict(rdbZstdLoadDict);
+    rdbZstdLoadDict = NULL;
+    if (dict == NULL)
+        return 0;
+    rdbZstdLoadDict = ZSTD_createDDict(dict, len);
+    return rdbZstdLoadDict ? 0 : -1;
+#else
+    (void)len;
+    return dict ? -1 : 0;
+#endif
+}
+
+#ifdef USE_ZSTD
+/* Train a dictionary from a sample of the string values of the dataset.
+ * Returns NULL if there are too few of them to train one. */
+static sds rdbTrainZstdDictionary(void) {
+    unsigned long long total = 0;
+    std::vector<size_t> vecsizes;
+    sds samples = sdsempty();
+    sds dictbuf = NULL;
+
+    for (int j = 0; j < cserver.dbnum; j++)
+        total += dictSize(g_pserver->db[j].pdict);
+    for (int j = 0; j < cserver.dbnum && total; j++) {
+        dict *d = g_pserver->db[j].pdict;
+        unsigned long long count = (unsigned long long)RDB_ZSTD_DICT_SAMPLES*dictSize(d)/total;
+        if (dictSize(d) && count == 0) count = 1;
+        while (count-- && sdslen(samples) < RDB_ZSTD_DICT_SAMPLE_BYTES) {
+            dictEntry *de = dictGetRandomKey(d);
+            robj *o = (robj*)dictGetVal(de);
+            bool fInline = FInlineVal(o);
+            if (fInline)
+                o = createObjectFromInline(o);
+            if (o->type == OBJ_STRING && sdsEncodedObject(o)) {
+                size_t len = std::min(sdslen(szFromObj(o)), (size_t)RDB_ZSTD_DICT_MAX_SAMPLE);
+                samples = sdscatlen(samples, szFromObj(o), len);
+                vecsizes.push_back(len);
+            }
+            if (fInline)
+                decrRefCount(o);
+        }
+    }
+
+    if (!vecsizes.empty()) {
+        dictbuf = sdsnewlen(SDS_NOINIT, RDB_ZSTD_DICT_BYTES);
+        size_t len = ZDICT_trainFromBuffer(dictbuf, RDB_ZSTD_DICT_BYTES, samples,
+            vecsizes.data(), (unsigned)vecsizes.size());
+        if (ZDICT_isError(len)) {
+            serverLog(LL_VERBOSE,"No zstd dictionary for the RDB: %s",
+                ZDICT_getErrorName(len));
+            sdsfree(dictbuf);
+            dictbuf = NULL;
+        } else {
+            sdssetlen(dictbuf, len);
+            serverLog(LL_VERBOSE,"Trained a zstd dictionary of %zu bytes from %zu values",
+                len, vecsizes.size());
+        }
+    }
+    sdsfree(samples);
+    return dictbuf;
+}
+#endif
+
+/* Train and save the zstd dictionary of the file, when enabled. Returns -1
+ * on write error. */
+static int rdbSaveZstdDictionary(rio *rdb) {
+#ifdef USE_ZSTD
+    if (!g_pserver->rdb_compression || !g_pserver->rdb_compression_zstd_dict ||
+        g_pserver->rdb_compression_codec != RDB_ENC_ZSTD)
+        return 0;
+
+    sds dictbuf = rdbTrainZstdDictionary();
+    if (dictbuf == NULL)
+        return 0;
+    /* Saved before the dictionary is in use, that's how it is loaded */
+    if (rdbSaveAuxField(rdb,"zstd-dict",9,dictbuf,sdslen(dictbuf)) == -1) {
+        sdsfree(dictbuf);
+        return -1;
+    }
+    rdbZstdSaveDict = ZSTD_createCDict(dictbuf, sdslen(dictbuf), RDB_ZSTD_LEVEL);
+    sdsfree(dictbuf);
+#else
+    UNUSED(rdb);
+#endif
+    return 0;
+}
+
+static void rdbReleaseZstdSaveDictionary(void) {
+#ifdef USE_ZSTD
+    ZSTD_freeCDict(rdbZstdSaveDict);
+    rdbZstdSaveDict = NULL;
+#endif
+}
+
+/* Compress the 'len' bytes at 's' with the RDB_ENC_* codec 'enc' into 'out',
+ * which has room for 'outlen' bytes. Returns the compressed length, or 0 if
+ * it doesn't fit. */
+static size_t rdbCompress(int enc, const unsigned char *s, size_t len, void *out, size_t outlen) {
+    switch (enc) {
+#ifdef USE_LZ4
+    case RDB_ENC_LZ4: {
+        if (len > LZ4_MAX_INPUT_SIZE) return 0;
+        int n = LZ4_compress_default((const char*)s, (char*)out, (int)len, (int)outlen);
+        return n > 0 ? (size_t)n : 0;
+    }
+#endif
+#ifdef USE_ZSTD
+    case RDB_ENC_ZSTD: {
+        size_t n;
+        if (rdbZstd.cctx == NULL && (rdbZstd.cctx = ZSTD_createCCtx()) == NULL)
+            return 0;
+        if (rdbZstdSaveDict)
+            n = ZSTD_compress_usingCDict(rdbZstd.cctx, out, outlen, s, len, rdbZstdSaveDict);
+        else
+            n = ZSTD_compressCCtx(rdbZstd.cctx, out, outlen, s, len, RDB_ZSTD_LEVEL);
+        return ZSTD_isError(n) ? 0 : n;
+    }
+#endif
+    default:
+        return lzf_compress(s, len, out, outlen);
+    }
+}
+
+/* Decompress the 'clen' bytes at 'c', compressed with the RDB_ENC_* codec
+ * 'enc', to the 'len' bytes at 'val'. Returns 1 on success, 0 on failure. */
+static int rdbDecompress(int enc, const unsigned char *c, size_t clen, char *val, size_t len) {
+    switch (enc) {
+#ifdef USE_LZ4
+    case RDB_ENC_LZ4:
+        if (clen > INT_MAX || len > INT_MAX) return 0;
+        return LZ4_decompress_safe((const char*)c, val, (int)clen, (int)len) == (int)len;
+#endif
+#ifdef USE_ZSTD
+    case RDB_ENC_ZSTD: {
+        size_t n;
+        if (rdbZstd.dctx == NULL && (rdbZstd.dctx = ZSTD_createDCtx()) == NULL)
+            return 0;
+        if (rdbZstdLoadDict)
+            n = ZSTD_decompress_usingDDict(rdbZstd.dctx, val, len, c, clen, rdbZstdLoadDict);
+        else
+            n = ZSTD_decompressDCtx(rdbZstd.dctx, val, len, c, clen);
+        return !ZSTD_isError(n) && n == len;
+    }
+#endif
+    case RDB_ENC_LZF:
+        return lzf_decompress(c, clen, val, len) != 0;
+    default:
+        return 0;
+    }
+}
+
+ssize_t rdbSaveCompressedBlob(rio *rdb, int enc, void *data, size_t compress_len,
+                              size_t original_len) {
     unsigned char byte;
     ssize_t n, nwritten = 0;
 
     /* Data compressed! Let's save it on disk */
-    byte = (RDB_ENCVAL<<6)|RDB_ENC_LZF;
+    byte = (RDB_ENCVAL<<6)|enc;
     if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) goto writeerr;
     nwritten += n;
 
@@ -339,7 +566,8 @@ writeerr:
     return -1;
 }
 
-ssize_t rdbSaveLzfStringObject(rio *rdb, const unsigned char *s, size_t len) {
+ssize_t rdbSaveCompressedStringObject(rio *rdb, const unsigned char *s, size_t len) {
+    int enc = g_pserver->rdb_compression_codec;
     size_t comprlen, outlen;
     void *out;
 
@@ -347,26 +575,37 @@ ssize_t rdbSaveLzfStringObject(rio *rdb, const unsigned char *s, size_t len) {
     if (len <= 4) return 0;
     outlen = len-4;
     if ((out = zmalloc(outlen+1, MALLOC_LOCAL)) == NULL) return 0;
-    comprlen = lzf_compress(s, len, out, outlen);
+    comprlen = rdbCompress(enc, s, len, out, outlen);
     if (comprlen == 0) {
         zfree(out);
         return 0;
     }
-    ssize_t nwritten = rdbSaveLzfBlob(rdb, out, comprlen, len);
+    ssize_t nwritten = rdbSaveCompressedBlob(rdb, enc, out, comprlen, len);
     zfree(out);
     return nwritten;
 }
 
-/* Load an LZF compressed string in RDB format. The returned value
- * changes according to 'flags'. For more info check the
+/* Load a string compressed with the RDB_ENC_* codec 'enc' in RDB format. The
+ * returned value changes according to 'flags'. For more info check the
  * rdbGenericLoadStringObject() function. */
-void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
+void *rdbLoadCompressedStringObject(rio *rdb, int enc, int flags, size_t *lenptr) {
     int plain = flags & RDB_LOAD_PLAIN;
     int sds = flags & RDB_LOAD_SDS;
     uint64_t len, clen;
     unsigned char *c = NULL;
     char *val = NULL;
 
+    if (!rdbCompressionCodecAvailable(enc)) {
+        /* Not corrupt, RESTORE just fails */
+        if (rdbCheckMode)
+            rdbCheckSetError("%s compressed string, this build lacks the codec",
+                rdbCompressionCodecName(enc));
+        else
+            serverLog(LL_WARNING,"Can't load a %s compressed string: "
+                "this build lacks the codec", rdbCompressionCodecName(enc));
+        return NULL;
+    }
+
     if ((clen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
     if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
     if ((c = (unsigned char*)zmalloc(clen, MALLOC_SHARED)) == NULL) goto err;
@@ -381,8 +620,9 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
 
     /* Load the compressed representation and uncompress it to target. */
     if (rioRead(rdb,c,clen) == 0) goto err;
-    if (lzf_decompress(c,clen,val,len) == 0) {
-        rdbExitReportCorruptRDB("Invalid LZF compressed string");
+    if (!rdbDecompress(enc,c,clen,val,len)) {
+        rdbExitReportCorruptRDB("Invalid %s compressed string",
+            rdbCompressionCodecName(enc));
     }
     zfree(c);
 
@@ -415,10 +655,10 @@ ssize_t rdbSaveRawString(rio *rdb, const unsigned char *s, size_t len) {
         }
     }
 
-    /* Try LZF compression - under 20 bytes it's unable to compress even
+    /* Try compression - under 20 bytes it's unable to compress even
      * aaaaaaaaaaaaaaaaaa so skip it */
     if (g_pserver->rdb_compression && len > 20) {
-        n = rdbSaveLzfStringObject(rdb,(const unsigned char*)s,len);
+        n = rdbSaveCompressedStringObject(rdb,(const unsigned char*)s,len);
         if (n == -1) return -1;
         if (n > 0) return n;
         /* Return value of 0 means data can't be compressed, save the old way */
@@ -493,7 +733,9 @@ void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr) {
         case RDB_ENC_INT32:
             return rdbLoadIntegerObject(rdb,len,flags,lenptr);
         case RDB_ENC_LZF:
-            return rdbLoadLzfStringObject(rdb,flags,lenptr);
+        case RDB_ENC_LZ4:
+        case RDB_ENC_ZSTD:
+            return rdbLoadCompressedStringObject(rdb,len,flags,lenptr);
         default:
             rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
             return nullptr; /* Never reached. */
@@ -635,20 +877,22 @@ int rdbSaveObjectType(rio *rdb, robj_roptr o) {
     case OBJ_SET:
         if (o->encoding == OBJ_ENCODING_INTSET)
             return rdbSaveType(rdb,RDB_TYPE_SET_INTSET);
+        else if (o->encoding == OBJ_ENCODING_ROARING)
+            return rdbSaveType(rdb,RDB_TYPE_SET_ROARING);
         else if (o->encoding == OBJ_ENCODING_HT)
             return rdbSaveType(rdb,RDB_TYPE_SET);
         else
             serverPanic("Unknown set encoding");
     case OBJ_ZSET:
-        if (o->encoding == OBJ_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,RDB_TYPE_ZSET_ZIPLIST);
-        else if (o->encoding == OBJ_ENCODING_SKIPLIST)
+        if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_ZSET_LISTPACK);
+        else if (o->encoding == OBJ_ENCODING_BTREE)
             return rdbSaveType(rdb,RDB_TYPE_ZSET_2);
         else
             serverPanic("Unknown sorted set encoding");
     case OBJ_HASH:
-        if (o->encoding == OBJ_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,RDB_TYPE_HASH_ZIPLIST);
+        if (o->encoding == OBJ_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,RDB_TYPE_HASH_LISTPACK);
         else if (o->encoding == OBJ_ENCODING_HT)
             return rdbSaveType(rdb,RDB_TYPE_HASH);
         else
@@ -769,10 +1013,27 @@ ssize_t rdbSaveObject(rio *rdb, robj_roptr o, robj *key) {
             nwritten += n;
 
             while(node) {
-                if (quicklistNodeIsCompressed(node)) {
+                if (node->encoding == QUICKLIST_NODE_ENCODING_LZF ||
+                    (node->encoding == QUICKLIST_NODE_ENCODING_LZ4 &&
+                     g_pserver->rdb_compression &&
+                     g_pserver->rdb_compression_codec == RDB_ENC_LZ4))
+                {
                     void *data;
                     size_t compress_len = quicklistGetLzf(node, &data);
-                    if ((n = rdbSaveLzfBlob(rdb,data,compress_len,node->sz)) == -1) return -1;
+                    int enc = (node->encoding == QUICKLIST_NODE_ENCODING_LZF) ?
+                        RDB_ENC_LZF : RDB_ENC_LZ4;
+                    if ((n = rdbSaveCompressedBlob(rdb,enc,data,compress_len,node->sz)) == -1) return -1;
+                    nwritten += n;
+                } else if (quicklistNodeIsCompressed(node)) {
+                    /* Nodes compressed with other codecs are saved as plain
+                     * ziplists, so that the file only depends on the codecs
+                     * of rdb-compression-codec (and the zstd dictionary of
+                     * the lists isn't needed to load it). */
+                    unsigned char *zl = quicklistGetZiplistCopy(node);
+                    if (zl == NULL) return -1;
+                    n = rdbSaveRawString(rdb,zl,node->sz);
+                    zfree(zl);
+                    if (n == -1) return -1;
                     nwritten += n;
                 } else {
                     if ((n = rdbSaveRawString(rdb,node->zl,node->sz)) == -1) return -1;
@@ -812,49 +1073,55 @@ ssize_t rdbSaveObject(rio *rdb, robj_roptr o, robj *key) {
 
             if ((n = rdbSaveRawString(rdb,(unsigned char*)szFromObj(o),l)) == -1) return -1;
             nwritten += n;
+        } else if (o->encoding == OBJ_ENCODING_ROARING) {
+            roaring *r = (roaring*)ptrFromObj(o);
+            size_t l = roaringBlobLen(r);
+            unsigned char *blob = (unsigned char*)zmalloc(l, MALLOC_LOCAL);
+
+            roaringSerialize(r,blob);
+            n = rdbSaveRawString(rdb,blob,l);
+            zfree(blob);
+            if (n == -1) return -1;
+            nwritten += n;
         } else {
             serverPanic("Unknown set encoding");
         }
     } else if (o->type == OBJ_ZSET) {
         /* Save a sorted set value */
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)ptrFromObj(o));
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)ptrFromObj(o));
 
             if ((n = rdbSaveRawString(rdb,(unsigned char*)ptrFromObj(o),l)) == -1) return -1;
             nwritten += n;
-        } else if (o->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (o->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = (zset*)ptrFromObj(o);
-            zskiplist *zsl = zs->zsl;
+            zbtree *zbt = zs->zbt;
 
-            if ((n = rdbSaveLen(rdb,zsl->length)) == -1) return -1;
+            if ((n = rdbSaveLen(rdb,zbt->length)) == -1) return -1;
             nwritten += n;
 
-            /* We save the skiplist elements from the greatest to the smallest
-             * (that's trivial since the elements are already ordered in the
-             * skiplist): this improves the load process, since the next loaded
-             * element will always be the smaller, so adding to the skiplist
-             * will always immediately stop at the head, making the insertion
-             * O(1) instead of O(log(N)). */
-            zskiplistNode *zn = zsl->tail;
-            while (zn != NULL) {
+            /* We save the elements from the greatest to the smallest, as
+             * older versions did for their skiplist: every loaded element is
+             * then the smallest so far, which the B+tree inserts at its head
+             * leaving the split nodes full. */
+            for (zbtreePos zn = zbtLast(zbt); zn.valid(); zn.prev()) {
                 if ((n = rdbSaveRawString(rdb,
-                    (unsigned char*)zn->ele,sdslen(zn->ele))) == -1)
+                    (unsigned char*)zn.ele(),sdslen(zn.ele()))) == -1)
                 {
                     return -1;
                 }
                 nwritten += n;
-                if ((n = rdbSaveBinaryDoubleValue(rdb,zn->score)) == -1)
+                if ((n = rdbSaveBinaryDoubleValue(rdb,zn.score())) == -1)
                     return -1;
                 nwritten += n;
-                zn = zn->backward;
             }
         } else {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (o->type == OBJ_HASH) {
         /* Save a hash value */
-        if (o->encoding == OBJ_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)ptrFromObj(o));
+        if (o->encoding == OBJ_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)ptrFromObj(o));
 
             if ((n = rdbSaveRawString(rdb,(unsigned char*)ptrFromObj(o),l)) == -1) return -1;
             nwritten += n;
@@ -1155,43 +1422,59 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
     snprintf(magic,sizeof(magic),"REDIS%04d",RDB_VERSION);
     if (rdbWriteRaw(rdb,magic,9) == -1) goto werr;
     if (rdbSaveInfoAuxFields(rdb,flags,rsi) == -1) goto werr;
+    if (rdbSaveZstdDictionary(rdb) == -1) goto werr;
 
-    for (j = 0; j < cserver.dbnum; j++) {
-        redisDb *db = g_pserver->db+j;
-        dict *d = db->pdict;
-        if (dictSize(d) == 0) continue;
-        di = dictGetSafeIterator(d);
-
-        /* Write the SELECT DB opcode */
-        if (rdbSaveType(rdb,RDB_OPCODE_SELECTDB) == -1) goto werr;
-        if (rdbSaveLen(rdb,j) == -1) goto werr;
-
-        /* Write the RESIZE DB opcode. We trim the size to UINT32_MAX, which
-         * is currently the largest type we are able to represent in RDB sizes.
-         * However this does not limit the actual size of the DB to load since
-         * these sizes are just hints to resize the hash tables. */
-        uint64_t db_size, expires_size;
-        db_size = dictSize(db->pdict);
-        expires_size = db->setexpire->size();
-        if (rdbSaveType(rdb,RDB_OPCODE_RESIZEDB) == -1) goto werr;
-        if (rdbSaveLen(rdb,db_size) == -1) goto werr;
-        if (rdbSaveLen(rdb,expires_size) == -1) goto werr;
+    /* Save the keyspace in segments serialized in parallel. Not for the AOF
+     * preamble, which has to read the diff from the parent as it goes, nor
+     * with modules, whose types may not serialize from several threads. */
+    if (g_pserver->rdb_save_threads > 1 && !(flags & RDB_SAVE_AOF_PREAMBLE) &&
+        moduleCount() == 0)
+    {
+        if (rdbSaveSegments(rdb,g_pserver->rdb_save_threads) == -1) goto werr;
+    } else {
+        for (j = 0; j < cserver.dbnum; j++) {
+            redisDb *db = g_pserver->db+j;
+            dict *d = db->pdict;
+            if (dictSize(d) == 0) continue;
+            di = dictGetSafeIterator(d);
+
+            /* Write the SELECT DB opcode */
+            if (rdbSaveType(rdb,RDB_OPCODE_SELECTDB) == -1) goto werr;
+            if (rdbSaveLen(rdb,j) == -1) goto werr;
+
+            /* Write the RESIZE DB opcode. We trim the size to UINT32_MAX, which
+             * is currently the largest type we are able to represent in RDB sizes.
+             * However this does not limit the actual size of the DB to load since
+             * these sizes are just hints to resize the hash tables. */
+            uint64_t db_size, expires_size;
+            db_size = dictSize(db->pdict);
+            expires_size = db->setexpire->size();
+            if (rdbSaveType(rdb,RDB_OPCODE_RESIZEDB) == -1) goto werr;
+            if (rdbSaveLen(rdb,db_size) == -1) goto werr;
+            if (rdbSaveLen(rdb,expires_size) == -1) goto werr;
         
-        /* Iterate this DB writing every entry */
-        size_t ckeysExpired = 0;
-        while((de = dictNext(di)) != NULL) {
-            sds keystr = (sds)dictGetKey(de);
-            robj *o = (robj*)dictGetVal(de);
-
-            if (o->FExpires())
-                ++ckeysExpired;
+            /* Iterate this DB writing every entry */
+            size_t ckeysExpired = 0;
+            while((de = dictNext(di)) != NULL) {
+                sds keystr = (sds)dictGetKey(de);
+                robj *o = (robj*)dictGetVal(de);
+                bool fInline = FInlineVal(o);
+                if (fInline)
+                    o = createObjectFromInline(o);
+
+                if (o->FExpires())
+                    ++ckeysExpired;
             
-            if (!saveKey(rdb, db, flags, &processed, keystr, o))
-                goto werr;
+                bool fSaved = saveKey(rdb, db, flags, &processed, keystr, o);
+                if (fInline)
+                    decrRefCount(o);
+                if (!fSaved)
+                    goto werr;
+            }
+            serverAssert(ckeysExpired == db->setexpire->size());
+            dictReleaseIterator(di);
+            di = NULL; /* So that we don't release it again on error. */
         }
-        serverAssert(ckeysExpired == db->setexpire->size());
-        dictReleaseIterator(di);
-        di = NULL; /* So that we don't release it again on error. */
     }
 
     /* If we are storing the replication information on disk, persist
@@ -1217,11 +1500,13 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
     cksum = rdb->cksum;
     memrev64ifbe(&cksum);
     if (rioWrite(rdb,&cksum,8) == 0) goto werr;
+    rdbReleaseZstdSaveDictionary();
     return C_OK;
 
 werr:
     if (error) *error = errno;
     if (di) dictReleaseIterator(di);
+    rdbReleaseZstdSaveDictionary();
     return C_ERR;
 }
 
@@ -1339,7 +1624,12 @@ int rdbSaveBackground(rdbSaveInfo *rsi) {
     pid_t childpid;
     long long start;
 
-    if (g_pserver->aof_child_pid != -1 || g_pserver->rdb_child_pid != -1) return C_ERR;
+    if (g_pserver->aof_child_pid != -1 || rdbSaveInProgress()) return C_ERR;
+
+    /* The fork-less save only writes the local file */
+    if (g_pserver->forkless_bgsave && g_pserver->rdb_filename != NULL &&
+        g_pserver->rdb_s3bucketpath == NULL)
+        return rdbSaveBackgroundForkless(rsi);
 
     g_pserver->dirty_before_bgsave = g_pserver->dirty;
     g_pserver->lastbgsave_try = time(NULL);
@@ -1434,6 +1724,31 @@ robj *rdbLoadCheckModuleValue(rio *rdb, char *modulename) {
     return createStringObject("module-dummy-value",18);
 }
 
+/* Convert a ziplist loaded from an older RDB file into a listpack holding
+ * the same entries, freeing the ziplist. Small hashes and sorted sets used to
+ * be serialized as ziplists before they switched to the listpack encoding. */
+static unsigned char *rdbZiplistToListpack(unsigned char *zl) {
+    unsigned char *lp = lpNew();
+    unsigned char *p = ziplistIndex(zl,0);
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll;
+    char buf[LONG_STR_SIZE];
+
+    while (p != NULL) {
+        if (!ziplistGet(p,&vstr,&vlen,&vll))
+            rdbExitReportCorruptRDB("Invalid ziplist entry");
+        if (vstr == NULL) {
+            vlen = ll2string(buf,sizeof(buf),vll);
+            vstr = (unsigned char*)buf;
+        }
+        lp = lpAppend(lp,vstr,vlen);
+        p = ziplistNext(zl,p);
+    }
+    zfree(zl);
+    return lp;
+}
+
 /* Load a Redis object of the specified type from the specified file.
  * On success a newly allocated object is returned, otherwise NULL. */
 robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key, uint64_t mvcc_tstamp) {
@@ -1466,13 +1781,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key, uint64_t mvcc_tstamp) {
         /* Read Set value */
         if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
 
-        /* Use a regular set when there are too many entries. */
+        /* Too many entries for an intset: start with a roaring bitmap,
+         * it is converted to a regular set on the first non integer. */
         if (len > g_pserver->set_max_intset_entries) {
-            o = createSetObject();
-            /* It's faster to expand the dict to the right size asap in order
-             * to avoid rehashing */
-            if (len > DICT_HT_INITIAL_SIZE)
-                dictExpand((dict*)ptrFromObj(o),len);
+            o = createRoaringSetObject(roaringNew());
         } else {
             o = createIntsetObject();
         }
@@ -1493,6 +1805,14 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key, uint64_t mvcc_tstamp) {
                     setTypeConvert(o,OBJ_ENCODING_HT);
                     dictExpand((dict*)ptrFromObj(o),len);
                 }
+            } else if (o->encoding == OBJ_ENCODING_ROARING) {
+                /* setTypeAdd() moves the set to a hash table when a member
+                 * is not an integer or the bitmap gets too sparse. */
+                setTypeAdd(o,sdsele);
+                sdsfree(sdsele);
+                if (o->encoding == OBJ_ENCODING_HT)
+                    dictExpand((dict*)ptrFromObj(o),len);
+                continue;
             }
 
             /* This will also be called when the set was just converted
@@ -1520,7 +1840,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key, uint64_t mvcc_tstamp) {
         while(zsetlen--) {
             sds sdsele;
             double score;
-            zskiplistNode *znode;
+            dictEntry *de;
 
             if ((sdsele = (sds)rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
                 == NULL) return NULL;
@@ -1534,14 +1854,15 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key, uint64_t mvcc_tstamp) {
             /* Don't care about integer-encoded strings. */
             if (sdslen(sdsele) > maxelelen) maxelelen = sdslen(sdsele);
 
-            znode = zslInsert(zs->zsl,score,sdsele);
-            dictAdd(zs->pdict,sdsele,&znode->score);
+            zbtInsert(zs->zbt,score,sdsele);
+            de = dictAddRaw(zs->pdict,sdsele,NULL);
+            if (de) dictSetDoubleVal(de,score);
         }
 
         /* Convert *after* loading, since sorted sets are not stored ordered. */
-        if (zsetLength(o) <= g_pserver->zset_max_ziplist_entries &&
-            maxelelen <= g_pserver->zset_max_ziplist_value)
-                zsetConvert(o,OBJ_ENCODING_ZIPLIST);
+        if (zsetLength(o) <= g_pserver->zset_max_listpack_entries &&
+            maxelelen <= g_pserver->zset_max_listpack_value)
+                zsetConvert(o,OBJ_ENCODING_LISTPACK);
     } else if (rdbtype == RDB_TYPE_HASH) {
         uint64_t len;
         int ret;
@@ -1553,11 +1874,11 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key, uint64_t mvcc_tstamp) {
         o = createHashObject();
 
         /* Too many entries? Use a hash table. */
-        if (len > g_pserver->hash_max_ziplist_entries)
+        if (len > g_pserver->hash_max_listpack_entries)
             hashTypeConvert(o, OBJ_ENCODING_HT);
 
-        /* Load every field and value into the ziplist */
-        while (o->encoding == OBJ_ENCODING_ZIPLIST && len > 0) {
+        /* Load every field and value into the listpack */
+        while (o->encoding == OBJ_ENCODING_LISTPACK && len > 0) {
             len--;
             /* Load raw strings */
             if ((field = (sds)rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
@@ -1565,15 +1886,15 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key, uint64_t mvcc_tstamp) {
             if ((value = (sds)rdbGenericLoadStringObject(rdb,RDB_LOAD_SDS,NULL))
                 == NULL) return NULL;
 
-            /* Add pair to ziplist */
-            o->m_ptr = ziplistPush((unsigned char*)ptrFromObj(o), (unsigned char*)field,
-                    sdslen(field), ZIPLIST_TAIL);
-            o->m_ptr = ziplistPush((unsigned char*)ptrFromObj(o), (unsigned char*)value,
-                    sdslen(value), ZIPLIST_TAIL);
+            /* Add pair to listpack */
+            o->m_ptr = lpAppend((unsigned char*)ptrFromObj(o), (unsigned char*)field,
+                    sdslen(field));
+            o->m_ptr = lpAppend((unsigned char*)ptrFromObj(o), (unsigned char*)value,
+                    sdslen(value));
 
             /* Convert to hash table if size threshold is exceeded */
-            if (sdslen(field) > g_pserver->hash_max_ziplist_value ||
-                sdslen(value) > g_pserver->hash_max_ziplist_value)
+            if (sdslen(field) > g_pserver->hash_max_listpack_value ||
+                sdslen(value) > g_pserver->hash_max_listpack_value)
             {
                 sdsfree(field);
                 sdsfree(value);
@@ -1636,10 +1957,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key, uint64_t mvcc_tstamp) {
          * converted. */
         switch(rdbtype) {
             case RDB_TYPE_HASH_ZIPMAP:
-                /* Convert to ziplist encoded hash. This must be deprecated
+                /* Convert to listpack encoded hash. This must be deprecated
                  * when loading dumps created by Redis 2.4 gets deprecated. */
                 {
-                    unsigned char *zl = ziplistNew();
+                    unsigned char *lp = lpNew();
                     unsigned char *zi = zipmapRewind((unsigned char*)ptrFromObj(o));
                     unsigned char *fstr, *vstr;
                     unsigned int flen, vlen;
@@ -1648,17 +1969,17 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key, uint64_t mvcc_tstamp) {
                     while ((zi = zipmapNext(zi, &fstr, &flen, &vstr, &vlen)) != NULL) {
                         if (flen > maxlen) maxlen = flen;
                         if (vlen > maxlen) maxlen = vlen;
-                        zl = ziplistPush(zl, fstr, flen, ZIPLIST_TAIL);
-                        zl = ziplistPush(zl, vstr, vlen, ZIPLIST_TAIL);
+                        lp = lpAppend(lp, fstr, flen);
+                        lp = lpAppend(lp, vstr, vlen);
                     }
 
                     zfree(ptrFromObj(o));
-                    o->m_ptr = zl;
+                    o->m_ptr = lp;
                     o->type = OBJ_HASH;
-                    o->encoding = OBJ_ENCODING_ZIPLIST;
+                    o->encoding = OBJ_ENCODING_LISTPACK;
 
-                    if (hashTypeLength(o) > g_pserver->hash_max_ziplist_entries ||
-                        maxlen > g_pserver->hash_max_ziplist_value)
+                    if (hashTypeLength(o) > g_pserver->hash_max_listpack_entries ||
+                        maxlen > g_pserver->hash_max_listpack_value)
                     {
                         hashTypeConvert(o, OBJ_ENCODING_HT);
                     }
@@ -1673,24 +1994,62 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key, uint64_t mvcc_tstamp) {
                 o->type = OBJ_SET;
                 o->encoding = OBJ_ENCODING_INTSET;
                 if (intsetLen((intset*)ptrFromObj(o)) > g_pserver->set_max_intset_entries)
-                    setTypeConvert(o,OBJ_ENCODING_HT);
+                    setTypeConvert(o,OBJ_ENCODING_ROARING);
                 break;
             case RDB_TYPE_ZSET_ZIPLIST:
+                o->m_ptr = rdbZiplistToListpack((unsigned char*)ptrFromObj(o));
                 o->type = OBJ_ZSET;
-                o->encoding = OBJ_ENCODING_ZIPLIST;
-                if (zsetLength(o) > g_pserver->zset_max_ziplist_entries)
-                    zsetConvert(o,OBJ_ENCODING_SKIPLIST);
+                o->encoding = OBJ_ENCODING_LISTPACK;
+                if (zsetLength(o) > g_pserver->zset_max_listpack_entries)
+                    zsetConvert(o,OBJ_ENCODING_BTREE);
                 break;
             case RDB_TYPE_HASH_ZIPLIST:
+                o->m_ptr = rdbZiplistToListpack((unsigned char*)ptrFromObj(o));
                 o->type = OBJ_HASH;
-                o->encoding = OBJ_ENCODING_ZIPLIST;
-                if (hashTypeLength(o) > g_pserver->hash_max_ziplist_entries)
+                o->encoding = OBJ_ENCODING_LISTPACK;
+                if (hashTypeLength(o) > g_pserver->hash_max_listpack_entries)
                     hashTypeConvert(o, OBJ_ENCODING_HT);
                 break;
             default:
                 rdbExitReportCorruptRDB("Unknown RDB encoding type %d",rdbtype);
                 break;
         }
+    } else if (rdbtype == RDB_TYPE_SET_ROARING) {
+        unsigned char *blob;
+        size_t bloblen;
+        roaring *r;
+
+        blob = (unsigned char*)
+            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&bloblen);
+        if (blob == NULL) return NULL;
+        r = roaringDeserialize(blob,bloblen);
+        zfree(blob);
+        if (r == NULL || roaringCard(r) == 0)
+            rdbExitReportCorruptRDB("Invalid roaring bitmap encoded set");
+        o = createRoaringSetObject(r);
+    } else if (rdbtype == RDB_TYPE_ZSET_LISTPACK ||
+               rdbtype == RDB_TYPE_HASH_LISTPACK)
+    {
+        unsigned char *lp = (unsigned char*)
+            rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL);
+        if (lp == NULL) return NULL;
+        if (lpFirst(lp) == NULL) {
+            /* Empty keys are deleted, so a serialized listpack can never
+             * be empty. */
+            rdbExitReportCorruptRDB("Empty listpack encoded %s",
+                rdbtype == RDB_TYPE_ZSET_LISTPACK ? "zset" : "hash");
+        }
+        if (rdbtype == RDB_TYPE_ZSET_LISTPACK) {
+            o = createObject(OBJ_ZSET,lp);
+            o->encoding = OBJ_ENCODING_LISTPACK;
+            if (zsetLength(o) > g_pserver->zset_max_listpack_entries)
+                zsetConvert(o,OBJ_ENCODING_BTREE);
+        } else {
+            o = createObject(OBJ_HASH,lp);
+            o->encoding = OBJ_ENCODING_LISTPACK;
+            if (hashTypeLength(o) > g_pserver->hash_max_listpack_entries)
+                hashTypeConvert(o, OBJ_ENCODING_HT);
+        }
     } else if (rdbtype == RDB_TYPE_STREAM_LISTPACKS) {
         o = createStreamObject();
         stream *s = (stream*)ptrFromObj(o);
@@ -1849,7 +2208,8 @@ robj *rdbLoadObject(int rdbtype, rio *rdb, robj *key, uint64_t mvcc_tstamp) {
         }
         o = createModuleObject(mt,ptr);
     } else {
-        rdbExitReportCorruptRDB("Unknown RDB encoding type %d",rdbtype);
+        rdbExitReportCorruptRDB("Unknown RDB encoding type %d, the file may "
+            "come from a newer or an incompatible server",rdbtype);
     }
 
     o->mvcc_tstamp = mvcc_tstamp;
@@ -1866,6 +2226,7 @@ void startLoading(FILE *fp) {
     g_pserver->loading = 1;
     g_pserver->loading_start_time = time(NULL);
     g_pserver->loading_loaded_bytes = 0;
+    g_pserver->loading_loaded_keys = 0;
     if (fstat(fileno(fp), &sb) == -1) {
         g_pserver->loading_total_bytes = 0;
     } else {
@@ -1911,6 +2272,319 @@ void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
     }
 }
 
+/* -----------------------------------------------------------------------------
+ * Pipelined loading
+ *
+ * With rdb-load-threads the loading thread no longer decodes the values: it
+ * reads the opcodes and the keys, and copies the serialized value of each key
+ * as is.  Worker threads then decompress the strings and build the objects
+ * while the loading thread moves on to the next keys.
+ *
+ * The dataset is only ever modified by the loading thread, which inserts the
+ * decoded keys in the order of the file.  The expires, subexpires and MVCC
+ * timestamps are thus applied exactly as by the serial loader.
+ * -------------------------------------------------------------------------- */
+
+/* Bounds of the values read ahead of the key being inserted. */
+#define RDB_LOAD_PIPELINE_MAX_JOBS 4096
+#define RDB_LOAD_PIPELINE_MAX_BYTES (64*1024*1024)
+/* Values are handed to the workers in batches of this size. */
+#define RDB_LOAD_PIPELINE_BATCH_JOBS 256
+#define RDB_LOAD_PIPELINE_BATCH_BYTES (256*1024)
+
+/* Read a string like rdbGenericLoadStringObject() but without decoding or
+ * keeping it. Returns -1 on I/O error. */
+static int rdbSkipStringObject(rio *rdb) {
+    char buf[4096];
+    int isencoded;
+    uint64_t len;
+
+    len = rdbLoadLen(rdb,&isencoded);
+    if (isencoded) {
+        switch(len) {
+        case RDB_ENC_INT8: len = 1; break;
+        case RDB_ENC_INT16: len = 2; break;
+        case RDB_ENC_INT32: len = 4; break;
+        case RDB_ENC_LZF:
+        case RDB_ENC_LZ4:
+        case RDB_ENC_ZSTD:
+            /* Compressed length, then the uncompressed one */
+            if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+            if (rdbLoadLen(rdb,NULL) == RDB_LENERR) return -1;
+            break;
+        default:
+            rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
+        }
+    }
+    if (len == RDB_LENERR) return -1;
+
+    while (len) {
+        size_t cb = std::min(len, (uint64_t)sizeof(buf));
+        if (rioRead(rdb,buf,cb) == 0) return -1;
+        len -= cb;
+    }
+    return 0;
+}
+
+/* Read the value of the type 'rdbtype' without decoding it. Returns 1 on
+ * success, -1 on I/O error, and 0 without reading anything if values of this
+ * type can only be read by rdbLoadObject(). */
+static int rdbSkipObject(int rdbtype, rio *rdb) {
+    uint64_t len, count;
+    double score;
+
+    switch(rdbtype) {
+    case RDB_TYPE_STRING:
+    case RDB_TYPE_HASH_ZIPMAP:
+    case RDB_TYPE_LIST_ZIPLIST:
+    case RDB_TYPE_SET_INTSET:
+    case RDB_TYPE_ZSET_ZIPLIST:
+    case RDB_TYPE_HASH_ZIPLIST:
+    case RDB_TYPE_SET_ROARING:
+    case RDB_TYPE_ZSET_LISTPACK:
+    case RDB_TYPE_HASH_LISTPACK:
+        return (rdbSkipStringObject(rdb) == 0) ? 1 : -1;
+
+    case RDB_TYPE_LIST:
+    case RDB_TYPE_SET:
+    case RDB_TYPE_LIST_QUICKLIST:
+    case RDB_TYPE_HASH:
+        if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+        count = (rdbtype == RDB_TYPE_HASH) ? len*2 : len;
+        while (count--) {
+            if (rdbSkipStringObject(rdb) == -1) return -1;
+        }
+        return 1;
+
+    case RDB_TYPE_ZSET:
+    case RDB_TYPE_ZSET_2:
+        if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+        while (len--) {
+            if (rdbSkipStringObject(rdb) == -1) return -1;
+            if (rdbtype == RDB_TYPE_ZSET_2) {
+                if (rdbLoadBinaryDoubleValue(rdb,&score) == -1) return -1;
+            } else {
+                if (rdbLoadDoubleValue(rdb,&score) == -1) return -1;
+            }
+        }
+        return 1;
+
+    default:
+        /* Streams and modules */
+        return 0;
+    }
+}
+
+/* While a value is skipped, every byte read is also appended to this buffer. */
+static sds rdbLoadCaptureBuf = NULL;
+static void (*rdbLoadCaptureNext)(rio *, const void *, size_t) = NULL;
+
+static void rdbLoadCaptureCallback(rio *r, const void *buf, size_t len) {
+    rdbLoadCaptureBuf = sdscatlen(rdbLoadCaptureBuf,buf,len);
+    if (rdbLoadCaptureNext) rdbLoadCaptureNext(r,buf,len);
+}
+
+/* Like rdbSkipObject() but returns the bytes of the value in '*payload'. */
+static int rdbCaptureObject(int rdbtype, rio *rdb, sds *payload) {
+    rdbLoadCaptureBuf = sdsempty();
+    rdbLoadCaptureNext = rdb->update_cksum;
+    rdb->update_cksum = rdbLoadCaptureCallback;
+    int ret = rdbSkipObject(rdbtype,rdb);
+    rdb->update_cksum = rdbLoadCaptureNext;
+    *payload = rdbLoadCaptureBuf;
+    rdbLoadCaptureBuf = NULL;
+    rdbLoadCaptureNext = NULL;
+    if (ret != 1) {
+        sdsfree(*payload);
+        *payload = NULL;
+    }
+    return ret;
+}
+
+/* Add a loaded key to the dataset. 'val' is consumed. Returns false if the
+ * key was already there and kept its value. */
+bool rdbLoadAddKey(redisDb *db, robj *key, robj *val, long long expiretime,
+        long long lfu_freq, long long lru_idle, long long lru_clock, bool fForceSetKey)
+{
+    int fInserted = dbMerge(db, key, val, fForceSetKey);   // Note: dbMerge will incrRef
+
+    if (fInserted)
+    {
+        /* Set the expire time if needed */
+        if (expiretime != -1)
+            setExpire(NULL,db,key,nullptr,expiretime);
+
+        /* Set usage information (for eviction). */
+        objectSetLRUOrLFU(val,lfu_freq,lru_idle,lru_clock);
+        g_pserver->loading_loaded_keys++;
+    }
+    else
+    {
+        decrRefCount(val);
+    }
+
+    /* Values inlined in the keyspace leave their object behind */
+    releaseAutoreleasedObjects();
+    return fInserted;
+}
+
+struct rdbLoadJob {
+    redisDb *db;
+    int type;
+    robj *key;
+    sds payload;        /* the serialized value, NULL once decoded */
+    size_t cbPayload;
+    robj *val = nullptr;
+    bool fPredecoded = false;   /* decoded by the loading thread */
+    bool fDecoded = false;      /* decoded by a worker, guarded by the pipeline mutex */
+    long long expiretime, lfu_freq, lru_idle;
+    uint64_t mvcc_tstamp;
+};
+
+class rdbLoadPipeline {
+    std::vector<std::thread> m_vecthreads;
+    std::mutex m_mutex;
+    std::condition_variable m_cvWork;       /* signaled when m_queueWork gets a batch */
+    std::condition_variable m_cvDone;       /* signaled when a batch is decoded */
+    std::deque<std::vector<rdbLoadJob*>> m_queueWork;  /* batches waiting for a worker */
+    bool m_fExit = false;
+
+    /* Only used by the loading thread */
+    std::deque<rdbLoadJob*> m_queueOrder;   /* every job not inserted yet, in file order */
+    std::vector<rdbLoadJob*> m_batch;       /* jobs not handed to the workers yet */
+    size_t m_cbBatch = 0;
+    size_t m_cbPending = 0;
+    long long m_lru_clock;
+    bool m_fForceSetKey;
+
+    void workerMain() {
+        dictNoRehashThisThread = 1;
+        quicklistNoAsyncCompressThisThread = 1;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            m_cvWork.wait(lock, [this]{ return m_fExit || !m_queueWork.empty(); });
+            if (m_queueWork.empty())
+                break;
+            std::vector<rdbLoadJob*> batch = std::move(m_queueWork.front());
+            m_queueWork.pop_front();
+            lock.unlock();
+
+            for (rdbLoadJob *job : batch) {
+                rio payload;
+                rioInitWithBuffer(&payload,job->payload);
+                job->val = rdbLoadObject(job->type,&payload,job->key,job->mvcc_tstamp);
+                sdsfree(job->payload);
+                job->payload = nullptr;
+            }
+
+            lock.lock();
+            for (rdbLoadJob *job : batch)
+                job->fDecoded = true;
+            m_cvDone.notify_one();
+        }
+    }
+
+    void flushBatch() {
+        if (m_batch.empty())
+            return;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_queueWork.push_back(std::move(m_batch));
+        m_cvWork.notify_one();
+        m_batch.clear();
+        m_cbBatch = 0;
+    }
+
+    /* Insert the oldest job, waiting for it to be decoded if 'fWait'.
+     * Returns 1 if a key was inserted, 0 if not, and -1 if it failed to
+     * decode. */
+    int insertFront(bool fWait) {
+        if (m_queueOrder.empty())
+            return 0;
+        rdbLoadJob *job = m_queueOrder.front();
+        if (!job->fPredecoded) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (!job->fDecoded) {
+                if (!fWait)
+                    return 0;
+                lock.unlock();
+                flushBatch();   /* it may not be queued yet */
+                lock.lock();
+                m_cvDone.wait(lock, [job]{ return job->fDecoded; });
+            }
+        }
+        m_queueOrder.pop_front();
+        m_cbPending -= job->cbPayload;
+
+        int ret = -1;
+        if (job->val != nullptr) {
+            rdbLoadAddKey(job->db,job->key,job->val,job->expiretime,job->lfu_freq,
+                job->lru_idle,m_lru_clock,m_fForceSetKey);
+            ret = 1;
+        }
+        decrRefCount(job->key);
+        delete job;
+        return ret;
+    }
+
+public:
+    rdbLoadPipeline(int cthreads, long long lru_clock, bool fForceSetKey)
+        : m_lru_clock(lru_clock), m_fForceSetKey(fForceSetKey)
+    {
+        for (int ithread = 0; ithread < cthreads; ++ithread)
+            m_vecthreads.emplace_back(&rdbLoadPipeline::workerMain, this);
+    }
+
+    ~rdbLoadPipeline() {
+        flushBatch();
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_fExit = true;
+            m_cvWork.notify_all();
+        }
+        /* The workers finish the queued batches before leaving */
+        for (auto &thread : m_vecthreads)
+            thread.join();
+        for (rdbLoadJob *job : m_queueOrder) {
+            if (job->val) decrRefCount(job->val);
+            decrRefCount(job->key);
+            delete job;
+        }
+    }
+
+    /* Queue a key for insertion, its value is decoded by a worker unless
+     * 'job->val' is already set. The job and its reference to the key are
+     * owned by the pipeline. Returns -1 if an earlier value failed to decode. */
+    int submit(rdbLoadJob *job) {
+        m_queueOrder.push_back(job);
+        if (job->val != nullptr) {
+            job->fPredecoded = true;
+        } else {
+            m_cbPending += job->cbPayload;
+            m_batch.push_back(job);
+            m_cbBatch += job->cbPayload;
+            if (m_batch.size() >= RDB_LOAD_PIPELINE_BATCH_JOBS ||
+                m_cbBatch >= RDB_LOAD_PIPELINE_BATCH_BYTES)
+                flushBatch();
+        }
+
+        /* Insert what is ready, and wait for the workers if we read too far */
+        int ret;
+        while ((ret = insertFront(false)) == 1);
+        while (ret != -1 && (m_queueOrder.size() > RDB_LOAD_PIPELINE_MAX_JOBS ||
+                             m_cbPending > RDB_LOAD_PIPELINE_MAX_BYTES))
+            ret = insertFront(true);
+        return (ret == -1) ? -1 : 0;
+    }
+
+    /* Insert every key queued so far. Returns -1 if a value failed to decode. */
+    int drain() {
+        int ret;
+        while ((ret = insertFront(true)) == 1);
+        return ret;
+    }
+};
+
 /* Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
  * otherwise C_ERR is returned and 'errno' is set accordingly. */
 int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
@@ -1924,6 +2598,8 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
     uint64_t mvcc_tstamp = OBJ_MVCC_INVALID;
     robj *subexpireKey = nullptr;
     robj *key = nullptr;
+    std::unique_ptr<rdbLoadPipeline> pipeline;
+    rdbSegmentLoader *segments = nullptr;
 
     rdb->update_cksum = rdbLoadProgressCallback;
     rdb->max_processing_chunk = g_pserver->loading_process_events_interval_bytes;
@@ -1943,9 +2619,15 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
 
     now = mstime();
     lru_clock = LRU_CLOCK();
-    
+    rdbSetZstdLoadDictionary(NULL,0);
+    if (g_pserver->rdb_load_threads > 0) {
+        pipeline = std::unique_ptr<rdbLoadPipeline>(new (MALLOC_LOCAL) rdbLoadPipeline(
+            g_pserver->rdb_load_threads, lru_clock, rsi->fForceSetKey));
+        g_pserver->loading_threads = g_pserver->rdb_load_threads;
+    }
+
     while(1) {
-        robj *val;
+        robj *val = nullptr;
 
         /* Read type. */
         if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
@@ -2000,6 +2682,26 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
                 goto eoferr;
             dictExpand(db->pdict,db_size);
             continue; /* Read next opcode. */
+        } else if (type == RDB_OPCODE_SEGMENT) {
+            /* SEGMENT: a chunk of one of the segments the keyspace was saved
+             * in, parsed by a thread of its own. */
+            if (segments == nullptr) {
+                if (pipeline != nullptr && pipeline->drain() == -1) goto eoferr;
+                segments = rdbSegmentLoaderCreate(false,
+                    listLength(g_pserver->masters) == 0 && !loading_aof,
+                    lru_clock, rsi->fForceSetKey);
+            }
+            if (rdbSegmentLoaderFeed(segments,rdb) == C_ERR) goto segerr;
+            continue; /* Read next opcode. */
+        } else if (type == RDB_OPCODE_SEGMENT_MANIFEST) {
+            /* SEGMENT_MANIFEST: the segments are complete, check them
+             * against their sizes and checksums. */
+            if (segments == nullptr)
+                segments = rdbSegmentLoaderCreate(false,false,lru_clock,rsi->fForceSetKey);
+            if (rdbSegmentLoaderFinish(segments,rdb) == C_ERR) goto segerr;
+            rdbSegmentLoaderRelease(segments);
+            segments = nullptr;
+            continue; /* Read next opcode. */
         } else if (type == RDB_OPCODE_AUX) {
             /* AUX: generic string-string fields. Use to add state to RDB
              * which is backward compatible. Implementations of RDB loading
@@ -2050,6 +2752,11 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
                 if (haspreamble) serverLog(LL_NOTICE,"RDB has an AOF tail");
             } else if (!strcasecmp(szFromObj(auxkey),"redis-bits")) {
                 /* Just ignored. */
+            } else if (!strcasecmp(szFromObj(auxkey),"zstd-dict")) {
+                /* The values that follow are compressed with it */
+                if (rdbSetZstdLoadDictionary(ptrFromObj(auxval),sdslen(szFromObj(auxval))) == -1) {
+                    rdbExitReportCorruptRDB("Can't use the zstd dictionary of the RDB file");
+                }
             } else if (!strcasecmp(szFromObj(auxkey),"mvcc-tstamp")) {
                 static_assert(sizeof(unsigned long long) == sizeof(uint64_t), "Ensure long long is 64-bits");
                 mvcc_tstamp = strtoull(szFromObj(auxval), nullptr, 10);
@@ -2057,6 +2764,8 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
                 subexpireKey = auxval;
                 incrRefCount(subexpireKey);
             } else if (!strcasecmp(szFromObj(auxkey), "keydb-subexpire-when")) {
+                /* The key it applies to must be in the dataset */
+                if (pipeline != nullptr && pipeline->drain() == -1) goto eoferr;
                 if (key == nullptr || subexpireKey == nullptr) {
                     serverLog(LL_WARNING, "Corrupt subexpire entry in RDB skipping.");
                 }
@@ -2103,6 +2812,9 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
                 robj *aux = rdbLoadCheckModuleValue(rdb,name);
                 decrRefCount(aux);
             }
+        } else if (!rdbIsObjectType(type)) {
+            rdbExitReportCorruptRDB("Unknown RDB opcode or object type %d, the "
+                "file may come from a newer or an incompatible server",type);
         }
 
         /* Read key */
@@ -2113,35 +2825,57 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
         }
 
         if ((key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
-        /* Read value */
-        if ((val = rdbLoadObject(type,rdb,key, mvcc_tstamp)) == NULL) goto eoferr;
         /* Check if the key already expired. This function is used when loading
          * an RDB file from disk, either at startup, or when an RDB was
          * received from the master. In the latter case, the master is
          * responsible for key expiry. If we would expire keys here, the
          * snapshot taken by the master may not be reflected on the replica. */
-        if (listLength(g_pserver->masters) == 0 && !loading_aof && expiretime != -1 && expiretime < now) {
-            decrRefCount(key);
-            key = nullptr;
-            decrRefCount(val);
-            val = nullptr;
-        } else {
-            /* Add the new object in the hash table */
-            int fInserted = dbMerge(db, key, val, rsi->fForceSetKey);   // Note: dbMerge will incrRef
-
-            if (fInserted)
-            {
-                /* Set the expire time if needed */
-                if (expiretime != -1)
-                    setExpire(NULL,db,key,nullptr,expiretime);
+        bool fExpired = listLength(g_pserver->masters) == 0 && !loading_aof && expiretime != -1 && expiretime < now;
+
+        if (pipeline != nullptr) {
+            /* Read the value, the workers will decode it */
+            rdbLoadJob *job = nullptr;
+            sds payload = nullptr;
+            int ret = fExpired ? rdbSkipObject(type,rdb) : rdbCaptureObject(type,rdb,&payload);
+            if (ret == -1) goto eoferr;
+            if (ret == 0) {
+                /* This type has to be decoded here */
+                if ((val = rdbLoadObject(type,rdb,key,mvcc_tstamp)) == NULL) goto eoferr;
+                if (fExpired) {
+                    decrRefCount(val);
+                    val = nullptr;
+                }
+            }
 
-                /* Set usage information (for eviction). */
-                objectSetLRUOrLFU(val,lfu_freq,lru_idle,lru_clock);
+            if (fExpired) {
+                decrRefCount(key);
+                key = nullptr;
+            } else {
+                job = new (MALLOC_LOCAL) rdbLoadJob;
+                job->db = db;
+                job->type = type;
+                job->key = key;
+                incrRefCount(key);
+                job->payload = payload;
+                job->cbPayload = payload ? sdslen(payload) : 0;
+                job->val = (ret == 0) ? val : nullptr;
+                job->expiretime = expiretime;
+                job->lfu_freq = lfu_freq;
+                job->lru_idle = lru_idle;
+                job->mvcc_tstamp = mvcc_tstamp;
+                if (pipeline->submit(job) == -1) goto eoferr;
             }
-            else
-            {
+        } else {
+            /* Read value */
+            if ((val = rdbLoadObject(type,rdb,key, mvcc_tstamp)) == NULL) goto eoferr;
+            if (fExpired) {
+                decrRefCount(key);
+                key = nullptr;
                 decrRefCount(val);
                 val = nullptr;
+            } else {
+                /* Add the new object in the hash table */
+                rdbLoadAddKey(db,key,val,expiretime,lfu_freq,lru_idle,lru_clock,rsi->fForceSetKey);
             }
         }
 
@@ -2152,6 +2886,17 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
         lru_idle = -1;
     }
 
+    if (pipeline != nullptr) {
+        if (pipeline->drain() == -1) goto eoferr;
+        pipeline.reset();
+        g_pserver->loading_threads = 0;
+    }
+
+    if (segments != nullptr) {
+        serverLog(LL_WARNING,"RDB segments without a manifest. Aborting now.");
+        rdbExitReportCorruptRDB("Missing segment manifest");
+    }
+
     if (key != nullptr)
         decrRefCount(key);
 
@@ -2161,6 +2906,7 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
         decrRefCount(subexpireKey);
         subexpireKey = nullptr;
     }
+    rdbSetZstdLoadDictionary(NULL,0);
     
     /* Verify the checksum if RDB version is >= 5 */
     if (rdbver >= 5) {
@@ -2179,6 +2925,11 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
     }
     return C_OK;
 
+segerr: /* an invalid segment, or a short read */
+    if (rdbSegmentLoaderError(segments) != nullptr) {
+        serverLog(LL_WARNING,"Invalid RDB segment. Aborting now.");
+        rdbExitReportCorruptRDB("%s", rdbSegmentLoaderError(segments));
+    }
 eoferr: /* unexpected end of file is handled here with a fatal exit */
     serverLog(LL_WARNING,"Short read or OOM loading DB. Unrecoverable error, aborting now.");
     rdbExitReportCorruptRDB("Unexpected EOF reading RDB file");
@@ -2236,7 +2987,8 @@ void backgroundSaveDoneHandlerDisk(int exitcode, int bysignal) {
         serverLog(LL_WARNING,
             "Background saving terminated by signal %d", bysignal);
         latencyStartMonitor(latency);
-        rdbRemoveTempFile(g_pserver->rdb_child_pid);
+        if (g_pserver->rdb_child_pid != -1)
+            rdbRemoveTempFile(g_pserver->rdb_child_pid);
         latencyEndMonitor(latency);
         latencyAddSampleIfNeeded("rdb-unlink-temp-file",latency);
         /* SIGUSR1 is whitelisted, so we have a way to kill a child without
@@ -2368,6 +3120,10 @@ void backgroundSaveDoneHandler(int exitcode, int bysignal) {
  * the child did not exit for an error, but because we wanted), and performs
  * the cleanup needed. */
 void killRDBChild(void) {
+    if (g_pserver->rdb_forkless_save != nullptr) {
+        rdbForklessSaveAbort("killed");
+        return;
+    }
     kill(g_pserver->rdb_child_pid,SIGUSR1);
     rdbRemoveTempFile(g_pserver->rdb_child_pid);
     closeChildInfoPipe();
@@ -2387,7 +3143,7 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
     long long start;
     int pipefds[2];
 
-    if (g_pserver->aof_child_pid != -1 || g_pserver->rdb_child_pid != -1) return C_ERR;
+    if (g_pserver->aof_child_pid != -1 || rdbSaveInProgress()) return C_ERR;
 
     /* Before to fork, create a pipe that will be used in order to
      * send back to the parent the IDs of the slaves that successfully
@@ -2537,7 +3293,7 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
 }
 
 void saveCommand(client *c) {
-    if (g_pserver->rdb_child_pid != -1) {
+    if (rdbSaveInProgress()) {
         addReplyError(c,"Background save already in progress");
         return;
     }
@@ -2568,7 +3324,7 @@ void bgsaveCommand(client *c) {
     rdbSaveInfo rsi, *rsiptr;
     rsiptr = rdbPopulateSaveInfo(&rsi);
 
-    if (g_pserver->rdb_child_pid != -1) {
+    if (rdbSaveInProgress()) {
         addReplyError(c,"Background save already in progress");
     } else if (g_pserver->aof_child_pid != -1) {
         if (schedule) {
@@ -38,7 +38,7 @@
 
 /* The current RDB version. When the format changes in a way that is no longer
  * backward compatible this number gets incremented. */
-#define RDB_VERSION 9
+#define RDB_VERSION 10
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -68,6 +68,8 @@
 #define RDB_ENC_INT16 1       /* 16 bit signed integer */
 #define RDB_ENC_INT32 2       /* 32 bit signed integer */
 #define RDB_ENC_LZF 3         /* string compressed with FASTLZ */
+#define RDB_ENC_LZ4 4         /* string compressed with LZ4 */
+#define RDB_ENC_ZSTD 5        /* string compressed with zstd */
 
 /* Map object types to RDB object types. Macros starting with OBJ_ are for
  * memory storage and may change. Instead RDB types must be fixed because
@@ -91,10 +93,19 @@
 #define RDB_TYPE_HASH_ZIPLIST  13
 #define RDB_TYPE_LIST_QUICKLIST 14
 #define RDB_TYPE_STREAM_LISTPACKS 15
+#define RDB_TYPE_HASH_LISTPACK 16
+#define RDB_TYPE_ZSET_LISTPACK 17
+
+/* KeyDB only types.  Upstream keeps numbering new types after the ones above
+ * (18 is its LIST_QUICKLIST_2), so these are numbered from 100: files of one
+ * server with a type the other lacks are then rejected instead of having
+ * their values parsed as something else. */
+#define RDB_TYPE_SET_ROARING 100
 /* NOTE: WHEN ADDING NEW RDB TYPE, UPDATE rdbIsObjectType() BELOW */
 
 /* Test if a type is an object type. */
-#define rdbIsObjectType(t) ((t >= 0 && t <= 7) || (t >= 9 && t <= 15))
+#define rdbIsObjectType(t) ((t >= 0 && t <= 7) || (t >= 9 && t <= 17) || \
+                            t == RDB_TYPE_SET_ROARING)
 
 /* Special RDB opcodes (saved/loaded with rdbSaveType/rdbLoadType). */
 #define RDB_OPCODE_MODULE_AUX 247   /* Module auxiliary data. */
@@ -107,6 +118,13 @@
 #define RDB_OPCODE_SELECTDB   254   /* DB number of the following keys. */
 #define RDB_OPCODE_EOF        255   /* End of the RDB file. */
 
+/* KeyDB only opcodes.  Upstream numbers new opcodes down from the ones above
+ * (246 and 245 are its FUNCTION_PRE_GA and FUNCTION2), so like the KeyDB
+ * only types these are kept apart, numbered down from 200.  A loader meeting
+ * an opcode it doesn't know reports the file as corrupt. */
+#define RDB_OPCODE_SEGMENT    200   /* Chunk of a segment of the keyspace. */
+#define RDB_OPCODE_SEGMENT_MANIFEST 199  /* Sizes and checksums of the segments. */
+
 /* Module serialized values sub opcodes */
 #define RDB_MODULE_OPCODE_EOF   0   /* End of module value. */
 #define RDB_MODULE_OPCODE_SINT  1   /* Signed integer. */
@@ -150,6 +168,9 @@ size_t rdbSavedObjectLen(robj *o);
 robj *rdbLoadObject(int type, rio *rdb, robj *key, uint64_t mvcc_tstamp);
 void backgroundSaveDoneHandler(int exitcode, int bysignal);
 int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val, long long expiretime);
+int saveKey(rio *rdb, redisDb *db, int flags, size_t *processed, const char *keystr, robj *o);
+int rdbSaveInfoAuxFields(rio *rdb, int flags, rdbSaveInfo *rsi);
+ssize_t rdbSaveAuxField(rio *rdb, const void *key, size_t keylen, const void *val, size_t vallen);
 robj *rdbLoadStringObject(rio *rdb);
 ssize_t rdbSaveStringObject(rio *rdb, robj_roptr obj);
 ssize_t rdbSaveRawString(rio *rdb, const unsigned char *s, size_t len);
@@ -159,6 +180,21 @@ int rdbLoadBinaryDoubleValue(rio *rdb, double *val);
 int rdbSaveBinaryFloatValue(rio *rdb, float val);
 int rdbLoadBinaryFloatValue(rio *rdb, float *val);
 int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof);
+int rdbCompressionCodecAvailable(int enc);
+int rdbSetZstdLoadDictionary(const void *dict, size_t len);
+bool rdbLoadAddKey(redisDb *db, robj *key, robj *val, long long expiretime,
+        long long lfu_freq, long long lru_idle, long long lru_clock, bool fForceSetKey);
+
+/* Segmented RDB files, see rdb-segments.cpp */
+class rdbSegmentLoader;
+int rdbSaveSegments(rio *rdb, int csegments);
+rdbSegmentLoader *rdbSegmentLoaderCreate(bool fCheckOnly, bool fDropExpired, long long lru_clock, bool fForceSetKey);
+int rdbSegmentLoaderFeed(rdbSegmentLoader *loader, rio *rdb);
+int rdbSegmentLoaderFinish(rdbSegmentLoader *loader, rio *rdb);
+const char *rdbSegmentLoaderError(rdbSegmentLoader *loader);
+void rdbSegmentLoaderGetStats(rdbSegmentLoader *loader, unsigned long *keys,
+        unsigned long *expires, unsigned long *already_expired);
+void rdbSegmentLoaderRelease(rdbSegmentLoader *loader);
 rdbSaveInfo *rdbPopulateSaveInfo(rdbSaveInfo *rsi);
 
 #endif
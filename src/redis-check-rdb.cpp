@@ -58,6 +58,7 @@ struct {
 #define RDB_CHECK_DOING_CHECK_SUM 5
 #define RDB_CHECK_DOING_READ_LEN 6
 #define RDB_CHECK_DOING_READ_AUX 7
+#define RDB_CHECK_DOING_READ_SEGMENT 8
 
 const char *rdb_check_doing_string[] = {
     "start",
@@ -67,7 +68,8 @@ const char *rdb_check_doing_string[] = {
     "read-object-value",
     "check-sum",
     "read-len",
-    "read-aux"
+    "read-aux",
+    "read-segment"
 };
 
 const char *rdb_type_string[] = {
@@ -85,7 +87,10 @@ const char *rdb_type_string[] = {
     "zset-ziplist",
     "hash-ziplist",
     "quicklist",
-    "stream"
+    "stream",
+    "hash-listpack",
+    "zset-listpack",
+    "set-roaring"
 };
 
 /* Show a few stats collected into 'rdbstate' */
@@ -182,12 +187,14 @@ int redis_check_rdb(const char *rdbfilename, FILE *fp) {
     char buf[1024];
     long long expiretime, now = mstime();
     static rio rdb; /* Pointed by global struct riostate. */
+    rdbSegmentLoader *segments = nullptr;
 
     int closefile = (fp == NULL);
     if (fp == NULL && (fp = fopen(rdbfilename,"r")) == NULL) return 1;
 
     rioInitWithFile(&rdb,fp);
     rdbstate.rio = &rdb;
+    rdbSetZstdLoadDictionary(NULL,0);
     rdb.update_cksum = rdbLoadProgressCallback;
     if (rioRead(&rdb,buf,9) == 0) goto eoferr;
     buf[9] = '\0';
@@ -254,6 +261,27 @@ int redis_check_rdb(const char *rdbfilename, FILE *fp) {
             if ((expires_size = rdbLoadLen(&rdb,NULL)) == RDB_LENERR)
                 goto eoferr;
             continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_SEGMENT) {
+            /* SEGMENT: a chunk of a segment, parsed by a thread. */
+            rdbstate.doing = RDB_CHECK_DOING_READ_SEGMENT;
+            if (segments == nullptr)
+                segments = rdbSegmentLoaderCreate(true,false,0,false);
+            if (rdbSegmentLoaderFeed(segments,&rdb) == C_ERR) goto segerr;
+            continue; /* Read type again. */
+        } else if (type == RDB_OPCODE_SEGMENT_MANIFEST) {
+            /* SEGMENT_MANIFEST: check the segments against it. */
+            unsigned long keys, expires, already_expired;
+            rdbstate.doing = RDB_CHECK_DOING_READ_SEGMENT;
+            if (segments == nullptr)
+                segments = rdbSegmentLoaderCreate(true,false,0,false);
+            if (rdbSegmentLoaderFinish(segments,&rdb) == C_ERR) goto segerr;
+            rdbSegmentLoaderGetStats(segments,&keys,&expires,&already_expired);
+            rdbstate.keys += keys;
+            rdbstate.expires += expires;
+            rdbstate.already_expired += already_expired;
+            rdbSegmentLoaderRelease(segments);
+            segments = nullptr;
+            continue; /* Read type again. */
         } else if (type == RDB_OPCODE_AUX) {
             /* AUX: generic string-string fields. Use to add state to RDB
              * which is backward compatible. Implementations of RDB loading
@@ -265,14 +293,29 @@ int redis_check_rdb(const char *rdbfilename, FILE *fp) {
             if ((auxkey = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
             if ((auxval = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
 
-            rdbCheckInfo("AUX FIELD %s = '%s'",
-                (char*)ptrFromObj(auxkey), (char*)ptrFromObj(auxval));
+            if (!strcasecmp(szFromObj(auxkey),"zstd-dict")) {
+                /* The values that follow are compressed with it */
+                rdbCheckInfo("AUX FIELD zstd-dict of %zu bytes",
+                    sdslen(szFromObj(auxval)));
+                if (rdbSetZstdLoadDictionary(ptrFromObj(auxval),
+                        sdslen(szFromObj(auxval))) == -1)
+                {
+                    rdbCheckError("Can't use the zstd dictionary");
+                    decrRefCount(auxkey);
+                    decrRefCount(auxval);
+                    goto err;
+                }
+            } else {
+                rdbCheckInfo("AUX FIELD %s = '%s'",
+                    (char*)ptrFromObj(auxkey), (char*)ptrFromObj(auxval));
+            }
             decrRefCount(auxkey);
             decrRefCount(auxval);
             continue; /* Read type again. */
         } else {
             if (!rdbIsObjectType(type)) {
-                rdbCheckError("Invalid object type: %d", type);
+                rdbCheckError("Unknown opcode or object type: %d (saved by "
+                    "a newer or an incompatible server?)", type);
                 goto err;
             }
             rdbstate.key_type = type;
@@ -296,6 +339,10 @@ int redis_check_rdb(const char *rdbfilename, FILE *fp) {
         rdbstate.key_type = -1;
         expiretime = -1;
     }
+    if (segments != nullptr) {
+        rdbCheckError("RDB segments without a manifest");
+        goto err;
+    }
     /* Verify the checksum if RDB version is >= 5 */
     if (rdbver >= 5 && g_pserver->rdb_checksum) {
         uint64_t cksum, expected = rdb.cksum;
@@ -313,9 +360,15 @@ int redis_check_rdb(const char *rdbfilename, FILE *fp) {
         }
     }
 
+    rdbSetZstdLoadDictionary(NULL,0);
     if (closefile) fclose(fp);
     return 0;
 
+segerr: /* an invalid segment, or a short read */
+    if (rdbSegmentLoaderError(segments) != nullptr) {
+        rdbCheckError("%s", rdbSegmentLoaderError(segments));
+        goto err;
+    }
 eoferr: /* unexpected end of file is handled here with a fatal exit */
     if (rdbstate.error_set) {
         rdbCheckError(rdbstate.error);
@@ -323,6 +376,8 @@ eoferr: /* unexpected end of file is handled here with a fatal exit */
         rdbCheckError("Unexpected EOF reading RDB file");
     }
 err:
+    if (segments != nullptr) rdbSegmentLoaderRelease(segments);
+    rdbSetZstdLoadDictionary(NULL,0);
     if (closefile) fclose(fp);
     return 1;
 }
@@ -189,7 +189,7 @@ void freeReplicationBacklog(void) {
  * g_pserver->master_repl_offset, because there is no case where we want to feed
  * the backlog without incrementing the offset. */
 void feedReplicationBacklog(const void *ptr, size_t len) {
-    serverAssert(GlobalLocksAcquired());
+    serverAssert(CommandLocksAcquired());
     const unsigned char *p = (const unsigned char*)ptr;
 
     g_pserver->master_repl_offset += len;
@@ -287,7 +287,7 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc) {
     listNode *ln, *lnReply;
     listIter li, liReply;
     int j, len;
-    serverAssert(GlobalLocksAcquired());
+    serverAssert(CommandLocksAcquired());
     if (dictid < 0)
         dictid = 0; // this can happen if we send a PING before any real operation
 
@@ -858,7 +858,7 @@ void syncCommand(client *c) {
     }
 
     /* CASE 1: BGSAVE is in progress, with disk target. */
-    if (g_pserver->rdb_child_pid != -1 &&
+    if (rdbSaveInProgress() &&
         g_pserver->rdb_child_type == RDB_CHILD_TYPE_DISK)
     {
         /* Ok a background save is in progress. Let's check if it is a good
@@ -889,7 +889,7 @@ void syncCommand(client *c) {
         }
 
     /* CASE 2: BGSAVE is in progress, with socket target. */
-    } else if (g_pserver->rdb_child_pid != -1 &&
+    } else if (rdbSaveInProgress() &&
                g_pserver->rdb_child_type == RDB_CHILD_TYPE_SOCKET)
     {
         /* There is an RDB child process but it is writing directly to
@@ -1518,6 +1518,12 @@ void readSyncBulkPayload(aeEventLoop *el, int fd, void *privdata, int mask) {
                 "any race",
                     (long) g_pserver->rdb_child_pid);
             killRDBChild();
+        } else if (g_pserver->rdb_forkless_save != nullptr) {
+            serverLog(LL_NOTICE,
+                "Replica is about to load the RDB file received from the "
+                "master, but there is a pending fork-less BGSAVE running. "
+                "Aborting it to avoid any race");
+            killRDBChild();
         }
 
         const char *rdb_filename = mi->repl_transfer_tmpfile;
@@ -2664,7 +2670,7 @@ void replicationResurrectCachedMaster(redisMaster *mi, int newfd) {
 
     /* Re-add to the list of clients. */
     linkClient(mi->master);
-    if (aeCreateFileEvent(g_pserver->rgthreadvar[mi->master->iel].el, newfd, AE_READABLE|AE_READ_THREADSAFE,
+    if (aeCreateFileEvent(g_pserver->rgthreadvar[mi->master->iel].el, newfd, AE_READABLE|AE_READ_THREADSAFE|AE_READ_BUFFERED,
                           readQueryFromClient, mi->master)) {
         serverLog(LL_WARNING,"Error resurrecting the cached master, impossible to add the readable handler: %s", strerror(errno));
         freeClientAsync(mi->master); /* Close ASAP. */
@@ -3143,7 +3149,7 @@ void replicationCron(void) {
     * In case of diskless replication, we make sure to wait the specified
     * number of seconds (according to configuration) so that other slaves
     * have the time to arrive before we start streaming. */
-    if (g_pserver->rdb_child_pid == -1 && g_pserver->aof_child_pid == -1) {
+    if (!rdbSaveInProgress() && g_pserver->aof_child_pid == -1) {
         time_t idle, max_idle = 0;
         int slaves_waiting = 0;
         int mincapa = -1;
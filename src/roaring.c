@@ -0,0 +1,991 @@
+/* Roaring bitmap -- a compressed set of signed 64 bit integers.
+ *
+ * See roaring.h for the overall layout. Array containers hold at most
+ * ROARING_ARRAY_MAX values, at which point they take 8k as an array and
+ * switching to a bitmap stops costing memory. Bitmap containers only turn
+ * back into arrays once they shrink to half that size, so a container that
+ * hovers around the threshold does not flip encoding on every add/remove.
+ * The set operations always produce the smaller representation.
+ */
+
+#include "fmacros.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "roaring.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+#define ROARING_BITMAP_BYTES (ROARING_BITMAP_WORDS*sizeof(uint64_t))
+#define ROARING_BITMAP_BITS (ROARING_BITMAP_WORDS*64)
+#define ROARING_RANDOM_SAMPLES 16
+
+/* Bitmap containers are combined a whole 1024 word block at a time. When the
+ * toolchain supports function multiversioning we build AVX2 and POPCNT clones
+ * of those loops and let the dynamic loader pick the best one at startup. */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && defined(__GLIBC__)
+#define ROARING_KERNEL __attribute__((target_clones("avx2","popcnt","default")))
+#else
+#define ROARING_KERNEL
+#endif
+
+/* Flipping the sign bit maps signed values to unsigned ones with the same
+ * order, so containers and their contents sort like the original values. */
+#define ROARING_SIGN_BIT (1ULL<<63)
+
+static inline uint64_t roaringKey(int64_t value) {
+    return ((uint64_t)value ^ ROARING_SIGN_BIT) >> 16;
+}
+
+static inline uint16_t roaringLow(int64_t value) {
+    return (uint16_t)((uint64_t)value & 0xffff);
+}
+
+static inline int64_t roaringValue(uint64_t key, uint16_t low) {
+    return (int64_t)(((key << 16) | low) ^ ROARING_SIGN_BIT);
+}
+
+/*-----------------------------------------------------------------------------
+ * Container level helpers
+ *----------------------------------------------------------------------------*/
+
+static inline int bitmapTest(const uint64_t *b, uint16_t low) {
+    return (b[low >> 6] >> (low & 63)) & 1;
+}
+
+static inline void bitmapSet(uint64_t *b, uint16_t low) {
+    b[low >> 6] |= 1ULL << (low & 63);
+}
+
+static inline void bitmapClear(uint64_t *b, uint16_t low) {
+    b[low >> 6] &= ~(1ULL << (low & 63));
+}
+
+ROARING_KERNEL static uint32_t bitmapCount(const uint64_t *b) {
+    uint32_t card = 0;
+    for (int i = 0; i < ROARING_BITMAP_WORDS; i++)
+        card += __builtin_popcountll(b[i]);
+    return card;
+}
+
+ROARING_KERNEL static uint32_t bitmapAnd(uint64_t *dst, const uint64_t *src) {
+    uint32_t card = 0;
+    for (int i = 0; i < ROARING_BITMAP_WORDS; i++) {
+        dst[i] &= src[i];
+        card += __builtin_popcountll(dst[i]);
+    }
+    return card;
+}
+
+ROARING_KERNEL static uint32_t bitmapOr(uint64_t *dst, const uint64_t *src) {
+    uint32_t card = 0;
+    for (int i = 0; i < ROARING_BITMAP_WORDS; i++) {
+        dst[i] |= src[i];
+        card += __builtin_popcountll(dst[i]);
+    }
+    return card;
+}
+
+ROARING_KERNEL static uint32_t bitmapAndNot(uint64_t *dst, const uint64_t *src) {
+    uint32_t card = 0;
+    for (int i = 0; i < ROARING_BITMAP_WORDS; i++) {
+        dst[i] &= ~src[i];
+        card += __builtin_popcountll(dst[i]);
+    }
+    return card;
+}
+
+/* Return the position of the first element >= low. */
+static uint32_t arrayLowerBound(const uint16_t *a, uint32_t card, uint16_t low) {
+    uint32_t lo = 0, hi = card;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (a[mid] < low) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Merge helpers for two sorted arrays. 'out' may alias 'a' for the
+ * intersection and the difference, since they never write ahead of the
+ * element they are reading. */
+static uint32_t arrayIntersect(const uint16_t *a, uint32_t na,
+                               const uint16_t *b, uint32_t nb, uint16_t *out)
+{
+    uint32_t i = 0, j = 0, n = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) i++;
+        else if (a[i] > b[j]) j++;
+        else out[n++] = a[i++], j++;
+    }
+    return n;
+}
+
+static uint32_t arrayDifference(const uint16_t *a, uint32_t na,
+                                const uint16_t *b, uint32_t nb, uint16_t *out)
+{
+    uint32_t i = 0, j = 0, n = 0;
+    while (i < na) {
+        if (j == nb || a[i] < b[j]) out[n++] = a[i++];
+        else if (a[i] > b[j]) j++;
+        else i++, j++;
+    }
+    return n;
+}
+
+static uint32_t arrayUnion(const uint16_t *a, uint32_t na,
+                           const uint16_t *b, uint32_t nb, uint16_t *out)
+{
+    uint32_t i = 0, j = 0, n = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) out[n++] = a[i++];
+        else if (a[i] > b[j]) out[n++] = b[j++];
+        else out[n++] = a[i++], j++;
+    }
+    while (i < na) out[n++] = a[i++];
+    while (j < nb) out[n++] = b[j++];
+    return n;
+}
+
+static void containerToBitmap(roaringContainer *c) {
+    uint64_t *b = zcalloc(ROARING_BITMAP_BYTES, MALLOC_SHARED);
+    uint16_t *a = c->data;
+    for (uint32_t i = 0; i < c->card; i++) bitmapSet(b,a[i]);
+    zfree(a);
+    c->data = b;
+    c->type = ROARING_BITMAP;
+}
+
+static void containerToArray(roaringContainer *c) {
+    uint16_t *a = zmalloc(sizeof(uint16_t)*c->card, MALLOC_SHARED);
+    uint64_t *b = c->data;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < ROARING_BITMAP_WORDS; i++) {
+        uint64_t w = b[i];
+        while (w) {
+            a[n++] = (uint16_t)(i*64 + __builtin_ctzll(w));
+            w &= w - 1;
+        }
+    }
+    zfree(b);
+    c->data = a;
+    c->type = ROARING_ARRAY;
+}
+
+/* Release the unused tail of an array container after it shrank. Empty
+ * containers are left alone, the caller is going to drop them. */
+static void containerShrink(roaringContainer *c) {
+    if (c->type == ROARING_ARRAY) {
+        if (c->card)
+            c->data = zrealloc(c->data, sizeof(uint16_t)*c->card, MALLOC_SHARED);
+    } else if (c->card && c->card <= ROARING_ARRAY_MAX) {
+        containerToArray(c);
+    }
+}
+
+static size_t containerDataSize(const roaringContainer *c) {
+    return c->type == ROARING_ARRAY ? sizeof(uint16_t)*c->card :
+                                      ROARING_BITMAP_BYTES;
+}
+
+static void containerCopy(roaringContainer *dst, const roaringContainer *src) {
+    size_t size = containerDataSize(src);
+    *dst = *src;
+    dst->data = zmalloc(size, MALLOC_SHARED);
+    memcpy(dst->data, src->data, size);
+}
+
+/* Return the value of the given rank (0 based) inside the container. */
+static uint16_t containerSelect(const roaringContainer *c, uint32_t rank) {
+    if (c->type == ROARING_ARRAY) return ((uint16_t*)c->data)[rank];
+
+    const uint64_t *b = c->data;
+    for (uint32_t i = 0; i < ROARING_BITMAP_WORDS; i++) {
+        uint32_t n = __builtin_popcountll(b[i]);
+        if (rank < n) {
+            uint64_t w = b[i];
+            while (rank--) w &= w - 1;
+            return (uint16_t)(i*64 + __builtin_ctzll(w));
+        }
+        rank -= n;
+    }
+    return 0; /* Not reached if rank < card. */
+}
+
+/* c &= o. The result may be empty. */
+static void containerAnd(roaringContainer *c, const roaringContainer *o) {
+    if (c->type == ROARING_ARRAY) {
+        uint16_t *a = c->data;
+        uint32_t n = 0;
+        if (o->type == ROARING_ARRAY) {
+            n = arrayIntersect(a,c->card,o->data,o->card,a);
+        } else {
+            for (uint32_t i = 0; i < c->card; i++)
+                if (bitmapTest(o->data,a[i])) a[n++] = a[i];
+        }
+        c->card = n;
+    } else if (o->type == ROARING_ARRAY) {
+        /* The result is a subset of the array, so it is an array too. */
+        const uint16_t *oa = o->data;
+        uint16_t *a = zmalloc(sizeof(uint16_t)*o->card, MALLOC_SHARED);
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < o->card; i++)
+            if (bitmapTest(c->data,oa[i])) a[n++] = oa[i];
+        zfree(c->data);
+        c->data = a;
+        c->type = ROARING_ARRAY;
+        c->card = n;
+    } else {
+        c->card = bitmapAnd(c->data,o->data);
+    }
+    containerShrink(c);
+}
+
+/* c |= o. */
+static void containerOr(roaringContainer *c, const roaringContainer *o) {
+    if (c->type == ROARING_ARRAY && o->type == ROARING_ARRAY) {
+        if (c->card + o->card <= ROARING_ARRAY_MAX) {
+            uint16_t *a = zmalloc(sizeof(uint16_t)*(c->card+o->card), MALLOC_SHARED);
+            c->card = arrayUnion(c->data,c->card,o->data,o->card,a);
+            zfree(c->data);
+            c->data = a;
+            containerShrink(c);
+            return;
+        }
+        containerToBitmap(c);
+    }
+
+    if (c->type == ROARING_ARRAY) {
+        const uint16_t *a = c->data;
+        uint64_t *b = zmalloc(ROARING_BITMAP_BYTES, MALLOC_SHARED);
+        memcpy(b,o->data,ROARING_BITMAP_BYTES);
+        for (uint32_t i = 0; i < c->card; i++) bitmapSet(b,a[i]);
+        zfree(c->data);
+        c->data = b;
+        c->type = ROARING_BITMAP;
+        c->card = bitmapCount(b);
+    } else if (o->type == ROARING_ARRAY) {
+        const uint16_t *a = o->data;
+        for (uint32_t i = 0; i < o->card; i++) {
+            if (!bitmapTest(c->data,a[i])) {
+                bitmapSet(c->data,a[i]);
+                c->card++;
+            }
+        }
+    } else {
+        c->card = bitmapOr(c->data,o->data);
+    }
+    containerShrink(c);
+}
+
+/* c &= ~o. The result may be empty. */
+static void containerAndNot(roaringContainer *c, const roaringContainer *o) {
+    if (c->type == ROARING_ARRAY) {
+        uint16_t *a = c->data;
+        uint32_t n = 0;
+        if (o->type == ROARING_ARRAY) {
+            n = arrayDifference(a,c->card,o->data,o->card,a);
+        } else {
+            for (uint32_t i = 0; i < c->card; i++)
+                if (!bitmapTest(o->data,a[i])) a[n++] = a[i];
+        }
+        c->card = n;
+    } else if (o->type == ROARING_ARRAY) {
+        const uint16_t *a = o->data;
+        for (uint32_t i = 0; i < o->card; i++) {
+            if (bitmapTest(c->data,a[i])) {
+                bitmapClear(c->data,a[i]);
+                c->card--;
+            }
+        }
+    } else {
+        c->card = bitmapAndNot(c->data,o->data);
+    }
+    containerShrink(c);
+}
+
+/*-----------------------------------------------------------------------------
+ * Container array handling
+ *----------------------------------------------------------------------------*/
+
+/* Return the index of the first container with a key >= 'key'. */
+static uint32_t roaringLowerBound(const roaring *r, uint64_t key) {
+    uint32_t lo = 0, hi = r->len;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (r->containers[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Like roaringLowerBound() but starting from 'from', galloping forward so
+ * that walking a small bitmap against a huge one stays cheap. */
+static uint32_t roaringSeek(const roaring *r, uint32_t from, uint64_t key) {
+    uint32_t lo = from, step = 1, hi;
+    while (lo + step < r->len && r->containers[lo+step].key < key) {
+        lo += step;
+        step *= 2;
+    }
+    hi = lo + step < r->len ? lo + step + 1 : r->len;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (r->containers[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static roaringContainer *roaringInsertContainer(roaring *r, uint32_t idx, uint64_t key) {
+    roaringContainer *c;
+
+    if (r->len == r->alloc) {
+        r->alloc = r->alloc ? r->alloc*2 : 4;
+        r->containers = zrealloc(r->containers,
+            sizeof(roaringContainer)*r->alloc, MALLOC_SHARED);
+    }
+    memmove(r->containers+idx+1, r->containers+idx,
+            sizeof(roaringContainer)*(r->len-idx));
+    r->len++;
+    c = r->containers+idx;
+    c->key = key;
+    c->card = 0;
+    c->type = ROARING_ARRAY;
+    c->data = NULL;
+    return c;
+}
+
+/* Give back container slots once the array is mostly empty. */
+static void roaringShrinkContainers(roaring *r) {
+    if (r->alloc > 4 && r->len < r->alloc/4) {
+        r->alloc = r->len > 4 ? r->len : 4;
+        r->containers = zrealloc(r->containers,
+            sizeof(roaringContainer)*r->alloc, MALLOC_SHARED);
+    }
+}
+
+static void roaringDeleteContainer(roaring *r, uint32_t idx) {
+    zfree(r->containers[idx].data);
+    memmove(r->containers+idx, r->containers+idx+1,
+            sizeof(roaringContainer)*(r->len-idx-1));
+    r->len--;
+    roaringShrinkContainers(r);
+}
+
+/*-----------------------------------------------------------------------------
+ * Public API
+ *----------------------------------------------------------------------------*/
+
+roaring *roaringNew(void) {
+    roaring *r = zmalloc(sizeof(*r), MALLOC_SHARED);
+    r->card = 0;
+    r->len = 0;
+    r->alloc = 0;
+    r->containers = NULL;
+    return r;
+}
+
+void roaringFree(roaring *r) {
+    for (uint32_t i = 0; i < r->len; i++) zfree(r->containers[i].data);
+    zfree(r->containers);
+    zfree(r);
+}
+
+roaring *roaringDup(const roaring *r) {
+    roaring *d = roaringNew();
+    if (r->len) {
+        d->containers = zmalloc(sizeof(roaringContainer)*r->len, MALLOC_SHARED);
+        d->alloc = r->len;
+        for (uint32_t i = 0; i < r->len; i++)
+            containerCopy(d->containers+i, r->containers+i);
+    }
+    d->len = r->len;
+    d->card = r->card;
+    return d;
+}
+
+/* Add 'value'. Returns 1 if it was added, 0 if it was already a member. */
+int roaringAdd(roaring *r, int64_t value) {
+    uint64_t key = roaringKey(value);
+    uint16_t low = roaringLow(value);
+    uint32_t idx = roaringLowerBound(r,key);
+    roaringContainer *c;
+
+    if (idx == r->len || r->containers[idx].key != key)
+        c = roaringInsertContainer(r,idx,key);
+    else
+        c = r->containers+idx;
+
+    if (c->type == ROARING_ARRAY) {
+        uint16_t *a = c->data;
+        uint32_t pos = arrayLowerBound(a,c->card,low);
+        if (pos < c->card && a[pos] == low) return 0;
+        if (c->card < ROARING_ARRAY_MAX) {
+            a = zrealloc(a, sizeof(uint16_t)*(c->card+1), MALLOC_SHARED);
+            memmove(a+pos+1, a+pos, sizeof(uint16_t)*(c->card-pos));
+            a[pos] = low;
+            c->data = a;
+            c->card++;
+            r->card++;
+            return 1;
+        }
+        containerToBitmap(c);
+    }
+
+    if (bitmapTest(c->data,low)) return 0;
+    bitmapSet(c->data,low);
+    c->card++;
+    r->card++;
+    return 1;
+}
+
+/* Remove 'value'. Returns 1 if it was removed, 0 if it was not a member. */
+int roaringRemove(roaring *r, int64_t value) {
+    uint64_t key = roaringKey(value);
+    uint16_t low = roaringLow(value);
+    uint32_t idx = roaringLowerBound(r,key);
+    roaringContainer *c;
+
+    if (idx == r->len || r->containers[idx].key != key) return 0;
+    c = r->containers+idx;
+
+    if (c->type == ROARING_ARRAY) {
+        uint16_t *a = c->data;
+        uint32_t pos = arrayLowerBound(a,c->card,low);
+        if (pos == c->card || a[pos] != low) return 0;
+        memmove(a+pos, a+pos+1, sizeof(uint16_t)*(c->card-pos-1));
+        c->card--;
+        if (c->card == 0)
+            roaringDeleteContainer(r,idx);
+        else
+            containerShrink(c);
+    } else {
+        if (!bitmapTest(c->data,low)) return 0;
+        bitmapClear(c->data,low);
+        c->card--;
+        if (c->card <= ROARING_ARRAY_MAX/2) containerToArray(c);
+    }
+    r->card--;
+    return 1;
+}
+
+int roaringContains(const roaring *r, int64_t value) {
+    uint64_t key = roaringKey(value);
+    uint16_t low = roaringLow(value);
+    uint32_t idx = roaringLowerBound(r,key);
+    const roaringContainer *c;
+
+    if (idx == r->len || r->containers[idx].key != key) return 0;
+    c = r->containers+idx;
+    if (c->type == ROARING_ARRAY) {
+        const uint16_t *a = c->data;
+        uint32_t pos = arrayLowerBound(a,c->card,low);
+        return pos < c->card && a[pos] == low;
+    }
+    return bitmapTest(c->data,low);
+}
+
+uint64_t roaringCard(const roaring *r) {
+    return r->card;
+}
+
+static uint64_t roaringRandomULL(void) {
+    return ((uint64_t)random() << 32) ^ (uint64_t)random();
+}
+
+/* Return a random member of a non empty bitmap.
+ *
+ * With few containers we pick a uniformly random rank. Otherwise finding the
+ * container holding a given rank would be O(N), so we sample a few containers
+ * and choose among them weighted by cardinality. This favours members of
+ * dense containers less than a perfectly fair pick would, much like
+ * dictGetFairRandomKey() is only approximately fair. */
+int64_t roaringRandom(const roaring *r) {
+    const roaringContainer *c = r->containers;
+    uint64_t rank;
+
+    if (r->len <= ROARING_RANDOM_SAMPLES) {
+        rank = roaringRandomULL() % r->card;
+        while (rank >= c->card) rank -= (c++)->card;
+    } else {
+        const roaringContainer *samples[ROARING_RANDOM_SAMPLES];
+        uint64_t total = 0;
+        int j;
+
+        for (j = 0; j < ROARING_RANDOM_SAMPLES; j++) {
+            samples[j] = r->containers + roaringRandomULL() % r->len;
+            total += samples[j]->card;
+        }
+        rank = roaringRandomULL() % total;
+        for (j = 0; rank >= samples[j]->card; j++) rank -= samples[j]->card;
+        c = samples[j];
+    }
+    return roaringValue(c->key,containerSelect(c,(uint32_t)rank));
+}
+
+/* dst = dst AND src */
+void roaringAnd(roaring *dst, const roaring *src) {
+    uint32_t i, j = 0, n = 0;
+    uint64_t card = 0;
+
+    for (i = 0; i < dst->len; i++) {
+        roaringContainer *c = dst->containers+i;
+
+        j = roaringSeek(src,j,c->key);
+        if (j < src->len && src->containers[j].key == c->key)
+            containerAnd(c,src->containers+j);
+        else
+            c->card = 0;
+
+        if (c->card == 0) {
+            zfree(c->data);
+            continue;
+        }
+        card += c->card;
+        dst->containers[n++] = *c;
+    }
+    dst->len = n;
+    dst->card = card;
+    roaringShrinkContainers(dst);
+}
+
+/* dst = dst OR src */
+void roaringOr(roaring *dst, const roaring *src) {
+    uint32_t i = 0, j = 0, n = 0, alloc = dst->len + src->len;
+    uint64_t card = 0;
+    roaringContainer *out;
+
+    if (src->len == 0) return;
+    out = zmalloc(sizeof(roaringContainer)*alloc, MALLOC_SHARED);
+    while (i < dst->len || j < src->len) {
+        if (j == src->len ||
+            (i < dst->len && dst->containers[i].key < src->containers[j].key))
+        {
+            out[n] = dst->containers[i++];
+        } else if (i == dst->len ||
+                   src->containers[j].key < dst->containers[i].key)
+        {
+            containerCopy(out+n,src->containers+j++);
+        } else {
+            out[n] = dst->containers[i++];
+            containerOr(out+n,src->containers+j++);
+        }
+        card += out[n++].card;
+    }
+    zfree(dst->containers);
+    dst->containers = out;
+    dst->alloc = alloc;
+    dst->len = n;
+    dst->card = card;
+}
+
+/* dst = dst AND NOT src */
+void roaringAndNot(roaring *dst, const roaring *src) {
+    uint32_t i, j = 0, n = 0;
+    uint64_t card = 0;
+
+    for (i = 0; i < dst->len; i++) {
+        roaringContainer *c = dst->containers+i;
+
+        j = roaringSeek(src,j,c->key);
+        if (j < src->len && src->containers[j].key == c->key)
+            containerAndNot(c,src->containers+j);
+
+        if (c->card == 0) {
+            zfree(c->data);
+            continue;
+        }
+        card += c->card;
+        dst->containers[n++] = *c;
+    }
+    dst->len = n;
+    dst->card = card;
+    roaringShrinkContainers(dst);
+}
+
+/* Iterate the members in ascending order. The bitmap must not be modified
+ * while iterating. */
+void roaringIterInit(roaringIterator *it, const roaring *r) {
+    it->r = r;
+    it->ci = 0;
+    it->pos = 0;
+}
+
+/* Position the iterator so that the next member returned is the smallest
+ * one >= 'value'. */
+void roaringIterSeek(roaringIterator *it, int64_t value) {
+    uint64_t key = roaringKey(value);
+    uint16_t low = roaringLow(value);
+    const roaringContainer *c;
+
+    it->ci = roaringLowerBound(it->r,key);
+    it->pos = 0;
+    if (it->ci == it->r->len) return;
+    c = it->r->containers+it->ci;
+    if (c->key != key) return;
+    if (c->type == ROARING_ARRAY)
+        it->pos = arrayLowerBound(c->data,c->card,low);
+    else
+        it->pos = low;
+}
+
+int roaringIterNext(roaringIterator *it, int64_t *value) {
+    while (it->ci < it->r->len) {
+        const roaringContainer *c = it->r->containers+it->ci;
+
+        if (c->type == ROARING_ARRAY) {
+            if (it->pos < c->card) {
+                *value = roaringValue(c->key,((uint16_t*)c->data)[it->pos++]);
+                return 1;
+            }
+        } else if (it->pos < ROARING_BITMAP_BITS) {
+            const uint64_t *b = c->data;
+            uint32_t w = it->pos >> 6;
+            uint64_t word = b[w] & (~0ULL << (it->pos & 63));
+
+            while (word == 0 && ++w < ROARING_BITMAP_WORDS) word = b[w];
+            if (word) {
+                uint32_t bit = w*64 + __builtin_ctzll(word);
+                it->pos = bit + 1;
+                *value = roaringValue(c->key,(uint16_t)bit);
+                return 1;
+            }
+        }
+        it->ci++;
+        it->pos = 0;
+    }
+    return 0;
+}
+
+/* Return the number of bytes allocated for the bitmap. */
+size_t roaringAllocSize(const roaring *r) {
+    size_t size = sizeof(*r) + sizeof(roaringContainer)*r->alloc;
+    for (uint32_t i = 0; i < r->len; i++)
+        size += containerDataSize(r->containers+i);
+    return size;
+}
+
+/*-----------------------------------------------------------------------------
+ * Serialization
+ *
+ * All the integers are little endian:
+ *
+ *   <containers:u32> { <key:u64> <card:u32> <type:u8> <payload> } ...
+ *
+ * where the payload is 'card' u16 values for array containers and
+ * ROARING_BITMAP_WORDS u64 words for bitmap containers.
+ *----------------------------------------------------------------------------*/
+
+#define ROARING_BLOB_HDR_SIZE 4
+#define ROARING_BLOB_CONTAINER_HDR_SIZE 13
+
+size_t roaringBlobLen(const roaring *r) {
+    size_t len = ROARING_BLOB_HDR_SIZE + ROARING_BLOB_CONTAINER_HDR_SIZE*r->len;
+    for (uint32_t i = 0; i < r->len; i++)
+        len += containerDataSize(r->containers+i);
+    return len;
+}
+
+/* Write the serialized bitmap to 'buf', which must be roaringBlobLen() bytes
+ * long. */
+void roaringSerialize(const roaring *r, unsigned char *buf) {
+    uint32_t len = intrev32ifbe(r->len);
+
+    memcpy(buf,&len,sizeof(len));
+    buf += sizeof(len);
+    for (uint32_t i = 0; i < r->len; i++) {
+        const roaringContainer *c = r->containers+i;
+        uint64_t key = intrev64ifbe(c->key);
+        uint32_t card = intrev32ifbe(c->card);
+        size_t size = containerDataSize(c);
+
+        memcpy(buf,&key,sizeof(key));
+        memcpy(buf+8,&card,sizeof(card));
+        buf[12] = (unsigned char)c->type;
+        buf += ROARING_BLOB_CONTAINER_HDR_SIZE;
+        memcpy(buf,c->data,size);
+#if (BYTE_ORDER == BIG_ENDIAN)
+        if (c->type == ROARING_ARRAY) {
+            for (uint32_t j = 0; j < c->card; j++) memrev16(buf+j*2);
+        } else {
+            for (uint32_t j = 0; j < ROARING_BITMAP_WORDS; j++) memrev64(buf+j*8);
+        }
+#endif
+        buf += size;
+    }
+}
+
+/* Load a bitmap written by roaringSerialize(). The blob is fully validated,
+ * NULL is returned if it is truncated or inconsistent. */
+roaring *roaringDeserialize(const unsigned char *buf, size_t len) {
+    const unsigned char *p = buf, *end = buf + len;
+    uint32_t count;
+    roaring *r;
+
+    if (len < ROARING_BLOB_HDR_SIZE) return NULL;
+    memcpy(&count,p,sizeof(count));
+    count = intrev32ifbe(count);
+    p += ROARING_BLOB_HDR_SIZE;
+    if (count > (len-ROARING_BLOB_HDR_SIZE)/ROARING_BLOB_CONTAINER_HDR_SIZE)
+        return NULL;
+
+    r = roaringNew();
+    if (count) {
+        r->containers = zmalloc(sizeof(roaringContainer)*count, MALLOC_SHARED);
+        r->alloc = count;
+    }
+    while (r->len < count) {
+        roaringContainer *c = r->containers+r->len;
+        uint64_t key;
+        uint32_t card;
+        unsigned char type;
+        size_t size;
+
+        if ((size_t)(end-p) < ROARING_BLOB_CONTAINER_HDR_SIZE) goto err;
+        memcpy(&key,p,sizeof(key));
+        memcpy(&card,p+8,sizeof(card));
+        key = intrev64ifbe(key);
+        card = intrev32ifbe(card);
+        type = p[12];
+        p += ROARING_BLOB_CONTAINER_HDR_SIZE;
+
+        if (key > (UINT64_MAX >> 16)) goto err;
+        if (r->len && key <= c[-1].key) goto err;
+        if (card == 0) goto err;
+        if (type == ROARING_ARRAY) {
+            if (card > ROARING_ARRAY_MAX) goto err;
+            size = sizeof(uint16_t)*card;
+        } else if (type == ROARING_BITMAP) {
+            if (card > ROARING_BITMAP_BITS) goto err;
+            size = ROARING_BITMAP_BYTES;
+        } else {
+            goto err;
+        }
+        if ((size_t)(end-p) < size) goto err;
+
+        c->key = key;
+        c->card = card;
+        c->type = type;
+        c->data = zmalloc(size, MALLOC_SHARED);
+        memcpy(c->data,p,size);
+        p += size;
+        r->len++;
+
+        if (type == ROARING_ARRAY) {
+            uint16_t *a = c->data;
+            for (uint32_t j = 0; j < card; j++) {
+                a[j] = intrev16ifbe(a[j]);
+                if (j && a[j] <= a[j-1]) goto err;
+            }
+        } else {
+#if (BYTE_ORDER == BIG_ENDIAN)
+            uint64_t *b = c->data;
+            for (uint32_t j = 0; j < ROARING_BITMAP_WORDS; j++)
+                b[j] = intrev64(b[j]);
+#endif
+            if (bitmapCount(c->data) != card) goto err;
+        }
+        r->card += card;
+    }
+    if (p != end) goto err;
+    return r;
+
+err:
+    roaringFree(r);
+    return NULL;
+}
+
+#ifdef REDIS_TEST
+#include <time.h>
+
+#define assert(_e) ((_e)?(void)0:(_assert(#_e,__FILE__,__LINE__),exit(1)))
+static void _assert(char *estr, char *file, int line) {
+    printf("\n\n=== ASSERTION FAILED ===\n");
+    printf("==> %s:%d '%s' is not true\n",file,line,estr);
+}
+
+static void ok(void) {
+    printf("OK\n");
+}
+
+/* Values clustered around a few bases, so that we get a mix of sparse array
+ * containers and dense bitmap ones, with both signs. */
+static int64_t randomMember(void) {
+    static const int64_t bases[] = {
+        0, -70000, 1LL<<40, INT64_MIN, INT64_MAX-200000
+    };
+    int64_t base = bases[rand() % (sizeof(bases)/sizeof(bases[0]))];
+    uint64_t span = (rand() % 2) ? 8000 : 200000;
+    return (int64_t)((uint64_t)base + (uint64_t)(rand() % span));
+}
+
+static int cmpInt64(const void *a, const void *b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Check the bitmap against a sorted array of the values it should hold. */
+static void checkMembers(const roaring *r, const int64_t *v, uint64_t n) {
+    roaringIterator it;
+    int64_t value;
+    uint64_t i = 0, card = 0;
+
+    assert(roaringCard(r) == n);
+    roaringIterInit(&it,r);
+    while (roaringIterNext(&it,&value)) {
+        assert(i < n && v[i] == value);
+        i++;
+    }
+    assert(i == n);
+    for (uint32_t j = 0; j < r->len; j++) {
+        const roaringContainer *c = r->containers+j;
+        assert(c->card > 0);
+        assert(j == 0 || c[-1].key < c->key);
+        if (c->type == ROARING_BITMAP) assert(bitmapCount(c->data) == c->card);
+        card += c->card;
+    }
+    assert(card == n);
+}
+
+static roaring *randomBitmap(int64_t *v, uint64_t *n, int count) {
+    roaring *r = roaringNew();
+    *n = 0;
+    for (int i = 0; i < count; i++) {
+        int64_t value = randomMember();
+        if (roaringAdd(r,value)) v[(*n)++] = value;
+    }
+    qsort(v,*n,sizeof(int64_t),cmpInt64);
+    return r;
+}
+
+#define UNUSED(x) (void)(x)
+int roaringTest(int argc, char **argv) {
+    int64_t *a = zmalloc(sizeof(int64_t)*200000, MALLOC_SHARED);
+    int64_t *b = zmalloc(sizeof(int64_t)*200000, MALLOC_SHARED);
+    int64_t *x = zmalloc(sizeof(int64_t)*400000, MALLOC_SHARED);
+    uint64_t na, nb, nx, i, j;
+    roaring *ra, *rb, *rx;
+
+    UNUSED(argc);
+    UNUSED(argv);
+    srand(time(NULL));
+
+    printf("Add, contains and iterate: "); {
+        ra = randomBitmap(a,&na,100000);
+        checkMembers(ra,a,na);
+        for (i = 0; i < na; i++) assert(roaringContains(ra,a[i]));
+        assert(!roaringAdd(ra,a[0]));
+        roaringFree(ra);
+        ok();
+    }
+
+    printf("Remove until empty: "); {
+        ra = randomBitmap(a,&na,100000);
+        for (i = 0; i < na; i += 2) assert(roaringRemove(ra,a[i]));
+        for (i = 1, j = 0; i < na; i += 2) a[j++] = a[i];
+        checkMembers(ra,a,j);
+        for (i = 0; i < j; i++) assert(roaringRemove(ra,a[i]));
+        assert(!roaringRemove(ra,a[0]));
+        checkMembers(ra,a,0);
+        roaringFree(ra);
+        ok();
+    }
+
+    printf("Seek: "); {
+        roaringIterator it;
+        int64_t value;
+
+        ra = randomBitmap(a,&na,50000);
+        for (i = 0; i < 1000; i++) {
+            int64_t from = randomMember();
+            uint64_t k = 0;
+            while (k < na && a[k] < from) k++;
+            roaringIterInit(&it,ra);
+            roaringIterSeek(&it,from);
+            if (k == na) {
+                assert(!roaringIterNext(&it,&value));
+            } else {
+                assert(roaringIterNext(&it,&value) && value == a[k]);
+            }
+        }
+        roaringFree(ra);
+        ok();
+    }
+
+    printf("And, Or, AndNot against a reference: "); {
+        for (int round = 0; round < 20; round++) {
+            ra = randomBitmap(a,&na,rand() % 150000);
+            rb = randomBitmap(b,&nb,rand() % 150000);
+
+            rx = roaringDup(ra);
+            roaringAnd(rx,rb);
+            for (i = 0, j = 0, nx = 0; i < na && j < nb;) {
+                if (a[i] < b[j]) i++;
+                else if (a[i] > b[j]) j++;
+                else x[nx++] = a[i++], j++;
+            }
+            checkMembers(rx,x,nx);
+            roaringFree(rx);
+
+            rx = roaringDup(ra);
+            roaringOr(rx,rb);
+            for (i = 0, j = 0, nx = 0; i < na || j < nb;) {
+                if (j == nb || (i < na && a[i] < b[j])) x[nx++] = a[i++];
+                else if (i == na || b[j] < a[i]) x[nx++] = b[j++];
+                else x[nx++] = a[i++], j++;
+            }
+            checkMembers(rx,x,nx);
+            roaringFree(rx);
+
+            rx = roaringDup(ra);
+            roaringAndNot(rx,rb);
+            for (i = 0, j = 0, nx = 0; i < na;) {
+                if (j == nb || a[i] < b[j]) x[nx++] = a[i++];
+                else if (a[i] > b[j]) j++;
+                else i++, j++;
+            }
+            checkMembers(rx,x,nx);
+            roaringFree(rx);
+
+            roaringFree(ra);
+            roaringFree(rb);
+        }
+        ok();
+    }
+
+    printf("Random members: "); {
+        ra = randomBitmap(a,&na,100000);
+        for (i = 0; i < 10000; i++) assert(roaringContains(ra,roaringRandom(ra)));
+        roaringFree(ra);
+        ok();
+    }
+
+    printf("Serialization round trip and corruption: "); {
+        ra = randomBitmap(a,&na,100000);
+        size_t len = roaringBlobLen(ra);
+        unsigned char *blob = zmalloc(len, MALLOC_SHARED);
+        roaringSerialize(ra,blob);
+        rb = roaringDeserialize(blob,len);
+        assert(rb != NULL);
+        checkMembers(rb,a,na);
+        roaringFree(rb);
+        assert(roaringDeserialize(blob,len-1) == NULL);
+        for (i = 0; i < 1000; i++) {
+            size_t pos = rand() % len;
+            unsigned char orig = blob[pos];
+            blob[pos] ^= 1 << (rand() % 8);
+            rb = roaringDeserialize(blob,len);
+            if (rb) roaringFree(rb);
+            blob[pos] = orig;
+        }
+        zfree(blob);
+        roaringFree(ra);
+        ok();
+    }
+
+    zfree(a);
+    zfree(b);
+    zfree(x);
+    return 0;
+}
+#endif
@@ -0,0 +1,76 @@
+/* Roaring bitmap -- a compressed set of signed 64 bit integers, used to
+ * encode large sets whose members are all integers.
+ *
+ * Every value is split into a 48 bit key and a 16 bit low part. The values
+ * sharing a key are stored in one container, and the containers are kept in
+ * an array sorted by key, so lookups are two binary searches and set algebra
+ * works one container pair at a time instead of one element at a time.
+ */
+
+#ifndef __ROARING_H
+#define __ROARING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Container types. An array container keeps the low 16 bits of its values
+ * as a sorted uint16_t array, a bitmap container keeps one bit for each of
+ * the 65536 possible low values. */
+#define ROARING_ARRAY 0
+#define ROARING_BITMAP 1
+
+#define ROARING_ARRAY_MAX 4096      /* Largest array container. */
+#define ROARING_BITMAP_WORDS 1024   /* 64 bit words in a bitmap container. */
+
+typedef struct roaringContainer {
+    uint64_t key;       /* High 48 bits shared by all the values. */
+    uint32_t card;      /* Number of values, never zero. */
+    uint32_t type;      /* ROARING_ARRAY or ROARING_BITMAP. */
+    void *data;         /* uint16_t[card] or uint64_t[ROARING_BITMAP_WORDS]. */
+} roaringContainer;
+
+typedef struct roaring {
+    uint64_t card;                  /* Total number of values. */
+    uint32_t len;                   /* Containers in use. */
+    uint32_t alloc;                 /* Containers allocated. */
+    roaringContainer *containers;   /* Sorted by key. */
+} roaring;
+
+typedef struct roaringIterator {
+    const roaring *r;
+    uint32_t ci;        /* Current container. */
+    uint32_t pos;       /* Next array index, or next bit to test. */
+} roaringIterator;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+roaring *roaringNew(void);
+void roaringFree(roaring *r);
+roaring *roaringDup(const roaring *r);
+int roaringAdd(roaring *r, int64_t value);
+int roaringRemove(roaring *r, int64_t value);
+int roaringContains(const roaring *r, int64_t value);
+uint64_t roaringCard(const roaring *r);
+int64_t roaringRandom(const roaring *r);
+void roaringAnd(roaring *dst, const roaring *src);
+void roaringOr(roaring *dst, const roaring *src);
+void roaringAndNot(roaring *dst, const roaring *src);
+void roaringIterInit(roaringIterator *it, const roaring *r);
+void roaringIterSeek(roaringIterator *it, int64_t value);
+int roaringIterNext(roaringIterator *it, int64_t *value);
+size_t roaringAllocSize(const roaring *r);
+size_t roaringBlobLen(const roaring *r);
+void roaringSerialize(const roaring *r, unsigned char *buf);
+roaring *roaringDeserialize(const unsigned char *buf, size_t len);
+
+#ifdef REDIS_TEST
+int roaringTest(int argc, char *argv[]);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ROARING_H */
@@ -14,6 +14,8 @@
  */
 
 extern uint64_t dictGenHashFunction(const void *key, int len);
+extern __thread int dictNoRehashThisThread;
+extern void dictWillModify(void);
 
 template<typename T, typename T_KEY = T, bool MEMMOVE_SAFE = false>
 class semiorderedset
@@ -103,7 +105,10 @@ public:
     void insert(T &e, bool fRehash = false)
     {
         if (!fRehash)
+        {
+            dictWillModify();
             RehashStep();
+        }
 
         auto idx = idxFromObj(static_cast<T_KEY>(e));
         if (!fRehash)
@@ -187,6 +192,7 @@ public:
 
     void erase(const setiter &itr)
     {
+        dictWillModify();
         auto &vecRow = m_data[itr.idxPrimary];
         vecRow.erase(vecRow.begin() + itr.idxSecondary);
         --celem;
@@ -195,6 +201,7 @@ public:
 
     void clear()
     {
+        dictWillModify();
         m_data = decltype(m_data)();
         bits = bits_min;
         m_data.resize(1ULL << bits);
@@ -286,8 +293,10 @@ private:
 
     void RehashStep()
     {
-        if (fPauseRehash)
+        if (fPauseRehash || dictNoRehashThisThread)
             return;
+        if (idxRehash < (m_data.size()/2))
+            dictWillModify();
         
         int steps = 0;
         for (; idxRehash < (m_data.size()/2); ++idxRehash)
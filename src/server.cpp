@@ -83,6 +83,7 @@ struct redisServer server; /* Server global state */
 redisServer *g_pserver = &GlobalHidden::server;
 struct redisServerConst cserver;
 __thread struct redisServerThreadVars *serverTL = NULL;   // thread local server vars
+thread_local long long dirtycounter::s_cchangesThisThread = 0;
 volatile unsigned long lru_clock; /* Server global current LRU time. */
 
 /* Our command table.
@@ -169,6 +170,11 @@ volatile unsigned long lru_clock; /* Server global current LRU time. */
  *              us time. Note that commands that may trigger a DEL as a side
  *              effect (like SET) are not fast commands.
  *
+ * global:      The command may touch more than the database selected by the
+ *              client, or server wide state, so it always runs under the
+ *              global lock (see db-lock-striping).  Admin, pub-sub, blocking,
+ *              scripting and module commands are always treated as global.
+ *
  * The following additional flags are only used in order to put commands
  * in a specific ACL category. Commands can have multiple ACL categories.
  *
@@ -361,6 +367,10 @@ struct redisCommand redisCommandTable[] = {
      "read-only fast @set",
      0,NULL,1,1,1,0,0,0},
 
+    {"smismember",smismemberCommand,-3,
+     "read-only fast @set",
+     0,NULL,1,1,1,0,0,0},
+
     {"scard",scardCommand,2,
      "read-only fast @set",
      0,NULL,1,1,1,0,0,0},
@@ -598,11 +608,11 @@ struct redisCommand redisCommandTable[] = {
      0,NULL,0,0,0,0,0,0},
 
     {"swapdb",swapdbCommand,3,
-     "write fast @keyspace @dangerous",
+     "write fast global @keyspace @dangerous",
      0,NULL,0,0,0,0,0,0},
 
     {"move",moveCommand,3,
-     "write fast @keyspace",
+     "write fast global @keyspace",
      0,NULL,1,1,1,0,0,0},
 
     /* Like for SET, we can't mark rename as a fast command because
@@ -652,7 +662,7 @@ struct redisCommand redisCommandTable[] = {
      0,NULL,0,0,0,0,0,0},
 
     {"auth",authCommand,-2,
-     "no-script ok-loading ok-stale fast @connection",
+     "no-script ok-loading ok-stale fast global @connection",
      0,NULL,0,0,0,0,0,0},
 
     /* We don't allow PING during loading since in Redis PING is used as
@@ -695,11 +705,11 @@ struct redisCommand redisCommandTable[] = {
      0,NULL,0,0,0,0,0,0},
 
     {"exec",execCommand,1,
-     "no-script no-monitor @transaction",
+     "no-script no-monitor global @transaction",
      0,NULL,0,0,0,0,0,0},
 
     {"discard",discardCommand,1,
-     "no-script fast @transaction",
+     "no-script fast global @transaction",
      0,NULL,0,0,0,0,0,0},
 
     {"sync",syncCommand,1,
@@ -715,19 +725,19 @@ struct redisCommand redisCommandTable[] = {
      0,NULL,0,0,0,0,0,0},
 
     {"flushdb",flushdbCommand,-1,
-     "write @keyspace @dangerous",
+     "write global @keyspace @dangerous",
      0,NULL,0,0,0,0,0,0},
 
     {"flushall",flushallCommand,-1,
-     "write @keyspace @dangerous",
+     "write global @keyspace @dangerous",
      0,NULL,0,0,0,0,0,0},
 
     {"sort",sortCommand,-2,
-     "write use-memory @list @set @sortedset @dangerous",
+     "write use-memory global @list @set @sortedset @dangerous",
      0,sortGetKeys,1,1,1,0,0,0},
 
     {"info",infoCommand,-1,
-     "ok-loading ok-stale random @dangerous",
+     "ok-loading ok-stale random global @dangerous",
      0,NULL,0,0,0,0,0,0},
 
     {"monitor",monitorCommand,1,
@@ -759,7 +769,7 @@ struct redisCommand redisCommandTable[] = {
      0,NULL,0,0,0,0,0,0},
 
     {"role",roleCommand,1,
-     "ok-loading ok-stale no-script fast read-only @dangerous",
+     "ok-loading ok-stale no-script fast read-only global @dangerous",
      0,NULL,0,0,0,0,0,0},
 
     {"debug",debugCommand,-2,
@@ -799,7 +809,7 @@ struct redisCommand redisCommandTable[] = {
      0,NULL,1,-1,1,0,0,0},
 
     {"unwatch",unwatchCommand,1,
-     "no-script fast @transaction",
+     "no-script fast global @transaction",
      0,NULL,0,0,0,0,0,0},
 
     {"cluster",clusterCommand,-2,
@@ -815,7 +825,7 @@ struct redisCommand redisCommandTable[] = {
     0,NULL,1,1,1,0,0,0},
 
     {"migrate",migrateCommand,-6,
-     "write random @keyspace @dangerous",
+     "write random global @keyspace @dangerous",
      0,migrateGetKeys,0,0,0,0,0,0},
 
     {"asking",askingCommand,1,
@@ -839,7 +849,7 @@ struct redisCommand redisCommandTable[] = {
      0,NULL,2,2,1,0,0,0},
 
     {"memory",memoryCommand,-2,
-     "random read-only",
+     "random read-only global",
      0,NULL,0,0,0,0,0,0},
 
     {"client",clientCommand,-2,
@@ -847,7 +857,7 @@ struct redisCommand redisCommandTable[] = {
      0,NULL,0,0,0,0,0,0},
 
     {"hello",helloCommand,-2,
-     "no-script fast @connection",
+     "no-script fast global @connection",
      0,NULL,0,0,0,0,0,0},
 
     /* EVAL can modify the dataset, however it is not flagged as a write
@@ -885,7 +895,7 @@ struct redisCommand redisCommandTable[] = {
      0,NULL,1,1,1,0,0,0},
 
     {"wait",waitCommand,3,
-     "no-script @keyspace",
+     "no-script global @keyspace",
      0,NULL,0,0,0,0,0,0},
 
     {"command",commandCommand,-1,
@@ -1022,7 +1032,7 @@ struct redisCommand redisCommandTable[] = {
      0,NULL,0,0,0,0,0,0},
 
     {"rreplay",replicaReplayCommand,-3,
-     "read-only fast noprop",
+     "read-only fast noprop global",
      0,NULL,0,0,0,0,0,0}
 };
 
@@ -1197,6 +1207,13 @@ void dictObjectDestructor(void *privdata, void *val)
     decrRefCount((robj*)val);
 }
 
+/* Values inlined in a keyspace entry have nothing to free */
+void dictDbValDestructor(void *privdata, void *val)
+{
+    if (FInlineVal(val)) return;
+    dictObjectDestructor(privdata, val);
+}
+
 void dictSdsDestructor(void *privdata, void *val)
 {
     DICT_NOTUSED(privdata);
@@ -1221,6 +1238,14 @@ uint64_t dictSdsHash(const void *key) {
     return dictGenHashFunction((unsigned char*)key, sdslen((char*)key));
 }
 
+size_t dictSdsEmbedLen(const void *key) {
+    return sdsInPlaceSize(sdslen((sds)key));
+}
+
+void *dictSdsEmbed(void *buf, const void *key) {
+    return sdsnewlenInPlace(buf, key, sdslen((sds)key));
+}
+
 uint64_t dictSdsCaseHash(const void *key) {
     return dictGenCaseHashFunction((unsigned char*)key, sdslen((char*)key));
 }
@@ -1295,17 +1320,19 @@ dictType setDictType = {
     NULL,                      /* val dup */
     dictSdsKeyCompare,         /* key compare */
     dictSdsDestructor,         /* key destructor */
-    NULL                       /* val destructor */
+    NULL,                      /* val destructor */
+    DICT_TYPE_ASYNC_REHASH | DICT_TYPE_READ_SHARED /* flags */
 };
 
-/* Sorted sets hash (note: a skiplist is used in addition to the hash table) */
+/* Sorted sets hash (note: a B+tree is used in addition to the hash table) */
 dictType zsetDictType = {
     dictSdsHash,               /* hash function */
     NULL,                      /* key dup */
     NULL,                      /* val dup */
     dictSdsKeyCompare,         /* key compare */
-    NULL,                      /* Note: SDS string shared & freed by skiplist */
-    NULL                       /* val destructor */
+    NULL,                      /* Note: SDS string shared & freed by the B+tree */
+    NULL,                      /* val destructor */
+    DICT_TYPE_READ_SHARED      /* flags */
 };
 
 /* db->pdict, keys are sds strings, vals are Redis objects. */
@@ -1315,9 +1342,28 @@ dictType dbDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
     dictSdsDestructor,          /* key destructor */
-    dictObjectDestructor   /* val destructor */
+    dictDbValDestructor,        /* val destructor */
+    DICT_TYPE_ASYNC_REHASH | DICT_TYPE_READ_SHARED /* flags */
 };
 
+/* The dict type of the keyspace of every DB: dbDictType adjusted by the
+ * keyspace-open-addressing and keyspace-embedded-keys startup options. */
+dictType *keyspaceDictType(void) {
+    static dictType keyspaceType = []{
+        dictType type = dbDictType;
+        if (cserver.keyspace_open_addressing)
+            type.flags |= DICT_TYPE_OPEN_ADDRESSING;
+        if (cserver.keyspace_embedded_keys) {
+            /* Keys live in their dictEntry and are freed along with it */
+            type.keyDestructor = NULL;
+            type.embedKeyLen = dictSdsEmbedLen;
+            type.embedKey = dictSdsEmbed;
+        }
+        return type;
+    }();
+    return &keyspaceType;
+}
+
 /* g_pserver->lua_scripts sha (as sds string) -> scripts (as robj) cache. */
 dictType shaScriptObjectDictType = {
     dictSdsCaseHash,            /* hash function */
@@ -1355,7 +1401,8 @@ dictType hashDictType = {
     NULL,                       /* val dup */
     dictSdsKeyCompare,          /* key compare */
     dictSdsDestructor,          /* key destructor */
-    dictSdsDestructor           /* val destructor */
+    dictSdsDestructor,          /* val destructor */
+    DICT_TYPE_ASYNC_REHASH | DICT_TYPE_READ_SHARED /* flags */
 };
 
 /* Keylist hash table type has unencoded redis objects as keys and
@@ -1459,6 +1506,18 @@ int incrementallyRehash(int dbid) {
     return 0;
 }
 
+/* Batches of rehashing work on the large keyspace, hash and set tables are
+ * hashed by the bio thread, see dictRehashAsync(). */
+static void asyncRehashDispatch(dictAsyncRehashCtl *ctl) {
+    bioCreateBackgroundJob(BIO_REHASH,ctl,NULL,NULL);
+}
+
+/* With list-compress-async, quicklist nodes leaving the uncompressed ends of
+ * lists are compressed by the bio thread, see quicklistRunCompressJob(). */
+static void asyncQuicklistCompressDispatch(quicklistCompressJob *job) {
+    bioCreateBackgroundJob(BIO_QUICKLIST_COMPRESS,job,NULL,NULL);
+}
+
 /* This function is called once a background process of some kind terminates,
  * as we want to avoid resizing the hash tables when there is a child in order
  * to play well with copy-on-write (otherwise when a resize happens lots of
@@ -1922,12 +1981,15 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 
     /* Start a scheduled AOF rewrite if this was requested by the user while
      * a BGSAVE was in progress. */
-    if (g_pserver->rdb_child_pid == -1 && g_pserver->aof_child_pid == -1 &&
+    if (!rdbSaveInProgress() && g_pserver->aof_child_pid == -1 &&
         g_pserver->aof_rewrite_scheduled)
     {
         rewriteAppendOnlyFileBackground();
     }
 
+    /* Check if a fork-less background saving terminated. */
+    if (g_pserver->rdb_forkless_save != nullptr) rdbForklessSaveCheckDone();
+
     /* Check if a background saving or AOF rewrite in progress terminated. */
     if (g_pserver->rdb_child_pid != -1 || g_pserver->aof_child_pid != -1 ||
         ldbPendingChildren())
@@ -1963,7 +2025,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
             updateDictResizePolicy();
             closeChildInfoPipe();
         }
-    } else {
+    } else if (g_pserver->rdb_forkless_save == nullptr) {
         /* If there is not a background saving/rewrite in progress check if
          * we have to save/rewrite now. */
         for (j = 0; j < g_pserver->saveparamslen; j++) {
@@ -2039,6 +2101,11 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         migrateCloseTimedoutSockets();
     }
 
+    /* Move hot clients away from overloaded threads. */
+    run_with_period(1000) {
+        if (g_pserver->client_rebalance && cserver.cthreads > 1) rebalanceClients();
+    }
+
     /* Start a scheduled BGSAVE if the corresponding flag is set. This is
      * useful when we are forced to postpone a BGSAVE because an AOF
      * rewrite is in progress.
@@ -2046,7 +2113,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
      * Note: this code must be after the replicationCron() call above so
      * make sure when refactoring this file to keep this order. This is useful
      * because we want to give priority to RDB savings for replication. */
-    if (g_pserver->rdb_child_pid == -1 && g_pserver->aof_child_pid == -1 &&
+    if (!rdbSaveInProgress() && g_pserver->aof_child_pid == -1 &&
         g_pserver->rdb_bgsave_scheduled &&
         (g_pserver->unixtime-g_pserver->lastbgsave_try > CONFIG_BGSAVE_RETRY_DELAY ||
          g_pserver->lastbgsave_status == C_OK))
@@ -2085,6 +2152,14 @@ int serverCronLite(struct aeEventLoop *eventLoop, long long id, void *clientData
     return 1000/g_pserver->hz;
 }
 
+/* Account the time since the event loop woke up as busy, this is the load
+ * metric used by rebalanceClients(). */
+static void updateThreadBusyTime() {
+    if (serverTL->wakeup_usec == 0) return;
+    atomicIncr(serverTL->busy_usec, ustime() - serverTL->wakeup_usec);
+    serverTL->wakeup_usec = 0;
+}
+
 /* This function gets called every time Redis is entering the
  * main loop of the event driven library, that is, before to sleep
  * for ready file descriptors. */
@@ -2132,6 +2207,9 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
         processUnblockedClients(IDX_EVENT_LOOP_MAIN);
     }
 
+    /* Run the commands read in this iteration (lock-batch-size) */
+    processClientsPendingRead(IDX_EVENT_LOOP_MAIN);
+
     /* Write the AOF buffer on disk */
     flushAppendOnlyFile(0);
 
@@ -2140,8 +2218,14 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     handleClientsWithPendingWrites(IDX_EVENT_LOOP_MAIN);
     aeAcquireLock();
 
+    /* Move the clients picked by rebalanceClients() now that their replies are flushed */
+    processClientsPendingMigration(IDX_EVENT_LOOP_MAIN);
+
     /* Close clients that need to be closed asynchronous */
     freeClientsInAsyncFreeQueue(IDX_EVENT_LOOP_MAIN);
+    releaseAutoreleasedObjects();
+
+    updateThreadBusyTime();
 
     /* Before we are going to sleep, let the threads access the dataset by
      * releasing the GIL. Redis main thread will not touch anything at this
@@ -2158,6 +2242,7 @@ void beforeSleepLite(struct aeEventLoop *eventLoop)
     if (listLength(g_pserver->rgthreadvar[iel].unblocked_clients)) {
         processUnblockedClients(iel);
     }
+    processClientsPendingRead(iel);
 
     /* Check if there are clients unblocked by modules that implement
      * blocking commands. */
@@ -2168,10 +2253,14 @@ void beforeSleepLite(struct aeEventLoop *eventLoop)
     handleClientsWithPendingWrites(iel);
 
     aeAcquireLock();
+    processClientsPendingMigration(iel);
     /* Close clients that need to be closed asynchronous */
     freeClientsInAsyncFreeQueue(iel);
+    releaseAutoreleasedObjects();
     aeReleaseLock();
 
+    updateThreadBusyTime();
+
     /* Before we are going to sleep, let the threads access the dataset by
      * releasing the GIL. Redis main thread will not touch anything at this
      * time. */
@@ -2183,6 +2272,7 @@ void beforeSleepLite(struct aeEventLoop *eventLoop)
  * the different events callbacks. */
 void afterSleep(struct aeEventLoop *eventLoop) {
     UNUSED(eventLoop);
+    if (g_pserver->client_rebalance) serverTL->wakeup_usec = ustime();
     if (moduleCount()) moduleAcquireGIL(TRUE /*fServerThread*/);
 }
 
@@ -2354,6 +2444,7 @@ void initServerConfig(void) {
     cserver.client_max_querybuf_len = PROTO_MAX_QUERYBUF_LEN;
     g_pserver->saveparams = NULL;
     g_pserver->loading = 0;
+    g_pserver->loading_threads = 0;
     g_pserver->logfile = zstrdup(CONFIG_DEFAULT_LOGFILE);
     g_pserver->syslog_enabled = CONFIG_DEFAULT_SYSLOG_ENABLED;
     g_pserver->syslog_ident = zstrdup(CONFIG_DEFAULT_SYSLOG_IDENT);
@@ -2386,7 +2477,12 @@ void initServerConfig(void) {
     g_pserver->aof_filename = zstrdup(CONFIG_DEFAULT_AOF_FILENAME);
     g_pserver->acl_filename = zstrdup(CONFIG_DEFAULT_ACL_FILENAME);
     g_pserver->rdb_compression = CONFIG_DEFAULT_RDB_COMPRESSION;
+    g_pserver->rdb_compression_codec = CONFIG_DEFAULT_RDB_COMPRESSION_CODEC;
+    g_pserver->rdb_compression_zstd_dict = CONFIG_DEFAULT_RDB_COMPRESSION_ZSTD_DICT;
     g_pserver->rdb_checksum = CONFIG_DEFAULT_RDB_CHECKSUM;
+    g_pserver->forkless_bgsave = CONFIG_DEFAULT_FORKLESS_BGSAVE;
+    g_pserver->rdb_load_threads = CONFIG_DEFAULT_RDB_LOAD_THREADS;
+    g_pserver->rdb_save_threads = CONFIG_DEFAULT_RDB_SAVE_THREADS;
     g_pserver->stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     g_pserver->activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;
     g_pserver->active_defrag_running = 0;
@@ -2400,13 +2496,13 @@ void initServerConfig(void) {
     g_pserver->maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
     g_pserver->lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
     g_pserver->lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
-    g_pserver->hash_max_ziplist_entries = OBJ_HASH_MAX_ZIPLIST_ENTRIES;
-    g_pserver->hash_max_ziplist_value = OBJ_HASH_MAX_ZIPLIST_VALUE;
+    g_pserver->hash_max_listpack_entries = OBJ_HASH_MAX_LISTPACK_ENTRIES;
+    g_pserver->hash_max_listpack_value = OBJ_HASH_MAX_LISTPACK_VALUE;
     g_pserver->list_max_ziplist_size = OBJ_LIST_MAX_ZIPLIST_SIZE;
     g_pserver->list_compress_depth = OBJ_LIST_COMPRESS_DEPTH;
     g_pserver->set_max_intset_entries = OBJ_SET_MAX_INTSET_ENTRIES;
-    g_pserver->zset_max_ziplist_entries = OBJ_ZSET_MAX_ZIPLIST_ENTRIES;
-    g_pserver->zset_max_ziplist_value = OBJ_ZSET_MAX_ZIPLIST_VALUE;
+    g_pserver->zset_max_listpack_entries = OBJ_ZSET_MAX_LISTPACK_ENTRIES;
+    g_pserver->zset_max_listpack_value = OBJ_ZSET_MAX_LISTPACK_VALUE;
     g_pserver->hll_sparse_max_bytes = CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES;
     g_pserver->stream_node_max_bytes = OBJ_STREAM_NODE_MAX_BYTES;
     g_pserver->stream_node_max_entries = OBJ_STREAM_NODE_MAX_ENTRIES;
@@ -2442,6 +2538,11 @@ void initServerConfig(void) {
     /* Replication related */
     g_pserver->masters = listCreate();
     g_pserver->enable_multimaster = CONFIG_DEFAULT_ENABLE_MULTIMASTER;
+    g_pserver->lockless_reads = CONFIG_DEFAULT_LOCKLESS_READS;
+    g_pserver->db_lock_striping = CONFIG_DEFAULT_DB_LOCK_STRIPING;
+    g_pserver->client_rebalance = CONFIG_DEFAULT_CLIENT_REBALANCE;
+    dictAsyncRehash = CONFIG_DEFAULT_ASYNC_REHASH;
+    g_pserver->lock_batch_size = CONFIG_DEFAULT_LOCK_BATCH_SIZE;
     g_pserver->repl_syncio_timeout = CONFIG_REPL_SYNCIO_TIMEOUT;
     g_pserver->repl_serve_stale_data = CONFIG_DEFAULT_SLAVE_SERVE_STALE_DATA;
     g_pserver->repl_slave_ro = CONFIG_DEFAULT_SLAVE_READ_ONLY;
@@ -2521,7 +2622,11 @@ void initServerConfig(void) {
 
     /* Multithreading */
     cserver.cthreads = CONFIG_DEFAULT_THREADS;
+    cserver.fNumaAwareLock = CONFIG_DEFAULT_NUMA_AWARE_LOCK;
+    cserver.keyspace_open_addressing = CONFIG_DEFAULT_KEYSPACE_OPEN_ADDRESSING;
+    cserver.keyspace_embedded_keys = CONFIG_DEFAULT_KEYSPACE_EMBEDDED_KEYS;
     cserver.fThreadAffinity = CONFIG_DEFAULT_THREAD_AFFINITY;
+    cserver.thread_steering = THREAD_STEERING_NONE;
 }
 
 extern char **environ;
@@ -2785,6 +2890,7 @@ void resetServerStats(void) {
     g_pserver->stat_evictedkeys = 0;
     g_pserver->stat_keyspace_misses = 0;
     g_pserver->stat_keyspace_hits = 0;
+    fastlock_profile_reset();
     g_pserver->stat_active_defrag_hits = 0;
     g_pserver->stat_active_defrag_misses = 0;
     g_pserver->stat_active_defrag_key_hits = 0;
@@ -2796,6 +2902,11 @@ void resetServerStats(void) {
     g_pserver->stat_sync_full = 0;
     g_pserver->stat_sync_partial_ok = 0;
     g_pserver->stat_sync_partial_err = 0;
+    g_pserver->stat_client_migrations = 0;
+    g_pserver->stat_lockless_reads = 0;
+    g_pserver->stat_lockless_reads_locked = 0;
+    g_pserver->stat_striped_commands = 0;
+    dictResetAsyncRehashStats();
     for (j = 0; j < STATS_METRIC_COUNT; j++) {
         g_pserver->inst_metric[j].idx = 0;
         g_pserver->inst_metric[j].last_sample_time = mstime();
@@ -2835,11 +2946,43 @@ static void initNetworkingThread(int iel, int fReusePort)
     }
 }
 
+/* With server-thread-steering the kernel hands a new connection to the
+ * listener of the thread running on the CPU that received it, instead of
+ * hashing the 4-tuple.  Combined with server-thread-affinity (thread N runs
+ * on CPU N) and NIC queues steered to those CPUs, the softirq processing, the
+ * event loop and the client's memory stay on one core.  Failures only cost
+ * locality, so they are logged and the default hashing is kept. */
+static void initListenerSteering()
+{
+    if (!cserver.fThreadAffinity)
+        serverLog(LL_WARNING, "WARNING: server-thread-steering is enabled without server-thread-affinity, connections are steered to threads that may run on any CPU.");
+
+    for (int j = 0; j < g_pserver->rgthreadvar[IDX_EVENT_LOOP_MAIN].ipfd_count; j++) {
+        if (cserver.thread_steering == THREAD_STEERING_INCOMING_CPU) {
+            for (int iel = 0; iel < cserver.cthreads; ++iel) {
+                if (anetSetIncomingCpu(serverTL->neterr, g_pserver->rgthreadvar[iel].ipfd[j], iel) == ANET_ERR) {
+                    serverLog(LL_WARNING, "Could not steer connections to thread %d: %s", iel, serverTL->neterr);
+                    return;
+                }
+            }
+        } else if (cserver.thread_steering == THREAD_STEERING_BPF) {
+            /* The program is shared by the whole reuseport group, attach it
+             * once the last listener has joined. */
+            if (anetSetReusePortCpuSteering(serverTL->neterr, g_pserver->rgthreadvar[cserver.cthreads-1].ipfd[j], cserver.cthreads) == ANET_ERR) {
+                serverLog(LL_WARNING, "Could not steer connections by CPU: %s", serverTL->neterr);
+                return;
+            }
+        }
+    }
+}
+
 static void initNetworking(int fReusePort)
 {
     int celListen = (fReusePort) ? cserver.cthreads : 1;
     for (int iel = 0; iel < celListen; ++iel)
         initNetworkingThread(iel, fReusePort);
+    if (fReusePort && cserver.thread_steering != THREAD_STEERING_NONE)
+        initListenerSteering();
 
     /* Open the listening Unix domain socket. */
     if (g_pserver->unixsocket != NULL) {
@@ -2867,6 +3010,7 @@ static void initServerThread(struct redisServerThreadVars *pvar, int fMain)
 {
     pvar->unblocked_clients = listCreate();
     pvar->clients_pending_asyncwrite = listCreate();
+    pvar->ready_keys = listCreate();
     pvar->ipfd_count = 0;
     pvar->cclients = 0;
     pvar->el = aeCreateEventLoop(g_pserver->maxclients+CONFIG_FDSET_INCR);
@@ -2879,6 +3023,7 @@ static void initServerThread(struct redisServerThreadVars *pvar, int fMain)
     }
 
     fastlock_init(&pvar->lockPendingWrite);
+    fastlock_setname(&pvar->lockPendingWrite, "pending-write");
 
     if (!fMain)
     {
@@ -2926,15 +3071,20 @@ void initServer(void) {
     setupSignalHandlers();
 
     fastlock_init(&g_pserver->flock);
+    fastlock_setname(&g_pserver->flock, "server");
+    fastlock_init(&g_pserver->lockPropagate);
+    fastlock_setname(&g_pserver->lockPropagate, "propagate");
 
     g_pserver->db = (redisDb*)zmalloc(sizeof(redisDb)*cserver.dbnum, MALLOC_LOCAL);
 
     /* Create the Redis databases, and initialize other internal state. */
     for (int j = 0; j < cserver.dbnum; j++) {
         new (&g_pserver->db[j]) redisDb;
-        g_pserver->db[j].pdict = dictCreate(&dbDictType,NULL);
+        fastlock_setname(&g_pserver->db[j].lock, "db");
+        g_pserver->db[j].pdict = dictCreate(keyspaceDictType(),NULL);
         g_pserver->db[j].setexpire = new(MALLOC_LOCAL) expireset();
         g_pserver->db[j].expireitr = g_pserver->db[j].setexpire->end();
+        expireWheelReset(&g_pserver->db[j]);
         g_pserver->db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         g_pserver->db[j].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
         g_pserver->db[j].watched_keys = dictCreate(&keylistDictType,NULL);
@@ -2982,6 +3132,9 @@ void initServer(void) {
     listSetMatchMethod(g_pserver->pubsub_patterns,listMatchPubsubPattern);
     g_pserver->cronloops = 0;
     g_pserver->rdb_child_pid = -1;
+    g_pserver->rdb_forkless_save = NULL;
+    g_pserver->rdb_forkless_tracking = 0;
+    g_pserver->rdb_forkless_save_delay = 0;
     g_pserver->aof_child_pid = -1;
     g_pserver->rdb_child_type = RDB_CHILD_TYPE_NONE;
     g_pserver->rdb_bgsave_scheduled = 0;
@@ -3000,6 +3153,8 @@ void initServer(void) {
     cserver.stat_starttime = time(NULL);
     g_pserver->stat_peak_memory = 0;
     g_pserver->stat_rdb_cow_bytes = 0;
+    g_pserver->stat_rdb_forkless_preserved_keys = 0;
+    g_pserver->stat_rdb_forkless_preserved_bytes = 0;
     g_pserver->stat_aof_cow_bytes = 0;
     g_pserver->cron_malloc_stats.zmalloc_used = 0;
     g_pserver->cron_malloc_stats.process_rss = 0;
@@ -3052,6 +3207,9 @@ void initServer(void) {
     slowlogInit();
     latencyMonitorInit();
     bioInit();
+    dictSetAsyncRehashProc(asyncRehashDispatch);
+    dictSetModifyProc(aeExcludeReaders);
+    quicklistSetAsyncCompressProc(asyncQuicklistCompressDispatch);
     g_pserver->initial_memory_usage = zmalloc_used_memory();
 }
 
@@ -3096,6 +3254,8 @@ int populateCommandTableParseFlags(struct redisCommand *c, const char *strflags)
             c->flags |= CMD_FAST | CMD_CATEGORY_FAST;
         } else if (!strcasecmp(flag,"noprop")) {
             c->flags |= CMD_SKIP_PROPOGATE;
+        } else if (!strcasecmp(flag,"global")) {
+            c->flags |= CMD_GLOBAL;
         } else {
             /* Parse ACL categories here if the flag name starts with @. */
             uint64_t catflag;
@@ -3235,7 +3395,12 @@ struct redisCommand *lookupCommandOrOriginal(sds name) {
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc,
                int flags)
 {
-    serverAssert(GlobalLocksAcquired());
+    serverAssert(CommandLocksAcquired());
+    /* The global lock keeps commands run under their db lock only out, but
+     * those may propagate concurrently with each other */
+    std::unique_lock<fastlock> ulock(g_pserver->lockPropagate, std::defer_lock);
+    if (aeThreadInStripedSection())
+        ulock.lock();
     if (g_pserver->aof_state != AOF_OFF && flags & PROPAGATE_AOF)
         feedAppendOnlyFile(cmd,dbid,argv,argc);
     if (flags & PROPAGATE_REPL)
@@ -3267,7 +3432,7 @@ void alsoPropagate(struct redisCommand *cmd, int dbid, robj **argv, int argc,
         argvcopy[j] = argv[j];
         incrRefCount(argv[j]);
     }
-    redisOpArrayAppend(&g_pserver->also_propagate,cmd,dbid,argvcopy,argc,target);
+    redisOpArrayAppend(&serverTL->also_propagate,cmd,dbid,argvcopy,argc,target);
 }
 
 /* It is possible to call the function forceCommandPropagation() inside a
@@ -3331,12 +3496,22 @@ void preventCommandReplication(client *c) {
  * preventCommandAOF(client *c);
  * preventCommandReplication(client *c);
  *
+ * Commands may also be called holding only the lock of their database (see
+ * FStripingAllowed()).  The caller then clears CMD_CALL_SLOWLOG and records
+ * the returned duration (in microseconds) itself once it may take the
+ * global lock.
  */
-void call(client *c, int flags) {
+long long call(client *c, int flags) {
     long long dirty, start, duration;
     int client_old_flags = c->flags;
     struct redisCommand *real_cmd = c->cmd;
-    serverAssert(GlobalLocksAcquired());
+    serverAssert(CommandLocksAcquired());
+
+    /* Keyspace changes are caught where they are made, see dbBeforeWrite(),
+     * but commands that may also change server state lockless readers depend
+     * on keep them out right away. */
+    if (c->cmd->flags & (CMD_WRITE|CMD_ADMIN|CMD_MODULE))
+        aeExcludeReaders();
 
     /* Sent the command to clients in MONITOR mode, only if the commands are
      * not generated from reading an AOF. */
@@ -3350,16 +3525,17 @@ void call(client *c, int flags) {
     /* Initialization: clear the flags that must be set by the command on
      * demand, and initialize the array for additional commands propagation. */
     c->flags &= ~(CLIENT_FORCE_AOF|CLIENT_FORCE_REPL|CLIENT_PREVENT_PROP);
-    redisOpArray prev_also_propagate = g_pserver->also_propagate;
-    redisOpArrayInit(&g_pserver->also_propagate);
+    redisOpArray prev_also_propagate = serverTL->also_propagate;
+    redisOpArrayInit(&serverTL->also_propagate);
 
     /* Call the command. */
-    dirty = g_pserver->dirty;
+    dirty = g_pserver->dirty.changesThisThread();
     start = ustime();
     c->cmd->proc(c);
     serverTL->commandsExecuted++;
+    c->commands_processed++;
     duration = ustime()-start;
-    dirty = g_pserver->dirty-dirty;
+    dirty = g_pserver->dirty.changesThisThread()-dirty;
     if (dirty < 0) dirty = 0;
 
     /* When EVAL is called loading the AOF we don't want commands called
@@ -3390,8 +3566,8 @@ void call(client *c, int flags) {
         /* use the real command that was executed (cmd and lastamc) may be
          * different, in case of MULTI-EXEC or re-written commands such as
          * EXPIRE, GEOADD, etc. */
-        real_cmd->microseconds += duration;
-        real_cmd->calls++;
+        atomicIncr(real_cmd->microseconds, duration);
+        atomicIncr(real_cmd->calls, 1);
     }
 
     /* Propagate the command into the AOF and replication link */
@@ -3438,13 +3614,13 @@ void call(client *c, int flags) {
     /* Handle the alsoPropagate() API to handle commands that want to propagate
      * multiple separated commands. Note that alsoPropagate() is not affected
      * by CLIENT_PREVENT_PROP flag. */
-    if (g_pserver->also_propagate.numops) {
+    if (serverTL->also_propagate.numops) {
         int j;
         redisOp *rop;
 
         if (flags & CMD_CALL_PROPAGATE) {
-            for (j = 0; j < g_pserver->also_propagate.numops; j++) {
-                rop = &g_pserver->also_propagate.ops[j];
+            for (j = 0; j < serverTL->also_propagate.numops; j++) {
+                rop = &serverTL->also_propagate.ops[j];
                 int target = rop->target;
                 /* Whatever the command wish is, we honor the call() flags. */
                 if (!(flags&CMD_CALL_PROPAGATE_AOF)) target &= ~PROPAGATE_AOF;
@@ -3453,12 +3629,14 @@ void call(client *c, int flags) {
                     propagate(rop->cmd,rop->dbid,rop->argv,rop->argc,target);
             }
         }
-        redisOpArrayFree(&g_pserver->also_propagate);
+        redisOpArrayFree(&serverTL->also_propagate);
     }
 
-    ProcessPendingAsyncWrites();
+    /* Without the global lock our caller hands the writes over later */
+    if (!aeThreadInStripedSection())
+        ProcessPendingAsyncWrites();
     
-    g_pserver->also_propagate = prev_also_propagate;
+    serverTL->also_propagate = prev_also_propagate;
 
     /* If the client has keys tracking enabled for client side caching,
      * make sure to remember the keys it fetched via this command. */
@@ -3469,7 +3647,83 @@ void call(client *c, int flags) {
             trackingRememberKeys(caller);
     }
 
-    g_pserver->stat_numcommands++;
+    /* Lockless reads update these stats concurrently, see callLockless() */
+    atomicIncr(g_pserver->stat_numcommands, 1);
+    return duration;
+}
+
+/* Returns true if the command may be run without the global lock, see the
+ * lockless-reads config.  Only simple read-only commands qualify, and only
+ * for clients where nothing besides the reply depends on the command. */
+static bool FLocklessReadAllowed(client *c) {
+    if (!g_pserver->lockless_reads)
+        return false;
+    if ((c->cmd->flags & (CMD_READONLY|CMD_FAST)) != (CMD_READONLY|CMD_FAST))
+        return false;
+    if (c->cmd->flags & (CMD_ADMIN|CMD_MODULE|CMD_PUBSUB))
+        return false;
+    if (c->flags & (CLIENT_MULTI|CLIENT_MASTER|CLIENT_LUA|CLIENT_TRACKING|CLIENT_MODULE))
+        return false;
+    /* keymiss events are published to other clients */
+    if (g_pserver->notify_keyspace_events & NOTIFY_KEY_MISS)
+        return false;
+    return true;
+}
+
+/* Returns true if the command may run holding only the lock of the client's
+ * database, see the db-lock-striping config.  Called in the striped section
+ * so none of the state checked here may change until we leave it.  Commands
+ * touching other databases or server wide state need the global lock, as do
+ * the features call() only serves under it: MONITOR, keyspace notifications,
+ * client side caching, modules and eviction. */
+static bool FStripingAllowed(client *c) {
+    serverAssert(aeThreadInStripedSection());
+    if (!g_pserver->db_lock_striping)
+        return false;
+    if (c->cmd->flags & (CMD_GLOBAL|CMD_ADMIN|CMD_MODULE|CMD_PUBSUB|
+                         CMD_CATEGORY_BLOCKING|CMD_CATEGORY_SCRIPTING))
+        return false;
+    if (c->flags & (CLIENT_MULTI|CLIENT_MASTER|CLIENT_SLAVE|CLIENT_LUA|CLIENT_TRACKING|CLIENT_MODULE))
+        return false;
+    if (listLength(g_pserver->monitors) || g_pserver->lua_timedout || g_pserver->loading)
+        return false;
+    if (g_pserver->notify_keyspace_events || g_pserver->tracking_clients || moduleCount())
+        return false;
+    /* Replicas apply the writes of their master under the global lock */
+    if (listLength(g_pserver->masters) || g_pserver->fActiveReplica)
+        return false;
+    if (g_pserver->rdb_forkless_tracking)
+        return false;
+    if (g_pserver->maxmemory && zmalloc_used_memory() > g_pserver->maxmemory)
+        return false;
+    return true;
+}
+
+/* The lockless counterpart of call(), used by processCommand() for commands
+ * admitted by FLocklessReadAllowed().  Such commands have nothing to propagate
+ * and MONITOR forces the locked path, so all that is left is running the
+ * proc and updating stats, which other readers update concurrently.  Returns
+ * the duration of the command in microseconds. */
+static long long callLockless(client *c, int flags) {
+    serverAssert(aeThreadInReadSection());
+
+    atomicIncr(g_pserver->stat_lockless_reads, 1);
+    if (aeLockHeld())
+        atomicIncr(g_pserver->stat_lockless_reads_locked, 1);
+    long long start = ustime();
+    dictNoRehashThisThread = 1;
+    c->cmd->proc(c);
+    dictNoRehashThisThread = 0;
+    serverTL->commandsExecuted++;
+    c->commands_processed++;
+    long long duration = ustime()-start;
+
+    if (flags & CMD_CALL_STATS) {
+        atomicIncr(c->cmd->microseconds, duration);
+        atomicIncr(c->cmd->calls, 1);
+    }
+    atomicIncr(g_pserver->stat_numcommands, 1);
+    return duration;
 }
 
 /* If this function gets called we already read a whole
@@ -3580,8 +3834,24 @@ int processCommand(client *c, int callFlags) {
     }
 
     incrementMvccTstamp();
-    
-    if (!locker.isArmed())
+
+    /* Simple reads may skip the global lock entirely, writers wait for us to
+     * leave the read section before they touch the dataset. */
+    AeReadGate readgate;
+    if (!locker.isArmed() && !aeThreadOwnsLock() && FLocklessReadAllowed(c) && readgate.tryEnter()) {
+        if (listLength(g_pserver->monitors) || g_pserver->lua_timedout)
+            readgate.exit();
+    }
+
+    /* Otherwise commands that only touch the client's database just take
+     * its lock, unless the global lock is needed for anything else. */
+    AeStripeGate stripegate;
+    if (!locker.isArmed() && !readgate.isEntered() && !aeThreadOwnsLock() && stripegate.tryEnter()) {
+        if (!FStripingAllowed(c))
+            stripegate.exit();
+    }
+
+    if (!locker.isArmed() && !readgate.isEntered() && !stripegate.isEntered())
         locker.arm(c);
 
     /* Handle the maxmemory directive.
@@ -3590,7 +3860,7 @@ int processCommand(client *c, int callFlags) {
      * the event loop since there is a busy Lua script running in timeout
      * condition, to avoid mixing the propagation of scripts with the
      * propagation of DELs due to eviction. */
-    if (g_pserver->maxmemory && !g_pserver->lua_timedout) {
+    if (g_pserver->maxmemory && !g_pserver->lua_timedout && !readgate.isEntered() && !stripegate.isEntered()) {
         int out_of_memory = freeMemoryIfNeededAndSafe() == C_ERR;
         /* freeMemoryIfNeeded may flush replica output buffers. This may result
          * into a replica, that may be the active client, to be freed. */
@@ -3705,12 +3975,59 @@ int processCommand(client *c, int callFlags) {
     {
         queueMultiCommand(c);
         addReply(c,shared.queued);
+    } else if (readgate.isEntered()) {
+        long long duration = callLockless(c,callFlags);
+        c->woff = g_pserver->master_repl_offset;
+        bool fSlow = (callFlags & CMD_CALL_SLOWLOG) &&
+            ((g_pserver->latency_monitor_threshold &&
+              duration/1000 >= g_pserver->latency_monitor_threshold) ||
+             (g_pserver->slowlog_log_slower_than >= 0 &&
+              duration >= g_pserver->slowlog_log_slower_than));
+        readgate.exit();
+        releaseAutoreleasedObjects();
+
+        /* The latency monitor and slowlog are not thread safe, only take the
+         * lock when there is something to record. */
+        if (fSlow) {
+            locker.arm(c);
+            latencyAddSampleIfNeeded("fast-command",duration/1000);
+            slowlogPushEntryIfNeeded(c,c->argv,c->argc,duration);
+        }
+    } else if (stripegate.isEntered()) {
+        std::unique_lock<decltype(c->db->lock)> ulock(c->db->lock);
+        long long duration = call(c,callFlags & ~CMD_CALL_SLOWLOG);
+        c->woff = g_pserver->master_repl_offset;
+        bool fSlow = (callFlags & CMD_CALL_SLOWLOG) &&
+            ((g_pserver->latency_monitor_threshold &&
+              duration/1000 >= g_pserver->latency_monitor_threshold) ||
+             (g_pserver->slowlog_log_slower_than >= 0 &&
+              duration >= g_pserver->slowlog_log_slower_than));
+        releaseAutoreleasedObjects();
+        ulock.unlock();
+        stripegate.exit();
+        atomicIncr(g_pserver->stat_striped_commands, 1);
+
+        if (fSlow) {
+            locker.arm(c);
+            latencyAddSampleIfNeeded((c->cmd->flags & CMD_FAST) ? "fast-command" : "command",
+                duration/1000);
+            slowlogPushEntryIfNeeded(c,c->argv,c->argc,duration);
+        }
+        /* Keys signaled by the command, see signalKeyAsReady() */
+        if (listLength(serverTL->ready_keys)) {
+            if (!locker.isArmed())
+                locker.arm(c);
+            listJoin(g_pserver->ready_keys,serverTL->ready_keys);
+            handleClientsBlockedOnKeys();
+            releaseAutoreleasedObjects();
+        }
     } else {
         std::unique_lock<decltype(c->db->lock)> ulock(c->db->lock);
         call(c,callFlags);
         c->woff = g_pserver->master_repl_offset;
         if (listLength(g_pserver->ready_keys))
             handleClientsBlockedOnKeys();
+        releaseAutoreleasedObjects();
     }
     return C_OK;
 }
@@ -3736,6 +4053,24 @@ void closeListeningSockets(int unlink_unix_socket) {
     }
 }
 
+/* The io_uring event loop keeps a reference on every socket it polls until
+ * the kernel tears its ring down, which finishes after we exit.  Closing the
+ * listening sockets isn't enough for them to stop accepting connections. */
+static void shutdownListeningSockets(void) {
+#ifdef USE_IOURING
+    int j;
+
+    for (int iel = 0; iel < cserver.cthreads; ++iel)
+    {
+        for (j = 0; j < g_pserver->rgthreadvar[iel].ipfd_count; j++)
+            shutdown(g_pserver->rgthreadvar[iel].ipfd[j], SHUT_RDWR);
+    }
+    if (g_pserver->sofd != -1) shutdown(g_pserver->sofd, SHUT_RDWR);
+    if (g_pserver->cluster_enabled)
+        for (j = 0; j < g_pserver->cfd_count; j++) shutdown(g_pserver->cfd[j], SHUT_RDWR);
+#endif
+}
+
 int prepareForShutdown(int flags) {
     int save = flags & SHUTDOWN_SAVE;
     int nosave = flags & SHUTDOWN_NOSAVE;
@@ -3751,6 +4086,8 @@ int prepareForShutdown(int flags) {
     if (g_pserver->rdb_child_pid != -1) {
         serverLog(LL_WARNING,"There is a child saving an .rdb. Killing it!");
         killRDBChild();
+    } else if (g_pserver->rdb_forkless_save != nullptr) {
+        rdbForklessSaveAbort("shutting down");
     }
 
     if (g_pserver->aof_state != AOF_OFF) {
@@ -3801,6 +4138,7 @@ int prepareForShutdown(int flags) {
     flushSlavesOutputBuffers();
 
     /* Close the listening sockets. Apparently this allows faster restarts. */
+    shutdownListeningSockets();
     closeListeningSockets(1);
     serverLog(LL_WARNING,"%s is now ready to exit, bye bye...",
         g_pserver->sentinel_mode ? "Sentinel" : "KeyDB");
@@ -4013,6 +4351,52 @@ void bytesToHuman(char *s, unsigned long long n) {
     }
 }
 
+/* Returns the upper bound of the log2 histogram bucket holding the given
+ * percentile of samples. */
+static uint64_t lockstatPercentile(const uint64_t *rgbucket, uint64_t csamples, double pct) {
+    uint64_t target = (uint64_t)ceil(csamples * pct / 100.0);
+    uint64_t seen = 0;
+    for (int ibucket = 0; ibucket < FASTLOCK_PROFILE_BUCKETS; ++ibucket) {
+        seen += rgbucket[ibucket];
+        if (seen >= target && seen > 0)
+            return ibucket ? (1ULL << ibucket) : 0;
+    }
+    return 1ULL << (FASTLOCK_PROFILE_BUCKETS-1);
+}
+
+static void collectLockstat(const struct fastlock_profile_stats *stats, void *privdata) {
+    static_cast<std::vector<fastlock_profile_stats>*>(privdata)->push_back(*stats);
+}
+
+/* One line per lock and call site, the call sites that spent the most time
+ * waiting come first.  All times are in TSC cycles.  The site is last before
+ * the counters since C++ symbol names may contain ':'. */
+static sds genLockstatsInfoString(sds info) {
+    std::vector<fastlock_profile_stats> vecstats;
+    fastlock_profile_visit(collectLockstat, &vecstats);
+    std::sort(vecstats.begin(), vecstats.end(), [](const fastlock_profile_stats &a, const fastlock_profile_stats &b) {
+        return a.cyclesWait > b.cyclesWait;
+    });
+
+    int istat = 0;
+    for (const auto &stats : vecstats) {
+        info = sdscatprintf(info, "lockstat_%d:lock=%s,site=", istat++, stats.szLock);
+        info = catCodeAddress(info, stats.callsite);
+        info = sdscatprintf(info,
+            ",acquires=%" PRIu64 ",contended=%" PRIu64
+            ",wait_avg=%" PRIu64 ",wait_p50=%" PRIu64 ",wait_p99=%" PRIu64
+            ",hold_avg=%" PRIu64 ",hold_p50=%" PRIu64 ",hold_p99=%" PRIu64 "\r\n",
+            stats.cacquires, stats.ccontended,
+            stats.cacquires ? stats.cyclesWait / stats.cacquires : 0,
+            lockstatPercentile(stats.rgwait, stats.cacquires, 50),
+            lockstatPercentile(stats.rgwait, stats.cacquires, 99),
+            stats.cholds ? stats.cyclesHold / stats.cholds : 0,
+            lockstatPercentile(stats.rghold, stats.cholds, 50),
+            lockstatPercentile(stats.rghold, stats.cholds, 99));
+    }
+    return info;
+}
+
 /* Create the string returned by the INFO command. This is decoupled
  * by the INFO command itself as we need to report the same information
  * on memory corruption problems. */
@@ -4252,6 +4636,8 @@ sds genRedisInfoString(const char *section) {
             "rdb_last_bgsave_time_sec:%jd\r\n"
             "rdb_current_bgsave_time_sec:%jd\r\n"
             "rdb_last_cow_size:%zu\r\n"
+            "rdb_forkless_preserved_keys:%lld\r\n"
+            "rdb_forkless_preserved_bytes:%lld\r\n"
             "aof_enabled:%d\r\n"
             "aof_rewrite_in_progress:%d\r\n"
             "aof_rewrite_scheduled:%d\r\n"
@@ -4261,14 +4647,16 @@ sds genRedisInfoString(const char *section) {
             "aof_last_write_status:%s\r\n"
             "aof_last_cow_size:%zu\r\n",
             g_pserver->loading,
-            g_pserver->dirty,
-            g_pserver->rdb_child_pid != -1,
+            (long long)g_pserver->dirty,
+            rdbSaveInProgress(),
             (intmax_t)g_pserver->lastsave,
             (g_pserver->lastbgsave_status == C_OK) ? "ok" : "err",
             (intmax_t)g_pserver->rdb_save_time_last,
-            (intmax_t)((g_pserver->rdb_child_pid == -1) ?
+            (intmax_t)(!rdbSaveInProgress() ?
                 -1 : time(NULL)-g_pserver->rdb_save_time_start),
             g_pserver->stat_rdb_cow_bytes,
+            g_pserver->stat_rdb_forkless_preserved_keys,
+            g_pserver->stat_rdb_forkless_preserved_bytes,
             g_pserver->aof_state != AOF_OFF,
             g_pserver->aof_child_pid != -1,
             g_pserver->aof_rewrite_scheduled,
@@ -4319,18 +4707,32 @@ sds genRedisInfoString(const char *section) {
                 "loading_total_bytes:%llu\r\n"
                 "loading_loaded_bytes:%llu\r\n"
                 "loading_loaded_perc:%.2f\r\n"
-                "loading_eta_seconds:%jd\r\n",
+                "loading_eta_seconds:%jd\r\n"
+                "loading_loaded_keys:%lld\r\n"
+                "loading_threads:%d\r\n",
                 (intmax_t) g_pserver->loading_start_time,
                 (unsigned long long) g_pserver->loading_total_bytes,
                 (unsigned long long) g_pserver->loading_loaded_bytes,
                 perc,
-                (intmax_t)eta
+                (intmax_t)eta,
+                g_pserver->loading_loaded_keys,
+                g_pserver->loading_threads
             );
         }
     }
 
     /* Stats */
     if (allsections || defsections || !strcasecmp(section,"stats")) {
+        dictAsyncRehashStats rehashstats;
+        size_t wheel_entries = 0, wheel_backlog = 0;
+
+        dictGetAsyncRehashStats(&rehashstats);
+        for (int j = 0; j < cserver.dbnum; j++) {
+            expirewheel *wheel = g_pserver->db[j].wheelexpire;
+            if (wheel == nullptr) continue;
+            wheel_entries += wheel->size();
+            wheel_backlog += wheel->due_size();
+        }
         if (sections++) info = sdscat(info,"\r\n");
         info = sdscatprintf(info,
             "# Stats\r\n"
@@ -4348,6 +4750,8 @@ sds genRedisInfoString(const char *section) {
             "expired_keys:%lld\r\n"
             "expired_stale_perc:%.2f\r\n"
             "expired_time_cap_reached_count:%lld\r\n"
+            "expire_wheel_entries:%zu\r\n"
+            "expire_wheel_backlog:%zu\r\n"
             "evicted_keys:%lld\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
@@ -4359,7 +4763,16 @@ sds genRedisInfoString(const char *section) {
             "active_defrag_hits:%lld\r\n"
             "active_defrag_misses:%lld\r\n"
             "active_defrag_key_hits:%lld\r\n"
-            "active_defrag_key_misses:%lld\r\n",
+            "active_defrag_key_misses:%lld\r\n"
+            "client_migrations:%lld\r\n"
+            "lockless_reads:%lld\r\n"
+            "lockless_reads_during_lock:%lld\r\n"
+            "striped_commands:%lld\r\n"
+            "async_rehash_batches:%llu\r\n"
+            "async_rehash_entries:%llu\r\n"
+            "async_rehash_abandoned:%llu\r\n"
+            "async_rehash_hash_usec:%llu\r\n"
+            "async_rehash_move_usec:%llu\r\n",
             g_pserver->stat_numconnections,
             g_pserver->stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
@@ -4374,6 +4787,8 @@ sds genRedisInfoString(const char *section) {
             g_pserver->stat_expiredkeys,
             g_pserver->stat_expired_stale_perc*100,
             g_pserver->stat_expired_time_cap_reached_count,
+            wheel_entries,
+            wheel_backlog,
             g_pserver->stat_evictedkeys,
             g_pserver->stat_keyspace_hits,
             g_pserver->stat_keyspace_misses,
@@ -4385,7 +4800,16 @@ sds genRedisInfoString(const char *section) {
             g_pserver->stat_active_defrag_hits,
             g_pserver->stat_active_defrag_misses,
             g_pserver->stat_active_defrag_key_hits,
-            g_pserver->stat_active_defrag_key_misses);
+            g_pserver->stat_active_defrag_key_misses,
+            g_pserver->stat_client_migrations,
+            g_pserver->stat_lockless_reads,
+            g_pserver->stat_lockless_reads_locked,
+            g_pserver->stat_striped_commands,
+            rehashstats.batches,
+            rehashstats.entries,
+            rehashstats.abandoned,
+            rehashstats.hash_usec,
+            rehashstats.move_usec);
     }
 
     /* Replication */
@@ -4567,6 +4991,17 @@ sds genRedisInfoString(const char *section) {
         dictReleaseIterator(di);
     }
 
+    /* Lock contention, only populated while lock-profiling is enabled */
+    if (allsections || !strcasecmp(section,"lockstats")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Lockstats\r\n"
+            "lock_profiling:%d\r\n"
+            "lock_implementation:%s\r\n",
+            g_fLockProfiling, fastlock_implementation());
+        info = genLockstatsInfoString(info);
+    }
+
     /* Cluster */
     if (allsections || defsections || !strcasecmp(section,"cluster")) {
         if (sections++) info = sdscat(info,"\r\n");
@@ -4593,9 +5028,16 @@ sds genRedisInfoString(const char *section) {
             g_pserver->db[j].last_expire_set = g_pserver->mstime;
             
             if (keys || vkeys) {
+                dict *d = g_pserver->db[j].pdict;
+
                 info = sdscatprintf(info,
-                    "db%d:keys=%lld,expires=%lld,avg_ttl=%lld\r\n",
+                    "db%d:keys=%lld,expires=%lld,avg_ttl=%lld",
                     j, keys, vkeys, static_cast<long long>(g_pserver->db[j].avg_ttl));
+                /* Share of the old table already moved to the new one */
+                if (dictIsRehashing(d))
+                    info = sdscatprintf(info, ",rehash_progress=%.2f",
+                        (double)d->rehashidx*100/d->ht[0].size);
+                info = sdscat(info,"\r\n");
             }
         }
     }
@@ -5046,6 +5488,8 @@ int main(int argc, char **argv) {
             quicklistTest(argc, argv);
         } else if (!strcasecmp(argv[2], "intset")) {
             return intsetTest(argc, argv);
+        } else if (!strcasecmp(argv[2], "roaring")) {
+            return roaringTest(argc, argv);
         } else if (!strcasecmp(argv[2], "zipmap")) {
             return zipmapTest(argc, argv);
         } else if (!strcasecmp(argv[2], "sha1test")) {
@@ -5056,6 +5500,8 @@ int main(int argc, char **argv) {
             return endianconvTest(argc, argv);
         } else if (!strcasecmp(argv[2], "crc64")) {
             return crc64Test(argc, argv);
+        } else if (!strcasecmp(argv[2], "dict")) {
+            return dictTest(argc, argv);
         } else if (!strcasecmp(argv[2], "zmalloc")) {
             return zmalloc_test(argc, argv);
         }
@@ -5071,6 +5517,7 @@ int main(int argc, char **argv) {
     setlocale(LC_COLLATE,"");
     tzset(); /* Populates 'timezone' global. */
     zmalloc_set_oom_handler(redisOutOfMemoryHandler);
+    crc64Init();
     srand(time(NULL)^getpid());
     gettimeofday(&tv,NULL);
 
@@ -5193,6 +5640,8 @@ int main(int argc, char **argv) {
     } else {
         serverLog(LL_WARNING, "Configuration loaded");
     }
+    serverLog(LL_VERBOSE, "Checksumming with the %s CRC64 implementation",
+        crc64Implementation());
 
     if (cserver.cthreads > (int)std::thread::hardware_concurrency()) {
         serverLog(LL_WARNING, "WARNING: server-threads is greater than this machine's core count.  Truncating to %u threads", std::thread::hardware_concurrency());
@@ -5200,6 +5649,11 @@ int main(int argc, char **argv) {
 	cserver.cthreads = std::max(cserver.cthreads, 1);	// in case of any weird sign overflows
     }
 
+    if (cserver.fNumaAwareLock) {
+        serverLog(LL_NOTICE, "Using the NUMA aware global lock (%d nodes detected)", fastlock_numa_node_count());
+        aeSetNumaAwareLock(true);
+    }
+
     cserver.supervised = redisIsSupervised(cserver.supervised_mode);
     int background = cserver.daemonize && !cserver.supervised;
     if (background) daemonize();
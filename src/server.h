@@ -73,7 +73,9 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
+#include "listpack.h" /* Compact list of strings, used by small hashes and zsets */
 #include "intset.h"  /* Compact integer set structure */
+#include "roaring.h" /* Compressed bitmap, used by large integer sets */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
 #include "latency.h" /* Latency monitor API */
@@ -83,6 +85,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "rax.h"     /* Radix tree */
 #include "uuid.h"
 #include "semiorderedset.h"
+#include "timingwheel.h"
 
 /* Following includes allow test functions to be called from Redis main() */
 #include "zipmap.h"
@@ -161,6 +164,7 @@ public:
 #define CONFIG_MAX_LINE    1024
 #define CRON_DBS_PER_CALL 16
 #define NET_MAX_WRITES_PER_EVENT (1024*64)
+#define NET_MAX_WRITEV_IOV (IOV_MAX < 128 ? IOV_MAX : 128) /* Buffers per writev() call */
 #define PROTO_SHARED_SELECT_CMDS 10
 #define OBJ_SHARED_INTEGERS 10000
 #define OBJ_SHARED_BULKHDR_LEN 32
@@ -196,7 +200,10 @@ public:
 #define CONFIG_DEFAULT_SYSLOG_ENABLED 0
 #define CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR 1
 #define CONFIG_DEFAULT_RDB_COMPRESSION 1
+#define CONFIG_DEFAULT_RDB_COMPRESSION_CODEC RDB_ENC_LZF
+#define CONFIG_DEFAULT_RDB_COMPRESSION_ZSTD_DICT 0
 #define CONFIG_DEFAULT_RDB_CHECKSUM 1
+#define CONFIG_DEFAULT_FORKLESS_BGSAVE 0
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb"
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
@@ -215,6 +222,15 @@ public:
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
 #define CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE 1
 #define CONFIG_DEFAULT_ACTIVE_REHASHING 1
+#define CONFIG_DEFAULT_ASYNC_REHASH 0
+#define CONFIG_DEFAULT_ACTIVE_EXPIRE_WHEEL 0
+#define CONFIG_DEFAULT_KEYSPACE_INLINE_VALUES 0
+#define CONFIG_DEFAULT_RDB_LOAD_THREADS 0
+#define CONFIG_RDB_LOAD_THREADS_MAX 256
+#define CONFIG_DEFAULT_RDB_SAVE_THREADS 0
+#define CONFIG_RDB_SAVE_THREADS_MAX 64
+#define CONFIG_DEFAULT_LIST_COMPRESS_CODEC QUICKLIST_NODE_ENCODING_LZF
+#define CONFIG_DEFAULT_LIST_COMPRESS_ASYNC 0
 #define CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
 #define CONFIG_DEFAULT_RDB_SAVE_INCREMENTAL_FSYNC 1
 #define CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE 0
@@ -241,9 +257,17 @@ public:
 
 #define CONFIG_DEFAULT_THREADS 1
 #define CONFIG_DEFAULT_THREAD_AFFINITY 0
+#define CONFIG_DEFAULT_NUMA_AWARE_LOCK 0
+#define CONFIG_DEFAULT_KEYSPACE_OPEN_ADDRESSING 0
+#define CONFIG_DEFAULT_KEYSPACE_EMBEDDED_KEYS 0
 
 #define CONFIG_DEFAULT_ACTIVE_REPLICA 0
 #define CONFIG_DEFAULT_ENABLE_MULTIMASTER 0
+#define CONFIG_DEFAULT_LOCKLESS_READS 0
+#define CONFIG_DEFAULT_DB_LOCK_STRIPING 1
+#define CONFIG_DEFAULT_LOCK_PROFILING 0
+#define CONFIG_DEFAULT_CLIENT_REBALANCE 0
+#define CONFIG_DEFAULT_LOCK_BATCH_SIZE 0
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 64 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
@@ -262,6 +286,7 @@ public:
 #define PROTO_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+#define PROTO_REPLY_ZEROCOPY_MIN_BYTES (16*1024) /* Bulk values at least this large are referenced, not copied */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
@@ -322,6 +347,7 @@ public:
 #define CMD_CATEGORY_TRANSACTION (1ULL<<35)
 #define CMD_CATEGORY_SCRIPTING (1ULL<<36)
 #define CMD_SKIP_PROPOGATE (1ULL<<37)  /* "noprop" flag */
+#define CMD_GLOBAL (1ULL<<38)           /* "global" flag */
 
 /* AOF states */
 #define AOF_OFF 0             /* AOF is off */
@@ -460,12 +486,14 @@ public:
 #define SUPERVISED_SYSTEMD 2
 #define SUPERVISED_UPSTART 3
 
+/* How connections are spread across the per-thread listeners */
+#define THREAD_STEERING_NONE 0          /* Kernel hashes on the 4-tuple */
+#define THREAD_STEERING_INCOMING_CPU 1  /* SO_INCOMING_CPU on each listener */
+#define THREAD_STEERING_BPF 2           /* Reuseport BPF program selecting by CPU */
+
 /* Anti-warning macro... */
 #define UNUSED(V) ((void) V)
 
-#define ZSKIPLIST_MAXLEVEL 64 /* Should be enough for 2^64 elements */
-#define ZSKIPLIST_P 0.25      /* Skiplist P = 1/4 */
-
 /* Append only defines */
 #define AOF_FSYNC_NO 0
 #define AOF_FSYNC_ALWAYS 1
@@ -473,11 +501,11 @@ public:
 #define CONFIG_DEFAULT_AOF_FSYNC AOF_FSYNC_EVERYSEC
 
 /* Zipped structures related defaults */
-#define OBJ_HASH_MAX_ZIPLIST_ENTRIES 512
-#define OBJ_HASH_MAX_ZIPLIST_VALUE 64
+#define OBJ_HASH_MAX_LISTPACK_ENTRIES 512
+#define OBJ_HASH_MAX_LISTPACK_VALUE 64
 #define OBJ_SET_MAX_INTSET_ENTRIES 512
-#define OBJ_ZSET_MAX_ZIPLIST_ENTRIES 128
-#define OBJ_ZSET_MAX_ZIPLIST_VALUE 64
+#define OBJ_ZSET_MAX_LISTPACK_ENTRIES 128
+#define OBJ_ZSET_MAX_LISTPACK_VALUE 64
 #define OBJ_STREAM_NODE_MAX_BYTES 4096
 #define OBJ_STREAM_NODE_MAX_ENTRIES 100
 
@@ -710,10 +738,13 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_LINKEDLIST 4 /* No longer used: old list encoding. */
 #define OBJ_ENCODING_ZIPLIST 5 /* Encoded as ziplist */
 #define OBJ_ENCODING_INTSET 6  /* Encoded as intset */
-#define OBJ_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
+#define OBJ_ENCODING_SKIPLIST 7  /* No longer used: old zset encoding. */
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
 #define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
 #define OBJ_ENCODING_STREAM 10 /* Encoded as a radix tree of listpacks */
+#define OBJ_ENCODING_BTREE 11  /* Encoded as order statistic B+tree */
+#define OBJ_ENCODING_LISTPACK 12 /* Encoded as a listpack */
+#define OBJ_ENCODING_ROARING 13 /* Encoded as a roaring bitmap */
 
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
@@ -722,6 +753,11 @@ typedef struct RedisModuleDigest {
 #define OBJ_SHARED_REFCOUNT (0x7FFFFFFF) 
 #define OBJ_MVCC_INVALID (0xFFFFFFFFFFFFFFFFULL)
 
+/* With keyspace-inline-values small strings and integers are stored in the
+ * value slot of their keyspace dictEntry instead of a robj.  Such values have
+ * their lowest bit set, which no robj pointer has. */
+#define OBJ_INLINE_TAG 1
+
 #define MVCC_MS_SHIFT 20
 
 typedef struct redisObject {
@@ -746,6 +782,13 @@ public:
 } robj;
 static_assert(sizeof(redisObject) == 24, "object size is critical, don't increase");
 
+inline bool FInlineVal(const void *val) { return ((uintptr_t)val & OBJ_INLINE_TAG) != 0; }
+
+/* Inlined values never expire, a key with an expire always has a robj */
+inline bool FEntryExpires(const dictEntry *de) {
+    return !FInlineVal(dictGetVal(de)) && ((const robj*)dictGetVal(de))->FExpires();
+}
+
 __attribute__((always_inline)) inline const void *ptrFromObj(robj_roptr &o)
 {
     if (o->encoding == OBJ_ENCODING_EMBSTR)
@@ -1006,6 +1049,7 @@ public:
     explicit operator long long() const noexcept { return when(); }
 };
 typedef semiorderedset<expireEntry, const char *, true /*expireEntry can be memmoved*/> expireset;
+typedef timingwheel<const char *> expirewheel;
 
 /* The a string name for an object's type as listed above
  * Native types are checked against the OBJ_STRING, OBJ_LIST, OBJ_* defines,
@@ -1029,11 +1073,17 @@ struct evictionPoolEntry; /* Defined in evict.c */
  * which is actually a linked list of blocks like that, that is: client->reply. */
 typedef struct clientReplyBlock {
     size_t size, used;
+    /* When set the block has no payload of its own and instead references
+     * the string held by this object (see addReplyBulk()).  Such blocks are
+     * always full (size == used) so nothing is ever appended to them. */
+    struct redisObject *pobjRef;
 #ifndef __cplusplus
     char buf[];
 #else
     __attribute__((always_inline)) char *buf()
     {
+        if (pobjRef != nullptr)
+            return reinterpret_cast<char*>(ptrFromObj(pobjRef));
         return reinterpret_cast<char*>(this+1);
     }
 #endif
@@ -1049,6 +1099,7 @@ typedef struct redisDb {
     dict *pdict;                 /* The keyspace for this DB */
     expireset *setexpire;
     expireset::setiter expireitr;
+    expirewheel *wheelexpire = nullptr; /* Due times of setexpire, with active-expire-timing-wheel */
 
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP)*/
     dict *ready_keys;           /* Blocked keys that received a PUSH */
@@ -1251,6 +1302,10 @@ typedef struct client {
 
     int iel; /* the event loop index we're registered with */
     struct fastlock lock;
+
+    /* Load estimate used by client-rebalance */
+    unsigned long commands_processed;
+    unsigned long commands_at_rebalance;
 } client;
 
 struct saveparam {
@@ -1280,34 +1335,65 @@ struct sharedObjectsStruct {
     sds minstring, maxstring;
 };
 
-/* ZSETs use a specialized version of Skiplists */
-struct zskiplistLevel {
-        struct zskiplistNode *forward;
-        unsigned long span;
-};
-typedef struct zskiplistNode {
-    sds ele;
-    double score;
-    struct zskiplistNode *backward;
-    
-#ifdef __cplusplus
-    zskiplistLevel *level(size_t idx) {
-        return reinterpret_cast<zskiplistLevel*>(this+1) + idx;
-    }
-#else
-    struct zskiplistLevel level[];
-#endif
-} zskiplistNode;
-
-typedef struct zskiplist {
-    struct zskiplistNode *header, *tail;
+/* Large ZSETs keep their elements ordered in a B+tree. Leaves pack scores
+ * and elements into parallel arrays and are linked in both directions, so
+ * range scans walk contiguous memory. Inner nodes remember, for every child,
+ * how many elements live below it (giving O(log N) ranks) and a copy of the
+ * greatest score/element below it, so lookups are routed without touching
+ * the children. Both node kinds are sized to fill a 1k allocation. */
+#define ZBTREE_LEAF_SIZE 62
+#define ZBTREE_INNER_SIZE 31
+
+typedef struct zbtreeLeaf {
+    struct zbtreeLeaf *prev, *next;
+    unsigned int count;
+    double score[ZBTREE_LEAF_SIZE];
+    sds ele[ZBTREE_LEAF_SIZE];
+} zbtreeLeaf;
+
+typedef struct zbtreeInner {
+    unsigned int count;
+    unsigned long size[ZBTREE_INNER_SIZE];  /* Elements below each child. */
+    double maxscore[ZBTREE_INNER_SIZE];     /* Greatest element below each child. */
+    sds maxele[ZBTREE_INNER_SIZE];
+    void *child[ZBTREE_INNER_SIZE];         /* zbtreeLeaf when height is 1. */
+} zbtreeInner;
+
+typedef struct zbtree {
+    void *root;                 /* zbtreeLeaf when height is 0. */
+    zbtreeLeaf *head, *tail;
     unsigned long length;
-    int level;
-} zskiplist;
+    int height;                 /* Number of inner levels. */
+} zbtree;
+
+/* An element of a zbtree, as returned by lookups. Positions are invalidated
+ * by any modification of the tree. */
+typedef struct zbtreePos {
+    zbtreeLeaf *leaf;           /* NULL when there is no such element. */
+    unsigned int idx;
+
+    bool valid() const { return leaf != nullptr; }
+    sds ele() const { return leaf->ele[idx]; }
+    double score() const { return leaf->score[idx]; }
+    void next() {
+        if (++idx == leaf->count) {
+            leaf = leaf->next;
+            idx = 0;
+        }
+    }
+    void prev() {
+        if (idx == 0) {
+            leaf = leaf->prev;
+            if (leaf) idx = leaf->count-1;
+        } else {
+            idx--;
+        }
+    }
+} zbtreePos;
 
 typedef struct zset {
-    dict *pdict;
-    zskiplist *zsl;
+    dict *pdict;                /* Element -> score, kept in the entry's v.d */
+    zbtree *zbt;
 } zset;
 
 typedef struct clientBufferLimitsConfig {
@@ -1423,12 +1509,61 @@ struct clusterState;
 #define MAX_EVENT_LOOPS 16
 #define IDX_EVENT_LOOP_MAIN 0
 
+/* Number of changes made to the dataset, see g_pserver->dirty.  Commands run
+ * under their database lock only (see db-lock-striping) update it concurrently,
+ * so besides the total each thread counts the changes it made itself, which is
+ * what call() looks at to decide whether to propagate a command. */
+class dirtycounter
+{
+    std::atomic<long long> m_cchanges {0};
+    static thread_local long long s_cchangesThisThread;
+
+public:
+    operator long long() const
+    {
+        return m_cchanges.load(std::memory_order_relaxed);
+    }
+
+    long long changesThisThread() const
+    {
+        return s_cchangesThisThread;
+    }
+
+    // Resetting the counter must still look like a change to call()
+    dirtycounter &operator=(long long val)
+    {
+        long long old = m_cchanges.exchange(val, std::memory_order_relaxed);
+        s_cchangesThisThread += val - old;
+        return *this;
+    }
+
+    dirtycounter &operator+=(long long val)
+    {
+        m_cchanges.fetch_add(val, std::memory_order_relaxed);
+        s_cchangesThisThread += val;
+        return *this;
+    }
+
+    dirtycounter &operator++()
+    {
+        return *this += 1;
+    }
+
+    long long operator++(int)
+    {
+        long long old = m_cchanges.fetch_add(1, std::memory_order_relaxed);
+        ++s_cchangesThisThread;
+        return old;
+    }
+};
+
 // Per-thread variabels that may be accessed without a lock
 struct redisServerThreadVars {
     aeEventLoop *el;
     int ipfd[CONFIG_BINDADDR_MAX]; /* TCP socket file descriptors */
     int ipfd_count;             /* Used slots in ipfd[] */
     std::vector<client*> clients_pending_write; /* There is to write or install handler. */
+    std::vector<client*> clients_pending_read;  /* Read but not yet processed, see lock-batch-size */
     list *unblocked_clients;     /* list of clients to unblock before next loop NOT THREADSAFE */
     list *clients_pending_asyncwrite;
     int cclients;
@@ -1440,6 +1575,12 @@ struct redisServerThreadVars {
     struct fastlock lockPendingWrite;
     char neterr[ANET_ERR_LEN];   /* Error buffer for anet.c */
     long unsigned commandsExecuted = 0;
+    std::vector<client*> clients_pending_asyncfree;  /* freeClientAsync() calls made while in a lockless read or striped section */
+    redisOpArray also_propagate;    /* Additional command to propagate. */
+    list *ready_keys;               /* Keys signaled while holding only a db lock, see signalKeyAsReady() */
+    long long busy_usec = 0;        /* Time spent outside the poll wait, only kept with client-rebalance */
+    long long wakeup_usec = 0;      /* When the last poll wait returned */
+    std::vector<std::pair<uint64_t, int>> clients_pending_migration;   /* (client id, target thread) picked by rebalanceClients() */
 };
 
 struct redisMaster {
@@ -1479,7 +1620,12 @@ struct redisServerConst {
 
     int cthreads;               /* Number of main worker threads */
     int fThreadAffinity;        /* Should we pin threads to cores? */
+    int fNumaAwareLock;         /* Use the NUMA aware cohort lock for the global lock */
+    int keyspace_open_addressing; /* Keyspace dicts use open addressing tables */
+    int keyspace_embedded_keys; /* Keyspace keys are stored inside their dictEntry */
+    int thread_steering;        /* See THREAD_STEERING_* */
     char *pidfile;              /* PID file path */
+    char *list_compress_zstd_dict; /* zstd dictionary for list nodes, or NULL */
 
     /* Fast pointers to often looked up command */
     struct redisCommand *delCommand, *multiCommand, *lpushCommand,
@@ -1530,6 +1676,8 @@ struct redisServer {
     std::atomic<unsigned int> lruclock;      /* Clock for LRU eviction */
     int shutdown_asap;          /* SHUTDOWN needed ASAP */
     int activerehashing;        /* Incremental rehash in serverCron() */
+    int active_expire_wheel;    /* Expire keys from a timing wheel of due times */
+    int keyspace_inline_values; /* Store small values in their keyspace dictEntry */
     int active_defrag_running;  /* Active defragmentation running (holds current scan aggressiveness) */
     int cronloops;              /* Number of times the cron function run */
     char runid[CONFIG_RUN_ID_SIZE+1];  /* ID always different at every exec. */
@@ -1566,6 +1714,8 @@ struct redisServer {
     off_t loading_loaded_bytes;
     time_t loading_start_time;
     off_t loading_process_events_interval_bytes;
+    long long loading_loaded_keys;  /* Keys added to the dataset so far */
+    int loading_threads;            /* Threads decoding values, 0 if loading serially */
 
     int active_expire_enabled;      /* Can be disabled for testing purposes. */
 
@@ -1590,6 +1740,10 @@ struct redisServer {
     long long stat_sync_full;       /* Number of full resyncs with slaves. */
     long long stat_sync_partial_ok; /* Number of accepted PSYNC requests. */
     long long stat_sync_partial_err;/* Number of unaccepted PSYNC requests. */
+    long long stat_client_migrations;   /* Clients moved by client-rebalance */
+    long long stat_lockless_reads;  /* Commands run without the global lock */
+    long long stat_lockless_reads_locked;   /* ... while another thread held it */
+    long long stat_striped_commands;    /* Commands run under their db lock only */
     list *slowlog;                  /* SLOWLOG list of commands */
     long long slowlog_entry_id;     /* SLOWLOG current entry ID */
     long long slowlog_log_slower_than; /* SLOWLOG time limit (to get logged) */
@@ -1598,6 +1752,8 @@ struct redisServer {
     std::atomic<long long> stat_net_input_bytes; /* Bytes read from network. */
     std::atomic<long long> stat_net_output_bytes; /* Bytes written to network. */
     size_t stat_rdb_cow_bytes;      /* Copy on write bytes during RDB saving. */
+    long long stat_rdb_forkless_preserved_keys; /* Keys preserved by writers during fork-less RDB saving. */
+    long long stat_rdb_forkless_preserved_bytes; /* Their size in the RDB. */
     size_t stat_aof_cow_bytes;      /* Copy on write bytes during AOF rewrite. */
     /* The following two are used to track instantaneous metrics, like
      * number of operations per second, network traffic. */
@@ -1647,15 +1803,23 @@ struct redisServer {
                                       to child process. */
     sds aof_child_diff;             /* AOF diff accumulator child side. */
     /* RDB persistence */
-    long long dirty;                /* Changes to DB from the last save */
+    dirtycounter dirty;             /* Changes to DB from the last save */
     long long dirty_before_bgsave;  /* Used to restore dirty on failed BGSAVE */
     pid_t rdb_child_pid;            /* PID of RDB saving child */
+    struct rdbForklessSave *rdb_forkless_save; /* BGSAVE running on a thread, or NULL */
+    int rdb_forkless_tracking;      /* Writers must preserve keys for rdb_forkless_save */
+    int forkless_bgsave;            /* BGSAVE on a thread instead of a child? */
+    int rdb_forkless_save_delay;    /* Can be set for testing purposes. */
     struct saveparam *saveparams;   /* Save points array for RDB */
     int saveparamslen;              /* Number of saving points */
     char *rdb_filename;             /* Name of RDB file */
     char *rdb_s3bucketpath;         /* Path for AWS S3 backup of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
+    int rdb_compression_codec;      /* RDB_ENC_* codec compressing RDB strings */
+    int rdb_compression_zstd_dict;  /* Train a zstd dictionary for every RDB? */
     int rdb_checksum;               /* Use RDB checksum? */
+    int rdb_load_threads;           /* Threads decoding values while loading an RDB */
+    int rdb_save_threads;           /* Segments of the keyspace saved in parallel */
     time_t lastsave;                /* Unix time of last successful save */
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
@@ -1674,7 +1838,8 @@ struct redisServer {
         unsigned long long magic;   /* Magic value to make sure data is valid. */
     } child_info_data;
     /* Propagation of commands in AOF / replication */
-    redisOpArray also_propagate;    /* Additional command to propagate. */
+    struct fastlock lockPropagate;  /* Serializes propagate() for commands run
+                                       under their db lock only */
     /* Logging */
     char *logfile;                  /* Path of log file */
     int syslog_enabled;             /* Is syslog enabled? */
@@ -1744,11 +1909,11 @@ struct redisServer {
     int sort_bypattern;
     int sort_store;
     /* Zip structure config, see redis.conf for more information  */
-    size_t hash_max_ziplist_entries;
-    size_t hash_max_ziplist_value;
+    size_t hash_max_listpack_entries;
+    size_t hash_max_listpack_value;
     size_t set_max_intset_entries;
-    size_t zset_max_ziplist_entries;
-    size_t zset_max_ziplist_value;
+    size_t zset_max_listpack_entries;
+    size_t zset_max_listpack_value;
     size_t hll_sparse_max_bytes;
     size_t stream_node_max_bytes;
     int64_t stream_node_max_entries;
@@ -1818,6 +1983,10 @@ struct redisServer {
     int watchdog_period;  /* Software watchdog period in ms. 0 = off */
 
     int fActiveReplica;                          /* Can this replica also be a master? */
+    int lockless_reads;                          /* Run simple read commands without the global lock */
+    int db_lock_striping;                        /* Run non global commands under their db lock only */
+    int client_rebalance;                        /* Move busy clients to less loaded threads */
+    int lock_batch_size;                         /* Clients processed per global lock acquisition, 0 = unbatched */
 
     struct fastlock flock;
 
@@ -1896,6 +2065,7 @@ typedef struct {
     int encoding;
     int ii; /* intset iterator */
     dictIterator *di;
+    roaringIterator ri;
 } setTypeIterator;
 
 /* Structure to hold hash iteration abstraction. Note that iteration over
@@ -2054,6 +2224,9 @@ int writeToClient(int fd, client *c, int handler_installed);
 void linkClient(client *c);
 void protectClient(client *c);
 void unprotectClient(client *c);
+void rebalanceClients(void);
+void processClientsPendingMigration(int iel);
+void processClientsPendingRead(int iel);
 
 // Special Thread-safe addReply() commands for posting messages to clients from a different thread
 void addReplyAsync(client *c, robj_roptr obj);
@@ -2147,9 +2320,10 @@ robj *createQuicklistObject(void);
 robj *createZiplistObject(void);
 robj *createSetObject(void);
 robj *createIntsetObject(void);
+robj *createRoaringSetObject(roaring *r);
 robj *createHashObject(void);
 robj *createZsetObject(void);
-robj *createZsetZiplistObject(void);
+robj *createZsetListpackObject(void);
 robj *createStreamObject(void);
 robj *createModuleObject(moduleType *mt, void *value);
 int getLongFromObjectOrReply(client *c, robj *o, long *target, const char *msg);
@@ -2166,6 +2340,11 @@ int collateStringObjects(robj *a, robj *b);
 int equalStringObjects(robj *a, robj *b);
 unsigned long long estimateObjectIdleTime(robj *o);
 void trimStringObjectIfNeeded(robj *o);
+int objectCanInline(robj *o);
+void *objectToInline(robj *o);
+robj *createObjectFromInline(const void *val);
+void autoreleaseObject(robj *o);
+void releaseAutoreleasedObjects(void);
 #define sdsEncodedObject(objptr) (objptr->encoding == OBJ_ENCODING_RAW || objptr->encoding == OBJ_ENCODING_EMBSTR)
 
 /* Synchronous I/O with timeout */
@@ -2221,6 +2400,17 @@ int writeCommandsDeniedByDiskError(void);
 int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi);
 void killRDBChild(void);
 
+/* Fork-less BGSAVE */
+int rdbSaveBackgroundForkless(rdbSaveInfo *rsi);
+void rdbForklessSaveAbort(const char *reason);
+void rdbForklessSaveCheckDone(void);
+void rdbForklessPreserveKey(redisDb *db, sds key);
+
+/* A BGSAVE is running, either in a child or on a thread */
+inline int rdbSaveInProgress(void) {
+    return g_pserver->rdb_child_pid != -1 || g_pserver->rdb_forkless_save != nullptr;
+}
+
 /* AOF persistence */
 void flushAppendOnlyFile(int force);
 void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc);
@@ -2293,13 +2483,15 @@ typedef struct {
     int minex, maxex; /* are min or max exclusive? */
 } zlexrangespec;
 
-zskiplist *zslCreate(void);
-void zslFree(zskiplist *zsl);
-zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele);
+zbtree *zbtCreate(void);
+void zbtFree(zbtree *zbt);
+void zbtInsert(zbtree *zbt, double score, sds ele);
 unsigned char *zzlInsert(unsigned char *zl, sds ele, double score);
-int zslDelete(zskiplist *zsl, double score, sds ele, zskiplistNode **node);
-zskiplistNode *zslFirstInRange(zskiplist *zsl, zrangespec *range);
-zskiplistNode *zslLastInRange(zskiplist *zsl, zrangespec *range);
+int zbtDelete(zbtree *zbt, double score, sds ele, sds *oldele);
+zbtreePos zbtFirst(zbtree *zbt);
+zbtreePos zbtLast(zbtree *zbt);
+zbtreePos zbtFirstInRange(zbtree *zbt, zrangespec *range);
+zbtreePos zbtLastInRange(zbtree *zbt, zrangespec *range);
 double zzlGetScore(unsigned char *sptr);
 void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr);
 void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr);
@@ -2307,22 +2499,23 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range);
 unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range);
 unsigned long zsetLength(robj_roptr zobj);
 void zsetConvert(robj *zobj, int encoding);
-void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen);
+void zsetConvertToListpackIfNeeded(robj *zobj, size_t maxelelen);
 int zsetScore(robj_roptr zobj, sds member, double *score);
-unsigned long zslGetRank(zskiplist *zsl, double score, sds o);
+unsigned long zbtGetRank(zbtree *zbt, double score, sds ele);
+zbtreePos zbtGetElementByRank(zbtree *zbt, unsigned long rank);
 int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore);
 long zsetRank(robj_roptr zobj, sds ele, int reverse);
 int zsetDel(robj *zobj, sds ele);
 void genericZpopCommand(client *c, robj **keyv, int keyc, int where, int emitkey, robj *countarg);
-sds ziplistGetObject(unsigned char *sptr);
+sds lpGetObject(unsigned char *sptr);
 int zslValueGteMin(double value, zrangespec *spec);
 int zslValueLteMax(double value, zrangespec *spec);
 void zslFreeLexRange(zlexrangespec *spec);
 int zslParseLexRange(robj *min, robj *max, zlexrangespec *spec);
 unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range);
 unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range);
-zskiplistNode *zslFirstInLexRange(zskiplist *zsl, zlexrangespec *range);
-zskiplistNode *zslLastInLexRange(zskiplist *zsl, zlexrangespec *range);
+zbtreePos zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range);
+zbtreePos zbtLastInLexRange(zbtree *zbt, zlexrangespec *range);
 int zzlLexValueGteMin(unsigned char *p, zlexrangespec *spec);
 int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec);
 int zslLexValueGteMin(sds value, zlexrangespec *spec);
@@ -2338,7 +2531,7 @@ void setupSignalHandlers(void);
 struct redisCommand *lookupCommand(sds name);
 struct redisCommand *lookupCommandByCString(const char *s);
 struct redisCommand *lookupCommandOrOriginal(sds name);
-void call(client *c, int flags);
+long long call(client *c, int flags);
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int flags);
 void alsoPropagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int target);
 void forceCommandPropagation(client *c, int flags);
@@ -2402,10 +2595,10 @@ unsigned long hashTypeLength(robj_roptr o);
 hashTypeIterator *hashTypeInitIterator(robj_roptr subject);
 void hashTypeReleaseIterator(hashTypeIterator *hi);
 int hashTypeNext(hashTypeIterator *hi);
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
-                                unsigned char **vstr,
-                                unsigned int *vlen,
-                                long long *vll);
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
+                                 unsigned char **vstr,
+                                 unsigned int *vlen,
+                                 long long *vll);
 sds hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what);
 void hashTypeCurrentObject(hashTypeIterator *hi, int what, unsigned char **vstr, unsigned int *vlen, long long *vll);
 sds hashTypeCurrentObjectNewSds(hashTypeIterator *hi, int what);
@@ -2455,6 +2648,7 @@ void objectSetLRUOrLFU(robj *val, long long lfu_freq, long long lru_idle,
 #define LOOKUP_NONE 0
 #define LOOKUP_NOTOUCH (1<<0)
 #define LOOKUP_UPDATEMVCC (1<<1)
+#define LOOKUP_MATERIALIZE (1<<2)
 void dbAdd(redisDb *db, robj *key, robj *val);
 void dbOverwrite(redisDb *db, robj *key, robj *val);
 int dbMerge(redisDb *db, robj *key, robj *val, int fReplace);
@@ -2464,6 +2658,9 @@ robj *dbRandomKey(redisDb *db);
 int dbSyncDelete(redisDb *db, robj *key);
 int dbDelete(redisDb *db, robj *key);
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
+robj *dbEntryValue(dictEntry *de);
+robj *dbMaterializeValue(redisDb *db, dictEntry *de);
+dictType *keyspaceDictType(void);
 
 #define EMPTYDB_NO_FLAGS 0      /* No flags. */
 #define EMPTYDB_ASYNC (1<<0)    /* Reclaim memory in another thread. */
@@ -2472,6 +2669,17 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*));
 int selectDb(client *c, int id);
 void signalModifiedKey(redisDb *db, robj *key);
 void signalFlushedDb(int dbid);
+
+/* Must be called before the key is modified, deleted or created.  Lockless
+ * readers are kept out of the keyspace from then on until the global lock is
+ * released, and a fork-less BGSAVE in progress still saves the key as it was
+ * when it started. */
+inline void dbBeforeWrite(redisDb *db, sds key) {
+    aeExcludeReaders();
+    if (g_pserver->rdb_forkless_tracking)
+        rdbForklessPreserveKey(db, key);
+}
+
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count);
 unsigned int countKeysInSlot(unsigned int hashslot);
 unsigned int delKeysInSlot(unsigned int hashslot);
@@ -2541,6 +2749,8 @@ void blockForKeys(client *c, int btype, robj **keys, int numkeys, mstime_t timeo
 /* expire.c -- Handling of expired keys */
 void activeExpireCycle(int type);
 void expireSlaveKeys(void);
+void expireWheelTrack(redisDb *db, const char *key, long long when);
+void expireWheelReset(redisDb *db);
 void rememberSlaveKeyWithExpire(redisDb *db, robj *key);
 void flushSlaveKeysWithExpireList(void);
 size_t getSlaveKeyWithExpireCount(void);
@@ -2616,6 +2826,7 @@ void saddCommand(client *c);
 void sremCommand(client *c);
 void smoveCommand(client *c);
 void sismemberCommand(client *c);
+void smismemberCommand(client *c);
 void scardCommand(client *c);
 void spopCommand(client *c);
 void srandmemberCommand(client *c);
@@ -2793,6 +3004,7 @@ void enableWatchdog(int period);
 void disableWatchdog(void);
 void watchdogScheduleSignal(int period);
 void serverLogHexDump(int level, const char *descr, void *value, size_t len);
+sds catCodeAddress(sds s, void *addr);
 extern "C" int memtest_preserving_test(unsigned long *m, size_t bytes, int passes);
 void mixDigest(unsigned char *digest, const void *ptr, size_t len);
 void xorDigest(unsigned char *digest, const void *ptr, size_t len);
@@ -2805,6 +3017,11 @@ static inline int GlobalLocksAcquired(void)  // Used in asserts to verify all gl
     return aeThreadOwnsLock() || moduleGILAcquiredByModule() || g_fInCrash;
 }
 
+static inline int CommandLocksAcquired(void)  // Same as above for code also reached by commands run under their db lock only, see db-lock-striping
+{
+    return GlobalLocksAcquired() || aeThreadInStripedSection();
+}
+
 inline int ielFromEventLoop(const aeEventLoop *eventLoop)
 {
     int iel = 0;
@@ -33,7 +33,6 @@
 #include "pqsort.h" /* Partial qsort for SORT+LIMIT */
 #include <math.h> /* isnan() */
 
-zskiplistNode* zslGetElementByRank(zskiplist *zsl, unsigned long rank);
 
 redisSortOperation *createSortOperation(int type, robj *pattern) {
     redisSortOperation *so = (redisSortOperation*)zmalloc(sizeof(*so), MALLOC_LOCAL);
@@ -311,7 +310,7 @@ void sortCommand(client *c) {
 
     /* Destructively convert encoded sorted sets for SORT. */
     if (sortval->type == OBJ_ZSET)
-        zsetConvert(sortval, OBJ_ENCODING_SKIPLIST);
+        zsetConvert(sortval, OBJ_ENCODING_BTREE);
 
     /* Objtain the length of the object to sort. */
     switch(sortval->type) {
@@ -405,8 +404,8 @@ void sortCommand(client *c) {
          * way, just getting the required range, as an optimization. */
 
         zset *zs = (zset*)ptrFromObj(sortval);
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *ln;
+        zbtree *zbt = zs->zbt;
+        zbtreePos ln;
         sds sdsele;
         int rangelen = vectorlen;
 
@@ -414,23 +413,23 @@ void sortCommand(client *c) {
         if (desc) {
             long zsetlen = dictSize(((zset*)ptrFromObj(sortval))->pdict);
 
-            ln = zsl->tail;
+            ln = zbtLast(zbt);
             if (start > 0)
-                ln = zslGetElementByRank(zsl,zsetlen-start);
+                ln = zbtGetElementByRank(zbt,zsetlen-start);
         } else {
-            ln = zsl->header->level(0)->forward;
+            ln = zbtFirst(zbt);
             if (start > 0)
-                ln = zslGetElementByRank(zsl,start+1);
+                ln = zbtGetElementByRank(zbt,start+1);
         }
 
         while(rangelen--) {
-            serverAssertWithInfo(c,sortval,ln != NULL);
-            sdsele = ln->ele;
+            serverAssertWithInfo(c,sortval,ln.valid());
+            sdsele = ln.ele();
             vector[j].obj = createStringObject(sdsele,sdslen(sdsele));
             vector[j].u.score = 0;
             vector[j].u.cmpobj = NULL;
             j++;
-            ln = desc ? ln->backward : ln->level(0)->forward;
+            if (desc) ln.prev(); else ln.next();
         }
         /* Fix start/end: output code is not aware of this optimization. */
         end -= start;
@@ -36,6 +36,39 @@
 void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
                               robj *dstkey, int op);
 
+/* A roaring bitmap only pays off while its members cluster. Once most
+ * containers hold a handful of values, adding a member usually means shifting
+ * the whole container array, so sets that get that sparse are moved to a
+ * hash table. */
+#define SET_ROARING_SPARSE_CONTAINERS 1024
+#define SET_ROARING_MIN_FILL 4
+
+static int setTypeRoaringIsSparse(const roaring *r) {
+    return r->len > SET_ROARING_SPARSE_CONTAINERS &&
+           r->card < (uint64_t)r->len*SET_ROARING_MIN_FILL;
+}
+
+/* Return a new roaring bitmap with the members of an intset or roaring
+ * encoded set. */
+static roaring *setTypeDupRoaring(robj *setobj) {
+    if (setobj->encoding == OBJ_ENCODING_ROARING)
+        return roaringDup((const roaring*)setobj->m_ptr);
+
+    roaring *r = roaringNew();
+    int64_t intele;
+    uint32_t ii = 0;
+    while (intsetGet((intset*)setobj->m_ptr,ii++,&intele)) roaringAdd(r,intele);
+    return r;
+}
+
+/* Return a copy of the intset of an intset encoded set. */
+static intset *setTypeDupIntset(robj *setobj) {
+    size_t len = intsetBlobLen((intset*)setobj->m_ptr);
+    intset *is = (intset*)zmalloc(len, MALLOC_SHARED);
+    memcpy(is,setobj->m_ptr,len);
+    return is;
+}
+
 /* Factory method to return a set that *can* hold "value". When the object has
  * an integer-encodable value, an intset will be returned. Otherwise a regular
  * hash table. */
@@ -64,10 +97,10 @@ int setTypeAdd(robj *subject, const char *value) {
             uint8_t success = 0;
             subject->m_ptr = intsetAdd((intset*)subject->m_ptr,llval,&success);
             if (success) {
-                /* Convert to regular set when the intset contains
+                /* Convert to a roaring bitmap when the intset contains
                  * too many entries. */
                 if (intsetLen((intset*)subject->m_ptr) > g_pserver->set_max_intset_entries)
-                    setTypeConvert(subject,OBJ_ENCODING_HT);
+                    setTypeConvert(subject,OBJ_ENCODING_ROARING);
                 return 1;
             }
         } else {
@@ -79,6 +112,19 @@ int setTypeAdd(robj *subject, const char *value) {
             serverAssert(dictAdd((dict*)subject->m_ptr,sdsdup(value),NULL) == DICT_OK);
             return 1;
         }
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
+            roaring *r = (roaring*)subject->m_ptr;
+            if (roaringAdd(r,llval)) {
+                if (setTypeRoaringIsSparse(r))
+                    setTypeConvert(subject,OBJ_ENCODING_HT);
+                return 1;
+            }
+        } else {
+            setTypeConvert(subject,OBJ_ENCODING_HT);
+            serverAssert(dictAdd((dict*)subject->m_ptr,sdsdup(value),NULL) == DICT_OK);
+            return 1;
+        }
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -98,6 +144,9 @@ int setTypeRemove(robj *setobj, const char *value) {
             setobj->m_ptr = intsetRemove((intset*)setobj->m_ptr,llval,&success);
             if (success) return 1;
         }
+    } else if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK)
+            return roaringRemove((roaring*)setobj->m_ptr,llval);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -112,6 +161,10 @@ int setTypeIsMember(robj_roptr subject, const char *value) {
         if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
             return intsetFind((intset*)subject->m_ptr,llval);
         }
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        if (isSdsRepresentableAsLongLong(value,&llval) == C_OK) {
+            return roaringContains((const roaring*)subject->m_ptr,llval);
+        }
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -126,6 +179,8 @@ setTypeIterator *setTypeInitIterator(robj_roptr subject) {
         si->di = dictGetIterator((dict*)subject->m_ptr);
     } else if (si->encoding == OBJ_ENCODING_INTSET) {
         si->ii = 0;
+    } else if (si->encoding == OBJ_ENCODING_ROARING) {
+        roaringIterInit(&si->ri,(const roaring*)subject->m_ptr);
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -161,6 +216,10 @@ int setTypeNext(setTypeIterator *si, const char **sdsele, int64_t *llele) {
         if (!intsetGet((intset*)si->subject->m_ptr,si->ii++,llele))
             return -1;
         *sdsele = NULL; /* Not needed. Defensive. */
+    } else if (si->encoding == OBJ_ENCODING_ROARING) {
+        if (!roaringIterNext(&si->ri,llele))
+            return -1;
+        *sdsele = NULL; /* Not needed. Defensive. */
     } else {
         serverPanic("Wrong set encoding in setTypeNext");
     }
@@ -183,6 +242,7 @@ sds setTypeNextObject(setTypeIterator *si) {
     switch(encoding) {
         case -1:    return NULL;
         case OBJ_ENCODING_INTSET:
+        case OBJ_ENCODING_ROARING:
             return sdsfromlonglong(intele);
         case OBJ_ENCODING_HT:
             return sdsdup(sdsele);
@@ -194,8 +254,8 @@ sds setTypeNextObject(setTypeIterator *si) {
 
 /* Return random element from a non empty set.
  * The returned element can be a int64_t value if the set is encoded
- * as an "intset" blob of integers, or an SDS string if the set
- * is a regular set.
+ * as an "intset" blob of integers or a roaring bitmap, or an SDS string
+ * if the set is a regular set.
  *
  * The caller provides both pointers to be populated with the right
  * object. The return value of the function is the object->encoding
@@ -213,6 +273,9 @@ int setTypeRandomElement(robj *setobj, sds *sdsele, int64_t *llele) {
     } else if (setobj->encoding == OBJ_ENCODING_INTSET) {
         *llele = intsetRandom((intset*)setobj->m_ptr);
         *sdsele = NULL; /* Not needed. Defensive. */
+    } else if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        *llele = roaringRandom((roaring*)setobj->m_ptr);
+        *sdsele = NULL; /* Not needed. Defensive. */
     } else {
         serverPanic("Unknown set encoding");
     }
@@ -229,18 +292,22 @@ unsigned long setTypeSize(robj_roptr subject) {
         return dictSize((const dict*)subject->m_ptr);
     } else if (subject->encoding == OBJ_ENCODING_INTSET) {
         return intsetLen((const intset*)subject->m_ptr);
+    } else if (subject->encoding == OBJ_ENCODING_ROARING) {
+        return roaringCard((const roaring*)subject->m_ptr);
     } else {
         serverPanic("Unknown set encoding");
     }
 }
 
-/* Convert the set to specified encoding. The resulting dict (when converting
- * to a hash table) is presized to hold the number of elements in the original
- * set. */
+/* Convert the set to specified encoding. Intsets can be converted to a
+ * roaring bitmap or a hash table, roaring bitmaps to a hash table. The
+ * resulting dict (when converting to a hash table) is presized to hold the
+ * number of elements in the original set. */
 void setTypeConvert(robj *setobj, int enc) {
     setTypeIterator *si;
     serverAssertWithInfo(NULL,setobj,setobj->type == OBJ_SET &&
-                             setobj->encoding == OBJ_ENCODING_INTSET);
+                             (setobj->encoding == OBJ_ENCODING_INTSET ||
+                              setobj->encoding == OBJ_ENCODING_ROARING));
 
     if (enc == OBJ_ENCODING_HT) {
         int64_t intele;
@@ -248,7 +315,7 @@ void setTypeConvert(robj *setobj, int enc) {
         const char *element;
 
         /* Presize the dict to avoid rehashing */
-        dictExpand(d,intsetLen((intset*)setobj->m_ptr));
+        dictExpand(d,setTypeSize(setobj));
 
         /* To add the elements we extract integers and create redis objects */
         si = setTypeInitIterator(setobj);
@@ -258,9 +325,19 @@ void setTypeConvert(robj *setobj, int enc) {
         }
         setTypeReleaseIterator(si);
 
+        if (setobj->encoding == OBJ_ENCODING_ROARING)
+            roaringFree((roaring*)setobj->m_ptr);
+        else
+            zfree(setobj->m_ptr);
         setobj->encoding = OBJ_ENCODING_HT;
-        zfree(setobj->m_ptr);
         setobj->m_ptr = d;
+    } else if (enc == OBJ_ENCODING_ROARING &&
+               setobj->encoding == OBJ_ENCODING_INTSET)
+    {
+        roaring *r = setTypeDupRoaring(setobj);
+        zfree(setobj->m_ptr);
+        setobj->encoding = OBJ_ENCODING_ROARING;
+        setobj->m_ptr = r;
     } else {
         serverPanic("Unsupported set conversion");
     }
@@ -387,6 +464,43 @@ void sismemberCommand(client *c) {
         addReply(c,shared.czero);
 }
 
+/* SMISMEMBER key member [member ...]
+ *
+ * Intsets look up all the members in one batch, see intsetFindMany(). */
+void smismemberCommand(client *c) {
+    robj_roptr set = lookupKeyRead(c->db,c->argv[1]);
+    int j, count = c->argc-2;
+
+    if (set != nullptr && checkType(c,set,OBJ_SET)) return;
+
+    addReplyArrayLen(c,count);
+    if (set == nullptr) {
+        for (j = 0; j < count; j++) addReply(c,shared.czero);
+    } else if (set->encoding == OBJ_ENCODING_INTSET) {
+        int64_t *values = (int64_t*)zmalloc(sizeof(int64_t)*count, MALLOC_LOCAL);
+        uint8_t *found = (uint8_t*)zmalloc(count, MALLOC_LOCAL);
+        uint8_t *isint = (uint8_t*)zmalloc(count, MALLOC_LOCAL);
+        for (j = 0; j < count; j++) {
+            long long llval = 0;
+            isint[j] = isSdsRepresentableAsLongLong(szFromObj(c->argv[j+2]),&llval) == C_OK;
+            values[j] = llval;
+        }
+        intsetFindMany((const intset*)set->m_ptr,values,count,found);
+        for (j = 0; j < count; j++)
+            addReply(c,(isint[j] && found[j]) ? shared.cone : shared.czero);
+        zfree(values);
+        zfree(found);
+        zfree(isint);
+    } else {
+        for (j = 0; j < count; j++) {
+            if (setTypeIsMember(set,szFromObj(c->argv[j+2])))
+                addReply(c,shared.cone);
+            else
+                addReply(c,shared.czero);
+        }
+    }
+}
+
 void scardCommand(client *c) {
     robj_roptr o;
 
@@ -484,6 +598,10 @@ void spopWithCountCommand(client *c) {
                 addReplyBulkLongLong(c,llele);
                 objele = createStringObjectFromLongLong(llele);
                 set->m_ptr = intsetRemove((intset*)set->m_ptr,llele,NULL);
+            } else if (encoding == OBJ_ENCODING_ROARING) {
+                addReplyBulkLongLong(c,llele);
+                objele = createStringObjectFromLongLong(llele);
+                roaringRemove((roaring*)set->m_ptr,llele);
             } else {
                 addReplyBulkCBuffer(c,sdsele,sdslen(sdsele));
                 objele = createStringObject(sdsele,sdslen(sdsele));
@@ -510,10 +628,10 @@ void spopWithCountCommand(client *c) {
         /* Create a new set with just the remaining elements. */
         while(remaining--) {
             encoding = setTypeRandomElement(set,&sdsele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
-                sdsele = sdsfromlonglong(llele);
-            } else {
+            if (encoding == OBJ_ENCODING_HT) {
                 sdsele = sdsdup(sdsele);
+            } else {
+                sdsele = sdsfromlonglong(llele);
             }
             if (!newset) newset = setTypeCreate(sdsele);
             setTypeAdd(newset,sdsele);
@@ -525,12 +643,12 @@ void spopWithCountCommand(client *c) {
         setTypeIterator *si;
         si = setTypeInitIterator(set);
         while((encoding = setTypeNext(si,&sdsele,&llele)) != -1) {
-            if (encoding == OBJ_ENCODING_INTSET) {
-                addReplyBulkLongLong(c,llele);
-                objele = createStringObjectFromLongLong(llele);
-            } else {
+            if (encoding == OBJ_ENCODING_HT) {
                 addReplyBulkCBuffer(c,sdsele,sdslen(sdsele));
                 objele = createStringObject(sdsele,sdslen(sdsele));
+            } else {
+                addReplyBulkLongLong(c,llele);
+                objele = createStringObjectFromLongLong(llele);
             }
 
             /* Replicate/AOF this command as an SREM operation */
@@ -581,6 +699,9 @@ void spopCommand(client *c) {
     if (encoding == OBJ_ENCODING_INTSET) {
         ele = createStringObjectFromLongLong(llele);
         set->m_ptr = intsetRemove((intset*)set->m_ptr,llele,NULL);
+    } else if (encoding == OBJ_ENCODING_ROARING) {
+        ele = createStringObjectFromLongLong(llele);
+        roaringRemove((roaring*)set->m_ptr,llele);
     } else {
         ele = createStringObject(sdsele,sdslen(sdsele));
         setTypeRemove(set,szFromObj(ele));
@@ -655,10 +776,10 @@ void srandmemberWithCountCommand(client *c) {
         addReplySetLen(c,count);
         while(count--) {
             encoding = setTypeRandomElement(set,&ele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
-                addReplyBulkLongLong(c,llele);
-            } else {
+            if (encoding == OBJ_ENCODING_HT) {
                 addReplyBulkCBuffer(c,ele,sdslen(ele));
+            } else {
+                addReplyBulkLongLong(c,llele);
             }
         }
         return;
@@ -692,10 +813,10 @@ void srandmemberWithCountCommand(client *c) {
         while((encoding = setTypeNext(si,&ele,&llele)) != -1) {
             int retval = DICT_ERR;
 
-            if (encoding == OBJ_ENCODING_INTSET) {
-                retval = dictAdd(d,createStringObjectFromLongLong(llele),NULL);
-            } else {
+            if (encoding == OBJ_ENCODING_HT) {
                 retval = dictAdd(d,createStringObject(ele,sdslen(ele)),NULL);
+            } else {
+                retval = dictAdd(d,createStringObjectFromLongLong(llele),NULL);
             }
             serverAssert(retval == DICT_OK);
         }
@@ -722,10 +843,10 @@ void srandmemberWithCountCommand(client *c) {
 
         while(added < count) {
             encoding = setTypeRandomElement(set,&ele,&llele);
-            if (encoding == OBJ_ENCODING_INTSET) {
-                objele = createStringObjectFromLongLong(llele);
-            } else {
+            if (encoding == OBJ_ENCODING_HT) {
                 objele = createStringObject(ele,sdslen(ele));
+            } else {
+                objele = createStringObjectFromLongLong(llele);
             }
             /* Try to add the object to the dictionary. If it already exists
              * free it, otherwise increment the number of objects we have
@@ -769,10 +890,10 @@ void srandmemberCommand(client *c) {
         == nullptr || checkType(c,set,OBJ_SET)) return;
 
     encoding = setTypeRandomElement(set,&ele,&llele);
-    if (encoding == OBJ_ENCODING_INTSET) {
-        addReplyBulkLongLong(c,llele);
-    } else {
+    if (encoding == OBJ_ENCODING_HT) {
         addReplyBulkCBuffer(c,ele,sdslen(ele));
+    } else {
+        addReplyBulkLongLong(c,llele);
     }
 }
 
@@ -794,6 +915,134 @@ int qsortCompareSetsByRevCardinality(const void *s1, const void *s2) {
     return 0;
 }
 
+/* Return 1 if every existing set in 'sets' holds only integers and at least
+ * one of them is a roaring bitmap, so that the whole operation can be carried
+ * out on bitmaps a container at a time. */
+static int setOpCanUseRoaring(robj **sets, unsigned long setnum) {
+    int found = 0;
+    for (unsigned long j = 0; j < setnum; j++) {
+        if (!sets[j]) continue;
+        if (sets[j]->encoding == OBJ_ENCODING_ROARING) found = 1;
+        else if (sets[j]->encoding != OBJ_ENCODING_INTSET) return 0;
+    }
+    return found;
+}
+
+/* r = fn(r, setobj) where setobj is an intset or roaring encoded set. */
+static void setOpRoaringApply(roaring *r, robj *setobj,
+                              void (*fn)(roaring*, const roaring*))
+{
+    if (setobj->encoding == OBJ_ENCODING_ROARING) {
+        fn(r,(const roaring*)setobj->m_ptr);
+    } else {
+        roaring *tmp = setTypeDupRoaring(setobj);
+        fn(r,tmp);
+        roaringFree(tmp);
+    }
+}
+
+/* Reply with the members of 'r', or store them into 'dstkey' when it is not
+ * NULL, the same way the generic set operations do. Small results become
+ * intsets like they would when built one element at a time. Takes ownership
+ * of 'r'. */
+static void setOpRoaringReplyOrStore(client *c, roaring *r, robj *dstkey,
+                                     const char *event)
+{
+    roaringIterator ri;
+    int64_t intele;
+
+    if (!dstkey) {
+        addReplySetLen(c,roaringCard(r));
+        roaringIterInit(&ri,r);
+        while (roaringIterNext(&ri,&intele)) addReplyBulkLongLong(c,intele);
+        roaringFree(r);
+        return;
+    }
+
+    int deleted = dbDelete(c->db,dstkey);
+    if (roaringCard(r) > 0) {
+        robj *dstset;
+        if (roaringCard(r) <= g_pserver->set_max_intset_entries) {
+            dstset = createIntsetObject();
+            roaringIterInit(&ri,r);
+            while (roaringIterNext(&ri,&intele))
+                dstset->m_ptr = intsetAdd((intset*)dstset->m_ptr,intele,NULL);
+            roaringFree(r);
+        } else {
+            dstset = createRoaringSetObject(r);
+            if (setTypeRoaringIsSparse(r))
+                setTypeConvert(dstset,OBJ_ENCODING_HT);
+        }
+        dbAdd(c->db,dstkey,dstset);
+        addReplyLongLong(c,setTypeSize(dstset));
+        notifyKeyspaceEvent(NOTIFY_SET,event,dstkey,c->db->id);
+    } else {
+        roaringFree(r);
+        addReply(c,shared.czero);
+        if (deleted)
+            notifyKeyspaceEvent(NOTIFY_GENERIC,"del",
+                dstkey,c->db->id);
+    }
+    signalModifiedKey(c->db,dstkey);
+    g_pserver->dirty++;
+}
+
+/* Return 1 if every existing set in 'sets' is an intset, so that the whole
+ * operation can be carried out merging sorted arrays. */
+static int setOpCanUseIntset(robj **sets, unsigned long setnum) {
+    for (unsigned long j = 0; j < setnum; j++)
+        if (sets[j] && sets[j]->encoding != OBJ_ENCODING_INTSET) return 0;
+    return 1;
+}
+
+/* is = fn(is, setobj) where setobj is an intset encoded set. */
+static intset *setOpIntsetApply(intset *is, robj *setobj,
+                                intset *(*fn)(const intset*, const intset*))
+{
+    intset *res = fn(is,(const intset*)setobj->m_ptr);
+    zfree(is);
+    return res;
+}
+
+/* Like setOpRoaringReplyOrStore() for a result held in an intset. A union
+ * can outgrow set-max-intset-entries, in which case the stored set is
+ * converted the same way SADD would. Takes ownership of 'is'. */
+static void setOpIntsetReplyOrStore(client *c, intset *is, robj *dstkey,
+                                    const char *event)
+{
+    int64_t intele;
+    uint32_t ii = 0;
+
+    if (!dstkey) {
+        addReplySetLen(c,intsetLen(is));
+        while (intsetGet(is,ii++,&intele)) addReplyBulkLongLong(c,intele);
+        zfree(is);
+        return;
+    }
+
+    int deleted = dbDelete(c->db,dstkey);
+    if (intsetLen(is) > 0) {
+        robj *dstset = createObject(OBJ_SET,is);
+        dstset->encoding = OBJ_ENCODING_INTSET;
+        if (intsetLen(is) > g_pserver->set_max_intset_entries) {
+            setTypeConvert(dstset,OBJ_ENCODING_ROARING);
+            if (setTypeRoaringIsSparse((roaring*)dstset->m_ptr))
+                setTypeConvert(dstset,OBJ_ENCODING_HT);
+        }
+        dbAdd(c->db,dstkey,dstset);
+        addReplyLongLong(c,setTypeSize(dstset));
+        notifyKeyspaceEvent(NOTIFY_SET,event,dstkey,c->db->id);
+    } else {
+        zfree(is);
+        addReply(c,shared.czero);
+        if (deleted)
+            notifyKeyspaceEvent(NOTIFY_GENERIC,"del",
+                dstkey,c->db->id);
+    }
+    signalModifiedKey(c->db,dstkey);
+    g_pserver->dirty++;
+}
+
 void sinterGenericCommand(client *c, robj **setkeys,
                           unsigned long setnum, robj *dstkey) {
     robj **sets = (robj**)zmalloc(sizeof(robj*)*setnum, MALLOC_SHARED);
@@ -835,6 +1084,30 @@ void sinterGenericCommand(client *c, robj **setkeys,
      * algorithm's performance */
     qsort(sets,setnum,sizeof(robj*),qsortCompareSetsByCardinality);
 
+    /* When even the smallest set is a roaring bitmap intersect whole
+     * containers instead of probing the other sets element by element. */
+    if (sets[0]->encoding == OBJ_ENCODING_ROARING &&
+        setOpCanUseRoaring(sets,setnum))
+    {
+        roaring *r = roaringDup((const roaring*)sets[0]->m_ptr);
+        for (j = 1; j < setnum && roaringCard(r); j++)
+            setOpRoaringApply(r,sets[j],roaringAnd);
+        setOpRoaringReplyOrStore(c,r,dstkey,"sinterstore");
+        zfree(sets);
+        return;
+    }
+
+    /* Intsets are intersected merging their sorted arrays, galloping
+     * through the larger ones. */
+    if (setOpCanUseIntset(sets,setnum)) {
+        intset *is = setTypeDupIntset(sets[0]);
+        for (j = 1; j < setnum && intsetLen(is); j++)
+            is = setOpIntsetApply(is,sets[j],intsetIntersect);
+        setOpIntsetReplyOrStore(c,is,dstkey,"sinterstore");
+        zfree(sets);
+        return;
+    }
+
     /* The first thing we should output is the total number of elements...
      * since this is a multi-bulk write, but at this stage we don't know
      * the intersection set size, so we use a trick, append an empty object
@@ -855,12 +1128,17 @@ void sinterGenericCommand(client *c, robj **setkeys,
     while((encoding = setTypeNext(si,&elesds,&intobj)) != -1) {
         for (j = 1; j < setnum; j++) {
             if (sets[j] == sets[0]) continue;
-            if (encoding == OBJ_ENCODING_INTSET) {
-                /* intset with intset is simple... and fast */
+            if (encoding != OBJ_ENCODING_HT) {
+                /* integers against intsets and bitmaps are simple... and
+                 * fast */
                 if (sets[j]->encoding == OBJ_ENCODING_INTSET &&
                     !intsetFind((intset*)sets[j]->m_ptr,intobj))
                 {
                     break;
+                } else if (sets[j]->encoding == OBJ_ENCODING_ROARING &&
+                           !roaringContains((roaring*)sets[j]->m_ptr,intobj))
+                {
+                    break;
                 /* in order to compare an integer with an object we
                  * have to use the generic function, creating an object
                  * for this */
@@ -888,12 +1166,12 @@ void sinterGenericCommand(client *c, robj **setkeys,
                     addReplyBulkLongLong(c,intobj);
                 cardinality++;
             } else {
-                if (encoding == OBJ_ENCODING_INTSET) {
-                    elesds = sdsfromlonglong(intobj);
+                if (encoding == OBJ_ENCODING_HT) {
                     setTypeAdd(dstset,elesds);
-                    sdsfree(elesds);
                 } else {
+                    elesds = sdsfromlonglong(intobj);
                     setTypeAdd(dstset,elesds);
+                    sdsfree(elesds);
                 }
             }
         }
@@ -960,6 +1238,45 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum,
         sets[j] = setobj;
     }
 
+    /* Integer only sets involving at least one roaring bitmap are combined
+     * a container at a time. */
+    if (setOpCanUseRoaring(sets,setnum)) {
+        roaring *r;
+
+        if (op == SET_OP_UNION) {
+            r = roaringNew();
+            for (j = 0; j < setnum; j++)
+                if (sets[j]) setOpRoaringApply(r,sets[j],roaringOr);
+        } else {
+            r = sets[0] ? setTypeDupRoaring(sets[0]) : roaringNew();
+            for (j = 1; j < setnum && roaringCard(r); j++)
+                if (sets[j]) setOpRoaringApply(r,sets[j],roaringAndNot);
+        }
+        setOpRoaringReplyOrStore(c,r,dstkey,
+            op == SET_OP_UNION ? "sunionstore" : "sdiffstore");
+        zfree(sets);
+        return;
+    }
+
+    /* The same for intsets, merging their sorted arrays. */
+    if (setOpCanUseIntset(sets,setnum)) {
+        intset *is;
+
+        if (op == SET_OP_UNION) {
+            is = intsetNew();
+            for (j = 0; j < setnum; j++)
+                if (sets[j]) is = setOpIntsetApply(is,sets[j],intsetUnion);
+        } else {
+            is = sets[0] ? setTypeDupIntset(sets[0]) : intsetNew();
+            for (j = 1; j < setnum && intsetLen(is); j++)
+                if (sets[j]) is = setOpIntsetApply(is,sets[j],intsetDifference);
+        }
+        setOpIntsetReplyOrStore(c,is,dstkey,
+            op == SET_OP_UNION ? "sunionstore" : "sdiffstore");
+        zfree(sets);
+        return;
+    }
+
     /* Select what DIFF algorithm to use.
      *
      * Algorithm 1 is O(N*M) where N is the size of the element first set
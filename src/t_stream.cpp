@@ -1477,6 +1477,8 @@ void xreadCommand(client *c) {
     for (int i = 0; i < streams_count; i++) {
         robj_roptr o = lookupKeyRead(c->db,c->argv[streams_arg+i]);
         if (o == nullptr) continue;
+        /* Serving a group updates its consumers and pending entries */
+        if (groupname) dbBeforeWrite(c->db,szFromObj(c->argv[streams_arg+i]));
         stream *s = (stream*)ptrFromObj(o);
         streamID *gt = ids+i; /* ID must be greater than this. */
         int serve_synchronously = 0;
@@ -1898,6 +1900,7 @@ void xackCommand(client *c) {
         addReply(c,shared.czero);
         return;
     }
+    dbBeforeWrite(c->db,szFromObj(c->argv[1]));
 
     int acknowledged = 0;
     for (int j = 3; j < c->argc; j++) {
@@ -2211,6 +2214,10 @@ void xclaimCommand(client *c) {
         }
     }
 
+    /* The claims change the PEL and consumers of the group even though the
+     * key was looked up for reading. */
+    dbBeforeWrite(c->db,szFromObj(c->argv[1]));
+
     if (streamCompareID(&last_id,&group->last_id) > 0) {
         group->last_id = last_id;
         propagate_last_id = 1;
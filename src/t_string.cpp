@@ -353,9 +353,11 @@ void incrDecrCommand(client *c, long long incr) {
     }
     value += incr;
 
+    /* Values that can be inlined in the keyspace are stored anew rather than
+     * updated in place, so they go back to their inlined form. */
     if (o && o->getrefcount(std::memory_order_relaxed) == 1 && o->encoding == OBJ_ENCODING_INT &&
         (value < 0 || value >= OBJ_SHARED_INTEGERS) &&
-        value >= LONG_MIN && value <= LONG_MAX)
+        value >= LONG_MIN && value <= LONG_MAX && !objectCanInline(o))
     {
         newObj = o;
         o->m_ptr = (void*)((long)value);
@@ -37,266 +37,569 @@
  * data structure.
  *
  * The elements are added to a hash table mapping Redis objects to scores.
- * At the same time the elements are added to a skip list mapping scores
+ * At the same time the elements are added to a B+tree mapping scores
  * to Redis objects (so objects are sorted by scores in this "view").
  *
  * Note that the SDS string representing the element is the same in both
- * the hash table and skiplist in order to save memory. What we do in order
+ * the hash table and the B+tree in order to save memory. What we do in order
  * to manage the shared SDS string more easily is to free the SDS string
- * only in zslFreeNode(). The dictionary has no value free method set.
+ * only when it leaves the B+tree. The dictionary has no key free method set.
  * So we should always remove an element from the dictionary, and later from
- * the skiplist.
+ * the B+tree.
  *
- * This skiplist implementation is almost a C translation of the original
- * algorithm described by William Pugh in "Skip Lists: A Probabilistic
- * Alternative to Balanced Trees", modified in three ways:
- * a) this implementation allows for repeated scores.
- * b) the comparison is not just by key (our 'score') but by satellite data.
- * c) there is a back pointer, so it's a doubly linked list with the back
- * pointers being only at "level 1". This allows to traverse the list
- * from tail to head, useful for ZREVRANGE. */
+ * The B+tree stores elements only in its leaves, sorted by score and then
+ * by element, with repeated scores allowed. Leaves are doubly linked so
+ * ZRANGE and ZREVRANGE can scan in both directions, and every inner node
+ * keeps the element count of each subtree, which is what ZRANK and the
+ * rank based ranges use to skip whole subtrees. Compared to a skiplist the
+ * per element overhead is a fraction of the forward/backward pointers and
+ * lookups touch a handful of contiguous nodes instead of a random chain. */
 
 #include "server.h"
 #include <math.h>
 
 /*-----------------------------------------------------------------------------
- * Skiplist implementation of the low level API
+ * B+tree implementation of the low level API
  *----------------------------------------------------------------------------*/
 
 int zslLexValueGteMin(sds value, zlexrangespec *spec);
 int zslLexValueLteMax(sds value, zlexrangespec *spec);
 
-/* Create a skiplist node with the specified number of levels.
- * The SDS string 'ele' is referenced by the node after the call. */
-zskiplistNode *zslCreateNode(int level, double score, sds ele) {
-    zskiplistNode *zn = (zskiplistNode*)
-        zmalloc(sizeof(*zn)+level*sizeof(struct zskiplistLevel), MALLOC_SHARED);
-    zn->score = score;
-    zn->ele = ele;
-    return zn;
+/* Nodes that drop below these fill levels after a removal are merged with
+ * or refilled from a sibling. */
+#define ZBTREE_LEAF_MIN (ZBTREE_LEAF_SIZE/4)
+#define ZBTREE_INNER_MIN (ZBTREE_INNER_SIZE/4)
+
+static zbtreeLeaf *zbtCreateLeaf(void) {
+    zbtreeLeaf *leaf = (zbtreeLeaf*)zmalloc(sizeof(*leaf), MALLOC_SHARED);
+    leaf->prev = leaf->next = NULL;
+    leaf->count = 0;
+    return leaf;
 }
 
-/* Create a new skiplist. */
-zskiplist *zslCreate(void) {
-    int j;
-    zskiplist *zsl;
-
-    zsl = (zskiplist*)zmalloc(sizeof(*zsl), MALLOC_SHARED);
-    zsl->level = 1;
-    zsl->length = 0;
-    zsl->header = zslCreateNode(ZSKIPLIST_MAXLEVEL,0,NULL);
-    for (j = 0; j < ZSKIPLIST_MAXLEVEL; j++) {
-        zsl->header->level(j)->forward = NULL;
-        zsl->header->level(j)->span = 0;
-    }
-    zsl->header->backward = NULL;
-    zsl->tail = NULL;
-    return zsl;
-}
-
-/* Free the specified skiplist node. The referenced SDS string representation
- * of the element is freed too, unless node->ele is set to NULL before calling
- * this function. */
-void zslFreeNode(zskiplistNode *node) {
-    sdsfree(node->ele);
+static zbtreeInner *zbtCreateInner(void) {
+    zbtreeInner *in = (zbtreeInner*)zmalloc(sizeof(*in), MALLOC_SHARED);
+    in->count = 0;
+    return in;
+}
+
+/* Create a new, empty, B+tree. */
+zbtree *zbtCreate(void) {
+    zbtree *zbt = (zbtree*)zmalloc(sizeof(*zbt), MALLOC_SHARED);
+    zbtreeLeaf *leaf = zbtCreateLeaf();
+    zbt->root = leaf;
+    zbt->head = zbt->tail = leaf;
+    zbt->length = 0;
+    zbt->height = 0;
+    return zbt;
+}
+
+/* Free the nodes of a subtree. The elements are released as well when
+ * 'freeele' is true. */
+static void zbtFreeNode(void *node, int height, int freeele) {
+    if (height == 0) {
+        zbtreeLeaf *leaf = (zbtreeLeaf*)node;
+        if (freeele) {
+            for (unsigned int j = 0; j < leaf->count; j++)
+                sdsfree(leaf->ele[j]);
+        }
+    } else {
+        zbtreeInner *in = (zbtreeInner*)node;
+        for (unsigned int j = 0; j < in->count; j++)
+            zbtFreeNode(in->child[j],height-1,freeele);
+    }
     zfree(node);
 }
 
-/* Free a whole skiplist. */
-void zslFree(zskiplist *zsl) {
-    zskiplistNode *node = zsl->header->level(0)->forward, *next;
+/* Free a whole B+tree, including the referenced SDS strings. */
+void zbtFree(zbtree *zbt) {
+    zbtFreeNode(zbt->root,zbt->height,1);
+    zfree(zbt);
+}
 
-    zfree(zsl->header);
-    while(node) {
-        next = node->level(0)->forward;
-        zslFreeNode(node);
-        node = next;
+/* Number of entries (elements or children) stored directly in a node. */
+static inline unsigned int zbtNodeCount(void *node, int height) {
+    return height ? ((zbtreeInner*)node)->count : ((zbtreeLeaf*)node)->count;
+}
+
+/* Number of elements stored below a node. */
+static unsigned long zbtNodeSize(void *node, int height) {
+    if (height == 0) return ((zbtreeLeaf*)node)->count;
+    zbtreeInner *in = (zbtreeInner*)node;
+    unsigned long size = 0;
+    for (unsigned int j = 0; j < in->count; j++) size += in->size[j];
+    return size;
+}
+
+/* Refresh the copy of the greatest element of child 'i' kept by 'in'. The
+ * child must not be empty. */
+static void zbtUpdateMax(zbtreeInner *in, unsigned int i, int height) {
+    void *child = in->child[i];
+    if (height == 0) {
+        zbtreeLeaf *leaf = (zbtreeLeaf*)child;
+        in->maxscore[i] = leaf->score[leaf->count-1];
+        in->maxele[i] = leaf->ele[leaf->count-1];
+    } else {
+        zbtreeInner *cin = (zbtreeInner*)child;
+        in->maxscore[i] = cin->maxscore[cin->count-1];
+        in->maxele[i] = cin->maxele[cin->count-1];
     }
-    zfree(zsl);
 }
 
-/* Returns a random level for the new skiplist node we are going to create.
- * The return value of this function is between 1 and ZSKIPLIST_MAXLEVEL
- * (both inclusive), with a powerlaw-alike distribution where higher
- * levels are less likely to be returned. */
-int zslRandomLevel(void) {
-    int level = 1;
-    while ((random()&0xFFFF) < (ZSKIPLIST_P * 0xFFFF))
-        level += 1;
-    return (level<ZSKIPLIST_MAXLEVEL) ? level : ZSKIPLIST_MAXLEVEL;
+/* Refresh both the size and the greatest element of child 'i'. */
+static void zbtUpdateEntry(zbtreeInner *in, unsigned int i, int height) {
+    in->size[i] = zbtNodeSize(in->child[i],height);
+    zbtUpdateMax(in,i,height);
 }
 
-/* Insert a new node in the skiplist. Assumes the element does not already
- * exist (up to the caller to enforce that). The skiplist takes ownership
- * of the passed SDS string 'ele'. */
-zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele) {
-    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
-    unsigned int rank[ZSKIPLIST_MAXLEVEL];
-    int i, level;
+/* Returns true if the element score/ele sorts before score2/ele2. */
+static inline int zbtLess(double score, sds ele, double score2, sds ele2) {
+    return score < score2 || (score == score2 && sdscmp(ele,ele2) < 0);
+}
 
-    serverAssert(!std::isnan(score));
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        /* store rank that is crossed to reach the insert position */
-        rank[i] = i == (zsl->level-1) ? 0 : rank[i+1];
-        while (x->level(i)->forward &&
-                (x->level(i)->forward->score < score ||
-                    (x->level(i)->forward->score == score &&
-                    sdscmp(x->level(i)->forward->ele,ele) < 0)))
-        {
-            rank[i] += x->level(i)->span;
-            x = x->level(i)->forward;
-        }
-        update[i] = x;
+/* Index of the first of the 'count' elements of the sorted arrays 'scores'
+ * and 'eles' for which before() is false, or 'count' if there is none. The
+ * predicate must be true for a prefix of the elements and false for the
+ * rest, which is the case for all the range and element lookups. */
+template<typename BEFORE>
+static inline unsigned int zbtLowerBound(const double *scores, const sds *eles,
+                                         unsigned int count, BEFORE before)
+{
+    unsigned int lo = 0, hi = count;
+    while (lo < hi) {
+        unsigned int mid = (lo+hi)/2;
+        if (before(scores[mid],eles[mid]))
+            lo = mid+1;
+        else
+            hi = mid;
     }
-    /* we assume the element is not already inside, since we allow duplicated
-     * scores, reinserting the same element should never happen since the
-     * caller of zslInsert() should test in the hash table if the element is
-     * already inside or not. */
-    level = zslRandomLevel();
-    if (level > zsl->level) {
-        for (i = zsl->level; i < level; i++) {
-            rank[i] = 0;
-            update[i] = zsl->header;
-            update[i]->level(i)->span = zsl->length;
+    return lo;
+}
+
+/* Return the first element of the tree for which before() is false, and
+ * when 'rank' is not NULL, the number of elements preceding it. The returned
+ * position is not valid if before() is true for every element. */
+template<typename BEFORE>
+static zbtreePos zbtSeek(zbtree *zbt, BEFORE before, unsigned long *rank) {
+    void *node = zbt->root;
+    unsigned long traversed = 0;
+
+    for (int h = zbt->height; h > 0; h--) {
+        zbtreeInner *in = (zbtreeInner*)node;
+        /* The last child also receives what sorts after every element. */
+        unsigned int i = zbtLowerBound(in->maxscore,in->maxele,in->count-1,before);
+        if (rank) {
+            for (unsigned int j = 0; j < i; j++) traversed += in->size[j];
         }
-        zsl->level = level;
+        node = in->child[i];
     }
-    x = zslCreateNode(level,score,ele);
-    for (i = 0; i < level; i++) {
-        x->level(i)->forward = update[i]->level(i)->forward;
-        update[i]->level(i)->forward = x;
 
-        /* update span covered by update[i] as x is inserted here */
-        x->level(i)->span = update[i]->level(i)->span - (rank[0] - rank[i]);
-        update[i]->level(i)->span = (rank[0] - rank[i]) + 1;
+    zbtreeLeaf *leaf = (zbtreeLeaf*)node;
+    zbtreePos pos;
+    pos.idx = zbtLowerBound(leaf->score,leaf->ele,leaf->count,before);
+    pos.leaf = leaf;
+    if (rank) *rank = traversed + pos.idx;
+    if (pos.idx == leaf->count) {
+        pos.leaf = leaf->next;
+        pos.idx = 0;
     }
+    return pos;
+}
 
-    /* increment span for untouched levels */
-    for (i = level; i < zsl->level; i++) {
-        update[i]->level(i)->span++;
-    }
+/* Return the position of the element with the given score and element, if
+ * it exists. Its 0-based rank is stored in 'rank' when not NULL. */
+static zbtreePos zbtFind(zbtree *zbt, double score, sds ele, unsigned long *rank) {
+    zbtreePos pos = zbtSeek(zbt, [&](double s, sds e) {
+        return zbtLess(s,e,score,ele);
+    }, rank);
+    if (pos.valid() && (pos.score() != score || sdscmp(pos.ele(),ele) != 0))
+        pos.leaf = NULL;
+    return pos;
+}
+
+zbtreePos zbtFirst(zbtree *zbt) {
+    zbtreePos pos = {zbt->length ? zbt->head : NULL, 0};
+    return pos;
+}
+
+zbtreePos zbtLast(zbtree *zbt) {
+    zbtreePos pos = {zbt->length ? zbt->tail : NULL, 0};
+    if (pos.leaf) pos.idx = pos.leaf->count-1;
+    return pos;
+}
 
-    x->backward = (update[0] == zsl->header) ? NULL : update[0];
-    if (x->level(0)->forward)
-        x->level(0)->forward->backward = x;
+/* Move the second half of a full leaf into a new leaf linked after it, and
+ * return the new leaf. Elements from index 'split' on are moved. */
+static zbtreeLeaf *zbtSplitLeaf(zbtree *zbt, zbtreeLeaf *leaf, unsigned int split) {
+    zbtreeLeaf *right = zbtCreateLeaf();
+    right->count = leaf->count - split;
+    memcpy(right->score,leaf->score+split,sizeof(double)*right->count);
+    memcpy(right->ele,leaf->ele+split,sizeof(sds)*right->count);
+    leaf->count = split;
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next)
+        leaf->next->prev = right;
+    else
+        zbt->tail = right;
+    leaf->next = right;
+    return right;
+}
+
+static zbtreeInner *zbtSplitInner(zbtreeInner *in, unsigned int split) {
+    zbtreeInner *right = zbtCreateInner();
+    right->count = in->count - split;
+    memcpy(right->size,in->size+split,sizeof(unsigned long)*right->count);
+    memcpy(right->maxscore,in->maxscore+split,sizeof(double)*right->count);
+    memcpy(right->maxele,in->maxele+split,sizeof(sds)*right->count);
+    memcpy(right->child,in->child+split,sizeof(void*)*right->count);
+    in->count = split;
+    return right;
+}
+
+/* Pick where to split a full node that is about to receive a new entry at
+ * 'idx'. Nodes are normally split in half, but when a node at the very end
+ * of the tree grows at its end (or one at the very start grows at its
+ * start) the old node is left full: loading sorted input, like an RDB file,
+ * then produces densely packed nodes instead of half empty ones.
+ * Returns the split point, and sets 'left' to whether the new entry belongs
+ * to the left node. */
+static unsigned int zbtSplitPoint(unsigned int count, unsigned int idx,
+                                  int first, int last, int *left)
+{
+    if (last && idx == count) {
+        *left = 0;
+        return count;
+    } else if (first && idx <= 1) {
+        /* An inner node grows at index 1 when its first child splits. */
+        *left = 1;
+        return idx;
+    }
+    *left = idx <= count/2;
+    return count/2;
+}
+
+static void zbtLeafInsertAt(zbtreeLeaf *leaf, unsigned int idx, double score, sds ele) {
+    memmove(leaf->score+idx+1,leaf->score+idx,sizeof(double)*(leaf->count-idx));
+    memmove(leaf->ele+idx+1,leaf->ele+idx,sizeof(sds)*(leaf->count-idx));
+    leaf->score[idx] = score;
+    leaf->ele[idx] = ele;
+    leaf->count++;
+}
+
+static void zbtInnerInsertAt(zbtreeInner *in, unsigned int idx, void *child, int height) {
+    unsigned int tomove = in->count-idx;
+    memmove(in->size+idx+1,in->size+idx,sizeof(unsigned long)*tomove);
+    memmove(in->maxscore+idx+1,in->maxscore+idx,sizeof(double)*tomove);
+    memmove(in->maxele+idx+1,in->maxele+idx,sizeof(sds)*tomove);
+    memmove(in->child+idx+1,in->child+idx,sizeof(void*)*tomove);
+    in->child[idx] = child;
+    in->count++;
+    zbtUpdateEntry(in,idx,height);
+}
+
+/* Insert score/ele in the subtree rooted at 'node'. 'first' and 'last' tell
+ * if the node is the leftmost / rightmost one of its level. When the node had
+ * to be split, the new right sibling is returned so the caller can link it,
+ * otherwise NULL is returned. */
+static void *zbtInsertNode(zbtree *zbt, void *node, int height, int first,
+                           int last, double score, sds ele)
+{
+    auto before = [&](double s, sds e) { return zbtLess(s,e,score,ele); };
+    int left;
+
+    if (height == 0) {
+        zbtreeLeaf *leaf = (zbtreeLeaf*)node;
+        unsigned int idx = zbtLowerBound(leaf->score,leaf->ele,leaf->count,before);
+        if (leaf->count < ZBTREE_LEAF_SIZE) {
+            zbtLeafInsertAt(leaf,idx,score,ele);
+            return NULL;
+        }
+        unsigned int split = zbtSplitPoint(leaf->count,idx,first,last,&left);
+        zbtreeLeaf *right = zbtSplitLeaf(zbt,leaf,split);
+        if (left)
+            zbtLeafInsertAt(leaf,idx,score,ele);
+        else
+            zbtLeafInsertAt(right,idx-split,score,ele);
+        return right;
+    }
+
+    zbtreeInner *in = (zbtreeInner*)node;
+    unsigned int i = zbtLowerBound(in->maxscore,in->maxele,in->count-1,before);
+    void *newchild = zbtInsertNode(zbt,in->child[i],height-1,
+                                   first && i == 0,last && i == in->count-1,
+                                   score,ele);
+    if (newchild == NULL) {
+        in->size[i]++;
+        zbtUpdateMax(in,i,height-1);
+        return NULL;
+    }
+
+    /* The child was split: account for the new sibling at i+1. */
+    zbtUpdateEntry(in,i,height-1);
+    if (in->count < ZBTREE_INNER_SIZE) {
+        zbtInnerInsertAt(in,i+1,newchild,height-1);
+        return NULL;
+    }
+    unsigned int split = zbtSplitPoint(in->count,i+1,first,last,&left);
+    zbtreeInner *right = zbtSplitInner(in,split);
+    if (left)
+        zbtInnerInsertAt(in,i+1,newchild,height-1);
+    else
+        zbtInnerInsertAt(right,i+1-split,newchild,height-1);
+    return right;
+}
+
+/* Insert a new element in the B+tree. Assumes the element does not already
+ * exist (up to the caller to enforce that). The tree takes ownership of the
+ * passed SDS string 'ele'. */
+void zbtInsert(zbtree *zbt, double score, sds ele) {
+    serverAssert(!std::isnan(score));
+    void *right = zbtInsertNode(zbt,zbt->root,zbt->height,1,1,score,ele);
+    if (right) {
+        /* The root was split: grow the tree by one level. */
+        zbtreeInner *root = zbtCreateInner();
+        root->child[0] = zbt->root;
+        root->count = 1;
+        zbtUpdateEntry(root,0,zbt->height);
+        zbtInnerInsertAt(root,1,right,zbt->height);
+        zbt->root = root;
+        zbt->height++;
+    }
+    zbt->length++;
+}
+
+/* Unlink a leaf that is about to be freed from the leaves list. */
+static void zbtUnlinkLeaf(zbtree *zbt, zbtreeLeaf *leaf) {
+    if (leaf->prev)
+        leaf->prev->next = leaf->next;
+    else
+        zbt->head = leaf->next;
+    if (leaf->next)
+        leaf->next->prev = leaf->prev;
     else
-        zsl->tail = x;
-    zsl->length++;
-    return x;
-}
-
-/* Internal function used by zslDelete, zslDeleteByScore and zslDeleteByRank */
-void zslDeleteNode(zskiplist *zsl, zskiplistNode *x, zskiplistNode **update) {
-    int i;
-    for (i = 0; i < zsl->level; i++) {
-        if (update[i]->level(i)->forward == x) {
-            update[i]->level(i)->span += x->level(i)->span - 1;
-            update[i]->level(i)->forward = x->level(i)->forward;
+        zbt->tail = leaf->prev;
+}
+
+/* Move 'n' entries from the start of node 'b' to the end of node 'a', or
+ * when 'n' is negative, -n entries from the end of 'a' to the start of 'b'. */
+static void zbtShiftEntries(void *a, void *b, int n, int height) {
+    if (height == 0) {
+        zbtreeLeaf *l = (zbtreeLeaf*)a, *r = (zbtreeLeaf*)b;
+        if (n > 0) {
+            memcpy(l->score+l->count,r->score,sizeof(double)*n);
+            memcpy(l->ele+l->count,r->ele,sizeof(sds)*n);
+            memmove(r->score,r->score+n,sizeof(double)*(r->count-n));
+            memmove(r->ele,r->ele+n,sizeof(sds)*(r->count-n));
         } else {
-            update[i]->level(i)->span -= 1;
+            n = -n;
+            memmove(r->score+n,r->score,sizeof(double)*r->count);
+            memmove(r->ele+n,r->ele,sizeof(sds)*r->count);
+            memcpy(r->score,l->score+l->count-n,sizeof(double)*n);
+            memcpy(r->ele,l->ele+l->count-n,sizeof(sds)*n);
+            n = -n;
+        }
+        l->count += n;
+        r->count -= n;
+    } else {
+        zbtreeInner *l = (zbtreeInner*)a, *r = (zbtreeInner*)b;
+        if (n > 0) {
+            memcpy(l->size+l->count,r->size,sizeof(unsigned long)*n);
+            memcpy(l->maxscore+l->count,r->maxscore,sizeof(double)*n);
+            memcpy(l->maxele+l->count,r->maxele,sizeof(sds)*n);
+            memcpy(l->child+l->count,r->child,sizeof(void*)*n);
+            memmove(r->size,r->size+n,sizeof(unsigned long)*(r->count-n));
+            memmove(r->maxscore,r->maxscore+n,sizeof(double)*(r->count-n));
+            memmove(r->maxele,r->maxele+n,sizeof(sds)*(r->count-n));
+            memmove(r->child,r->child+n,sizeof(void*)*(r->count-n));
+        } else {
+            n = -n;
+            memmove(r->size+n,r->size,sizeof(unsigned long)*r->count);
+            memmove(r->maxscore+n,r->maxscore,sizeof(double)*r->count);
+            memmove(r->maxele+n,r->maxele,sizeof(sds)*r->count);
+            memmove(r->child+n,r->child,sizeof(void*)*r->count);
+            memcpy(r->size,l->size+l->count-n,sizeof(unsigned long)*n);
+            memcpy(r->maxscore,l->maxscore+l->count-n,sizeof(double)*n);
+            memcpy(r->maxele,l->maxele+l->count-n,sizeof(sds)*n);
+            memcpy(r->child,l->child+l->count-n,sizeof(void*)*n);
+            n = -n;
+        }
+        l->count += n;
+        r->count -= n;
+    }
+}
+
+/* Remove the entry at 'idx' of an inner node, without freeing the child. */
+static void zbtInnerRemoveAt(zbtreeInner *in, unsigned int idx) {
+    unsigned int tomove = in->count-idx-1;
+    memmove(in->size+idx,in->size+idx+1,sizeof(unsigned long)*tomove);
+    memmove(in->maxscore+idx,in->maxscore+idx+1,sizeof(double)*tomove);
+    memmove(in->maxele+idx,in->maxele+idx+1,sizeof(sds)*tomove);
+    memmove(in->child+idx,in->child+idx+1,sizeof(void*)*tomove);
+    in->count--;
+}
+
+/* Child 'i' of 'in' went under its minimum fill after a removal: merge it
+ * with a sibling when both fit in a single node, otherwise even out the
+ * entries of the two. Empty children are always dropped, so that the leaves
+ * list never contains empty leaves. */
+static void zbtRebalance(zbtree *zbt, zbtreeInner *in, unsigned int i, int height) {
+    unsigned int cap = height ? ZBTREE_INNER_SIZE : ZBTREE_LEAF_SIZE;
+
+    if (in->count == 1) {
+        /* No sibling to work with: only happens at the root, or at the
+         * right edge of the tree right after an appending split. */
+        if (zbtNodeCount(in->child[0],height) == 0) {
+            if (height == 0) zbtUnlinkLeaf(zbt,(zbtreeLeaf*)in->child[0]);
+            zbtFreeNode(in->child[0],height,0);
+            in->count = 0;
+        } else {
+            zbtUpdateMax(in,0,height);
         }
+        return;
     }
-    if (x->level(0)->forward) {
-        x->level(0)->forward->backward = x->backward;
+
+    unsigned int l = (i+1 < in->count) ? i : i-1;
+    void *a = in->child[l], *b = in->child[l+1];
+    unsigned int ca = zbtNodeCount(a,height), cb = zbtNodeCount(b,height);
+
+    if (ca+cb <= cap) {
+        zbtShiftEntries(a,b,cb,height);
+        if (height == 0) zbtUnlinkLeaf(zbt,(zbtreeLeaf*)b);
+        zbtFreeNode(b,height,0);
+        in->size[l] += in->size[l+1];
+        zbtInnerRemoveAt(in,l+1);
+        if (ca+cb == 0) {
+            /* Both children are empty: only possible when an inner node
+             * lost its last grandchild. Drop the remaining one too. */
+            if (height == 0) zbtUnlinkLeaf(zbt,(zbtreeLeaf*)a);
+            zbtFreeNode(a,height,0);
+            zbtInnerRemoveAt(in,l);
+        } else {
+            zbtUpdateMax(in,l,height);
+        }
     } else {
-        zsl->tail = x->backward;
+        zbtShiftEntries(a,b,(int)((ca+cb)/2)-(int)ca,height);
+        zbtUpdateEntry(in,l,height);
+        zbtUpdateEntry(in,l+1,height);
     }
-    while(zsl->level > 1 && zsl->header->level(zsl->level-1)->forward == NULL)
-        zsl->level--;
-    zsl->length--;
 }
 
-/* Delete an element with matching score/element from the skiplist.
- * The function returns 1 if the node was found and deleted, otherwise
- * 0 is returned.
+/* Remove up to 'count' consecutive elements starting at the 0-based 'rank'
+ * from the subtree rooted at 'node'. Only elements stored in the same leaf
+ * as 'rank' are removed: the number of removed elements is returned.
  *
- * If 'node' is NULL the deleted node is freed by zslFreeNode(), otherwise
- * it is not freed (but just unlinked) and *node is set to the node pointer,
- * so that it is possible for the caller to reuse the node (including the
- * referenced SDS string at node->ele). */
-int zslDelete(zskiplist *zsl, double score, sds ele, zskiplistNode **node) {
-    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
-    int i;
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level(i)->forward &&
-                (x->level(i)->forward->score < score ||
-                    (x->level(i)->forward->score == score &&
-                     sdscmp(x->level(i)->forward->ele,ele) < 0)))
-        {
-            x = x->level(i)->forward;
-        }
-        update[i] = x;
+ * The removed elements are deleted from 'dict' too when it is not NULL.
+ * When 'oldele' is not NULL the SDS string of the (single) removed element
+ * is returned there instead of being freed. */
+static unsigned long zbtDeleteRunNode(zbtree *zbt, void *node, int height,
+                                      unsigned long rank, unsigned long count,
+                                      dict *dict, sds *oldele)
+{
+    if (height == 0) {
+        zbtreeLeaf *leaf = (zbtreeLeaf*)node;
+        unsigned int idx = rank;
+        serverAssert(rank < leaf->count);
+        if (count > leaf->count-idx) count = leaf->count-idx;
+        for (unsigned int j = idx; j < idx+count; j++) {
+            if (dict) dictDelete(dict,leaf->ele[j]);
+            if (oldele)
+                *oldele = leaf->ele[j];
+            else
+                sdsfree(leaf->ele[j]);
+        }
+        unsigned int tomove = leaf->count-idx-count;
+        memmove(leaf->score+idx,leaf->score+idx+count,sizeof(double)*tomove);
+        memmove(leaf->ele+idx,leaf->ele+idx+count,sizeof(sds)*tomove);
+        leaf->count -= count;
+        return count;
+    }
+
+    zbtreeInner *in = (zbtreeInner*)node;
+    unsigned int i = 0;
+    while (rank >= in->size[i]) rank -= in->size[i++];
+    unsigned long removed = zbtDeleteRunNode(zbt,in->child[i],height-1,
+                                             rank,count,dict,oldele);
+    in->size[i] -= removed;
+    unsigned int min = (height-1) ? ZBTREE_INNER_MIN : ZBTREE_LEAF_MIN;
+    if (zbtNodeCount(in->child[i],height-1) < min)
+        zbtRebalance(zbt,in,i,height-1);
+    else
+        zbtUpdateMax(in,i,height-1);
+    return removed;
+}
+
+/* Remove 'count' elements starting at the 0-based 'rank'. */
+static void zbtDeleteRange(zbtree *zbt, unsigned long rank, unsigned long count,
+                           dict *dict, sds *oldele)
+{
+    while (count) {
+        unsigned long removed = zbtDeleteRunNode(zbt,zbt->root,zbt->height,
+                                                 rank,count,dict,oldele);
+        zbt->length -= removed;
+        count -= removed;
+    }
+
+    if (zbt->length == 0) {
+        /* Start again from an empty leaf. */
+        zbtFreeNode(zbt->root,zbt->height,0);
+        zbtreeLeaf *leaf = zbtCreateLeaf();
+        zbt->root = leaf;
+        zbt->head = zbt->tail = leaf;
+        zbt->height = 0;
+        return;
     }
-    /* We may have multiple elements with the same score, what we need
-     * is to find the element with both the right score and object. */
-    x = x->level(0)->forward;
-    if (x && score == x->score && sdscmp(x->ele,ele) == 0) {
-        zslDeleteNode(zsl, x, update);
-        if (!node)
-            zslFreeNode(x);
-        else
-            *node = x;
-        return 1;
+
+    /* Shrink the tree while the root has a single child. */
+    while (zbt->height && ((zbtreeInner*)zbt->root)->count == 1) {
+        zbtreeInner *root = (zbtreeInner*)zbt->root;
+        zbt->root = root->child[0];
+        zbt->height--;
+        zfree(root);
     }
-    return 0; /* not found */
 }
 
-/* Update the score of an elmenent inside the sorted set skiplist.
+/* Delete an element with matching score/element from the B+tree.
+ * The function returns 1 if the element was found and deleted, otherwise
+ * 0 is returned.
+ *
+ * If 'oldele' is NULL the SDS string of the element is freed, otherwise it
+ * is returned there so that it is possible for the caller to reuse it. */
+int zbtDelete(zbtree *zbt, double score, sds ele, sds *oldele) {
+    unsigned long rank;
+    zbtreePos pos = zbtFind(zbt,score,ele,&rank);
+    if (!pos.valid()) return 0; /* not found */
+    zbtDeleteRange(zbt,rank,1,NULL,oldele);
+    return 1;
+}
+
+/* Update the score of an element inside the sorted set B+tree.
  * Note that the element must exist and must match 'score'.
  * This function does not update the score in the hash table side, the
  * caller should take care of it.
  *
- * Note that this function attempts to just update the node, in case after
- * the score update, the node would be exactly at the same position.
- * Otherwise the skiplist is modified by removing and re-adding a new
- * element, which is more costly.
- *
- * The function returns the updated element skiplist node pointer. */
-zskiplistNode *zslUpdateScore(zskiplist *zsl, double curscore, sds ele, double newscore) {
-    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
-    int i;
-
-    /* We need to seek to element to update to start: this is useful anyway,
-     * we'll have to update or remove it. */
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level(i)->forward &&
-                (x->level(i)->forward->score < curscore ||
-                    (x->level(i)->forward->score == curscore &&
-                     sdscmp(x->level(i)->forward->ele,ele) < 0)))
-        {
-            x = x->level(i)->forward;
+ * When the element keeps its position after the update and is not the
+ * greatest one of its leaf (whose copy lives in the inner nodes), just its
+ * score is rewritten. Otherwise it is removed and inserted again. */
+void zbtUpdateScore(zbtree *zbt, double curscore, sds ele, double newscore) {
+    zbtreePos pos = zbtFind(zbt,curscore,ele,NULL);
+    serverAssert(pos.valid());
+
+    zbtreeLeaf *leaf = pos.leaf;
+    unsigned int idx = pos.idx;
+    if (idx+1 < leaf->count && leaf->score[idx+1] > newscore) {
+        zbtreePos prev = pos;
+        prev.prev();
+        if (!prev.valid() || prev.score() < newscore) {
+            leaf->score[idx] = newscore;
+            return;
         }
-        update[i] = x;
-    }
-
-    /* Jump to our element: note that this function assumes that the
-     * element with the matching score exists. */
-    x = x->level(0)->forward;
-    serverAssert(x && curscore == x->score && sdscmp(x->ele,ele) == 0);
-
-    /* If the node, after the score update, would be still exactly
-     * at the same position, we can just update the score without
-     * actually removing and re-inserting the element in the skiplist. */
-    if ((x->backward == NULL || x->backward->score < newscore) &&
-        (x->level(0)->forward == NULL || x->level(0)->forward->score > newscore))
-    {
-        x->score = newscore;
-        return x;
     }
 
-    /* No way to reuse the old node: we need to remove and insert a new
-     * one at a different place. */
-    zslDeleteNode(zsl, x, update);
-    zskiplistNode *newnode = zslInsert(zsl,newscore,x->ele);
-    /* We reused the old node x->ele SDS string, free the node now
-     * since zslInsert created a new one. */
-    x->ele = NULL;
-    zslFreeNode(x);
-    return newnode;
+    sds oldele;
+    serverAssert(zbtDelete(zbt,curscore,ele,&oldele));
+    zbtInsert(zbt,newscore,oldele);
 }
 
 int zslValueGteMin(double value, zrangespec *spec) {
@@ -308,212 +611,137 @@ int zslValueLteMax(double value, zrangespec *spec) {
 }
 
 /* Returns if there is a part of the zset is in range. */
-int zslIsInRange(zskiplist *zsl, zrangespec *range) {
-    zskiplistNode *x;
-
+int zbtIsInRange(zbtree *zbt, zrangespec *range) {
     /* Test for ranges that will always be empty. */
     if (range->min > range->max ||
             (range->min == range->max && (range->minex || range->maxex)))
         return 0;
-    x = zsl->tail;
-    if (x == NULL || !zslValueGteMin(x->score,range))
-        return 0;
-    x = zsl->header->level(0)->forward;
-    if (x == NULL || !zslValueLteMax(x->score,range))
+    if (zbt->length == 0 ||
+        !zslValueGteMin(zbtLast(zbt).score(),range) ||
+        !zslValueLteMax(zbtFirst(zbt).score(),range))
         return 0;
     return 1;
 }
 
-/* Find the first node that is contained in the specified range.
- * Returns NULL when no element is contained in the range. */
-zskiplistNode *zslFirstInRange(zskiplist *zsl, zrangespec *range) {
-    zskiplistNode *x;
-    int i;
+/* Find the first element that is contained in the specified range.
+ * Returns an invalid position when no element is contained in the range. */
+zbtreePos zbtFirstInRange(zbtree *zbt, zrangespec *range) {
+    zbtreePos pos = {NULL, 0};
 
     /* If everything is out of range, return early. */
-    if (!zslIsInRange(zsl,range)) return NULL;
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        /* Go forward while *OUT* of range. */
-        while (x->level(i)->forward &&
-            !zslValueGteMin(x->level(i)->forward->score,range))
-                x = x->level(i)->forward;
-    }
+    if (!zbtIsInRange(zbt,range)) return pos;
 
-    /* This is an inner range, so the next node cannot be NULL. */
-    x = x->level(0)->forward;
-    serverAssert(x != NULL);
+    pos = zbtSeek(zbt, [&](double s, sds) {
+        return !zslValueGteMin(s,range);
+    }, NULL);
 
     /* Check if score <= max. */
-    if (!zslValueLteMax(x->score,range)) return NULL;
-    return x;
+    if (pos.valid() && !zslValueLteMax(pos.score(),range)) pos.leaf = NULL;
+    return pos;
 }
 
-/* Find the last node that is contained in the specified range.
- * Returns NULL when no element is contained in the range. */
-zskiplistNode *zslLastInRange(zskiplist *zsl, zrangespec *range) {
-    zskiplistNode *x;
-    int i;
+/* Find the last element that is contained in the specified range.
+ * Returns an invalid position when no element is contained in the range. */
+zbtreePos zbtLastInRange(zbtree *zbt, zrangespec *range) {
+    zbtreePos pos = {NULL, 0};
 
     /* If everything is out of range, return early. */
-    if (!zslIsInRange(zsl,range)) return NULL;
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        /* Go forward while *IN* range. */
-        while (x->level(i)->forward &&
-            zslValueLteMax(x->level(i)->forward->score,range))
-                x = x->level(i)->forward;
-    }
-
-    /* This is an inner range, so this node cannot be NULL. */
-    serverAssert(x != NULL);
+    if (!zbtIsInRange(zbt,range)) return pos;
+
+    /* Seek the first element past the range, and step back. */
+    pos = zbtSeek(zbt, [&](double s, sds) {
+        return zslValueLteMax(s,range);
+    }, NULL);
+    if (pos.valid())
+        pos.prev();
+    else
+        pos = zbtLast(zbt);
 
     /* Check if score >= min. */
-    if (!zslValueGteMin(x->score,range)) return NULL;
-    return x;
-}
-
-/* Delete all the elements with score between min and max from the skiplist.
+    if (pos.valid() && !zslValueGteMin(pos.score(),range)) pos.leaf = NULL;
+    return pos;
+}
+
+/* Return the 0-based ranks delimiting the elements in the specified score
+ * range: elements from 'start' (included) to 'end' (excluded). */
+static void zbtRangeRanks(zbtree *zbt, zrangespec *range,
+                          unsigned long *start, unsigned long *end)
+{
+    zbtSeek(zbt, [&](double s, sds) {
+        return !zslValueGteMin(s,range);
+    }, start);
+    zbtSeek(zbt, [&](double s, sds) {
+        return zslValueLteMax(s,range);
+    }, end);
+    if (*end < *start) *end = *start;
+}
+
+static void zbtLexRangeRanks(zbtree *zbt, zlexrangespec *range,
+                             unsigned long *start, unsigned long *end)
+{
+    zbtSeek(zbt, [&](double, sds e) {
+        return !zslLexValueGteMin(e,range);
+    }, start);
+    zbtSeek(zbt, [&](double, sds e) {
+        return zslLexValueLteMax(e,range);
+    }, end);
+    if (*end < *start) *end = *start;
+}
+
+/* Delete all the elements with score between min and max from the B+tree.
  * Min and max are inclusive, so a score >= min || score <= max is deleted.
  * Note that this function takes the reference to the hash table view of the
  * sorted set, in order to remove the elements from the hash table too. */
-unsigned long zslDeleteRangeByScore(zskiplist *zsl, zrangespec *range, dict *dict) {
-    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
-    unsigned long removed = 0;
-    int i;
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level(i)->forward && (range->minex ?
-            x->level(i)->forward->score <= range->min :
-            x->level(i)->forward->score < range->min))
-                x = x->level(i)->forward;
-        update[i] = x;
-    }
-
-    /* Current node is the last with score < or <= min. */
-    x = x->level(0)->forward;
-
-    /* Delete nodes while in range. */
-    while (x &&
-           (range->maxex ? x->score < range->max : x->score <= range->max))
-    {
-        zskiplistNode *next = x->level(0)->forward;
-        zslDeleteNode(zsl,x,update);
-        dictDelete(dict,x->ele);
-        zslFreeNode(x); /* Here is where x->ele is actually released. */
-        removed++;
-        x = next;
-    }
-    return removed;
-}
+unsigned long zbtDeleteRangeByScore(zbtree *zbt, zrangespec *range, dict *dict) {
+    unsigned long start, end;
 
-unsigned long zslDeleteRangeByLex(zskiplist *zsl, zlexrangespec *range, dict *dict) {
-    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
-    unsigned long removed = 0;
-    int i;
-
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level(i)->forward &&
-            !zslLexValueGteMin(x->level(i)->forward->ele,range))
-                x = x->level(i)->forward;
-        update[i] = x;
-    }
+    zbtRangeRanks(zbt,range,&start,&end);
+    zbtDeleteRange(zbt,start,end-start,dict,NULL);
+    return end-start;
+}
 
-    /* Current node is the last with score < or <= min. */
-    x = x->level(0)->forward;
+unsigned long zbtDeleteRangeByLex(zbtree *zbt, zlexrangespec *range, dict *dict) {
+    unsigned long start, end;
 
-    /* Delete nodes while in range. */
-    while (x && zslLexValueLteMax(x->ele,range)) {
-        zskiplistNode *next = x->level(0)->forward;
-        zslDeleteNode(zsl,x,update);
-        dictDelete(dict,x->ele);
-        zslFreeNode(x); /* Here is where x->ele is actually released. */
-        removed++;
-        x = next;
-    }
-    return removed;
+    zbtLexRangeRanks(zbt,range,&start,&end);
+    zbtDeleteRange(zbt,start,end-start,dict,NULL);
+    return end-start;
 }
 
-/* Delete all the elements with rank between start and end from the skiplist.
+/* Delete all the elements with rank between start and end from the B+tree.
  * Start and end are inclusive. Note that start and end need to be 1-based */
-unsigned long zslDeleteRangeByRank(zskiplist *zsl, unsigned int start, unsigned int end, dict *dict) {
-    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
-    unsigned long traversed = 0, removed = 0;
-    int i;
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level(i)->forward && (traversed + x->level(i)->span) < start) {
-            traversed += x->level(i)->span;
-            x = x->level(i)->forward;
-        }
-        update[i] = x;
-    }
-
-    traversed++;
-    x = x->level(0)->forward;
-    while (x && traversed <= end) {
-        zskiplistNode *next = x->level(0)->forward;
-        zslDeleteNode(zsl,x,update);
-        dictDelete(dict,x->ele);
-        zslFreeNode(x);
-        removed++;
-        traversed++;
-        x = next;
-    }
-    return removed;
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned int start, unsigned int end, dict *dict) {
+    if (end > zbt->length) end = zbt->length;
+    if (start > end) return 0;
+    zbtDeleteRange(zbt,start-1,end-start+1,dict,NULL);
+    return end-start+1;
 }
 
 /* Find the rank for an element by both score and key.
  * Returns 0 when the element cannot be found, rank otherwise.
- * Note that the rank is 1-based due to the span of zsl->header to the
- * first element. */
-unsigned long zslGetRank(zskiplist *zsl, double score, sds ele) {
-    zskiplistNode *x;
-    unsigned long rank = 0;
-    int i;
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level(i)->forward &&
-            (x->level(i)->forward->score < score ||
-                (x->level(i)->forward->score == score &&
-                sdscmp(x->level(i)->forward->ele,ele) <= 0))) {
-            rank += x->level(i)->span;
-            x = x->level(i)->forward;
-        }
-
-        /* x might be equal to zsl->header, so test if obj is non-NULL */
-        if (x->ele && sdscmp(x->ele,ele) == 0) {
-            return rank;
-        }
-    }
-    return 0;
+ * Note that the rank is 1-based. */
+unsigned long zbtGetRank(zbtree *zbt, double score, sds ele) {
+    unsigned long rank;
+    zbtreePos pos = zbtFind(zbt,score,ele,&rank);
+    return pos.valid() ? rank+1 : 0;
 }
 
 /* Finds an element by its rank. The rank argument needs to be 1-based. */
-zskiplistNode* zslGetElementByRank(zskiplist *zsl, unsigned long rank) {
-    zskiplistNode *x;
-    unsigned long traversed = 0;
-    int i;
+zbtreePos zbtGetElementByRank(zbtree *zbt, unsigned long rank) {
+    zbtreePos pos = {NULL, 0};
+    if (rank == 0 || rank > zbt->length) return pos;
 
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        while (x->level(i)->forward && (traversed + x->level(i)->span) <= rank)
-        {
-            traversed += x->level(i)->span;
-            x = x->level(i)->forward;
-        }
-        if (traversed == rank) {
-            return x;
-        }
+    void *node = zbt->root;
+    rank--;
+    for (int h = zbt->height; h > 0; h--) {
+        zbtreeInner *in = (zbtreeInner*)node;
+        unsigned int i = 0;
+        while (rank >= in->size[i]) rank -= in->size[i++];
+        node = in->child[i];
     }
-    return NULL;
+    pos.leaf = (zbtreeLeaf*)node;
+    pos.idx = rank;
+    return pos;
 }
 
 /* Populate the rangespec according to the objects min and max. */
@@ -648,75 +876,59 @@ int zslLexValueLteMax(sds value, zlexrangespec *spec) {
 }
 
 /* Returns if there is a part of the zset is in the lex range. */
-int zslIsInLexRange(zskiplist *zsl, zlexrangespec *range) {
-    zskiplistNode *x;
-
+int zbtIsInLexRange(zbtree *zbt, zlexrangespec *range) {
     /* Test for ranges that will always be empty. */
     int cmp = sdscmplex(range->min,range->max);
     if (cmp > 0 || (cmp == 0 && (range->minex || range->maxex)))
         return 0;
-    x = zsl->tail;
-    if (x == NULL || !zslLexValueGteMin(x->ele,range))
-        return 0;
-    x = zsl->header->level(0)->forward;
-    if (x == NULL || !zslLexValueLteMax(x->ele,range))
+    if (zbt->length == 0 ||
+        !zslLexValueGteMin(zbtLast(zbt).ele(),range) ||
+        !zslLexValueLteMax(zbtFirst(zbt).ele(),range))
         return 0;
     return 1;
 }
 
-/* Find the first node that is contained in the specified lex range.
- * Returns NULL when no element is contained in the range. */
-zskiplistNode *zslFirstInLexRange(zskiplist *zsl, zlexrangespec *range) {
-    zskiplistNode *x;
-    int i;
+/* Find the first element that is contained in the specified lex range.
+ * Returns an invalid position when no element is contained in the range. */
+zbtreePos zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range) {
+    zbtreePos pos = {NULL, 0};
 
     /* If everything is out of range, return early. */
-    if (!zslIsInLexRange(zsl,range)) return NULL;
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        /* Go forward while *OUT* of range. */
-        while (x->level(i)->forward &&
-            !zslLexValueGteMin(x->level(i)->forward->ele,range))
-                x = x->level(i)->forward;
-    }
+    if (!zbtIsInLexRange(zbt,range)) return pos;
 
-    /* This is an inner range, so the next node cannot be NULL. */
-    x = x->level(0)->forward;
-    serverAssert(x != NULL);
+    pos = zbtSeek(zbt, [&](double, sds e) {
+        return !zslLexValueGteMin(e,range);
+    }, NULL);
 
-    /* Check if score <= max. */
-    if (!zslLexValueLteMax(x->ele,range)) return NULL;
-    return x;
+    /* Check if ele <= max. */
+    if (pos.valid() && !zslLexValueLteMax(pos.ele(),range)) pos.leaf = NULL;
+    return pos;
 }
 
-/* Find the last node that is contained in the specified range.
- * Returns NULL when no element is contained in the range. */
-zskiplistNode *zslLastInLexRange(zskiplist *zsl, zlexrangespec *range) {
-    zskiplistNode *x;
-    int i;
+/* Find the last element that is contained in the specified lex range.
+ * Returns an invalid position when no element is contained in the range. */
+zbtreePos zbtLastInLexRange(zbtree *zbt, zlexrangespec *range) {
+    zbtreePos pos = {NULL, 0};
 
     /* If everything is out of range, return early. */
-    if (!zslIsInLexRange(zsl,range)) return NULL;
-
-    x = zsl->header;
-    for (i = zsl->level-1; i >= 0; i--) {
-        /* Go forward while *IN* range. */
-        while (x->level(i)->forward &&
-            zslLexValueLteMax(x->level(i)->forward->ele,range))
-                x = x->level(i)->forward;
-    }
-
-    /* This is an inner range, so this node cannot be NULL. */
-    serverAssert(x != NULL);
+    if (!zbtIsInLexRange(zbt,range)) return pos;
+
+    /* Seek the first element past the range, and step back. */
+    pos = zbtSeek(zbt, [&](double, sds e) {
+        return zslLexValueLteMax(e,range);
+    }, NULL);
+    if (pos.valid())
+        pos.prev();
+    else
+        pos = zbtLast(zbt);
 
-    /* Check if score >= min. */
-    if (!zslLexValueGteMin(x->ele,range)) return NULL;
-    return x;
+    /* Check if ele >= min. */
+    if (pos.valid() && !zslLexValueGteMin(pos.ele(),range)) pos.leaf = NULL;
+    return pos;
 }
 
 /*-----------------------------------------------------------------------------
- * Ziplist-backed sorted set API
+ * Listpack-backed sorted set API
  *----------------------------------------------------------------------------*/
 
 double zzlGetScore(unsigned char *sptr) {
@@ -727,7 +939,7 @@ double zzlGetScore(unsigned char *sptr) {
     double score;
 
     serverAssert(sptr != NULL);
-    serverAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(sptr,&vlen,&vlong);
 
     if (vstr) {
         memcpy(buf,vstr,vlen);
@@ -740,14 +952,14 @@ double zzlGetScore(unsigned char *sptr) {
     return score;
 }
 
-/* Return a ziplist element as an SDS string. */
-sds ziplistGetObject(unsigned char *sptr) {
+/* Return a listpack element as an SDS string. */
+sds lpGetObject(unsigned char *sptr) {
     unsigned char *vstr;
     unsigned int vlen;
     long long vlong;
 
     serverAssert(sptr != NULL);
-    serverAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(sptr,&vlen,&vlong);
 
     if (vstr) {
         return sdsnewlen((char*)vstr,vlen);
@@ -764,7 +976,7 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
     unsigned char vbuf[32];
     int minlen, cmp;
 
-    serverAssert(ziplistGet(eptr,&vstr,&vlen,&vlong));
+    vstr = lpGetValue(eptr,&vlen,&vlong);
     if (vstr == NULL) {
         /* Store string representation of long long in buf. */
         vlen = ll2string((char*)vbuf,sizeof(vbuf),vlong);
@@ -777,8 +989,8 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
     return cmp;
 }
 
-unsigned int zzlLength(const unsigned char *zl) {
-    return ziplistLen(zl)/2;
+unsigned int zzlLength(unsigned char *zl) {
+    return lpLength(zl)/2;
 }
 
 /* Move to next entry based on the values in eptr and sptr. Both are set to
@@ -787,9 +999,9 @@ void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
     unsigned char *_eptr, *_sptr;
     serverAssert(*eptr != NULL && *sptr != NULL);
 
-    _eptr = ziplistNext(zl,*sptr);
+    _eptr = lpNext(zl,*sptr);
     if (_eptr != NULL) {
-        _sptr = ziplistNext(zl,_eptr);
+        _sptr = lpNext(zl,_eptr);
         serverAssert(_sptr != NULL);
     } else {
         /* No next entry. */
@@ -806,9 +1018,9 @@ void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
     unsigned char *_eptr, *_sptr;
     serverAssert(*eptr != NULL && *sptr != NULL);
 
-    _sptr = ziplistPrev(zl,*eptr);
+    _sptr = lpPrev(zl,*eptr);
     if (_sptr != NULL) {
-        _eptr = ziplistPrev(zl,_sptr);
+        _eptr = lpPrev(zl,_sptr);
         serverAssert(_eptr != NULL);
     } else {
         /* No previous entry. */
@@ -830,13 +1042,13 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
             (range->min == range->max && (range->minex || range->maxex)))
         return 0;
 
-    p = ziplistIndex(zl,-1); /* Last score. */
+    p = lpSeek(zl,-1); /* Last score. */
     if (p == NULL) return 0; /* Empty sorted set */
     score = zzlGetScore(p);
     if (!zslValueGteMin(score,range))
         return 0;
 
-    p = ziplistIndex(zl,1); /* First score. */
+    p = lpSeek(zl,1); /* First score. */
     serverAssert(p != NULL);
     score = zzlGetScore(p);
     if (!zslValueLteMax(score,range))
@@ -848,14 +1060,14 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
 /* Find pointer to the first element contained in the specified range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInRange(zl,range)) return NULL;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
         score = zzlGetScore(sptr);
@@ -867,7 +1079,7 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     return NULL;
@@ -876,14 +1088,14 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
 /* Find pointer to the last element contained in the specified range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+    unsigned char *eptr = lpSeek(zl,-2), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInRange(zl,range)) return NULL;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
         score = zzlGetScore(sptr);
@@ -896,9 +1108,9 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(zl,eptr);
         if (sptr != NULL)
-            serverAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            serverAssert((eptr = lpPrev(zl,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -907,14 +1119,14 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
 }
 
 int zzlLexValueGteMin(unsigned char *p, zlexrangespec *spec) {
-    sds value = ziplistGetObject(p);
+    sds value = lpGetObject(p);
     int res = zslLexValueGteMin(value,spec);
     sdsfree(value);
     return res;
 }
 
 int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec) {
-    sds value = ziplistGetObject(p);
+    sds value = lpGetObject(p);
     int res = zslLexValueLteMax(value,spec);
     sdsfree(value);
     return res;
@@ -930,12 +1142,12 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
     if (cmp > 0 || (cmp == 0 && (range->minex || range->maxex)))
         return 0;
 
-    p = ziplistIndex(zl,-2); /* Last element. */
+    p = lpSeek(zl,-2); /* Last element. */
     if (p == NULL) return 0;
     if (!zzlLexValueGteMin(p,range))
         return 0;
 
-    p = ziplistIndex(zl,0); /* First element. */
+    p = lpSeek(zl,0); /* First element. */
     serverAssert(p != NULL);
     if (!zzlLexValueLteMax(p,range))
         return 0;
@@ -946,7 +1158,7 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
 /* Find pointer to the first element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInLexRange(zl,range)) return NULL;
@@ -960,9 +1172,9 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
         }
 
         /* Move to next element. */
-        sptr = ziplistNext(zl,eptr); /* This element score. Skip it. */
+        sptr = lpNext(zl,eptr); /* This element score. Skip it. */
         serverAssert(sptr != NULL);
-        eptr = ziplistNext(zl,sptr); /* Next element. */
+        eptr = lpNext(zl,sptr); /* Next element. */
     }
 
     return NULL;
@@ -971,7 +1183,7 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
 /* Find pointer to the last element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+    unsigned char *eptr = lpSeek(zl,-2), *sptr;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInLexRange(zl,range)) return NULL;
@@ -986,9 +1198,9 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(zl,eptr);
         if (sptr != NULL)
-            serverAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            serverAssert((eptr = lpPrev(zl,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -997,66 +1209,56 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 }
 
 unsigned char *zzlFind(unsigned char *zl, sds ele, double *score) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
-        if (ziplistCompare(eptr,(unsigned char*)ele,sdslen(ele))) {
+        if (lpCompare(eptr,(unsigned char*)ele,sdslen(ele))) {
             /* Matching element, pull out score. */
             if (score != NULL) *score = zzlGetScore(sptr);
             return eptr;
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
     return NULL;
 }
 
-/* Delete (element,score) pair from ziplist. Use local copy of eptr because we
+/* Delete (element,score) pair from listpack. Use local copy of eptr because we
  * don't want to modify the one given as argument. */
 unsigned char *zzlDelete(unsigned char *zl, unsigned char *eptr) {
     unsigned char *p = eptr;
-
-    /* TODO: add function to ziplist API to delete N elements from offset. */
-    zl = ziplistDelete(zl,&p);
-    zl = ziplistDelete(zl,&p);
-    return zl;
+    return lpDeleteRangeWithEntry(zl,&p,2);
 }
 
 unsigned char *zzlInsertAt(unsigned char *zl, unsigned char *eptr, sds ele, double score) {
-    unsigned char *sptr;
     char scorebuf[128];
     int scorelen;
-    size_t offset;
 
     scorelen = d2string(scorebuf,sizeof(scorebuf),score);
     if (eptr == NULL) {
-        zl = ziplistPush(zl,(unsigned char*)ele,sdslen(ele),ZIPLIST_TAIL);
-        zl = ziplistPush(zl,(unsigned char*)scorebuf,scorelen,ZIPLIST_TAIL);
+        zl = lpAppend(zl,(unsigned char*)ele,sdslen(ele));
+        zl = lpAppend(zl,(unsigned char*)scorebuf,scorelen);
     } else {
-        /* Keep offset relative to zl, as it might be re-allocated. */
-        offset = eptr-zl;
-        zl = ziplistInsert(zl,eptr,(unsigned char*)ele,sdslen(ele));
-        eptr = zl+offset;
-
-        /* Insert score after the element. */
-        serverAssert((sptr = ziplistNext(zl,eptr)) != NULL);
-        zl = ziplistInsert(zl,sptr,(unsigned char*)scorebuf,scorelen);
+        /* Insert the element, then the score after it: the element pointer
+         * returned by lpInsert() is valid in the reallocated listpack. */
+        zl = lpInsert(zl,(unsigned char*)ele,sdslen(ele),eptr,LP_BEFORE,&eptr);
+        zl = lpInsert(zl,(unsigned char*)scorebuf,scorelen,eptr,LP_AFTER,NULL);
     }
     return zl;
 }
 
-/* Insert (element,score) pair in ziplist. This function assumes the element is
+/* Insert (element,score) pair in listpack. This function assumes the element is
  * not yet present in the list. */
 unsigned char *zzlInsert(unsigned char *zl, sds ele, double score) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
     double s;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
         s = zzlGetScore(sptr);
 
@@ -1075,7 +1277,7 @@ unsigned char *zzlInsert(unsigned char *zl, sds ele, double score) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     /* Push on tail of list when it was not yet inserted. */
@@ -1085,8 +1287,7 @@ unsigned char *zzlInsert(unsigned char *zl, sds ele, double score) {
 }
 
 unsigned char *zzlDeleteRangeByScore(unsigned char *zl, zrangespec *range, unsigned long *deleted) {
-    unsigned char *eptr, *sptr;
-    double score;
+    unsigned char *eptr, *sptr, *p;
     unsigned long num = 0;
 
     if (deleted != NULL) *deleted = 0;
@@ -1094,27 +1295,24 @@ unsigned char *zzlDeleteRangeByScore(unsigned char *zl, zrangespec *range, unsig
     eptr = zzlFirstInRange(zl,range);
     if (eptr == NULL) return zl;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
-        score = zzlGetScore(sptr);
-        if (zslValueLteMax(score,range)) {
-            /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
-            num++;
-        } else {
-            /* No longer in range. */
-            break;
-        }
+    /* Find where the run of elements in range ends, then remove the whole
+     * run with a single listpack operation. */
+    p = eptr;
+    while (p != NULL) {
+        sptr = lpNext(zl,p);
+        serverAssert(sptr != NULL);
+        if (!zslValueLteMax(zzlGetScore(sptr),range)) break;
+        num++;
+        p = lpNext(zl,sptr);
     }
+    zl = lpDeleteRangeWithEntry(zl,&eptr,2*num);
 
     if (deleted != NULL) *deleted = num;
     return zl;
 }
 
 unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsigned long *deleted) {
-    unsigned char *eptr, *sptr;
+    unsigned char *eptr, *sptr, *p;
     unsigned long num = 0;
 
     if (deleted != NULL) *deleted = 0;
@@ -1122,30 +1320,27 @@ unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsi
     eptr = zzlFirstInLexRange(zl,range);
     if (eptr == NULL) return zl;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
-        if (zzlLexValueLteMax(eptr,range)) {
-            /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
-            num++;
-        } else {
-            /* No longer in range. */
-            break;
-        }
+    /* Find where the run of elements in range ends, then remove the whole
+     * run with a single listpack operation. */
+    p = eptr;
+    while (p != NULL && zzlLexValueLteMax(p,range)) {
+        sptr = lpNext(zl,p);
+        serverAssert(sptr != NULL);
+        num++;
+        p = lpNext(zl,sptr);
     }
+    zl = lpDeleteRangeWithEntry(zl,&eptr,2*num);
 
     if (deleted != NULL) *deleted = num;
     return zl;
 }
 
-/* Delete all the elements with rank between start and end from the skiplist.
+/* Delete all the elements with rank between start and end from the listpack.
  * Start and end are inclusive. Note that start and end need to be 1-based */
 unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsigned int end, unsigned long *deleted) {
     unsigned int num = (end-start)+1;
     if (deleted) *deleted = num;
-    zl = ziplistDeleteRange(zl,2*(start-1),2*num);
+    zl = lpDeleteRange(zl,2*(start-1),2*num);
     return zl;
 }
 
@@ -1155,10 +1350,10 @@ unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsig
 
 unsigned long zsetLength(robj_roptr zobj) {
     unsigned long length = 0;
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
-        length = zzlLength((const unsigned char*)zobj->m_ptr);
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
-        length = ((const zset*)zobj->m_ptr)->zsl->length;
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
+        length = zzlLength((unsigned char*)zobj->m_ptr);
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        length = ((const zset*)zobj->m_ptr)->zbt->length;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1167,85 +1362,78 @@ unsigned long zsetLength(robj_roptr zobj) {
 
 void zsetConvert(robj *zobj, int encoding) {
     zset *zs;
-    zskiplistNode *node, *next;
+    dictEntry *de;
     sds ele;
     double score;
 
     if (zobj->encoding == encoding) return;
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = (unsigned char*)zobj->m_ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
 
-        if (encoding != OBJ_ENCODING_SKIPLIST)
+        if (encoding != OBJ_ENCODING_BTREE)
             serverPanic("Unknown target encoding");
 
         zs = (zset*)zmalloc(sizeof(*zs), MALLOC_SHARED);
         zs->pdict = dictCreate(&zsetDictType,NULL);
-        zs->zsl = zslCreate();
+        zs->zbt = zbtCreate();
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         serverAssertWithInfo(NULL,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssertWithInfo(NULL,zobj,sptr != NULL);
 
         while (eptr != NULL) {
             score = zzlGetScore(sptr);
-            serverAssertWithInfo(NULL,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
             if (vstr == NULL)
                 ele = sdsfromlonglong(vlong);
             else
                 ele = sdsnewlen((char*)vstr,vlen);
 
-            node = zslInsert(zs->zsl,score,ele);
-            serverAssert(dictAdd(zs->pdict,ele,&node->score) == DICT_OK);
+            zbtInsert(zs->zbt,score,ele);
+            de = dictAddRaw(zs->pdict,ele,NULL);
+            serverAssert(de != NULL);
+            dictSetDoubleVal(de,score);
             zzlNext(zl,&eptr,&sptr);
         }
 
-        zfree(zobj->m_ptr);
+        lpFree(zl);
         zobj->m_ptr = zs;
-        zobj->encoding = OBJ_ENCODING_SKIPLIST;
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
-        unsigned char *zl = ziplistNew();
+        zobj->encoding = OBJ_ENCODING_BTREE;
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
+        unsigned char *zl = lpNew();
 
-        if (encoding != OBJ_ENCODING_ZIPLIST)
+        if (encoding != OBJ_ENCODING_LISTPACK)
             serverPanic("Unknown target encoding");
 
-        /* Approach similar to zslFree(), since we want to free the skiplist at
-         * the same time as creating the ziplist. */
         zs = (zset*)zobj->m_ptr;
         dictRelease(zs->pdict);
-        node = zs->zsl->header->level(0)->forward;
-        zfree(zs->zsl->header);
-        zfree(zs->zsl);
-
-        while (node) {
-            zl = zzlInsertAt(zl,NULL,node->ele,node->score);
-            next = node->level(0)->forward;
-            zslFreeNode(node);
-            node = next;
-        }
+        for (zbtreePos pos = zbtFirst(zs->zbt); pos.valid(); pos.next())
+            zl = zzlInsertAt(zl,NULL,pos.ele(),pos.score());
+        zbtFree(zs->zbt);
 
         zfree(zs);
         zobj->m_ptr = zl;
-        zobj->encoding = OBJ_ENCODING_ZIPLIST;
+        zobj->encoding = OBJ_ENCODING_LISTPACK;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
 }
 
-/* Convert the sorted set object into a ziplist if it is not already a ziplist
- * and if the number of elements and the maximum element size is within the
+/* Convert the sorted set object into a listpack if it is not already a
+ * listpack and if the number of elements and the maximum element size is within the
  * expected ranges. */
-void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen) {
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) return;
+void zsetConvertToListpackIfNeeded(robj *zobj, size_t maxelelen) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) return;
     zset *set = (zset*)zobj->m_ptr;
 
-    if (set->zsl->length <= g_pserver->zset_max_ziplist_entries &&
-        maxelelen <= g_pserver->zset_max_ziplist_value)
-            zsetConvert(zobj,OBJ_ENCODING_ZIPLIST);
+    if (set->zbt->length <= g_pserver->zset_max_listpack_entries &&
+        maxelelen <= g_pserver->zset_max_listpack_value)
+            zsetConvert(zobj,OBJ_ENCODING_LISTPACK);
 }
 
 /* Return (by reference) the score of the specified member of the sorted set
@@ -1255,13 +1443,13 @@ void zsetConvertToZiplistIfNeeded(robj *zobj, size_t maxelelen) {
 int zsetScore(robj_roptr zobj, sds member, double *score) {
     if (!zobj || !member) return C_ERR;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         if (zzlFind((unsigned char*)zobj->m_ptr, member, score) == NULL) return C_ERR;
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)zobj->m_ptr;
         dictEntry *de = dictFind(zs->pdict, member);
         if (de == NULL) return C_ERR;
-        *score = *(double*)dictGetVal(de);
+        *score = dictGetDoubleVal(de);
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -1305,7 +1493,7 @@ int zsetScore(robj_roptr zobj, sds member, double *score) {
  * start.
  *
  * The commad as a side effect of adding a new element may convert the sorted
- * set internal encoding from ziplist to hashtable+skiplist.
+ * set internal encoding from listpack to hashtable+B+tree.
  *
  * Memory managemnet of 'ele':
  *
@@ -1326,7 +1514,7 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
     }
 
     /* Update the sorted set according to its encoding. */
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *eptr;
 
         if ((eptr = zzlFind((unsigned char*)zobj->m_ptr,ele,&curscore)) != NULL) {
@@ -1357,10 +1545,10 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
             /* Optimize: check if the element is too large or the list
              * becomes too long *before* executing zzlInsert. */
             zobj->m_ptr = zzlInsert((unsigned char*)zobj->m_ptr,ele,score);
-            if (zzlLength((unsigned char*)zobj->m_ptr) > g_pserver->zset_max_ziplist_entries)
-                zsetConvert(zobj,OBJ_ENCODING_SKIPLIST);
-            if (sdslen(ele) > g_pserver->zset_max_ziplist_value)
-                zsetConvert(zobj,OBJ_ENCODING_SKIPLIST);
+            if (zzlLength((unsigned char*)zobj->m_ptr) > g_pserver->zset_max_listpack_entries)
+                zsetConvert(zobj,OBJ_ENCODING_BTREE);
+            if (sdslen(ele) > g_pserver->zset_max_listpack_value)
+                zsetConvert(zobj,OBJ_ENCODING_BTREE);
             if (newscore) *newscore = score;
             *flags |= ZADD_ADDED;
             return 1;
@@ -1368,9 +1556,8 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
             *flags |= ZADD_NOP;
             return 1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)zobj->m_ptr;
-        zskiplistNode *znode;
         dictEntry *de;
 
         de = dictFind(zs->pdict,ele);
@@ -1380,7 +1567,7 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
                 *flags |= ZADD_NOP;
                 return 1;
             }
-            curscore = *(double*)dictGetVal(de);
+            curscore = dictGetDoubleVal(de);
 
             /* Prepare the score for the increment if needed. */
             if (incr) {
@@ -1394,18 +1581,20 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
 
             /* Remove and re-insert when score changes. */
             if (score != curscore) {
-                znode = zslUpdateScore(zs->zsl,curscore,ele,score);
+                zbtUpdateScore(zs->zbt,curscore,ele,score);
                 /* Note that we did not removed the original element from
                  * the hash table representing the sorted set, so we just
                  * update the score. */
-                dictGetVal(de) = &znode->score; /* Update score ptr. */
+                dictSetDoubleVal(de,score);
                 *flags |= ZADD_UPDATED;
             }
             return 1;
         } else if (!xx) {
             ele = sdsdup(ele);
-            znode = zslInsert(zs->zsl,score,ele);
-            serverAssert(dictAdd(zs->pdict,ele,&znode->score) == DICT_OK);
+            zbtInsert(zs->zbt,score,ele);
+            de = dictAddRaw(zs->pdict,ele,NULL);
+            serverAssert(de != NULL);
+            dictSetDoubleVal(de,score);
             *flags |= ZADD_ADDED;
             if (newscore) *newscore = score;
             return 1;
@@ -1422,32 +1611,32 @@ int zsetAdd(robj *zobj, double score, sds ele, int *flags, double *newscore) {
 /* Delete the element 'ele' from the sorted set, returning 1 if the element
  * existed and was deleted, 0 otherwise (the element was not there). */
 int zsetDel(robj *zobj, sds ele) {
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *eptr;
 
         if ((eptr = zzlFind((unsigned char*)zobj->m_ptr,ele,NULL)) != NULL) {
             zobj->m_ptr = zzlDelete((unsigned char*)zobj->m_ptr,eptr);
             return 1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)zobj->m_ptr;
         dictEntry *de;
         double score;
 
         de = dictUnlink(zs->pdict,ele);
         if (de != NULL) {
-            /* Get the score in order to delete from the skiplist later. */
-            score = *(double*)dictGetVal(de);
+            /* Get the score in order to delete from the B+tree later. */
+            score = dictGetDoubleVal(de);
 
-            /* Delete from the hash table and later from the skiplist.
-             * Note that the order is important: deleting from the skiplist
+            /* Delete from the hash table and later from the B+tree.
+             * Note that the order is important: deleting from the B+tree
              * actually releases the SDS string representing the element,
-             * which is shared between the skiplist and the hash table, so
-             * we need to delete from the skiplist as the final step. */
+             * which is shared between the B+tree and the hash table, so
+             * we need to delete from the B+tree as the final step. */
             dictFreeUnlinkedEntry(zs->pdict,de);
 
-            /* Delete from skiplist. */
-            int retval = zslDelete(zs->zsl,score,ele,NULL);
+            /* Delete from B+tree. */
+            int retval = zbtDelete(zs->zbt,score,ele,NULL);
             serverAssert(retval);
 
             if (htNeedsResize(zs->pdict)) dictResize(zs->pdict);
@@ -1476,18 +1665,18 @@ long zsetRank(robj_roptr zobj, sds ele, int reverse) {
 
     llen = zsetLength(zobj);
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = (unsigned char*)zobj->m_ptr;
         unsigned char *eptr, *sptr;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         serverAssert(eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssert(sptr != NULL);
 
         rank = 1;
         while(eptr != NULL) {
-            if (ziplistCompare(eptr,(unsigned char*)ele,sdslen(ele)))
+            if (lpCompare(eptr,(unsigned char*)ele,sdslen(ele)))
                 break;
             rank++;
             zzlNext(zl,&eptr,&sptr);
@@ -1501,16 +1690,15 @@ long zsetRank(robj_roptr zobj, sds ele, int reverse) {
         } else {
             return -1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)zobj->m_ptr;
-        zskiplist *zsl = zs->zsl;
         dictEntry *de;
         double score;
 
         de = dictFind(zs->pdict,ele);
         if (de != NULL) {
-            score = *(double*)dictGetVal(de);
-            rank = zslGetRank(zsl,score,ele);
+            score = dictGetDoubleVal(de);
+            rank = zbtGetRank(zs->zbt,score,ele);
             /* Existing elements always have a rank. */
             serverAssert(rank != 0);
             if (reverse)
@@ -1600,12 +1788,12 @@ void zaddGenericCommand(client *c, int flags) {
     zobj = lookupKeyWrite(c->db,key);
     if (zobj == NULL) {
         if (xx) goto reply_to_client; /* No key + XX option: nothing to do. */
-        if (g_pserver->zset_max_ziplist_entries == 0 ||
-            g_pserver->zset_max_ziplist_value < sdslen(szFromObj(c->argv[scoreidx+1])))
+        if (g_pserver->zset_max_listpack_entries == 0 ||
+            g_pserver->zset_max_listpack_value < sdslen(szFromObj(c->argv[scoreidx+1])))
         {
             zobj = createZsetObject();
         } else {
-            zobj = createZsetZiplistObject();
+            zobj = createZsetListpackObject();
         }
         dbAdd(c->db,key,zobj);
     } else {
@@ -1738,7 +1926,7 @@ void zremrangeGenericCommand(client *c, int rangetype) {
     }
 
     /* Step 3: Perform the range deletion operation. */
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         switch(rangetype) {
         case ZRANGE_RANK:
             zobj->m_ptr = zzlDeleteRangeByRank((unsigned char*)zobj->m_ptr,start+1,end+1,&deleted);
@@ -1754,17 +1942,17 @@ void zremrangeGenericCommand(client *c, int rangetype) {
             dbDelete(c->db,key);
             keyremoved = 1;
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)zobj->m_ptr;
         switch(rangetype) {
         case ZRANGE_RANK:
-            deleted = zslDeleteRangeByRank(zs->zsl,start+1,end+1,zs->pdict);
+            deleted = zbtDeleteRangeByRank(zs->zbt,start+1,end+1,zs->pdict);
             break;
         case ZRANGE_SCORE:
-            deleted = zslDeleteRangeByScore(zs->zsl,&range,zs->pdict);
+            deleted = zbtDeleteRangeByScore(zs->zbt,&range,zs->pdict);
             break;
         case ZRANGE_LEX:
-            deleted = zslDeleteRangeByLex(zs->zsl,&lexrange,zs->pdict);
+            deleted = zbtDeleteRangeByLex(zs->zbt,&lexrange,zs->pdict);
             break;
         }
         if (htNeedsResize(zs->pdict)) dictResize(zs->pdict);
@@ -1816,6 +2004,7 @@ struct zsetopsrc {
                 intset *is;
                 int ii;
             } is;
+            roaringIterator ri;
             struct {
                 dict *pdict;
                 dictIterator *di;
@@ -1831,8 +2020,8 @@ struct zsetopsrc {
             } zl;
             struct {
                 zset *zs;
-                zskiplistNode *node;
-            } sl;
+                zbtreePos pos;
+            } bt;
         } zset;
     } iter;
 };
@@ -1871,6 +2060,8 @@ void zuiInitIterator(zsetopsrc *op) {
         if (op->encoding == OBJ_ENCODING_INTSET) {
             it->is.is = (intset*)op->subject->m_ptr;
             it->is.ii = 0;
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            roaringIterInit(&it->ri,(roaring*)op->subject->m_ptr);
         } else if (op->encoding == OBJ_ENCODING_HT) {
             it->ht.pdict = (dict*)op->subject->m_ptr;
             it->ht.di = dictGetIterator((dict*)op->subject->m_ptr);
@@ -1880,16 +2071,16 @@ void zuiInitIterator(zsetopsrc *op) {
         }
     } else if (op->type == OBJ_ZSET) {
         iterzset *it = (iterzset*)&op->iter.zset;
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             it->zl.zl = (unsigned char*)op->subject->m_ptr;
-            it->zl.eptr = ziplistIndex(it->zl.zl,0);
+            it->zl.eptr = lpSeek(it->zl.zl,0);
             if (it->zl.eptr != NULL) {
-                it->zl.sptr = ziplistNext(it->zl.zl,it->zl.eptr);
+                it->zl.sptr = lpNext(it->zl.zl,it->zl.eptr);
                 serverAssert(it->zl.sptr != NULL);
             }
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
-            it->sl.zs = (zset*)op->subject->m_ptr;
-            it->sl.node = it->sl.zs->zsl->header->level(0)->forward;
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            it->bt.zs = (zset*)op->subject->m_ptr;
+            it->bt.pos = zbtFirst(it->bt.zs->zbt);
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1904,7 +2095,9 @@ void zuiClearIterator(zsetopsrc *op) {
 
     if (op->type == OBJ_SET) {
         iterset *it = &op->iter.set;
-        if (op->encoding == OBJ_ENCODING_INTSET) {
+        if (op->encoding == OBJ_ENCODING_INTSET ||
+            op->encoding == OBJ_ENCODING_ROARING)
+        {
             UNUSED(it); /* skip */
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dictReleaseIterator(it->ht.di);
@@ -1913,9 +2106,9 @@ void zuiClearIterator(zsetopsrc *op) {
         }
     } else if (op->type == OBJ_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             UNUSED(it); /* skip */
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
             UNUSED(it); /* skip */
         } else {
             serverPanic("Unknown sorted set encoding");
@@ -1932,6 +2125,8 @@ unsigned long zuiLength(zsetopsrc *op) {
     if (op->type == OBJ_SET) {
         if (op->encoding == OBJ_ENCODING_INTSET) {
             return intsetLen((const intset*)op->subject->m_ptr);
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            return roaringCard((const roaring*)op->subject->m_ptr);
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dict *ht = (dict*)op->subject->m_ptr;
             return dictSize(ht);
@@ -1939,11 +2134,11 @@ unsigned long zuiLength(zsetopsrc *op) {
             serverPanic("Unknown set encoding");
         }
     } else if (op->type == OBJ_ZSET) {
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             return zzlLength((unsigned char*)op->subject->m_ptr);
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = (zset*)op->subject->m_ptr;
-            return zs->zsl->length;
+            return zs->zbt->length;
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -1976,6 +2171,13 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
             /* Move to next element. */
             it->is.ii++;
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            int64_t ell;
+
+            if (!roaringIterNext(&it->ri,&ell))
+                return 0;
+            val->ell = ell;
+            val->score = 1.0;
         } else if (op->encoding == OBJ_ENCODING_HT) {
             if (it->ht.de == NULL)
                 return 0;
@@ -1989,23 +2191,23 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
         }
     } else if (op->type == OBJ_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             /* No need to check both, but better be explicit. */
             if (it->zl.eptr == NULL || it->zl.sptr == NULL)
                 return 0;
-            serverAssert(ziplistGet(it->zl.eptr,&val->estr,&val->elen,&val->ell));
+            val->estr = lpGetValue(it->zl.eptr,&val->elen,&val->ell);
             val->score = zzlGetScore(it->zl.sptr);
 
             /* Move to next element. */
             zzlNext(it->zl.zl,&it->zl.eptr,&it->zl.sptr);
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
-            if (it->sl.node == NULL)
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
+            if (!it->bt.pos.valid())
                 return 0;
-            val->ele = it->sl.node->ele;
-            val->score = it->sl.node->score;
+            val->ele = it->bt.pos.ele();
+            val->score = it->bt.pos.score();
 
             /* Move to next element. */
-            it->sl.node = it->sl.node->level(0)->forward;
+            it->bt.pos.next();
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -2092,6 +2294,15 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
             } else {
                 return 0;
             }
+        } else if (op->encoding == OBJ_ENCODING_ROARING) {
+            if (zuiLongLongFromValue(val) &&
+                roaringContains((roaring*)op->subject->m_ptr,val->ell))
+            {
+                *score = 1.0;
+                return 1;
+            } else {
+                return 0;
+            }
         } else if (op->encoding == OBJ_ENCODING_HT) {
             dict *ht = (dict*)op->subject->m_ptr;
             zuiSdsFromValue(val);
@@ -2107,18 +2318,18 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
     } else if (op->type == OBJ_ZSET) {
         zuiSdsFromValue(val);
 
-        if (op->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (op->encoding == OBJ_ENCODING_LISTPACK) {
             if (zzlFind((unsigned char*)op->subject->m_ptr,val->ele,score) != NULL) {
                 /* Score is already set by zzlFind. */
                 return 1;
             } else {
                 return 0;
             }
-        } else if (op->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (op->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = (zset*)op->subject->m_ptr;
             dictEntry *de;
             if ((de = dictFind(zs->pdict,val->ele)) != NULL) {
-                *score = *(double*)dictGetVal(de);
+                *score = dictGetDoubleVal(de);
                 return 1;
             } else {
                 return 0;
@@ -2142,7 +2353,6 @@ int zuiCompareByCardinality(const void *s1, const void *s2) {
 #define REDIS_AGGR_SUM 1
 #define REDIS_AGGR_MIN 2
 #define REDIS_AGGR_MAX 3
-#define zunionInterDictValue(_e) (dictGetVal(_e) == NULL ? 1.0 : *(double*)dictGetVal(_e))
 
 inline static void zunionInterAggregate(double *target, double val, int aggregate) {
     if (aggregate == REDIS_AGGR_SUM) {
@@ -2183,7 +2393,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
     size_t maxelelen = 0;
     robj *dstobj;
     zset *dstzset;
-    zskiplistNode *znode;
+    dictEntry *de;
     int touched = 0;
 
     /* expect setnum input keys to be given */
@@ -2302,8 +2512,9 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                 /* Only continue when present in every input. */
                 if (j == setnum) {
                     tmp = zuiNewSdsFromValue(&zval);
-                    znode = zslInsert(dstzset->zsl,score,tmp);
-                    dictAdd(dstzset->pdict,tmp,&znode->score);
+                    zbtInsert(dstzset->zbt,score,tmp);
+                    de = dictAddRaw(dstzset->pdict,tmp,NULL);
+                    dictSetDoubleVal(de,score);
                     if (sdslen(tmp) > maxelelen) maxelelen = sdslen(tmp);
                 }
             }
@@ -2338,7 +2549,7 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
                 if (!existing) {
                     tmp = zuiNewSdsFromValue(&zval);
                     /* Remember the longest single element encountered,
-                     * to understand if it's possible to convert to ziplist
+                     * to understand if it's possible to convert to listpack
                      * at the end. */
                      if (sdslen(tmp) > maxelelen) maxelelen = sdslen(tmp);
                     /* Update the element with its initial score. */
@@ -2368,8 +2579,9 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
         while((de = dictNext(di)) != NULL) {
             sds ele = (sds)dictGetKey(de);
             score = dictGetDoubleVal(de);
-            znode = zslInsert(dstzset->zsl,score,ele);
-            dictAdd(dstzset->pdict,ele,&znode->score);
+            zbtInsert(dstzset->zbt,score,ele);
+            de = dictAddRaw(dstzset->pdict,ele,NULL);
+            dictSetDoubleVal(de,score);
         }
         dictReleaseIterator(di);
         dictRelease(accumulator);
@@ -2379,8 +2591,8 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
 
     if (dbDelete(c->db,dstkey))
         touched = 1;
-    if (dstzset->zsl->length) {
-        zsetConvertToZiplistIfNeeded(dstobj,maxelelen);
+    if (dstzset->zbt->length) {
+        zsetConvertToListpackIfNeeded(dstobj,maxelelen);
         dbAdd(c->db,dstkey,dstobj);
         addReplyLongLong(c,zsetLength(dstobj));
         signalModifiedKey(c->db,dstkey);
@@ -2453,7 +2665,7 @@ void zrangeGenericCommand(client *c, int reverse) {
     else
         addReplyArrayLen(c, rangelen);
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = (unsigned char*)zobj->m_ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2461,16 +2673,16 @@ void zrangeGenericCommand(client *c, int reverse) {
         long long vlong;
 
         if (reverse)
-            eptr = ziplistIndex(zl,-2-(2*start));
+            eptr = lpSeek(zl,-2-(2*start));
         else
-            eptr = ziplistIndex(zl,2*start);
+            eptr = lpSeek(zl,2*start);
 
         serverAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         while (rangelen--) {
             serverAssertWithInfo(c,zobj,eptr != NULL && sptr != NULL);
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
             if (withscores && c->resp > 2) addReplyArrayLen(c,2);
             if (vstr == NULL)
@@ -2485,30 +2697,30 @@ void zrangeGenericCommand(client *c, int reverse) {
                 zzlNext(zl,&eptr,&sptr);
         }
 
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)zobj->m_ptr;
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *ln;
+        zbtree *zbt = zs->zbt;
+        zbtreePos ln;
         sds ele;
 
         /* Check if starting point is trivial, before doing log(N) lookup. */
         if (reverse) {
-            ln = zsl->tail;
+            ln = zbtLast(zbt);
             if (start > 0)
-                ln = zslGetElementByRank(zsl,llen-start);
+                ln = zbtGetElementByRank(zbt,llen-start);
         } else {
-            ln = zsl->header->level(0)->forward;
+            ln = zbtFirst(zbt);
             if (start > 0)
-                ln = zslGetElementByRank(zsl,start+1);
+                ln = zbtGetElementByRank(zbt,start+1);
         }
 
         while(rangelen--) {
-            serverAssertWithInfo(c,zobj,ln != NULL);
-            ele = ln->ele;
+            serverAssertWithInfo(c,zobj,ln.valid());
+            ele = ln.ele();
             if (withscores && c->resp > 2) addReplyArrayLen(c,2);
             addReplyBulkCBuffer(c,ele,sdslen(ele));
-            if (withscores) addReplyDouble(c,ln->score);
-            ln = reverse ? ln->backward : ln->level(0)->forward;
+            if (withscores) addReplyDouble(c,ln.score());
+            if (reverse) ln.prev(); else ln.next();
         }
     } else {
         serverPanic("Unknown sorted set encoding");
@@ -2578,7 +2790,7 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
     if ((zobj = lookupKeyReadOrReply(c,key,(c->resp < 3) ? shared.emptyarray : shared.null[c->resp])) == nullptr ||
         checkType(c,zobj,OBJ_ZSET)) return;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = (unsigned char*)zobj->m_ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2604,7 +2816,7 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
 
         /* Get score pointer for the first element. */
         serverAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
@@ -2631,9 +2843,7 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
                 if (!zslValueLteMax(score,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always
-             * succeed */
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
             rangelen++;
             if (withscores && c->resp > 2) addReplyArrayLen(c,2);
@@ -2651,20 +2861,20 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
                 zzlNext(zl,&eptr,&sptr);
             }
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)zobj->m_ptr;
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *ln;
+        zbtree *zbt = zs->zbt;
+        zbtreePos ln;
 
         /* If reversed, get the last node in range as starting point. */
         if (reverse) {
-            ln = zslLastInRange(zsl,&range);
+            ln = zbtLastInRange(zbt,&range);
         } else {
-            ln = zslFirstInRange(zsl,&range);
+            ln = zbtFirstInRange(zbt,&range);
         }
 
         /* No "first" element in the specified interval. */
-        if (ln == NULL) {
+        if (!ln.valid()) {
             if (c->resp < 3)
                 addReply(c, shared.emptyarray);
             else
@@ -2679,32 +2889,32 @@ void genericZrangebyscoreCommand(client *c, int reverse) {
 
         /* If there is an offset, just traverse the number of elements without
          * checking the score because that is done in the next loop. */
-        while (ln && offset--) {
+        while (ln.valid() && offset--) {
             if (reverse) {
-                ln = ln->backward;
+                ln.prev();
             } else {
-                ln = ln->level(0)->forward;
+                ln.next();
             }
         }
 
-        while (ln && limit--) {
+        while (ln.valid() && limit--) {
             /* Abort when the node is no longer in range. */
             if (reverse) {
-                if (!zslValueGteMin(ln->score,&range)) break;
+                if (!zslValueGteMin(ln.score(),&range)) break;
             } else {
-                if (!zslValueLteMax(ln->score,&range)) break;
+                if (!zslValueLteMax(ln.score(),&range)) break;
             }
 
             rangelen++;
             if (withscores && c->resp > 2) addReplyArrayLen(c,2);
-            addReplyBulkCBuffer(c,ln->ele,sdslen(ln->ele));
-            if (withscores) addReplyDouble(c,ln->score);
+            addReplyBulkCBuffer(c,ln.ele(),sdslen(ln.ele()));
+            if (withscores) addReplyDouble(c,ln.score());
 
             /* Move to next node */
             if (reverse) {
-                ln = ln->backward;
+                ln.prev();
             } else {
-                ln = ln->level(0)->forward;
+                ln.next();
             }
         }
     } else {
@@ -2739,7 +2949,7 @@ void zcountCommand(client *c) {
     if ((zobj = lookupKeyReadOrReply(c, key, shared.czero)) == nullptr ||
         checkType(c, zobj, OBJ_ZSET)) return;
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = (unsigned char*)zobj->m_ptr;
         unsigned char *eptr, *sptr;
         double score;
@@ -2754,7 +2964,7 @@ void zcountCommand(client *c) {
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         score = zzlGetScore(sptr);
         serverAssertWithInfo(c,zobj,zslValueLteMax(score,&range));
 
@@ -2770,29 +2980,13 @@ void zcountCommand(client *c) {
                 zzlNext(zl,&eptr,&sptr);
             }
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)zobj->m_ptr;
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *zn;
-        unsigned long rank;
+        unsigned long start, end;
 
-        /* Find first element in range */
-        zn = zslFirstInRange(zsl, &range);
-
-        /* Use rank of first element, if any, to determine preliminary count */
-        if (zn != NULL) {
-            rank = zslGetRank(zsl, zn->score, zn->ele);
-            count = (zsl->length - (rank - 1));
-
-            /* Find last element in range */
-            zn = zslLastInRange(zsl, &range);
-
-            /* Use rank of last element, if any, to determine the actual count */
-            if (zn != NULL) {
-                rank = zslGetRank(zsl, zn->score, zn->ele);
-                count -= (zsl->length - rank);
-            }
-        }
+        /* The count is the distance between the ranks of the range ends. */
+        zbtRangeRanks(zs->zbt, &range, &start, &end);
+        count = end - start;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2820,7 +3014,7 @@ void zlexcountCommand(client *c) {
         return;
     }
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = (unsigned char*)zobj->m_ptr;
         unsigned char *eptr, *sptr;
 
@@ -2835,7 +3029,7 @@ void zlexcountCommand(client *c) {
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         serverAssertWithInfo(c,zobj,zzlLexValueLteMax(eptr,&range));
 
         /* Iterate over elements in range */
@@ -2848,29 +3042,13 @@ void zlexcountCommand(client *c) {
                 zzlNext(zl,&eptr,&sptr);
             }
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)zobj->m_ptr;
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *zn;
-        unsigned long rank;
+        unsigned long start, end;
 
-        /* Find first element in range */
-        zn = zslFirstInLexRange(zsl, &range);
-
-        /* Use rank of first element, if any, to determine preliminary count */
-        if (zn != NULL) {
-            rank = zslGetRank(zsl, zn->score, zn->ele);
-            count = (zsl->length - (rank - 1));
-
-            /* Find last element in range */
-            zn = zslLastInLexRange(zsl, &range);
-
-            /* Use rank of last element, if any, to determine the actual count */
-            if (zn != NULL) {
-                rank = zslGetRank(zsl, zn->score, zn->ele);
-                count -= (zsl->length - rank);
-            }
-        }
+        /* The count is the distance between the ranks of the range ends. */
+        zbtLexRangeRanks(zs->zbt, &range, &start, &end);
+        count = end - start;
     } else {
         serverPanic("Unknown sorted set encoding");
     }
@@ -2933,7 +3111,7 @@ void genericZrangebylexCommand(client *c, int reverse) {
         return;
     }
 
-    if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+    if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
         unsigned char *zl = (unsigned char*)zobj->m_ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2956,7 +3134,7 @@ void genericZrangebylexCommand(client *c, int reverse) {
 
         /* Get score pointer for the first element. */
         serverAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
@@ -2981,9 +3159,7 @@ void genericZrangebylexCommand(client *c, int reverse) {
                 if (!zzlLexValueLteMax(eptr,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always
-             * succeed. */
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
 
             rangelen++;
             if (vstr == NULL) {
@@ -2999,20 +3175,20 @@ void genericZrangebylexCommand(client *c, int reverse) {
                 zzlNext(zl,&eptr,&sptr);
             }
         }
-    } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
         zset *zs = (zset*)zobj->m_ptr;
-        zskiplist *zsl = zs->zsl;
-        zskiplistNode *ln;
+        zbtree *zbt = zs->zbt;
+        zbtreePos ln;
 
         /* If reversed, get the last node in range as starting point. */
         if (reverse) {
-            ln = zslLastInLexRange(zsl,&range);
+            ln = zbtLastInLexRange(zbt,&range);
         } else {
-            ln = zslFirstInLexRange(zsl,&range);
+            ln = zbtFirstInLexRange(zbt,&range);
         }
 
         /* No "first" element in the specified interval. */
-        if (ln == NULL) {
+        if (!ln.valid()) {
             addReplyNull(c);
             zslFreeLexRange(&range);
             return;
@@ -3025,30 +3201,30 @@ void genericZrangebylexCommand(client *c, int reverse) {
 
         /* If there is an offset, just traverse the number of elements without
          * checking the score because that is done in the next loop. */
-        while (ln && offset--) {
+        while (ln.valid() && offset--) {
             if (reverse) {
-                ln = ln->backward;
+                ln.prev();
             } else {
-                ln = ln->level(0)->forward;
+                ln.next();
             }
         }
 
-        while (ln && limit--) {
+        while (ln.valid() && limit--) {
             /* Abort when the node is no longer in range. */
             if (reverse) {
-                if (!zslLexValueGteMin(ln->ele,&range)) break;
+                if (!zslLexValueGteMin(ln.ele(),&range)) break;
             } else {
-                if (!zslLexValueLteMax(ln->ele,&range)) break;
+                if (!zslLexValueLteMax(ln.ele(),&range)) break;
             }
 
             rangelen++;
-            addReplyBulkCBuffer(c,ln->ele,sdslen(ln->ele));
+            addReplyBulkCBuffer(c,ln.ele(),sdslen(ln.ele()));
 
             /* Move to next node */
             if (reverse) {
-                ln = ln->backward;
+                ln.prev();
             } else {
-                ln = ln->level(0)->forward;
+                ln.next();
             }
         }
     } else {
@@ -3179,7 +3355,7 @@ void genericZpopCommand(client *c, robj **keyv, int keyc, int where, int emitkey
 
     /* Remove the element. */
     do {
-        if (zobj->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (zobj->encoding == OBJ_ENCODING_LISTPACK) {
             unsigned char *zl = (unsigned char*)zobj->m_ptr;
             unsigned char *eptr, *sptr;
             unsigned char *vstr;
@@ -3187,31 +3363,29 @@ void genericZpopCommand(client *c, robj **keyv, int keyc, int where, int emitkey
             long long vlong;
 
             /* Get the first or last element in the sorted set. */
-            eptr = ziplistIndex(zl,where == ZSET_MAX ? -2 : 0);
+            eptr = lpSeek(zl,where == ZSET_MAX ? -2 : 0);
             serverAssertWithInfo(c,zobj,eptr != NULL);
-            serverAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            vstr = lpGetValue(eptr,&vlen,&vlong);
             if (vstr == NULL)
                 ele = sdsfromlonglong(vlong);
             else
                 ele = sdsnewlen(vstr,vlen);
 
             /* Get the score. */
-            sptr = ziplistNext(zl,eptr);
+            sptr = lpNext(zl,eptr);
             serverAssertWithInfo(c,zobj,sptr != NULL);
             score = zzlGetScore(sptr);
-        } else if (zobj->encoding == OBJ_ENCODING_SKIPLIST) {
+        } else if (zobj->encoding == OBJ_ENCODING_BTREE) {
             zset *zs = (zset*)zobj->m_ptr;
-            zskiplist *zsl = zs->zsl;
-            zskiplistNode *zln;
+            zbtreePos zln;
 
             /* Get the first or last element in the sorted set. */
-            zln = (where == ZSET_MAX ? zsl->tail :
-                                       zsl->header->level(0)->forward);
+            zln = (where == ZSET_MAX ? zbtLast(zs->zbt) : zbtFirst(zs->zbt));
 
             /* There must be an element in the sorted set. */
-            serverAssertWithInfo(c,zobj,zln != NULL);
-            ele = sdsdup(zln->ele);
-            score = zln->score;
+            serverAssertWithInfo(c,zobj,zln.valid());
+            ele = sdsdup(zln.ele());
+            score = zln.score();
         } else {
             serverPanic("Unknown sorted set encoding");
         }
@@ -0,0 +1,179 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/****************************************
+ * timingwheel.h:
+ *
+ * A hierarchical timing wheel of (key, when) records, when being a time in milliseconds.
+ *  Records are bucketed by the highest group of bits in which their time differs from the
+ *  current time of the wheel: level 0 holds the records due in the current 64ms, level 1 those
+ *  due in the current 4096ms, and so on.  Advancing the wheel only visits the slots the time
+ *  went past, moving their records down a level or into the due list, so each record is
+ *  touched at most once per level no matter how many share the same time.
+ *
+ * The wheel does not support removal: records whose key was deleted or got another time are
+ *  expected to be recognized and skipped by the caller when they come due.
+ */
+
+template<typename T_KEY>
+class timingwheel
+{
+public:
+    struct entry
+    {
+        T_KEY key;
+        long long when;
+    };
+
+private:
+    static const int bits_level = 6;
+    static const int slots_level = 1 << bits_level;
+    static const int levels = 7;    // 42 bits of milliseconds, over a century
+
+    std::vector<entry> m_slots[levels][slots_level];
+    uint64_t m_occupied[levels] = {0};
+    std::vector<entry> m_overflow;  // beyond the last level
+    std::vector<entry> m_due;
+    size_t m_idxDue = 0;            // records before it in m_due were already popped
+    long long m_now;                // every record at or before this time is in m_due
+    size_t m_celem = 0;
+
+public:
+    // Records due before 'now' go straight to the due list
+    timingwheel(long long now)
+        : m_now(now - 1)
+    {}
+
+    void insert(T_KEY key, long long when)
+    {
+        ++m_celem;
+        place(entry{key, when});
+    }
+
+    // Move the records due before 'now' (that is, at 'now'-1 or earlier) to the due list
+    void advance(long long now)
+    {
+        long long last = now - 1;
+        if (last <= m_now)
+            return;
+
+        std::vector<entry> vecCascade;
+        for (int level = 0; level < levels; ++level)
+        {
+            int shift = level * bits_level;
+            uint64_t pending;
+            bool fLast = ((uint64_t)m_now >> (shift + bits_level)) == ((uint64_t)last >> (shift + bits_level));
+            if (fLast)
+            {
+                // Only the slots between the old and the new time at this level were reached
+                int slotOld = ((uint64_t)m_now >> shift) & (slots_level - 1);
+                int slotNew = ((uint64_t)last >> shift) & (slots_level - 1);
+                pending = maskUpTo(slotNew) & ~maskUpTo(slotOld);
+            }
+            else
+            {
+                // We went around this level at least once
+                pending = ~0ULL;
+            }
+
+            pending &= m_occupied[level];
+            while (pending)
+            {
+                int slot = __builtin_ctzll(pending);
+                pending &= pending - 1;
+                auto &vec = m_slots[level][slot];
+                if (vecCascade.empty())
+                    vecCascade.swap(vec);
+                else
+                    vecCascade.insert(vecCascade.end(), vec.begin(), vec.end());
+                std::vector<entry>().swap(vec);
+                m_occupied[level] &= ~(1ULL << slot);
+            }
+
+            if (fLast)
+                break;  // the higher levels didn't move
+        }
+        if (((uint64_t)m_now >> (levels * bits_level)) != ((uint64_t)last >> (levels * bits_level)))
+        {
+            vecCascade.insert(vecCascade.end(), m_overflow.begin(), m_overflow.end());
+            std::vector<entry>().swap(m_overflow);
+        }
+
+        m_now = last;
+        for (auto &e : vecCascade)
+            place(e);
+    }
+
+    // Pop a record of the due list, returns false if it is empty
+    bool pop_due(entry *pe)
+    {
+        if (m_idxDue == m_due.size())
+            return false;
+        *pe = m_due[m_idxDue++];
+        --m_celem;
+        if (m_idxDue == m_due.size())
+        {
+            m_due.clear();
+            if (m_due.capacity() > 4096)
+                std::vector<entry>().swap(m_due);
+            m_idxDue = 0;
+        }
+        return true;
+    }
+
+    void clear()
+    {
+        for (int level = 0; level < levels; ++level)
+        {
+            for (auto &vec : m_slots[level])
+                std::vector<entry>().swap(vec);
+            m_occupied[level] = 0;
+        }
+        std::vector<entry>().swap(m_overflow);
+        std::vector<entry>().swap(m_due);
+        m_idxDue = 0;
+        m_celem = 0;
+    }
+
+    size_t size() const noexcept { return m_celem; }
+    size_t due_size() const noexcept { return m_due.size() - m_idxDue; }
+
+    size_t bytes_used() const
+    {
+        size_t cb = sizeof(*this) + (m_overflow.capacity() + m_due.capacity()) * sizeof(entry);
+        for (int level = 0; level < levels; ++level)
+        {
+            for (auto &vec : m_slots[level])
+                cb += vec.capacity() * sizeof(entry);
+        }
+        return cb;
+    }
+
+private:
+    static uint64_t maskUpTo(int bit)
+    {
+        return (bit == 63) ? ~0ULL : ((1ULL << (bit + 1)) - 1);
+    }
+
+    void place(const entry &e)
+    {
+        if (e.when <= m_now)
+        {
+            m_due.push_back(e);
+            return;
+        }
+
+        uint64_t diff = (uint64_t)e.when ^ (uint64_t)m_now;
+        int level = (63 - __builtin_clzll(diff)) / bits_level;
+        if (level >= levels)
+        {
+            m_overflow.push_back(e);
+            return;
+        }
+        int slot = ((uint64_t)e.when >> (level * bits_level)) & (slots_level - 1);
+        m_slots[level][slot].push_back(e);
+        m_occupied[level] |= 1ULL << slot;
+    }
+};
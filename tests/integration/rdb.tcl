@@ -23,6 +23,16 @@ start_server [list overrides [list "dir" $server_path "dbfilename" "encodings.rd
 }
 }
 
+start_server [list overrides [list "dir" $server_path "dbfilename" "encodings.rdb" "rdb-load-threads" 4]] {
+  test "RDB encoding loading test with rdb-load-threads" {
+    r select 0
+    set dump [csvdump r]
+    r config set rdb-load-threads 0
+    r debug reload
+    assert_equal $dump [csvdump r]
+  }
+}
+
 set server_path [tmpdir "server.rdb-startup-test"]
 
 start_server [list overrides [list "dir" $server_path]] {
@@ -115,3 +125,240 @@ start_server_and_kill_it [list "dir" $server_path] {
         }
     }
 }
+
+# Write a file starting with an opcode this server doesn't know, here the
+# FUNCTION2 opcode of newer upstream versions
+set fd [open [file join $server_path dump.rdb] w]
+fconfigure $fd -translation binary
+puts -nonewline $fd "REDIS0010\xf5\x00\xff[binary format w 0]"
+close $fd
+
+start_server_and_kill_it [list "dir" $server_path] {
+    test {Server should not start if RDB has an unknown opcode} {
+        wait_for_condition 50 100 {
+            [string match {*Unknown RDB opcode or object type 245*} \
+                [exec tail -50 < [dict get $srv stdout]]]
+        } else {
+            fail "Server started even if RDB had an unknown opcode!"
+        }
+    }
+}
+
+test {keydb-check-rdb rejects unknown opcodes} {
+    catch {exec src/keydb-check-rdb [file join $server_path dump.rdb]} result
+    assert_match {*Unknown opcode or object type: 245*} $result
+}
+
+start_server {} {
+    test {RDB load with rdb-load-threads keeps values and expires} {
+        r config set list-max-ziplist-size 4
+        r config set set-max-intset-entries 16
+        createComplexDataset r 10000
+        for {set j 0} {$j < 100} {incr j} {
+            r set big:$j [string repeat "x$j" 500]
+            r pexpire big:$j [expr {1000000 + $j}]
+            set ints {}
+            for {set k 0} {$k < 100} {incr k} {
+                lappend ints [expr {$j*1000+$k}]
+            }
+            r sadd ints:$j {*}$ints
+        }
+        r xadd stream * field value
+        set digest [r debug digest]
+        set keys [r dbsize]
+        set ttl [r pttl big:42]
+        r config set rdb-load-threads 4
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal $keys [r dbsize]
+        assert {[r pttl big:42] > 0 && [r pttl big:42] <= $ttl}
+        r config set rdb-load-threads 0
+        r debug reload
+        assert_equal $digest [r debug digest]
+    }
+}
+
+set server_path [tmpdir "server.forkless-bgsave-test"]
+
+start_server [list overrides [list "dir" $server_path "forkless-bgsave" yes]] {
+    test {Fork-less BGSAVE saves the dataset as it was when it started} {
+        r debug populate 20000 key 20
+        for {set j 0} {$j < 100} {incr j} {
+            r rpush list:$j a b c
+            r hset hash:$j f v
+            r set vol:$j $j
+            r pexpire vol:$j [expr {1000000 + $j}]
+        }
+        r select 1
+        r debug populate 5000 other 20
+        r select 9
+        set digest [r debug digest]
+
+        r debug set-forkless-save-delay 20000
+        r bgsave
+        for {set j 0} {$j < 500} {incr j} {
+            r set key:[randomInt 20000] changed
+            r del key:[randomInt 20000]
+            r set new:$j x
+            r rpush list:[randomInt 100] d
+            r expire vol:[randomInt 100] 5000
+            r persist vol:[randomInt 100]
+            r select 1
+            r del other:[randomInt 5000]
+            r select 9
+        }
+        r debug set-forkless-save-delay 0
+        waitForBgsave r
+        assert_equal ok [s rdb_last_bgsave_status]
+        assert {[s rdb_forkless_preserved_keys] > 0}
+        set changed [r debug digest]
+        assert {$digest ne $changed}
+    }
+
+    start_server [list overrides [list "dir" $server_path]] {
+        test {Fork-less BGSAVE file loads with the dataset at the start of the save} {
+            assert_equal $digest [r debug digest]
+        }
+    }
+
+    test {Fork-less BGSAVE saves consumer groups as they were before XCLAIM} {
+        r flushall
+        r debug populate 20000 key 20
+        r xgroup create mystream mygroup $ MKSTREAM
+        for {set j 0} {$j < 10} {incr j} {r xadd mystream * field $j}
+        r xreadgroup GROUP mygroup Alice COUNT 10 STREAMS mystream >
+        set ids {}
+        foreach entry [r xpending mystream mygroup - + 10] {
+            lappend ids [lindex $entry 0]
+        }
+
+        r debug set-forkless-save-delay 20000
+        r bgsave
+        r xclaim mystream mygroup Bob 0 {*}$ids
+        r debug set-forkless-save-delay 0
+        waitForBgsave r
+        assert_equal ok [s rdb_last_bgsave_status]
+        assert_equal {{Bob 10}} [lindex [r xpending mystream mygroup] 3]
+
+        start_server [list overrides [list "dir" $server_path]] {
+            assert_equal {{Alice 10}} [lindex [r xpending mystream mygroup] 3]
+            assert_equal 10 [llength [r xpending mystream mygroup - + 100 Alice]]
+        }
+    }
+
+    test {Fork-less BGSAVE is aborted by FLUSHALL} {
+        r debug populate 20000 key 20
+        r debug set-forkless-save-delay 20000
+        r bgsave
+        r flushall
+        r debug set-forkless-save-delay 0
+        wait_for_condition 50 100 {
+            [s rdb_bgsave_in_progress] == 0
+        } else {
+            fail "fork-less BGSAVE not aborted"
+        }
+        assert_equal ok [s rdb_last_bgsave_status]
+        assert_equal {} [glob -nocomplain -directory $server_path temp-forkless-*]
+    }
+}
+
+set server_path [tmpdir "server.rdb-save-threads-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-save-threads" 4]] {
+    test {Segmented RDB save and load keeps values and expires} {
+        createComplexDataset r 10000
+        for {set j 0} {$j < 100} {incr j} {
+            r set big:$j [string repeat "x$j" 5000]
+            r pexpire big:$j [expr {1000000 + $j}]
+        }
+        r sadd subexpires a b c
+        r expiremember subexpires b 1000000
+        r select 5
+        r set otherdb value
+        r select 9
+        r xadd stream * field value
+        set digest [r debug digest]
+        set ttl [r pttl big:42]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert {[r pttl big:42] > 0 && [r pttl big:42] <= $ttl}
+        assert {[r ttl subexpires b] > 0}
+        r config set rdb-load-threads 4
+        r debug reload
+        r config set rdb-load-threads 0
+        assert_equal $digest [r debug digest]
+    }
+
+    test {keydb-check-rdb checks the segments of the file} {
+        r save
+        set result [exec src/keydb-check-rdb $server_path/dump.rdb]
+        assert_match {*Segment 3: * keys, * bytes, checksum OK*} $result
+        assert_match {*RDB looks OK*} $result
+    }
+
+    test {Replicas load a segmented RDB sent over the socket} {
+        r config set repl-diskless-sync yes
+        r config set repl-diskless-sync-delay 0
+        set digest [r debug digest]
+        start_server {} {
+            r slaveof [srv -1 host] [srv -1 port]
+            wait_for_condition 50 100 {
+                [s master_link_status] eq {up}
+            } else {
+                fail "Replication not started"
+            }
+            assert_equal $digest [r debug digest]
+        }
+    }
+}
+
+set server_path [tmpdir "server.rdb-compression-codec-test"]
+
+start_server [list overrides [list "dir" $server_path]] {
+    foreach codec {lzf lz4 zstd} {
+        # lz4 and zstd are only available when built with them
+        if {[catch {r config set rdb-compression-codec $codec}]} continue
+
+        test "RDB compressed with $codec keeps the values" {
+            r flushall
+            createComplexDataset r 5000
+            for {set j 0} {$j < 1000} {incr j} {
+                r set doc:$j "{\"id\":$j,\"name\":\"user$j\",\"tags\":\[\"alpha\",\"beta\",\"gamma\"\],\"bio\":\"[string repeat {lorem ipsum } 20]\"}"
+            }
+            set digest [r debug digest]
+            r debug reload
+            assert_equal $digest [r debug digest]
+            set result [exec src/keydb-check-rdb $server_path/dump.rdb]
+            assert_match {*RDB looks OK*} $result
+        }
+
+        test "DUMP / RESTORE of values compressed with $codec" {
+            set dump [r dump doc:42]
+            r restore doc:restored 0 $dump
+            assert_equal [r get doc:42] [r get doc:restored]
+        }
+
+        if {$codec eq {zstd}} {
+            test {RDB compressed with zstd and a trained dictionary} {
+                r config set rdb-compression-zstd-dict yes
+                set digest [r debug digest]
+                r debug reload
+                assert_equal $digest [r debug digest]
+                set result [exec src/keydb-check-rdb $server_path/dump.rdb]
+                assert_match {*AUX FIELD zstd-dict of * bytes*} $result
+                assert_match {*RDB looks OK*} $result
+                # DUMP payloads never use the dictionary
+                r restore doc:restored2 0 [r dump doc:42]
+                assert_equal [r get doc:42] [r get doc:restored2]
+                r config set rdb-compression-zstd-dict no
+            }
+        }
+    }
+
+    test {RDB files load whatever the configured codec} {
+        r config set rdb-compression-codec lzf
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+    }
+}
@@ -65,6 +65,8 @@ set ::all_tests {
     unit/lazyfree
     unit/wait
     unit/pendingquerybuf
+    unit/lockless-reads
+    unit/db-lock-striping
 }
 # Index to the next test to run in the ::all_tests list.
 set ::next_test 0
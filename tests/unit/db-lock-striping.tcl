@@ -0,0 +1,176 @@
+start_server {tags {"db-lock-striping"} overrides {db-lock-striping yes server-threads 4}} {
+    r config set notify-keyspace-events ""
+
+    test {Commands on a single database run under its lock only} {
+        r flushall
+        r config resetstat
+        r select 9
+        r set foo bar
+        r lpush list a b c
+        r select 10
+        r set foo baz
+        r incr counter
+        set res [list [r get foo] [r get counter]]
+        r select 9
+        lappend res [r get foo] [r lrange list 0 -1]
+        assert {[s striped_commands] >= 10}
+        set res
+    } {baz 1 bar {c b a}}
+
+    test {Global commands take the global lock} {
+        r flushall
+        r config resetstat
+        r select 9
+        r set foo bar
+        set before [s striped_commands]
+        r move foo 10
+        r swapdb 9 10
+        r flushdb
+        r sort {nosuchkey}
+        # Only the SELECT and SET above were striped
+        list [s striped_commands] $before
+    } {2 2}
+
+    test {Striped commands still update command stats and dirty} {
+        r config resetstat
+        set dirty [s rdb_changes_since_last_save]
+        r set a 1
+        r set b 2
+        r get a
+        assert_match {*cmdstat_set:calls=2*} [r info commandstats]
+        assert_match {*cmdstat_get:calls=1*} [r info commandstats]
+        expr {[s rdb_changes_since_last_save] - $dirty}
+    } {2}
+
+    test {MONITOR and keyspace notifications fall back to the global lock} {
+        set rd [redis_deferring_client]
+        $rd monitor
+        assert_match {*OK*} [$rd read]
+        r config resetstat
+        r set foo bar
+        assert_match {*"set"*"foo"*"bar"*} [$rd read]
+        $rd close
+        assert_equal 0 [s striped_commands]
+
+        r config set notify-keyspace-events KEA
+        r config resetstat
+        r set foo bar
+        r config set notify-keyspace-events ""
+        s striped_commands
+    } {0}
+
+    test {Striped pushes serve clients blocked on the key} {
+        r del blist
+        set rd [redis_deferring_client]
+        $rd select 9
+        $rd read
+        $rd blpop blist 0
+        wait_for_condition 50 100 {
+            [s blocked_clients] == 1
+        } else {
+            fail "Client not blocked"
+        }
+        r config resetstat
+        r lpush blist foo
+        assert_equal {blist foo} [$rd read]
+        $rd close
+        list [s striped_commands] [r llen blist]
+    } {1 0}
+
+    test {Slow striped commands are recorded in the slowlog} {
+        r config set slowlog-log-slower-than 0
+        r slowlog reset
+        r set slowkey value
+        set entry [lindex [r slowlog get 1] 0]
+        r config set slowlog-log-slower-than 10000
+        lindex $entry 3
+    } {set slowkey value}
+
+    test {Concurrent writers to different databases don't lose writes} {
+        r flushall
+        set clients {}
+        for {set db 0} {$db < 4} {incr db} {
+            set rd [redis_deferring_client]
+            $rd select $db
+            $rd read
+            lappend clients $rd
+        }
+        for {set j 0} {$j < 500} {incr j} {
+            foreach rd $clients {
+                $rd incr counter
+                $rd rpush list $j
+            }
+        }
+        foreach rd $clients {
+            for {set j 0} {$j < 1000} {incr j} {
+                $rd read
+            }
+            $rd close
+        }
+        set res {}
+        for {set db 0} {$db < 4} {incr db} {
+            r select $db
+            lappend res [r get counter] [r llen list]
+        }
+        r select 9
+        set res
+    } {500 500 500 500 500 500 500 500}
+
+    test {Striping can be disabled at runtime} {
+        r config set db-lock-striping no
+        r config resetstat
+        r set foo bar
+        set res [list [r get foo] [s striped_commands]]
+        r config set db-lock-striping yes
+        set res
+    } {bar 0}
+}
+
+start_server {tags {"db-lock-striping repl"} overrides {db-lock-striping yes}} {
+    start_server {overrides {db-lock-striping yes}} {
+        set master [srv -1 client]
+        set master_host [srv -1 host]
+        set master_port [srv -1 port]
+        set slave [srv 0 client]
+
+        test {Striped writes are replicated} {
+            $master config set notify-keyspace-events ""
+            $slave slaveof $master_host $master_port
+            wait_for_condition 50 100 {
+                [s 0 master_link_status] eq {up}
+            } else {
+                fail "Replication not started"
+            }
+            $master config resetstat
+            for {set db 0} {$db < 3} {incr db} {
+                $master select $db
+                $master set foo $db
+                $master rpush list a b
+                $master expire list 100
+            }
+            assert {[s -1 striped_commands] > 0}
+            wait_for_ofs_sync $master $slave
+            set res {}
+            for {set db 0} {$db < 3} {incr db} {
+                $slave select $db
+                lappend res [$slave get foo] [$slave llen list] [expr {[$slave ttl list] > 0}]
+            }
+            set res
+        } {0 2 1 1 2 1 2 2 1}
+    }
+}
+
+start_server {tags {"db-lock-striping aof"} overrides {db-lock-striping yes appendonly yes appendfsync always}} {
+    r config set notify-keyspace-events ""
+
+    test {Striped writes are appended to the AOF} {
+        r config resetstat
+        r select 5
+        r set foo bar
+        r incrby counter 3
+        assert {[s striped_commands] > 0}
+        r debug loadaof
+        r select 5
+        list [r get foo] [r get counter]
+    } {bar 3}
+}
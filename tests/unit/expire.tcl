@@ -219,4 +219,70 @@ start_server {tags {"expire"}} {
         set ttl [r ttl foo]
         assert {$ttl <= 98 && $ttl > 90}
     }
+
+    test {Active expire from the timing wheel} {
+        r config set appendonly no
+        r config set active-expire-timing-wheel yes
+        r flushdb
+        set expired [s expired_keys]
+        r debug set-active-expire 0
+        for {set j 0} {$j < 1000} {incr j} {
+            r psetex expiring$j 300 a
+        }
+        for {set j 0} {$j < 100} {incr j} {
+            r psetex volatile$j 100000 a
+            r psetex extended$j 300 a
+            r pexpire extended$j 100000
+            r psetex persisted$j 300 a
+            r persist persisted$j
+        }
+        r debug set-active-expire 1
+        wait_for_condition 50 100 {
+            [r dbsize] == 300
+        } else {
+            fail "Keys were not actively expired"
+        }
+        assert_equal 1000 [expr {[s expired_keys] - $expired}]
+        assert_equal 0 [s expire_wheel_backlog]
+        list [r exists volatile0] [r exists extended99] [r exists persisted50]
+    } {1 1 1}
+
+    test {Active expire of set members from the timing wheel} {
+        r del myset
+        r sadd myset a b c d
+        r expiremember myset a 200 ms
+        r expiremember myset b 100000 ms
+        r expiremember myset c 300 ms
+        wait_for_condition 50 100 {
+            [lsort [r smembers myset]] eq {b d}
+        } else {
+            fail "Set members were not actively expired"
+        }
+    }
+
+    test {The timing wheel is built from existing expires when enabled} {
+        r config set active-expire-timing-wheel no
+        r flushdb
+        for {set j 0} {$j < 100} {incr j} {
+            r psetex key$j 200 a
+        }
+        r set persistent a
+        r config set active-expire-timing-wheel yes
+        wait_for_condition 50 100 {
+            [r dbsize] == 1
+        } else {
+            fail "Keys were not actively expired"
+        }
+    }
+
+    test {Stale timing wheel records are discarded} {
+        r flushdb
+        r set foo bar
+        for {set j 0} {$j < 10000} {incr j} {
+            r pexpire foo [expr {100000 + $j}]
+        }
+        assert {[s expire_wheel_entries] <= 4096 + 2}
+        r config set active-expire-timing-wheel no
+        r flushdb
+    }
 }
@@ -57,4 +57,49 @@ start_server {tags {"introspection"}} {
             fail "Client still listed in CLIENT LIST after SETNAME."
         }
     }
+
+    test {INFO lockstats reports lock acquisitions while lock-profiling is enabled} {
+        # USEASM=true is also what makes the build use the assembly spinlock
+        if {[info exists ::env(USEASM)] && $::env(USEASM) eq {true}} {
+            assert_match {*lock_implementation:asm*} [r info lockstats]
+        }
+        r config set lock-profiling yes
+        r config resetstat
+        r set foo bar
+        r get foo
+        r config set lock-profiling no
+        set stats [r info lockstats]
+        assert_match {*lockstat_0:lock=*,site=*,acquires=*,hold_p99=*} $stats
+        assert_match {*lock=global,site=*} $stats
+        # Unlocks must reach the profiler too, or no hold time is recorded
+        assert {[regexp {lock=global,site=[^\r]*,hold_avg=([0-9]+)} $stats -> hold_avg]}
+        assert {$hold_avg > 0}
+        # Acquisitions through aeAcquireLock() are charged to its caller
+        assert {![string match {*site=aeAcquireLock*} $stats]}
+        assert {![string match {*site=aeTryAcquireLock*} $stats]}
+        r config resetstat
+        assert {![string match {*acquires=*} [r info lockstats]]}
+    }
+
+    test {Event loop backend serves pipelined requests and large replies} {
+        if {[info exists ::env(USE_IOURING)] && $::env(USE_IOURING) eq {yes}} {
+            assert_match {*multiplexing_api:io_uring*} [r info server]
+        }
+        # A reply much larger than the socket buffer needs several writable
+        # events, so the write handler is armed and re-armed in between reads
+        r set bigval [string repeat x 4000000]
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 1000} {incr j} {
+            $rd incr pipecounter
+        }
+        $rd get bigval
+        $rd incr pipecounter
+        for {set j 1} {$j <= 1000} {incr j} {
+            assert_equal $j [$rd read]
+        }
+        assert_equal 4000000 [string length [$rd read]]
+        assert_equal 1001 [$rd read]
+        $rd close
+        r del bigval pipecounter
+    }
 }
@@ -272,4 +272,63 @@ start_server {tags {"keyspace"}} {
         r keys *
         r keys *
     } {dlskeriewrioeuwqoirueioqwrueoqwrueqw}
+
+    foreach async {yes no} {
+        test "Keyspace and hash grown with async-rehash $async" {
+            r flushdb
+            r config resetstat
+            r config set async-rehash $async
+            set rd [redis_deferring_client]
+            for {set j 0} {$j < 50000} {incr j} {
+                $rd set key:$j $j
+                $rd hset myhash field:$j $j
+                if {$j % 3 == 0} {
+                    $rd del key:[expr {$j/2}]
+                    $rd hdel myhash field:[expr {$j/2}]
+                }
+            }
+            $rd ping
+            while {[$rd read] ne {PONG}} {}
+            $rd close
+            set batches [s async_rehash_batches]
+            if {$async} {
+                assert {$batches > 0}
+            } else {
+                assert_equal 0 $batches
+            }
+            set keys 0
+            set fields 0
+            for {set j 0} {$j < 50000} {incr j} {
+                if {[r get key:$j] eq $j} {incr keys}
+                if {[r hget myhash field:$j] eq $j} {incr fields}
+            }
+            assert_equal [expr {$keys+1}] [r dbsize]
+            assert_equal $keys [llength [r keys key:*]]
+            assert_equal $fields [r hlen myhash]
+            r config set async-rehash no
+        } {OK}
+    }
+
+    test "Tables freed while async-rehash batches are in flight" {
+        r flushall
+        r config resetstat
+        r config set async-rehash yes
+        for {set i 0} {$i < 10} {incr i} {
+            set rd [redis_deferring_client]
+            for {set j 0} {$j < 40000} {incr j} {
+                $rd hset big:$i field:$j $j
+                $rd set key:$i:$j $j
+            }
+            $rd ping
+            while {[$rd read] ne {PONG}} {}
+            $rd close
+            # Both tables are rehashing, release them without waiting
+            r unlink big:$i
+            if {$i % 2} {r flushall async}
+        }
+        assert {[s async_rehash_batches] > 0}
+        r set foo bar
+        assert_equal bar [r get foo]
+        r config set async-rehash no
+    } {OK}
 }
@@ -53,7 +53,7 @@ start_server {tags {"latency-monitor"}} {
         r eval {
             local i = 0
             while (i < 1000000) do
-                redis.call('sadd','mybigkey',i)
+                redis.call('sadd','mybigkey','e'..i)
                 i = i+1
              end
         } 0
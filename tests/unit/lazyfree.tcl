@@ -1,9 +1,11 @@
 start_server {tags {"lazyfree"}} {
     test "UNLINK can reclaim memory in background" {
         set orig_mem [s used_memory]
+        # Use strings: integers would be packed in a roaring bitmap, which
+        # is too small to be worth freeing in the background.
         set args {}
         for {set i 0} {$i < 200000} {incr i} {
-            lappend args $i
+            lappend args e$i
         }
         r sadd myset {*}$args
         assert {[r scard myset] == 200000}
@@ -22,7 +24,7 @@ start_server {tags {"lazyfree"}} {
         set orig_mem [s used_memory]
         set args {}
         for {set i 0} {$i < 200000} {incr i} {
-            lappend args $i
+            lappend args e$i
         }
         r sadd myset {*}$args
         assert {[r scard myset] == 200000}
@@ -0,0 +1,126 @@
+start_server {tags {"lockless-reads"} overrides {lockless-reads yes server-threads 4}} {
+    # keymiss notifications force reads through the global lock
+    r config set notify-keyspace-events ""
+
+    test {Lockless GET/MGET/EXISTS/TTL return the stored values} {
+        r flushall
+        r set foo bar
+        r set baz qux
+        r setex withttl 100 value
+        list [r get foo] [r mget foo baz missing] [r exists foo baz missing] \
+             [r ttl foo] [expr {[r ttl withttl] > 0}]
+    } {bar {bar qux {}} 2 -1 1}
+
+    test {Lockless reads count towards commandstats and keyspace stats} {
+        r config resetstat
+        r get foo
+        r get missing
+        set info [r info stats]
+        assert_match {*keyspace_hits:1*} $info
+        assert_match {*keyspace_misses:1*} $info
+        assert_match {*cmdstat_get:calls=2*} [r info commandstats]
+    }
+
+    test {Lockless reads treat expired keys as missing} {
+        r flushall
+        r debug set-active-expire 0
+        r psetex shortlived 50 value
+        after 100
+        set res [list [r get shortlived] [r exists shortlived] [r ttl shortlived]]
+        # A write still expires the key for real
+        r del shortlived
+        r debug set-active-expire 1
+        set res
+    } {{} 0 -2}
+
+    test {Lockless reads observe interleaved writes from other clients} {
+        r flushall
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 1000} {incr j} {
+            $rd set key:$j $j
+            $rd incr counter
+        }
+        for {set j 0} {$j < 2000} {incr j} {
+            $rd read
+        }
+        set ok 1
+        for {set j 0} {$j < 1000} {incr j} {
+            if {[r get key:$j] ne $j} {set ok 0}
+        }
+        $rd close
+        list $ok [r get counter] [r exists key:0 key:999]
+    } {1 1000 2}
+
+    test {Writes after lockless reads are not lost} {
+        r flushall
+        for {set j 0} {$j < 100} {incr j} {
+            r set k $j
+            assert_equal $j [r get k]
+            assert_equal [list $j $j] [r mget k k]
+        }
+    }
+
+    test {MONITOR still sees commands while lockless reads are enabled} {
+        set rd [redis_deferring_client]
+        $rd monitor
+        assert_match {*OK*} [$rd read]
+        r get foo
+        assert_match {*"get"*"foo"*} [$rd read]
+        $rd close
+    }
+
+    test {Lockless reads keep running while other clients write} {
+        r flushall
+        r set foo bar
+        r config resetstat
+        # Use several connections so readers and writers end up on different
+        # threads
+        set loads [list [start_write_load [srv 0 host] [srv 0 port] 20] \
+                        [start_write_load [srv 0 host] [srv 0 port] 20]]
+        set readers {}
+        for {set j 0} {$j < 4} {incr j} {
+            lappend readers [redis_deferring_client]
+        }
+        wait_for_condition 50 100 {
+            [r dbsize] > 100
+        } else {
+            fail "No write load"
+        }
+        # Writers only keep readers out while they modify the keyspace, so
+        # with more than one thread some reads run while the lock is held
+        set threaded [expr {[s server_threads] > 1}]
+        set rounds 0
+        while {$rounds < 200} {
+            foreach rd $readers {
+                for {set j 0} {$j < 50} {incr j} {
+                    $rd get foo
+                }
+            }
+            foreach rd $readers {
+                for {set j 0} {$j < 50} {incr j} {
+                    assert_equal bar [$rd read]
+                }
+            }
+            incr rounds
+            if {!$threaded || [s lockless_reads_during_lock] > 0} break
+        }
+        foreach load $loads {
+            stop_write_load $load
+        }
+        foreach rd $readers {
+            $rd close
+        }
+        assert {[s lockless_reads] > 0}
+        if {$threaded} {
+            assert {[s lockless_reads_during_lock] > 0}
+        }
+    }
+
+    test {Lockless reads can be disabled at runtime} {
+        r config set lockless-reads no
+        r set foo bar
+        set res [r get foo]
+        r config set lockless-reads yes
+        set res
+    } {bar}
+}
@@ -36,6 +36,91 @@ start_server {tags {"memefficiency"}} {
     }
 }
 
+start_server {tags {"memefficiency"} overrides {keyspace-inline-values yes}} {
+    test "Small strings and integers are inlined in the keyspace" {
+        r flushall
+        r set int 12345678
+        r set neg -987654321
+        r set str abcdefg
+        r set long abcdefgh
+        r set float 1.5
+        assert_match {*inline:1*} [r debug object int]
+        assert_match {*inline:1*} [r debug object neg]
+        assert_match {*inline:1*} [r debug object str]
+        assert_match {*inline:1*} [r debug object float]
+        assert {![string match {*inline:1*} [r debug object long]]}
+        assert_equal {int int embstr embstr} [list [r object encoding int] [r object encoding neg] \
+            [r object encoding str] [r object encoding long]]
+        assert_equal {12345678 -987654321 abcdefg abcdefgh 1.5} [r mget int neg str long float]
+        assert {[r memory usage str] < [r memory usage long]}
+    }
+
+    test "Inlined values survive writes, expires and reloads" {
+        r flushall
+        r set counter 100000
+        r incrby counter 5
+        assert_match {*inline:1*} [r debug object counter]
+        assert_equal 100005 [r get counter]
+        r append counter x
+        assert_equal 100005x [r get counter]
+        assert {![string match {*inline:1*} [r debug object counter]]}
+        r set flag on
+        r expire flag 100
+        assert {![string match {*inline:1*} [r debug object flag]]}
+        assert {[r ttl flag] > 90}
+        r set flag off
+        assert_match {*inline:1*} [r debug object flag]
+        assert_equal -1 [r ttl flag]
+        r set other 42000
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_match {*inline:1*} [r debug object other]
+    }
+
+    test "Inlined values use less memory" {
+        set used {}
+        foreach inline {no yes} {
+            r flushall
+            r config set keyspace-inline-values $inline
+            set base_mem [s used_memory]
+            set rd [redis_deferring_client]
+            for {set j 0} {$j < 10000} {incr j} {
+                $rd incrby counter:$j 100000
+            }
+            for {set j 0} {$j < 10000} {incr j} {
+                $rd read ; # Discard replies
+            }
+            $rd close
+            lappend used [expr {[s used_memory]-$base_mem}]
+        }
+        r config set keyspace-inline-values yes
+        assert {[lindex $used 1] < [lindex $used 0]*0.8}
+    }
+
+    test "Values are not inlined under an LRU or LFU policy" {
+        r flushall
+        r set before 12345
+        r config set maxmemory-policy allkeys-lru
+        r set after 12345
+        assert_match {*inline:1*} [r debug object before]
+        assert {![string match {*inline:1*} [r debug object after]]}
+        # Values inlined before the policy changed can still be evicted
+        for {set j 0} {$j < 1000} {incr j} {
+            r set key:$j 123456789
+        }
+        r config set maxmemory-policy noeviction
+        for {set j 0} {$j < 1000} {incr j} {
+            r set inline:$j 123456789
+        }
+        r config set maxmemory-policy allkeys-lru
+        r config set maxmemory [expr {[s used_memory]-20000}]
+        assert {[r dbsize] < 2002}
+        r config set maxmemory 0
+        r config set maxmemory-policy noeviction
+    }
+}
+
 start_server {tags {"defrag"}} {
     if {[string match {*jemalloc*} [s mem_allocator]]} {
         test "Active defrag" {
@@ -211,3 +296,51 @@ start_server {tags {"defrag"}} {
         } {OK}
     }
 }
+
+start_server {tags {"defrag"} overrides {keyspace-embedded-keys yes}} {
+    if {[string match {*jemalloc*} [s mem_allocator]]} {
+        test "Active defrag keys with an expire" {
+            r config set activedefrag no
+            r config set active-defrag-threshold-lower 5
+            r config set active-defrag-cycle-min 65
+            r config set active-defrag-cycle-max 75
+            r config set active-defrag-ignore-bytes 2mb
+            r config set maxmemory 0
+
+            set rd [redis_deferring_client]
+            for {set j 0} {$j < 200000} {incr j} {
+                $rd set $j [string repeat x 100] ex 10000
+            }
+            for {set j 0} {$j < 200000} {incr j} {
+                $rd read ; # Discard replies
+            }
+            for {set j 0} {$j < 200000} {incr j 2} {
+                $rd del $j
+            }
+            for {set j 0} {$j < 200000} {incr j 2} {
+                $rd read ; # Discard replies
+            }
+            $rd close
+            assert {[r dbsize] == 100000}
+
+            set digest [r debug digest]
+            catch {r config set activedefrag yes} e
+            if {![string match {DISABLED*} $e]} {
+                wait_for_condition 50 100 {
+                    [s active_defrag_running] ne 0
+                } else {
+                    fail "defrag not started."
+                }
+                wait_for_condition 500 100 {
+                    [s active_defrag_running] eq 0
+                } else {
+                    fail "defrag didn't stop."
+                }
+            }
+            # relocated keys must keep their expire
+            assert {[r debug digest] eq $digest}
+            assert {[r ttl 1] > 9000}
+            assert {[r ttl 199999] > 9000}
+        } {}
+    }
+}
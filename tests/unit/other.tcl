@@ -253,3 +253,136 @@ start_server {tags {"other"}} {
         r save
     } {OK}
 }
+
+start_server {tags {"other"} overrides {numa-aware-lock yes}} {
+    test {Commands work with the NUMA aware global lock} {
+        r set foo bar
+        r incr counter
+        r multi
+        r incr counter
+        r exec
+        list [r get foo] [r get counter] [r config get numa-aware-lock]
+    } {bar 2 {numa-aware-lock yes}}
+
+    test {INFO lockstats profiles the NUMA aware global lock} {
+        r config set lock-profiling yes
+        r config resetstat
+        for {set j 0} {$j < 100} {incr j} {
+            r incr counter
+        }
+        r config set lock-profiling no
+        set stats [r info lockstats]
+        r config resetstat
+        assert_match {*lock=global,site=*,acquires=*} $stats
+        assert {![string match {*site=cohortlock::*} $stats]}
+    }
+}
+
+start_server {tags {"other"} overrides {client-rebalance yes server-threads 2 testmode yes}} {
+    test {Busy clients are moved off an overloaded thread and keep working} {
+        # server-threads is capped to the number of cores
+        if {[status r server_threads] > 1} {
+            r config resetstat
+            # In test mode new connections are never given to the main thread, so
+            # with two threads every client below starts on the same one while the
+            # other thread only runs the cron.
+            set clients {}
+            for {set j 0} {$j < 6} {incr j} {
+                lappend clients [redis_deferring_client]
+            }
+            assert_equal 0 [status r thread_0_clients]
+            set n 0
+            set migrations 0
+            set deadline [expr {[clock milliseconds] + 20000}]
+            while {$migrations == 0 && [clock milliseconds] < $deadline} {
+                # Pipeline so the server, not the test, is the bottleneck
+                foreach c $clients {
+                    for {set i 0} {$i < 200} {incr i} {
+                        $c incr counter
+                    }
+                }
+                foreach c $clients {
+                    for {set i 0} {$i < 200} {incr i} {
+                        $c read
+                    }
+                    incr n 200
+                }
+                set migrations [status r client_migrations]
+            }
+            assert {$migrations > 0}
+            wait_for_condition 50 100 {
+                [status r thread_0_clients] > 0
+            } else {
+                fail "Migrated clients are not accounted to the idle thread"
+            }
+
+            # The moved clients are still served, and no command was lost or
+            # replayed along the way
+            foreach c $clients {
+                for {set i 0} {$i < 100} {incr i} {
+                    $c incr counter
+                }
+                $c ping
+            }
+            foreach c $clients {
+                for {set i 0} {$i < 100} {incr i} {
+                    $c read
+                }
+                assert_equal PONG [$c read]
+                incr n 100
+            }
+            foreach c $clients {
+                $c get counter
+                assert_equal $n [$c read]
+                $c close
+            }
+            assert_equal $n [r get counter]
+        }
+    }
+}
+
+start_server {tags {"other"} overrides {server-thread-steering bpf server-threads 2}} {
+    test {Connections are served with CPU steered listeners} {
+        set rd [redis_deferring_client]
+        $rd set foo bar
+        $rd read
+        $rd close
+        list [r get foo] [r config get server-thread-steering]
+    } {bar {server-thread-steering bpf}}
+}
+
+start_server {tags {"other"} overrides {lock-batch-size 3}} {
+    test {Batched clients see each other's writes in order} {
+        set clients {}
+        for {set j 0} {$j < 8} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        for {set i 0} {$i < 100} {incr i} {
+            foreach c $clients {
+                $c rpush biglist $i
+            }
+        }
+        foreach c $clients {
+            for {set i 0} {$i < 100} {incr i} {
+                $c read
+            }
+        }
+        foreach c $clients {$c close}
+        list [r llen biglist] [r lindex biglist 0] [r lindex biglist -1]
+    } {800 0 99}
+
+    test {A client killed by another client of the same batch is skipped} {
+        set rd1 [redis_deferring_client]
+        set rd2 [redis_deferring_client]
+        $rd1 client id
+        set id [$rd1 read]
+        # Both commands are read in the same event loop iteration
+        $rd2 client kill id $id
+        $rd1 ping
+        assert_equal 1 [$rd2 read]
+        catch {$rd1 read} e
+        $rd1 close
+        $rd2 close
+        r ping
+    } {PONG}
+}
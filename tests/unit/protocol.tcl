@@ -115,3 +115,56 @@ start_server {tags {"regression"}} {
         $rd read
     }
 }
+
+start_server {tags {"protocol"}} {
+    test "Large replies spanning many reply blocks are delivered intact" {
+        r del biglist
+        set payload [string repeat x 1000]
+        for {set j 0} {$j < 5000} {incr j} {
+            r rpush biglist "$j:$payload"
+        }
+        # Pipeline several replies so the static buffer and many reply
+        # blocks are queued at once and the socket only takes part of them
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 3} {incr j} {
+            $rd lrange biglist 0 -1
+            $rd ping
+        }
+        after 100
+        set ok 1
+        for {set j 0} {$j < 3} {incr j} {
+            set res [$rd read]
+            if {[llength $res] != 5000} {set ok 0}
+            for {set i 0} {$i < 5000} {incr i} {
+                if {[lindex $res $i] ne "$i:$payload"} {set ok 0; break}
+            }
+            if {[$rd read] ne {PONG}} {set ok 0}
+        }
+        $rd close
+        set ok
+    } {1}
+
+    test "Large values are intact when modified while their reply is pending" {
+        set payload [string repeat abcdefgh 32768]
+        r set bigval $payload
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 20} {incr j} {
+            $rd get bigval
+        }
+        $rd append bigval xyz
+        $rd get bigval
+        $rd del bigval
+        $rd get bigval
+        after 100
+        set ok 1
+        for {set j 0} {$j < 20} {incr j} {
+            if {[$rd read] ne $payload} {set ok 0}
+        }
+        if {[$rd read] != [expr {[string length $payload]+3}]} {set ok 0}
+        if {[$rd read] ne "${payload}xyz"} {set ok 0}
+        if {[$rd read] != 1} {set ok 0}
+        if {[$rd read] ne {}} {set ok 0}
+        $rd close
+        set ok
+    } {1}
+}
@@ -98,17 +98,21 @@ start_server {tags {"scan"}} {
         assert_equal 1000 [llength $keys]
     }
 
-    foreach enc {intset hashtable} {
+    foreach enc {intset roaring hashtable} {
         test "SSCAN with encoding $enc" {
             # Create the Set
             r del set
+            set count 100
             if {$enc eq {intset}} {
                 set prefix ""
+            } elseif {$enc eq {roaring}} {
+                set prefix ""
+                set count 1000
             } else {
                 set prefix "ele:"
             }
             set elements {}
-            for {set j 0} {$j < 100} {incr j} {
+            for {set j 0} {$j < $count} {incr j} {
                 lappend elements ${prefix}${j}
             }
             r sadd set {*}$elements
@@ -128,15 +132,36 @@ start_server {tags {"scan"}} {
             }
 
             set keys [lsort -unique $keys]
-            assert_equal 100 [llength $keys]
+            assert_equal $count [llength $keys]
         }
     }
 
-    foreach enc {ziplist hashtable} {
+    test "SSCAN of a roaring set spanning many containers" {
+        r del set
+        set elements {-9223372036854775808 9223372036854775807 -1 0}
+        for {set j 0} {$j < 2000} {incr j} {
+            lappend elements [expr {$j * 10000 - 10000000}]
+        }
+        r sadd set {*}$elements
+        assert_encoding roaring set
+
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [r sscan set $cur count 37]
+            set cur [lindex $res 0]
+            set k [lindex $res 1]
+            lappend keys {*}$k
+            if {$cur == 0} break
+        }
+        assert_equal [lsort -integer -unique $elements] [lsort -integer $keys]
+    }
+
+    foreach enc {listpack hashtable} {
         test "HSCAN with encoding $enc" {
             # Create the Hash
             r del hash
-            if {$enc eq {ziplist}} {
+            if {$enc eq {listpack}} {
                 set count 30
             } else {
                 set count 1000
@@ -172,11 +197,11 @@ start_server {tags {"scan"}} {
         }
     }
 
-    foreach enc {ziplist skiplist} {
+    foreach enc {listpack btree} {
         test "ZSCAN with encoding $enc" {
             # Create the Sorted Set
             r del zset
-            if {$enc eq {ziplist}} {
+            if {$enc eq {listpack}} {
                 set count 30
             } else {
                 set count 1000
@@ -328,3 +353,35 @@ start_server {tags {"scan"}} {
         }
     }
 }
+
+start_server {tags {"scan"} overrides {keyspace-open-addressing yes}} {
+    test "SCAN with open addressing keyspace while growing and shrinking" {
+        r flushdb
+        r debug populate 1000
+        assert_match {*open addressing*} [r debug htstats 9]
+
+        set cursor 0
+        set iteration 0
+        array set found {}
+        while {!($cursor == 0 && $iteration != 0)} {
+            lassign [r scan $cursor] cursor keys
+            foreach k $keys {set found($k) 1}
+            incr iteration
+            # Grow the table while scanning, then delete most of the new
+            # keys again to leave tombstones behind.
+            if {$iteration == 5} {
+                for {set j 0} {$j < 5000} {incr j} {r set extra:$j x}
+            }
+            if {$iteration == 10} {
+                for {set j 0} {$j < 5000} {incr j} {r del extra:$j}
+            }
+        }
+        for {set j 0} {$j < 1000} {incr j} {
+            if {![info exists found(key:$j)]} {
+                fail "SCAN element missing key:$j"
+            }
+        }
+        assert_equal 1000 [r dbsize]
+        assert_match {key:*} [r randomkey]
+    }
+}
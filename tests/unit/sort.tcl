@@ -5,7 +5,7 @@ start_server {
         "set-max-intset-entries" 32
     }
 } {
-    proc create_random_dataset {num cmd} {
+    proc create_random_dataset {num cmd {prefix ""}} {
         set tosort {}
         set result {}
         array set seenrand {}
@@ -22,10 +22,10 @@ start_server {
                 if {![info exists seenrand($rint)]} break
             }
             set seenrand($rint) x
-            r $cmd tosort $i
-            r set weight_$i $rint
-            r hset wobj_$i weight $rint
-            lappend tosort [list $i $rint]
+            r $cmd tosort $prefix$i
+            r set weight_$prefix$i $rint
+            r hset wobj_$prefix$i weight $rint
+            lappend tosort [list $prefix$i $rint]
         }
         set sorted [lsort -index 1 -real $tosort]
         for {set i 0} {$i < $num} {incr i} {
@@ -34,15 +34,19 @@ start_server {
         set _ $result
     }
 
-    foreach {num cmd enc title} {
-        16 lpush quicklist "Old Ziplist"
-        1000 lpush quicklist "Old Linked list"
-        10000 lpush quicklist "Old Big Linked list"
-        16 sadd intset "Intset"
-        1000 sadd hashtable "Hash table"
-        10000 sadd hashtable "Big Hash table"
+    # Integer members of a large set are kept in a roaring bitmap, the hash
+    # table rows use string members to get that encoding instead.
+    foreach {num cmd prefix enc title} {
+        16 lpush "" quicklist "Old Ziplist"
+        1000 lpush "" quicklist "Old Linked list"
+        10000 lpush "" quicklist "Old Big Linked list"
+        16 sadd "" intset "Intset"
+        1000 sadd e hashtable "Hash table"
+        10000 sadd e hashtable "Big Hash table"
+        1000 sadd "" roaring "Roaring bitmap"
+        10000 sadd "" roaring "Big Roaring bitmap"
     } {
-        set result [create_random_dataset $num $cmd]
+        set result [create_random_dataset $num $cmd $prefix]
         assert_encoding $enc tosort
 
         test "$title: SORT BY key" {
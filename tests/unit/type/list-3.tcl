@@ -120,3 +120,66 @@ start_server {
         }
     }
 }
+
+start_server {
+    tags {list compression}
+    overrides {
+        "list-max-ziplist-size" 16
+        "list-compress-depth" 1
+    }
+} {
+    proc ql_compressed_nodes {key} {
+        regexp {ql_compressed_nodes:(\d+)} [r debug object $key] - count
+        return $count
+    }
+
+    test {list-compress-codec rejects unknown codecs} {
+        catch {r config set list-compress-codec gzip} e
+        assert_match {*Invalid argument*} $e
+        r config get list-compress-codec
+    } {list-compress-codec lzf}
+
+    foreach codec {lzf lz4 zstd} {
+        # lz4 and zstd are only there when built with USE_LZ4/USE_ZSTD.
+        if {[catch {r config set list-compress-codec $codec}]} continue
+
+        foreach async {no yes} {
+            test "Compressed list with $codec codec, async $async" {
+                r config set list-compress-async $async
+                r del mylist
+                set l {}
+                for {set i 0} {$i < 1000} {incr i} {
+                    set ele "element $i [string repeat abc 20]"
+                    lappend l $ele
+                    r rpush mylist $ele
+                }
+                wait_for_condition 50 100 {
+                    [ql_compressed_nodes mylist] > 0
+                } else {
+                    fail "No node of the list was compressed"
+                }
+                assert_equal $l [r lrange mylist 0 -1]
+
+                # Modify interior nodes, possibly while being compressed.
+                r lset mylist 500 modified
+                lset l 500 modified
+                r linsert mylist before modified inserted
+                set l [linsert $l 500 inserted]
+                r lrem mylist 1 "element 250 [string repeat abc 20]"
+                set l [lreplace $l 250 250]
+                assert_equal $l [r lrange mylist 0 -1]
+                assert_equal [lindex $l 700] [r lindex mylist 700]
+
+                r debug reload
+                assert_equal $l [r lrange mylist 0 -1]
+                wait_for_condition 50 100 {
+                    [ql_compressed_nodes mylist] > 0
+                } else {
+                    fail "No node of the list was compressed after reload"
+                }
+            }
+        }
+    }
+    r config set list-compress-async no
+    r config set list-compress-codec lzf
+}
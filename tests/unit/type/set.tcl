@@ -33,6 +33,41 @@ start_server {
         assert_equal {16 17} [lsort [r smembers myset]]
     }
 
+    foreach {type contents} {hashtable {a b c 1 2} intset {-70000 -1 0 1 2 3 70000}} {
+        test "SMISMEMBER - $type" {
+            create_set myset $contents
+            assert_encoding $type myset
+            assert_equal {1 0 1 1} [r smismember myset 1 4 2 1]
+            assert_equal {0 0 0} [r smismember myset foo 1.5 9223372036854775808]
+            assert_equal [lrepeat [llength $contents] 1] [r smismember myset {*}$contents]
+            assert_equal {0 0} [r smismember nokey 1 a]
+        }
+    }
+
+    test "SMISMEMBER against a large intset" {
+        r config set set-max-intset-entries 20000
+        r del myset
+        set members {}
+        for {set i 0} {$i < 10000} {incr i} { lappend members [expr {$i * 7}] }
+        r sadd myset {*}$members
+        assert_encoding intset myset
+        set queries {}
+        set expected {}
+        for {set i 0} {$i < 200} {incr i} {
+            set v [randomInt 80000]
+            lappend queries $v
+            lappend expected [expr {$v % 7 == 0 && $v < 70000}]
+        }
+        assert_equal $expected [r smismember myset {*}$queries]
+        r config set set-max-intset-entries 512
+    }
+
+    test {SMISMEMBER against non set} {
+        r lpush mylist foo
+        assert_error WRONGTYPE* {r smismember mylist bar}
+        assert_error {*wrong number of arguments*} {r smismember myset}
+    }
+
     test {SADD against non set} {
         r lpush mylist foo
         assert_error WRONGTYPE* {r sadd mylist bar}
@@ -56,9 +91,55 @@ start_server {
         for {set i 0} {$i < 512} {incr i} { r sadd myset $i }
         assert_encoding intset myset
         assert_equal 1 [r sadd myset 512]
+        assert_encoding roaring myset
+    }
+
+    test "SADD a non-integer against a roaring set" {
+        r del myset
+        for {set i 0} {$i < 600} {incr i} { r sadd myset $i }
+        assert_encoding roaring myset
+        assert_equal 1 [r sadd myset a]
         assert_encoding hashtable myset
+        assert_equal 601 [r scard myset]
+        assert_equal 1 [r sismember myset 599]
     }
 
+    test "Sparse roaring sets are converted to a hash table" {
+        r del myset
+        # One member every 2^20, so that every member gets its own container.
+        for {set i 0} {$i < 1024} {incr i} { r sadd myset [expr {$i << 20}] }
+        assert_encoding roaring myset
+        r sadd myset [expr {1024 << 20}]
+        assert_encoding hashtable myset
+        assert_equal 1025 [r scard myset]
+    }
+
+    test "Roaring set SADD, SREM, SISMEMBER across containers" {
+        r del myset
+        set values {}
+        foreach base {-9223372036854775808 -65537 -1 0 65535 65536 9223372036854775807} {
+            for {set i 0} {$i < 100} {incr i} {
+                if {$base > 0} {
+                    lappend values [expr {$base - $i}]
+                } else {
+                    lappend values [expr {$base + $i}]
+                }
+            }
+        }
+        set values [lsort -unique -integer $values]
+        r sadd myset {*}$values
+        for {set i 0} {$i < 5000} {incr i} { r sadd myset [expr {1000000 + $i}] }
+        assert_encoding roaring myset
+        assert_equal [expr {[llength $values] + 5000}] [r scard myset]
+        foreach v $values { assert_equal 1 [r sismember myset $v] }
+        assert_equal 0 [r sismember myset 65537]
+        assert_equal 0 [r sismember myset foo]
+        assert_equal [llength $values] [r srem myset {*}$values foo]
+        assert_equal 5000 [r scard myset]
+        assert_encoding roaring myset
+    }
+
+
     test {Variadic SADD} {
         r del myset
         assert_equal 3 [r sadd myset a b c]
@@ -72,15 +153,26 @@ start_server {
         for {set i 0} {$i < 1280} {incr i} { r sadd mylargeintset $i }
         for {set i 0} {$i <  256} {incr i} { r sadd myhashset [format "i%03d" $i] }
         assert_encoding intset myintset
-        assert_encoding hashtable mylargeintset
+        assert_encoding roaring mylargeintset
         assert_encoding hashtable myhashset
 
         r debug reload
         assert_encoding intset myintset
-        assert_encoding hashtable mylargeintset
+        assert_encoding roaring mylargeintset
         assert_encoding hashtable myhashset
     }
 
+    test "Roaring sets are saved with a KeyDB only RDB type" {
+        # Type 18 is LIST_QUICKLIST_2 upstream
+        binary scan [r dump mylargeintset] c type
+        assert_equal 100 $type
+        set dump [r dump mylargeintset]
+        r del mylargeintset
+        r restore mylargeintset 0 $dump
+        assert_encoding roaring mylargeintset
+        assert_equal 1280 [r scard mylargeintset]
+    }
+
     test {SREM basics - regular set} {
         create_set myset {foo bar ciao}
         assert_encoding hashtable myset
@@ -111,10 +203,15 @@ start_server {
         r srem myset 1 2 3 4 5 6 7 8
     } {3}
 
-    foreach {type} {hashtable intset} {
+    foreach {type} {hashtable intset roaring} {
         for {set i 1} {$i <= 5} {incr i} {
             r del [format "set%d" $i]
         }
+        # Integer sets skip the intset encoding when it may not hold any
+        # element at all.
+        if {$type eq "roaring"} {
+            r config set set-max-intset-entries 0
+        }
         for {set i 0} {$i < 200} {incr i} {
             r sadd set1 $i
             r sadd set2 [expr $i+195]
@@ -205,6 +302,84 @@ start_server {
             }
             assert_equal {1 2 3 4} [lsort [r smembers setres]]
         }
+
+        r config set set-max-intset-entries 512
+    }
+
+    test "SINTER, SUNION, SDIFF mixing roaring sets and intsets" {
+        r del set1 set2 set3 setres
+        for {set i 0} {$i < 3000} {incr i} {
+            r sadd set1 [expr {$i * 3}]
+            r sadd set2 [expr {$i * 5}]
+        }
+        r sadd set3 0 15 16 30 90000
+        assert_encoding roaring set1
+        assert_encoding roaring set2
+        assert_encoding intset set3
+
+        set s1 [r smembers set1]
+        set s2 [r smembers set2]
+        set inter {}
+        foreach v $s1 { if {$v % 5 == 0} { lappend inter $v } }
+        assert_equal [lsort -integer $inter] [lsort -integer [r sinter set1 set2]]
+        assert_equal {0 15 30} [lsort -integer [r sinter set3 set1 set2]]
+        assert_equal [lsort -integer -unique [concat $s1 $s2]] \
+            [lsort -integer [r sunion set1 set2]]
+
+        # Small results are stored as intsets.
+        r sinterstore setres set1 set2 set3
+        assert_encoding intset setres
+        r sunionstore setres set1 set3
+        assert_encoding roaring setres
+        assert_equal 3002 [r scard setres]
+        r sdiffstore setres set1 set2
+        assert_encoding roaring setres
+        assert_equal [expr {3000 - [llength $inter]}] [r scard setres]
+        assert_equal {16 90000} [lsort -integer [r sdiff set3 set1 set2]]
+
+        # A hash table anywhere falls back to the generic implementation.
+        r sadd set3 foo
+        assert_equal {0 15 30} [lsort -integer [r sinter set1 set2 set3]]
+        assert_equal {16 90000 foo} [lsort [r sdiff set3 set1 set2]]
+    }
+
+    test "SINTER, SUNION, SDIFF of large intsets" {
+        r config set set-max-intset-entries 20000
+        r del set1 set2 set3 setres
+        set s1 {}
+        set s2 {}
+        for {set i 0} {$i < 10000} {incr i} {
+            lappend s1 [expr {$i * 2}]
+            lappend s2 [expr {$i * 3 - 3000}]
+        }
+        r sadd set1 {*}$s1
+        r sadd set2 {*}$s2
+        r sadd set3 -3000 6 7 12 9223372036854775807
+        assert_encoding intset set1
+        assert_encoding intset set2
+
+        set inter {}
+        foreach v $s2 {
+            if {$v >= 0 && $v < 20000 && $v % 2 == 0} { lappend inter $v }
+        }
+        assert_equal $inter [lsort -integer [r sinter set1 set2]]
+        assert_equal {6 12} [lsort -integer [r sinter set3 set2 set1]]
+        assert_equal [lsort -integer -unique [concat $s1 $s2]] \
+            [lsort -integer [r sunion set1 set2]]
+        assert_equal {7 9223372036854775807} [lsort -integer [r sdiff set3 set1 set2]]
+        assert_equal [expr {10000 - [llength $inter]}] \
+            [llength [r sdiff set1 set2 nokey]]
+
+        # A union can outgrow the intset limit.
+        r config set set-max-intset-entries 512
+        r sunionstore setres set1 set3
+        assert_encoding roaring setres
+        assert_equal 10003 [r scard setres]
+        r sinterstore setres set3 set2
+        assert_encoding intset setres
+        assert_equal {-3000 6 12} [lsort -integer [r smembers setres]]
+        r sdiffstore setres set3 set3
+        assert_equal 0 [r exists setres]
     }
 
     test "SDIFF with first set empty" {
@@ -323,6 +498,23 @@ start_server {
         }
     }
 
+    test "SPOP and SRANDMEMBER - roaring" {
+        r del myset
+        set contents {}
+        for {set i 0} {$i < 1000} {incr i} { lappend contents [expr {$i * 97 - 50000}] }
+        r sadd myset {*}$contents
+        assert_encoding roaring myset
+        assert_equal 10 [llength [r srandmember myset 10]]
+        assert_equal 2000 [llength [r srandmember myset -2000]]
+        assert_equal [lsort -integer $contents] [lsort -integer [r srandmember myset 5000]]
+        set popped [concat [r spop myset] [r spop myset 1] [r spop myset 300] [r spop myset 0]]
+        assert_equal 302 [llength [lsort -unique $popped]]
+        assert_equal 698 [r scard myset]
+        set popped [concat $popped [r spop myset 698]]
+        assert_equal [lsort -integer $contents] [lsort -integer $popped]
+        assert_equal 0 [r exists myset]
+    }
+
     # As seen in intsetRandomMembers
     test "SPOP using integers, testing Knuth's and Floyd's algorithm" {
         create_set myset {1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20}
@@ -7,12 +7,12 @@ start_server {tags {"zset"}} {
     }
 
     proc basics {encoding} {
-        if {$encoding == "ziplist"} {
-            r config set zset-max-ziplist-entries 128
-            r config set zset-max-ziplist-value 64
-        } elseif {$encoding == "skiplist"} {
-            r config set zset-max-ziplist-entries 0
-            r config set zset-max-ziplist-value 0
+        if {$encoding == "listpack"} {
+            r config set zset-max-listpack-entries 128
+            r config set zset-max-listpack-value 64
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-listpack-entries 0
+            r config set zset-max-listpack-value 0
         } else {
             puts "Unknown sorted set encoding"
             exit
@@ -735,8 +735,8 @@ start_server {tags {"zset"}} {
         }
     }
 
-    basics ziplist
-    basics skiplist
+    basics listpack
+    basics btree
 
     test {ZINTERSTORE regression with two sets, intset+hashtable} {
         r del seta setb setc
@@ -751,7 +751,7 @@ start_server {tags {"zset"}} {
         r zrange out 0 -1 withscores
     } {neginf 0}
 
-    test {ZINTERSTORE #516 regression, mixed sets and ziplist zsets} {
+    test {ZINTERSTORE #516 regression, mixed sets and listpack zsets} {
         r sadd one 100 101 102 103
         r sadd two 100 200 201 202
         r zadd three 1 500 1 501 1 502 1 503 1 100
@@ -786,14 +786,14 @@ start_server {tags {"zset"}} {
     }
 
     proc stressers {encoding} {
-        if {$encoding == "ziplist"} {
+        if {$encoding == "listpack"} {
             # Little extra to allow proper fuzzing in the sorting stresser
-            r config set zset-max-ziplist-entries 256
-            r config set zset-max-ziplist-value 64
+            r config set zset-max-listpack-entries 256
+            r config set zset-max-listpack-value 64
             set elements 128
-        } elseif {$encoding == "skiplist"} {
-            r config set zset-max-ziplist-entries 0
-            r config set zset-max-ziplist-value 0
+        } elseif {$encoding == "btree"} {
+            r config set zset-max-listpack-entries 0
+            r config set zset-max-listpack-value 0
             if {$::accurate} {set elements 1000} else {set elements 100}
         } else {
             puts "Unknown sorted set encoding"
@@ -1066,7 +1066,7 @@ start_server {tags {"zset"}} {
             }
         }
 
-        test "ZSETs skiplist implementation backlink consistency test - $encoding" {
+        test "ZSETs btree implementation backlink consistency test - $encoding" {
             set diff 0
             for {set j 0} {$j < $elements} {incr j} {
                 r zadd myzset [expr rand()] "Element-$j"
@@ -1198,13 +1198,13 @@ start_server {tags {"zset"}} {
     }
 
     tags {"slow"} {
-        stressers ziplist
-        stressers skiplist
+        stressers listpack
+        stressers btree
     }
 
-    test {ZSET skiplist order consistency when elements are moved} {
-        set original_max [lindex [r config get zset-max-ziplist-entries] 1]
-        r config set zset-max-ziplist-entries 0
+    test {ZSET btree order consistency when elements are moved} {
+        set original_max [lindex [r config get zset-max-listpack-entries] 1]
+        r config set zset-max-listpack-entries 0
         for {set times 0} {$times < 10} {incr times} {
             r del zset
             for {set j 0} {$j < 1000} {incr j} {
@@ -1225,6 +1225,64 @@ start_server {tags {"zset"}} {
                 set prev_score $score
             }
         }
-        r config set zset-max-ziplist-entries $original_max
+        r config set zset-max-listpack-entries $original_max
+    }
+
+    test {ZSET btree ranks and ranges match a model across node splits and merges} {
+        set original_max [lindex [r config get zset-max-listpack-entries] 1]
+        r config set zset-max-listpack-entries 0
+        r del zset
+        set model [dict create]
+        for {set j 0} {$j < 20000} {incr j} {
+            set ele m[randomInt 4000]
+            set op [randomInt 10]
+            if {$op < 6} {
+                set score [randomInt 200]
+                r zadd zset $score $ele
+                dict set model $ele $score
+            } elseif {$op < 9} {
+                r zrem zset $ele
+                dict unset model $ele
+            } else {
+                # Drop a small rank range, mirrored on the model below.
+                set start [randomInt [expr {[dict size $model]+1}]]
+                set end [expr {$start+[randomInt 100]}]
+                foreach victim [r zrange zset $start $end] {
+                    dict unset model $victim
+                }
+                r zremrangebyrank zset $start $end
+            }
+        }
+        assert_encoding btree zset
+
+        set expected {}
+        foreach {ele score} $model {lappend expected [list $ele $score]}
+        set expected [lsort -integer -index 1 [lsort -index 0 $expected]]
+        set flat {}
+        foreach pair $expected {lappend flat {*}$pair}
+        assert_equal [dict size $model] [r zcard zset]
+        assert_equal $flat [r zrange zset 0 -1 withscores]
+
+        for {set j 0} {$j < 200} {incr j} {
+            set rank [randomInt [llength $expected]]
+            set ele [lindex $expected $rank 0]
+            assert_equal $rank [r zrank zset $ele]
+            assert_equal [expr {[llength $expected]-$rank-1}] [r zrevrank zset $ele]
+            assert_equal [lindex $expected $rank] [r zrange zset $rank $rank withscores]
+            set min [randomInt 200]
+            set max [expr {$min+[randomInt 20]}]
+            set count 0
+            foreach pair $expected {
+                set score [lindex $pair 1]
+                if {$score >= $min && $score <= $max} {incr count}
+            }
+            assert_equal $count [r zcount zset $min $max]
+            assert_equal $count [llength [r zrangebyscore zset $min $max]]
+        }
+
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        r config set zset-max-listpack-entries $original_max
     }
 }